@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark comparing the CRC-8 routines against a bitwise baseline.
+ * Throughput is reported for buffer lengths typical of I2C transfers.
+ */
+
+#include <i2cd.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_BYTES	(64UL << 20)
+
+static volatile uint8_t sink;
+
+static uint8_t crc8_bitwise(uint8_t crc, uint8_t poly, const uint8_t *buf,
+		size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ poly : crc << 1;
+	}
+	return crc;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_pec_bitwise(const uint8_t *buf, size_t len)
+{
+	size_t i, n = BENCH_BYTES / len;
+	double start = now();
+
+	for (i = 0; i < n; i++)
+		sink = crc8_bitwise(0, 0x07, buf, len);
+
+	return (double)n * len / (now() - start) / 1e6;
+}
+
+static double bench_pec(const uint8_t *buf, size_t len)
+{
+	size_t i, n = BENCH_BYTES / len;
+	double start = now();
+
+	for (i = 0; i < n; i++)
+		sink = i2cd_pec_update(0, buf, len);
+
+	return (double)n * len / (now() - start) / 1e6;
+}
+
+static double bench_words_bitwise(const uint8_t *buf, size_t len)
+{
+	size_t i, j, n = BENCH_BYTES / len;
+	double start = now();
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < len; j += 3) {
+			if (crc8_bitwise(0xff, 0x31, &buf[j], 2) != buf[j + 2])
+				break;
+		}
+		sink = j;
+	}
+
+	return (double)n * len / (now() - start) / 1e6;
+}
+
+static double bench_words(const uint8_t *buf, size_t len)
+{
+	size_t i, n = BENCH_BYTES / len;
+	double start = now();
+
+	for (i = 0; i < n; i++)
+		sink = i2cd_verify_words(buf, len);
+
+	return (double)n * len / (now() - start) / 1e6;
+}
+
+int main(void)
+{
+	static const size_t lens[] = {3, 6, 48, 252, 4095};
+	size_t i, max = lens[sizeof(lens) / sizeof(lens[0]) - 1];
+	uint8_t *buf;
+
+	buf = malloc(max);
+	if (buf == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	/* Words are valid so that verification covers the whole buffer */
+	for (i = 0; i < max; i += 3) {
+		buf[i] = rand();
+		buf[i + 1] = rand();
+		buf[i + 2] = i2cd_crc8_word(&buf[i], 2);
+	}
+
+	printf("%6s %14s %14s %15s %14s\n", "length", "pec (bitwise)",
+	       "pec", "words (bitwise)", "words");
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+		printf("%6zu %9.1f MB/s %9.1f MB/s %10.1f MB/s %9.1f MB/s\n",
+		       lens[i], bench_pec_bitwise(buf, lens[i]),
+		       bench_pec(buf, lens[i]),
+		       bench_words_bitwise(buf, lens[i]),
+		       bench_words(buf, lens[i]));
+
+	free(buf);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,306 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cyclic jitter benchmark in the style of cyclictest. A transfer is issued
+ * at a fixed interval, both directly from the timing thread and through a
+ * real-time context, and the latency from each scheduled wakeup to transfer
+ * completion is reported. The device "stub" simulates an adapter which
+ * busy-waits for the on-wire time of each transfer at 400 kHz; any other
+ * device is opened normally.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define NSEC_PER_SEC	1000000000L
+
+#define STUB_PATH	"stub"
+#define STUB_FD		1000
+#define STUB_FREQ	400000
+
+static const char *progname;
+
+static int64_t ts_ns(const struct timespec *ts)
+{
+	return (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+int __wrap_open(const char *pathname, int flags, mode_t mode)
+{
+	extern int __real_open(const char *pathname, int flags, mode_t mode);
+
+	if (strcmp(pathname, STUB_PATH) == 0)
+		return STUB_FD;
+
+	return __real_open(pathname, flags, mode);
+}
+
+int __wrap_close(int fd)
+{
+	extern int __real_close(int fd);
+
+	if (fd == STUB_FD)
+		return 0;
+
+	return __real_close(fd);
+}
+
+static int stub_transfer(struct i2c_rdwr_ioctl_data *msgset)
+{
+	struct timespec ts;
+	int64_t bits = 1, deadline;
+	unsigned int i;
+
+	for (i = 0; i < msgset->nmsgs; i++)
+		bits += 10 + 9 * msgset->msgs[i].len;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	deadline = ts_ns(&ts) + bits * NSEC_PER_SEC / STUB_FREQ;
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+	} while (ts_ns(&ts) < deadline);
+
+	return msgset->nmsgs;
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+	extern int __real_ioctl(int fd, unsigned long request, ...);
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd != STUB_FD)
+		return __real_ioctl(fd, request, arg);
+
+	switch (request) {
+	case I2C_FUNCS:
+		*(unsigned long *)arg = I2C_FUNC_I2C;
+		return 0;
+
+	case I2C_RDWR:
+		return stub_transfer(arg);
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int run(const char *name, struct i2cd *dev, struct i2cd_rt *rt,
+		uint16_t addr, long count, long interval, int64_t *lat)
+{
+	uint8_t reg = 0, buf[2];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= addr,
+			.flags	= 0,
+			.len	= sizeof(reg),
+			.buf	= &reg
+		},
+		{
+			.addr	= addr,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(buf),
+			.buf	= buf
+		}
+	};
+	struct timespec next, end;
+	int64_t total = 0;
+	long i;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (i = 0; i < count; i++) {
+		next.tv_nsec += interval * 1000;
+		while (next.tv_nsec >= NSEC_PER_SEC) {
+			next.tv_nsec -= NSEC_PER_SEC;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		if (rt != NULL)
+			rc = i2cd_rt_transfer(rt, msgs, ARRAY_SIZE(msgs));
+		else
+			rc = i2cd_transfer(dev, msgs, ARRAY_SIZE(msgs));
+		if (rc < 0) {
+			fprintf(stderr, "%s: transfer: %s\n", progname,
+				strerror(errno));
+			return -1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		lat[i] = ts_ns(&end) - ts_ns(&next);
+		total += lat[i];
+	}
+
+	qsort(lat, count, sizeof(*lat), compare_i64);
+
+	printf("%-8s latency (us): min %.1f, avg %.1f, p99 %.1f, "
+	       "max %.1f, jitter %.1f\n", name, lat[0] / 1e3,
+	       total / 1e3 / count, lat[count * 99 / 100] / 1e3,
+	       lat[count - 1] / 1e3, (lat[count - 1] - lat[0]) / 1e3);
+	return 0;
+}
+
+static void usage(FILE *stream)
+{
+	fprintf(stream,
+		"Usage: %s [-m] [-c cpu] [-i interval] [-n count] "
+		"[-p priority] [device [addr]]\n"
+		"\n"
+		"Measure latency of periodic transfers issued directly and\n"
+		"through a real-time context. The default device is \"%s\",\n"
+		"which simulates an adapter at %d Hz.\n"
+		"\n"
+		"Options:\n"
+		"  -c cpu       pin the worker and timing threads to cpu\n"
+		"  -i interval  interval between transfers in us "
+		"(default: 1000)\n"
+		"  -m           lock memory using mlockall(2)\n"
+		"  -n count     number of transfers (default: 10000)\n"
+		"  -p priority  SCHED_FIFO priority (default: none)\n"
+		"  -h           display this help and exit\n",
+		progname, STUB_PATH, STUB_FREQ);
+}
+
+int main(int argc, char *argv[])
+{
+	struct i2cd_rt_attr attr;
+	struct i2cd_rt *rt;
+	struct i2cd *dev;
+	const char *path = STUB_PATH;
+	uint16_t addr = 0x20;
+	long count = 10000, interval = 1000;
+	int64_t *lat;
+	int opt, rc = EXIT_FAILURE;
+
+	progname = argv[0];
+	i2cd_rt_attr_init(&attr);
+
+	while ((opt = getopt(argc, argv, "c:hi:mn:p:")) != -1) {
+		switch (opt) {
+		case 'c':
+			attr.cpu = atoi(optarg);
+			break;
+		case 'h':
+			usage(stdout);
+			return EXIT_SUCCESS;
+		case 'i':
+			interval = atol(optarg);
+			break;
+		case 'm':
+			attr.flags |= I2CD_RT_MLOCK;
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'p':
+			attr.priority = atoi(optarg);
+			break;
+		default:
+			usage(stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc)
+		path = argv[optind++];
+	if (optind < argc)
+		addr = strtoul(argv[optind++], NULL, 0);
+	if (optind < argc || count <= 0 || interval <= 0) {
+		usage(stderr);
+		return EXIT_FAILURE;
+	}
+
+	/* The timing thread runs with the same policy as the worker */
+	if (attr.priority > 0) {
+		struct sched_param param = {
+			.sched_priority = attr.priority
+		};
+
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			perror("sched_setscheduler");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (attr.cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(attr.cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			perror("sched_setaffinity");
+			return EXIT_FAILURE;
+		}
+	}
+
+	lat = calloc(count, sizeof(*lat));
+	if (lat == NULL) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	dev = i2cd_open(path);
+	if (dev == NULL) {
+		fprintf(stderr, "%s: %s: %s\n", progname, path,
+			strerror(errno));
+		goto out;
+	}
+
+	rt = i2cd_rt_new(dev, &attr);
+	if (rt == NULL) {
+		perror("i2cd_rt_new");
+		goto out_close;
+	}
+
+	if (run("direct", dev, NULL, addr, count, interval, lat) == 0 &&
+	    run("rt", dev, rt, addr, count, interval, lat) == 0)
+		rc = EXIT_SUCCESS;
+
+	i2cd_rt_free(rt);
+out_close:
+	i2cd_close(dev);
+out:
+	free(lat);
+	return rc;
+}
@@ -41,6 +41,13 @@ extern "C" {
  * @struct i2cd
  *
  * @brief Handle to an I2C character device.
+ *
+ * A handle may be shared between threads. State cached by the handle is
+ * protected by a lock, which is only taken by transfers when bus utilization
+ * accounting or latency profiling is enabled. The kernel serializes
+ * transfers on each adapter; a thread which issues many transfers may instead
+ * use its own handle created by i2cd_dup() to avoid contending on a shared
+ * file descriptor.
  */
 struct i2cd;
 
@@ -88,6 +95,23 @@ struct i2cd *i2cd_open_by_name(const char *name);
  */
 struct i2cd *i2cd_open_by_number(unsigned int num);
 
+/**
+ * @brief Duplicate an I2C character device handle.
+ *
+ * @param dev Pointer to an I2C character device handle.
+ *
+ * @return Pointer to an I2C character device handle, or @c NULL on error with
+ * @c errno set appropriately.
+ *
+ * The I2C character device is opened again, which gives the new handle its
+ * own file descriptor. The functionality mask, bus frequency, retries and
+ * timeout recorded by @p dev are copied, as is the address to which it is
+ * bound. Bus utilization accounting, if enabled, is shared with @p dev;
+ * latency profiling and single-flight reads are not copied.
+ * The new handle must be closed using i2cd_close().
+ */
+struct i2cd *i2cd_dup(struct i2cd *dev);
+
 /**
  * @brief Close an I2C character device handle and free associated memory.
  *
@@ -103,9 +127,25 @@ void i2cd_close(struct i2cd *dev);
  * @param dev Pointer to an I2C character device handle.
  *
  * @return The path used to open the I2C character device handle.
+ *
+ * If the handle is reopened by hotplug monitoring, the path may change; a
+ * path returned earlier remains valid until the handle is closed.
  */
 const char *i2cd_get_path(struct i2cd *dev);
 
+/**
+ * @brief Get the file descriptor of the I2C character device handle.
+ *
+ * @param dev Pointer to an I2C character device handle.
+ *
+ * @return The file descriptor of the I2C character device handle.
+ *
+ * The file descriptor remains owned by the handle and must not be closed. If
+ * the handle is reopened by hotplug monitoring, the new device is duplicated
+ * onto the same file descriptor.
+ */
+int i2cd_fileno(struct i2cd *dev);
+
 /**
  * @brief Set the number of times a slave address should be polled when
  * not acknowledging.
@@ -142,10 +182,48 @@ int i2cd_set_timeout(struct i2cd *dev, unsigned long timeout);
  * Adapter functionality can be determined by comparing the returned mask to
  * values defined by the @c I2C_FUNC_* macros in @c linux/i2c.h.
  *
- * This function corresponds to the @c I2C_FUNCS @c ioctl() request.
+ * This function corresponds to the @c I2C_FUNCS @c ioctl() request. The mask
+ * is cached by the handle once the request succeeds.
  */
 int i2cd_get_functionality(struct i2cd *dev, unsigned long *funcs);
 
+/** @brief Bind to an address even if in use by a kernel driver. */
+#define I2CD_BIND_FORCE		0x0001
+
+/**
+ * @brief Bind the handle to a slave address.
+ *
+ * @param dev   Pointer to an I2C character device handle.
+ * @param addr  7-bit I2C slave address.
+ * @param flags #I2CD_BIND_FORCE, or 0.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately. If
+ * the address is in use by a kernel driver and #I2CD_BIND_FORCE is not given,
+ * @c errno is set to @c EBUSY.
+ *
+ * Once bound, i2cd_read() and i2cd_write() to @p addr use the @c read() and
+ * @c write() system calls rather than the @c I2C_RDWR @c ioctl() request,
+ * which avoids copying a message array into the kernel. Other addresses and
+ * functions are unaffected. Bus utilization accounting and latency profiling
+ * are only performed by @c I2C_RDWR; while either is enabled, bound reads and
+ * writes fall back to it.
+ *
+ * This function corresponds to the @c I2C_SLAVE and @c I2C_SLAVE_FORCE
+ * @c ioctl() requests. The first call opens the I2C character device again;
+ * the address is set on that file descriptor, which is used only by bound
+ * reads and writes and is kept open until the handle is closed. If binding
+ * to a different address fails, the handle is left unbound. Binding waits
+ * for bound reads and writes in progress on other threads to complete.
+ */
+int i2cd_bind(struct i2cd *dev, uint16_t addr, int flags);
+
+/**
+ * @brief Unbind the handle from its slave address.
+ *
+ * @param dev Pointer to an I2C character device handle.
+ */
+void i2cd_unbind(struct i2cd *dev);
+
 /**
  * @brief Transfer one or more low-level messages terminated with a single
  * STOP condition.
@@ -268,6 +346,1781 @@ static inline int i2cd_register_read16(struct i2cd *dev, uint16_t addr,
 /** @} */
 /** @} */
 
+/**
+ * @defgroup scan Bus Scanning
+ *
+ * @brief Functions for detecting slave devices present on a bus.
+ *
+ * Slave devices are detected by probing each address in turn and checking
+ * whether the address is acknowledged. Results are returned in a bitmap of
+ * #I2CD_SCAN_WORDS words, which may be tested using i2cd_scan_present().
+ * Only 7-bit addresses are supported.
+ *
+ * @{
+ */
+
+/**
+ * @brief Select a probe for each address based on adapter functionality.
+ *
+ * A zero-length write is preferred, followed by an SMBus quick write, and
+ * finally a one-byte read. Addresses in the ranges 0x30-0x37 and 0x50-0x5f are
+ * only probed using a one-byte read, as writing to these addresses may corrupt
+ * EEPROMs; these addresses are skipped if the adapter is unable to read.
+ */
+#define I2CD_SCAN_AUTO		0
+
+/** @brief Probe each address using an SMBus quick write. */
+#define I2CD_SCAN_QUICK		1
+
+/** @brief Probe each address using a zero-length write. */
+#define I2CD_SCAN_WRITE		2
+
+/** @brief Probe each address using a one-byte read. */
+#define I2CD_SCAN_READ		3
+
+/**
+ * @brief Lower adapter retries and timeout for the duration of the scan.
+ *
+ * This flag may be combined with any of the I2CD_SCAN_* probe modes. The
+ * handle must have set both retries and timeout so that they can be restored.
+ */
+#define I2CD_SCAN_FAST		0x100
+
+/** @brief Number of words in a bitmap of 7-bit addresses. */
+#define I2CD_SCAN_WORDS		2
+
+/**
+ * @brief Scan a range of addresses for slave devices.
+ *
+ * @param dev    Pointer to an I2C character device handle.
+ * @param first  First 7-bit address to probe.
+ * @param last   Last 7-bit address to probe.
+ * @param flags  One of the I2CD_SCAN_* probe modes, optionally combined with
+ *               #I2CD_SCAN_FAST.
+ * @param bitmap Bitmap of #I2CD_SCAN_WORDS words to receive addresses which
+ *               acknowledged a probe.
+ *
+ * @return Number of addresses which acknowledged a probe on success, or -1 on
+ * error with @c errno set appropriately. If the adapter does not support the
+ * requested probe mode, @c errno is set to @c EOPNOTSUPP.
+ *
+ * Addresses which are in use by a kernel driver are reported as present when
+ * probed using SMBus requests. If #I2CD_SCAN_FAST is given, retries are
+ * disabled and the timeout is lowered to 10ms while scanning; afterwards both
+ * are restored to the values last set with i2cd_set_retries() and
+ * i2cd_set_timeout(). Both are adapter-wide, so both must have been set using
+ * @p dev; otherwise @c errno is set to @c EINVAL. Other transfers on the
+ * adapter also use the lowered values while scanning.
+ */
+int i2cd_scan(struct i2cd *dev, uint16_t first, uint16_t last, int flags,
+		uint64_t bitmap[]);
+
+/**
+ * @brief Scan a range of addresses on several adapters in parallel.
+ *
+ * @param devs    Array of I2C character device handles.
+ * @param ndevs   Number of I2C character device handles.
+ * @param first   First 7-bit address to probe.
+ * @param last    Last 7-bit address to probe.
+ * @param flags   One of the I2CD_SCAN_* probe modes, optionally combined with
+ *                #I2CD_SCAN_FAST.
+ * @param bitmaps Array of @p ndevs bitmaps to receive addresses which
+ *                acknowledged a probe on each adapter.
+ *
+ * @return Total number of addresses which acknowledged a probe on success, or
+ * -1 on error with @c errno set appropriately.
+ *
+ * Each adapter is scanned by calling i2cd_scan() from a separate thread;
+ * handles in @p devs must refer to distinct adapters.
+ */
+int i2cd_scan_multi(struct i2cd *devs[], size_t ndevs, uint16_t first,
+		uint16_t last, int flags, uint64_t bitmaps[][I2CD_SCAN_WORDS]);
+
+/**
+ * @brief Test whether an address is set in a scan bitmap.
+ *
+ * @param bitmap Bitmap of #I2CD_SCAN_WORDS words.
+ * @param addr   7-bit address to test.
+ *
+ * @return Non-zero if @p addr is set in @p bitmap, otherwise 0.
+ */
+static inline int i2cd_scan_present(const uint64_t bitmap[], uint16_t addr)
+{
+	return (bitmap[addr / 64] >> (addr % 64)) & 1;
+}
+
+/** @} */
+
+/**
+ * @defgroup txn Prepared Transactions
+ *
+ * @brief Functions for executing a fixed sequence of messages repeatedly.
+ *
+ * A prepared transaction is validated once against the adapter
+ * functionality when it is created and stores a complete @c I2C_RDWR
+ * request, which is issued as-is each time the transaction is executed.
+ * Message buffers may be rebound between executions. This avoids rebuilding
+ * and revalidating messages in tight loops.
+ *
+ * @{
+ */
+
+/**
+ * @struct i2cd_txn
+ *
+ * @brief Handle to a prepared transaction.
+ */
+struct i2cd_txn;
+
+/**
+ * @brief Prepare a transaction of one or more low-level messages.
+ *
+ * @param dev   Pointer to an I2C character device handle.
+ * @param msgs  Array of messages to prepare.
+ * @param nmsgs Number of messages to prepare.
+ *
+ * @return Pointer to a prepared transaction, or @c NULL on error with @c errno
+ * set appropriately. If a message requires functionality not supported by
+ * the adapter, @c errno is set to @c EOPNOTSUPP.
+ *
+ * Messages are copied into the transaction. Messages with a @c NULL buffer
+ * are assigned a buffer owned by the transaction, which may be retrieved
+ * using i2cd_txn_get_buf(); this is useful for parameters such as register
+ * addresses which change between executions. Other buffers must remain valid
+ * until they are rebound or the transaction is freed.
+ */
+struct i2cd_txn *i2cd_txn_new(struct i2cd *dev, const struct i2c_msg msgs[],
+		size_t nmsgs);
+
+/**
+ * @brief Free a prepared transaction.
+ *
+ * @param txn Pointer to a prepared transaction.
+ *
+ * Once freed, @p txn is no longer valid for use.
+ */
+void i2cd_txn_free(struct i2cd_txn *txn);
+
+/**
+ * @brief Get the buffer of a message in a prepared transaction.
+ *
+ * @param txn   Pointer to a prepared transaction.
+ * @param index Index of the message.
+ *
+ * @return Pointer to the buffer of the message.
+ */
+void *i2cd_txn_get_buf(struct i2cd_txn *txn, size_t index);
+
+/**
+ * @brief Rebind the buffer of a message in a prepared transaction.
+ *
+ * @param txn   Pointer to a prepared transaction.
+ * @param index Index of the message.
+ * @param buf   Pointer to a buffer to send or receive bytes.
+ * @param len   Length of the buffer.
+ */
+void i2cd_txn_set_buf(struct i2cd_txn *txn, size_t index, void *buf,
+		size_t len);
+
+/**
+ * @brief Execute a prepared transaction.
+ *
+ * @param txn Pointer to a prepared transaction.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately.
+ */
+int i2cd_txn_execute(struct i2cd_txn *txn);
+
+/** @} */
+
+/**
+ * @defgroup mux Multiplexers
+ *
+ * @brief Functions for accessing slave devices behind I2C multiplexers.
+ *
+ * These functions control NXP PCA954x multiplexers and switches which are
+ * not bound to a kernel driver. The selected channel is cached to avoid
+ * redundant select writes; as such, a multiplexer should only be controlled
+ * through a single multiplexer handle, which may be shared between threads.
+ * Messages are transferred using the I2C character device handle given to
+ * i2cd_mux_new().
+ *
+ * @{
+ */
+
+/** @brief Deselect all multiplexer channels. */
+#define I2CD_MUX_NONE	(-1)
+
+/**
+ * @brief Supported multiplexer types.
+ */
+enum i2cd_mux_type {
+	I2CD_MUX_PCA9540,	/**< 2-channel multiplexer. */
+	I2CD_MUX_PCA9542,	/**< 2-channel multiplexer with interrupts. */
+	I2CD_MUX_PCA9543,	/**< 2-channel switch with interrupts. */
+	I2CD_MUX_PCA9544,	/**< 4-channel multiplexer with interrupts. */
+	I2CD_MUX_PCA9545,	/**< 4-channel switch with interrupts. */
+	I2CD_MUX_PCA9546,	/**< 4-channel switch. */
+	I2CD_MUX_PCA9548,	/**< 8-channel switch. */
+};
+
+/**
+ * @struct i2cd_mux
+ *
+ * @brief Handle to an I2C multiplexer.
+ */
+struct i2cd_mux;
+
+/**
+ * @brief Operation transferred on a multiplexer channel.
+ */
+struct i2cd_mux_op {
+	int channel;		/**< Channel to select. */
+	struct i2c_msg *msgs;	/**< Array of messages to transfer. */
+	size_t nmsgs;		/**< Number of messages to transfer. */
+	int rc;			/**< Result of i2cd_transfer(). */
+	int error;		/**< Value of @c errno if @p rc is negative. */
+};
+
+/**
+ * @brief Create a handle to an I2C multiplexer.
+ *
+ * @param dev  Pointer to an I2C character device handle.
+ * @param addr I2C slave address of the multiplexer.
+ * @param type Type of multiplexer.
+ *
+ * @return Pointer to a multiplexer handle, or @c NULL on error with @c errno
+ * set appropriately.
+ *
+ * The selected channel is initially unknown; the first call to
+ * i2cd_mux_select() always writes to the multiplexer.
+ */
+struct i2cd_mux *i2cd_mux_new(struct i2cd *dev, uint16_t addr,
+		enum i2cd_mux_type type);
+
+/**
+ * @brief Free a multiplexer handle.
+ *
+ * @param mux Pointer to a multiplexer handle.
+ *
+ * Once freed, @p mux is no longer valid for use. The selected channel is
+ * left unchanged.
+ */
+void i2cd_mux_free(struct i2cd_mux *mux);
+
+/**
+ * @brief Get the number of multiplexer channels.
+ *
+ * @param mux Pointer to a multiplexer handle.
+ *
+ * @return Number of multiplexer channels.
+ */
+unsigned int i2cd_mux_get_num_channels(struct i2cd_mux *mux);
+
+/**
+ * @brief Select a multiplexer channel.
+ *
+ * @param mux     Pointer to a multiplexer handle.
+ * @param channel Channel to select, or #I2CD_MUX_NONE.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * The multiplexer is only written if @p channel is not already selected.
+ */
+int i2cd_mux_select(struct i2cd_mux *mux, int channel);
+
+/**
+ * @brief Forget the selected multiplexer channel.
+ *
+ * @param mux Pointer to a multiplexer handle.
+ *
+ * This function should be called if the multiplexer may have been reset or
+ * written by other means; the next call to i2cd_mux_select() writes to the
+ * multiplexer. It need not be called after a handle is reopened by hot-plug
+ * monitoring.
+ */
+void i2cd_mux_invalidate(struct i2cd_mux *mux);
+
+/**
+ * @brief Transfer one or more low-level messages on a multiplexer channel.
+ *
+ * @param mux     Pointer to a multiplexer handle.
+ * @param channel Channel to select.
+ * @param msgs    Array of messages to transfer.
+ * @param nmsgs   Number of messages to transfer.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately.
+ *
+ * This function is equivalent to calling i2cd_mux_select() followed by
+ * i2cd_transfer().
+ */
+int i2cd_mux_transfer(struct i2cd_mux *mux, int channel,
+		struct i2c_msg msgs[], size_t nmsgs);
+
+/**
+ * @brief Transfer a batch of operations, grouped by multiplexer channel.
+ *
+ * @param mux  Pointer to a multiplexer handle.
+ * @param ops  Array of operations to transfer.
+ * @param nops Number of operations to transfer.
+ *
+ * @return 0 if all operations succeed, or -1 if any operation fails with @c
+ * errno set to the error of the first failed operation.
+ *
+ * Operations are reordered to minimize the number of channel selections:
+ * operations on the currently selected channel are transferred first,
+ * followed by operations on each remaining channel in ascending order.
+ * Operations on the same channel are transferred in their original order,
+ * which preserves the ordering of operations on each slave device. The
+ * result of each operation is stored in its @p rc and @p error members.
+ */
+int i2cd_mux_transfer_batch(struct i2cd_mux *mux, struct i2cd_mux_op ops[],
+		size_t nops);
+
+/** @} */
+
+/**
+ * @defgroup util Bus Utilization
+ *
+ * @brief Functions for estimating and limiting bus utilization.
+ *
+ * Each transfer is modeled as the number of bit periods it occupies the bus:
+ * a START or repeated START, nine bits for the address and ACK (eighteen for
+ * 10-bit addresses), nine bits for each data byte and ACK, and a final STOP.
+ * The on-wire time is derived from the bus frequency, which is read from the
+ * device tree when available.
+ *
+ * Once enabled using i2cd_util_enable(), the estimated on-wire time of each
+ * successful transfer is accounted to the bus and to each 7-bit target address
+ * using a sliding window, and transfers may optionally be rejected or deferred
+ * when the bus exceeds a utilization ceiling.
+ *
+ * @{
+ */
+
+/** @brief Bus frequency used when none is configured or found (Hz). */
+#define I2CD_BUS_FREQ_DEFAULT	100000
+
+/** @brief Reject transfers exceeding the ceiling with @c EAGAIN. */
+#define I2CD_UTIL_REJECT	0
+
+/** @brief Defer transfers exceeding the ceiling until admitted. */
+#define I2CD_UTIL_DEFER		1
+
+/**
+ * @brief Set the bus frequency.
+ *
+ * @param dev Pointer to an I2C character device handle.
+ * @param hz  Bus frequency in Hz.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ */
+int i2cd_set_bus_frequency(struct i2cd *dev, unsigned long hz);
+
+/**
+ * @brief Get the bus frequency.
+ *
+ * @param dev Pointer to an I2C character device handle.
+ *
+ * @return Bus frequency in Hz.
+ *
+ * If the bus frequency has not been set using i2cd_set_bus_frequency(), the
+ * @c clock-frequency property of the adapter's device tree node is used.
+ * #I2CD_BUS_FREQ_DEFAULT is returned if neither is available.
+ */
+unsigned long i2cd_get_bus_frequency(struct i2cd *dev);
+
+/**
+ * @brief Estimate the on-wire time of a transfer.
+ *
+ * @param dev   Pointer to an I2C character device handle.
+ * @param msgs  Array of messages to transfer.
+ * @param nmsgs Number of messages to transfer.
+ *
+ * @return Estimated on-wire time in nanoseconds.
+ *
+ * Clock stretching and bus arbitration are not modeled; the estimate is a
+ * lower bound for a transfer which is acknowledged in full.
+ */
+uint64_t i2cd_estimate_transfer_time(struct i2cd *dev,
+		const struct i2c_msg msgs[], size_t nmsgs);
+
+/**
+ * @brief Enable bus utilization accounting.
+ *
+ * @param dev       Pointer to an I2C character device handle.
+ * @param window_ms Length of the sliding window in milliseconds.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * Transfers made using the handle are accounted until it is closed. Calling
+ * this function again resets all accounting and the utilization ceiling.
+ *
+ * Accounting and the ceiling apply to the handle and to handles later
+ * duplicated from it using i2cd_dup(), which share a single budget. Handles
+ * opened separately, or duplicated before accounting was enabled, are
+ * accounted independently even if they use the same adapter.
+ */
+int i2cd_util_enable(struct i2cd *dev, unsigned long window_ms);
+
+/**
+ * @brief Set the bus utilization ceiling.
+ *
+ * @param dev     Pointer to an I2C character device handle.
+ * @param ceiling Fraction of the window the bus may be occupied, or 0 to
+ *                disable admission control.
+ * @param policy  #I2CD_UTIL_REJECT or #I2CD_UTIL_DEFER.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * A transfer is admitted if the bus is idle or the utilization including its
+ * estimated on-wire time does not exceed @p ceiling. Otherwise it fails with
+ * @c EAGAIN or is deferred, according to @p policy. Accounting must first be
+ * enabled using i2cd_util_enable().
+ */
+int i2cd_util_set_ceiling(struct i2cd *dev, double ceiling, int policy);
+
+/**
+ * @brief Get the bus utilization.
+ *
+ * @param dev Pointer to an I2C character device handle.
+ *
+ * @return Estimated fraction of the window the bus was occupied, or 0 if
+ * accounting is not enabled.
+ */
+double i2cd_util_get(struct i2cd *dev);
+
+/**
+ * @brief Get the bus utilization of a target.
+ *
+ * @param dev  Pointer to an I2C character device handle.
+ * @param addr 7-bit I2C slave address.
+ *
+ * @return Estimated fraction of the window the bus was occupied by messages
+ * addressed to @p addr, or 0 if accounting is not enabled.
+ */
+double i2cd_util_get_target(struct i2cd *dev, uint16_t addr);
+
+/** @} */
+
+/**
+ * @defgroup wbuf Write Combining
+ *
+ * @brief Functions for combining register writes into burst transfers.
+ *
+ * A write-combining buffer defers writes to the registers of a single slave
+ * device. Repeated writes to the same register are collapsed so that only the
+ * last value is written, and writes to contiguous registers are merged into a
+ * single message relying on register address auto-increment. Buffered writes
+ * are flushed by i2cd_wbuf_flush(), before reading a buffered register using
+ * i2cd_wbuf_read(), or when the buffer is full; each flush issues as few
+ * transfers as possible, separating messages with a repeated START.
+ *
+ * Writes are flushed in ascending register order rather than the order in
+ * which they were buffered. If a slave device requires writes to occur in a
+ * particular order, i2cd_wbuf_flush() should be called as a barrier between
+ * them. A write-combining buffer is not thread-safe.
+ *
+ * @{
+ */
+
+/** @brief Registers are addressed using 16 bits. */
+#define I2CD_WBUF_REG16		0x0001
+
+/** @brief Slave device does not support register auto-increment. */
+#define I2CD_WBUF_NO_BURST	0x0002
+
+/**
+ * @struct i2cd_wbuf
+ *
+ * @brief Handle to a write-combining buffer.
+ */
+struct i2cd_wbuf;
+
+/**
+ * @brief Create a write-combining buffer.
+ *
+ * @param dev   Pointer to an I2C character device handle.
+ * @param addr  I2C slave address.
+ * @param size  Number of registers which may be buffered before flushing.
+ * @param flags Bitwise OR of zero or more @c I2CD_WBUF_* flags.
+ *
+ * @return Pointer to a write-combining buffer, or @c NULL on error with @c
+ * errno set appropriately.
+ *
+ * Register addresses are transmitted in host byte order, as with the
+ * [Register Access](@ref register) functions.
+ */
+struct i2cd_wbuf *i2cd_wbuf_new(struct i2cd *dev, uint16_t addr, size_t size,
+		int flags);
+
+/**
+ * @brief Free a write-combining buffer.
+ *
+ * @param wbuf Pointer to a write-combining buffer.
+ *
+ * Buffered writes are discarded; i2cd_wbuf_flush() should be called first if
+ * they are to be written. Once freed, @p wbuf is no longer valid for use.
+ */
+void i2cd_wbuf_free(struct i2cd_wbuf *wbuf);
+
+/**
+ * @brief Buffer writes to one or more consecutive registers.
+ *
+ * @param wbuf Pointer to a write-combining buffer.
+ * @param reg  First I2C slave register.
+ * @param buf  Pointer to a buffer containing one byte per register.
+ * @param len  Number of registers to write.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * The buffer is flushed if it becomes full; an error is only returned if
+ * that flush fails.
+ */
+int i2cd_wbuf_write(struct i2cd_wbuf *wbuf, uint16_t reg, const void *buf,
+		size_t len);
+
+/**
+ * @brief Read bytes from one or more consecutive registers.
+ *
+ * @param wbuf Pointer to a write-combining buffer.
+ * @param reg  First I2C slave register.
+ * @param buf  Pointer to a buffer to receive bytes.
+ * @param len  Number of bytes to read.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately.
+ *
+ * The buffer is flushed first if a write to any register being read is
+ * buffered.
+ */
+int i2cd_wbuf_read(struct i2cd_wbuf *wbuf, uint16_t reg, void *buf,
+		size_t len);
+
+/**
+ * @brief Flush buffered writes.
+ *
+ * @param wbuf Pointer to a write-combining buffer.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * If a transfer fails, writes which were not transferred remain buffered.
+ */
+int i2cd_wbuf_flush(struct i2cd_wbuf *wbuf);
+
+/** @} */
+
+/**
+ * @defgroup snap Register Snapshots
+ *
+ * @brief Functions for capturing and restoring the registers of a device.
+ *
+ * A snapshot holds the contents of one or more ranges of registers of a
+ * single slave device. Ranges are captured using burst reads, combined into
+ * as few transfers as possible. When restored, the current contents of each
+ * range are read first and only registers which differ are written, using a
+ * [write-combining buffer](@ref wbuf); short runs of equal registers between
+ * differing registers are written as well when this saves a message. A
+ * snapshot may be saved to a file and loaded again, e.g. to restore the
+ * configuration of a device after it is reset or power-cycled.
+ *
+ * Unless #I2CD_SNAP_NO_BURST is given, the slave device must support register
+ * address auto-increment for both reads and writes. Registers which must not
+ * be written, such as status or interrupt registers, should not be included
+ * in a range. A snapshot is not thread-safe.
+ *
+ * @{
+ */
+
+/** @brief Registers are addressed using 16 bits. */
+#define I2CD_SNAP_REG16		0x0001
+
+/** @brief Slave device does not support register auto-increment. */
+#define I2CD_SNAP_NO_BURST	0x0002
+
+/**
+ * @brief Range of registers in a snapshot.
+ */
+struct i2cd_snap_range {
+	uint16_t reg;	/**< Address of first register. */
+	uint16_t len;	/**< Number of registers. */
+};
+
+/**
+ * @struct i2cd_snap
+ *
+ * @brief Handle to a register snapshot.
+ */
+struct i2cd_snap;
+
+/**
+ * @brief Create an empty register snapshot.
+ *
+ * @param addr    I2C slave address.
+ * @param ranges  Array of register ranges.
+ * @param nranges Number of register ranges.
+ * @param flags   Bitwise OR of zero or more @c I2CD_SNAP_* flags.
+ *
+ * @return Pointer to a register snapshot, or @c NULL on error with @c errno
+ * set appropriately.
+ *
+ * Register addresses are transmitted in host byte order, as with the
+ * [Register Access](@ref register) functions.
+ */
+struct i2cd_snap *i2cd_snap_new(uint16_t addr,
+		const struct i2cd_snap_range ranges[], size_t nranges,
+		int flags);
+
+/**
+ * @brief Free a register snapshot.
+ *
+ * @param snap Pointer to a register snapshot.
+ *
+ * Once freed, @p snap is no longer valid for use.
+ */
+void i2cd_snap_free(struct i2cd_snap *snap);
+
+/**
+ * @brief Capture registers into a snapshot.
+ *
+ * @param snap Pointer to a register snapshot.
+ * @param dev  Pointer to an I2C character device handle.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ */
+int i2cd_snap_capture(struct i2cd_snap *snap, struct i2cd *dev);
+
+/**
+ * @brief Restore registers from a snapshot.
+ *
+ * @param snap Pointer to a register snapshot.
+ * @param dev  Pointer to an I2C character device handle.
+ *
+ * @return Number of registers written on success, or -1 on error with @c
+ * errno set appropriately. If the snapshot has not been captured or loaded,
+ * @c errno is set to @c EINVAL.
+ *
+ * On error, some registers may have been written.
+ */
+int i2cd_snap_restore(struct i2cd_snap *snap, struct i2cd *dev);
+
+/**
+ * @brief Get captured register values from a snapshot.
+ *
+ * @param snap Pointer to a register snapshot.
+ * @param reg  Address of first register.
+ * @param buf  Pointer to a buffer to receive values.
+ * @param len  Number of registers.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately. If
+ * the snapshot has not been captured or loaded, @c errno is set to @c
+ * EINVAL. If the registers are not within a single range of the snapshot,
+ * @c errno is set to @c ENOENT.
+ */
+int i2cd_snap_get(struct i2cd_snap *snap, uint16_t reg, void *buf,
+		size_t len);
+
+/**
+ * @brief Save a snapshot to a file.
+ *
+ * @param snap Pointer to a register snapshot.
+ * @param path Path of file to write.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately. If
+ * the snapshot has not been captured or loaded, @c errno is set to @c
+ * EINVAL.
+ *
+ * The file records the slave address, flags, and ranges of the snapshot
+ * along with the captured values, in a format independent of the host.
+ */
+int i2cd_snap_save(struct i2cd_snap *snap, const char *path);
+
+/**
+ * @brief Load a snapshot from a file.
+ *
+ * @param path Path of file written by i2cd_snap_save().
+ *
+ * @return Pointer to a register snapshot, or @c NULL on error with @c errno
+ * set appropriately. If the file is not a valid snapshot, @c errno is set to
+ * @c EINVAL.
+ */
+struct i2cd_snap *i2cd_snap_load(const char *path);
+
+/** @} */
+
+/**
+ * @defgroup init Parallel Initialization
+ *
+ * @brief Functions for initializing many slave devices concurrently.
+ *
+ * An initialization engine runs sequences of transfers, each of which
+ * initializes a single slave device. Each step of a sequence may require a
+ * delay before the next step, such as after a reset or while a device
+ * calibrates. A sequence may depend on other sequences, in which case it
+ * starts once they have completed, including the delay of their final step.
+ *
+ * Sequences on different I2C character device handles are run concurrently
+ * by separate threads. Sequences on the same handle, including those behind
+ * a multiplexer, are interleaved: while a sequence waits for its delay to
+ * elapse, steps of other sequences are transferred rather than sleeping.
+ * When several steps are ready, steps on the currently selected multiplexer
+ * channel are preferred, followed by sequences in the order they were added.
+ *
+ * @{
+ */
+
+/**
+ * @brief Step of an initialization sequence.
+ */
+struct i2cd_init_step {
+	struct i2c_msg *msgs;	/**< Array of messages to transfer. */
+	size_t nmsgs;		/**< Number of messages, or 0 to only delay. */
+	unsigned int delay_us;	/**< Minimum delay after the transfer (us). */
+};
+
+/**
+ * @brief Initialization sequence of a slave device.
+ */
+struct i2cd_init_seq {
+	struct i2cd *dev;	/**< I2C character device handle. */
+	struct i2cd_mux *mux;	/**< Multiplexer handle, or @c NULL. */
+	int channel;		/**< Multiplexer channel, if @p mux is set. */
+	const struct i2cd_init_step *steps; /**< Array of steps. */
+	size_t nsteps;		/**< Number of steps. */
+};
+
+/**
+ * @struct i2cd_init
+ *
+ * @brief Handle to an initialization engine.
+ */
+struct i2cd_init;
+
+/**
+ * @brief Create an initialization engine.
+ *
+ * @param size Maximum number of sequences.
+ *
+ * @return Pointer to an initialization engine, or @c NULL on error with @c
+ * errno set appropriately.
+ */
+struct i2cd_init *i2cd_init_new(size_t size);
+
+/**
+ * @brief Free an initialization engine.
+ *
+ * @param init Pointer to an initialization engine.
+ *
+ * Once freed, @p init is no longer valid for use.
+ */
+void i2cd_init_free(struct i2cd_init *init);
+
+/**
+ * @brief Add a sequence to an initialization engine.
+ *
+ * @param init Pointer to an initialization engine.
+ * @param seq  Pointer to a sequence.
+ *
+ * @return Index of the sequence on success, or -1 on error with @c errno set
+ * appropriately. If the engine is full, @c errno is set to @c ENOSPC.
+ *
+ * The sequence is copied into the engine; its steps and messages must remain
+ * valid until the engine is freed. If @p mux is set, @p dev must be the
+ * handle given to i2cd_mux_new(), and each step is transferred using
+ * i2cd_mux_transfer().
+ */
+int i2cd_init_add(struct i2cd_init *init, const struct i2cd_init_seq *seq);
+
+/**
+ * @brief Add a dependency between sequences.
+ *
+ * @param init  Pointer to an initialization engine.
+ * @param index Index of the dependent sequence.
+ * @param after Index of the sequence which must complete first.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately. If
+ * the dependency would create a cycle, @c errno is set to @c EDEADLK.
+ */
+int i2cd_init_depend(struct i2cd_init *init, size_t index, size_t after);
+
+/**
+ * @brief Run all sequences of an initialization engine.
+ *
+ * @param init   Pointer to an initialization engine.
+ * @param status Bitmap of #I2CD_FANOUT_WORDS(@e n) words to receive
+ *               sequences which completed successfully, where @e n is the
+ *               number of sequences, or @c NULL.
+ *
+ * @return Number of sequences completed successfully, or -1 on error with @c
+ * errno set appropriately. If fewer than all sequences completed
+ * successfully, @c errno is set to the error of the first failed sequence
+ * which was started.
+ *
+ * A sequence stops at its first failed step. Sequences which depend on a
+ * failed sequence are not started and fail with @c ECANCELED. Bit @e n of
+ * @p status corresponds to sequence @e n, and may be tested using
+ * i2cd_fanout_succeeded(). An engine may be run more than once.
+ */
+int i2cd_init_run(struct i2cd_init *init, uint64_t status[]);
+
+/** @} */
+
+/**
+ * @defgroup fanout Fan-out Writes
+ *
+ * @brief Functions for writing the same messages to many slave devices.
+ *
+ * A sequence of write messages is written to each of a list of targets,
+ * which may be on several adapters. Messages for all targets on an adapter
+ * share the caller's buffers and are transferred in as few @c I2C_RDWR
+ * requests as possible; the messages for a single target are never split
+ * between requests. A failed request does not report how many of its
+ * messages were transferred, so by default none of its targets are reported
+ * as written, although targets before the one which failed usually were.
+ * With #I2CD_FANOUT_REPLAY, the sequence is instead written again to each of
+ * its targets separately to determine which failed.
+ *
+ * @{
+ */
+
+/**
+ * @brief Target of a fan-out write.
+ */
+struct i2cd_fanout_target {
+	struct i2cd *dev;	/**< I2C character device handle. */
+	uint16_t addr;		/**< I2C slave address. */
+};
+
+/**
+ * @brief Get the number of words in a fan-out status bitmap.
+ *
+ * @param ntargets Number of targets.
+ */
+#define I2CD_FANOUT_WORDS(ntargets)	(((ntargets) + 63) / 64)
+
+/**
+ * @brief Write each target of a failed request again, separately.
+ *
+ * Targets written successfully before the failure are written twice, so this
+ * flag must only be given if the sequence is idempotent; writes to command
+ * registers, FIFOs or write-one-to-clear registers are not.
+ */
+#define I2CD_FANOUT_REPLAY	0x1
+
+/**
+ * @brief Write a sequence of messages to many slave devices.
+ *
+ * @param targets  Array of targets.
+ * @param ntargets Number of targets.
+ * @param msgs     Array of write messages; the @p addr member is ignored.
+ * @param nmsgs    Number of write messages.
+ * @param flags    Zero or #I2CD_FANOUT_REPLAY.
+ * @param status   Bitmap of #I2CD_FANOUT_WORDS(@p ntargets) words to receive
+ *                 targets which were written successfully.
+ *
+ * @return Number of targets written successfully, or -1 on error with @c
+ * errno set appropriately. If fewer than @p ntargets targets were written
+ * successfully, @c errno is set to the error of the last failed request.
+ *
+ * Bit @e n of @p status corresponds to element @e n of @p targets, and may be
+ * tested using i2cd_fanout_succeeded(). Messages must not set @c I2C_M_RD, and
+ * at most @c I2C_RDWR_IOCTL_MAX_MSGS messages may be written to each target.
+ */
+int i2cd_fanout_write(const struct i2cd_fanout_target targets[],
+		size_t ntargets, const struct i2c_msg msgs[], size_t nmsgs,
+		int flags, uint64_t status[]);
+
+/**
+ * @brief Test whether a target is set in a fan-out status bitmap.
+ *
+ * @param status Status bitmap returned by i2cd_fanout_write().
+ * @param index  Index of the target to test.
+ *
+ * @return Non-zero if the target was written successfully, otherwise 0.
+ */
+static inline int i2cd_fanout_succeeded(const uint64_t status[], size_t index)
+{
+	return (status[index / 64] >> (index % 64)) & 1;
+}
+
+/** @} */
+
+/**
+ * @defgroup gather Gather Reads
+ *
+ * @brief Functions for reading the same registers from many slave devices.
+ *
+ * A block of registers is read from each of a list of targets, which may be
+ * on several adapters, using the targets of @ref fanout. Reads from all
+ * targets on an adapter are combined into as few @c I2C_RDWR requests as
+ * possible. Rather than returning a buffer per target, each field of the
+ * block is converted to a native integer and stored in a separate array
+ * supplied by the caller, indexed by target: the result is a
+ * structure-of-arrays which may be processed directly by vectorized code.
+ * If a request fails, each of its targets is read separately to determine
+ * which failed.
+ *
+ * @{
+ */
+
+/** @brief Registers are addressed using 16 bits. */
+#define I2CD_GATHER_REG16	0x0001
+
+/** @brief Field is stored big-endian rather than little-endian. */
+#define I2CD_GATHER_BE		0x0001
+
+/** @brief Maximum length of a register block. */
+#define I2CD_GATHER_MAX_LEN	1024
+
+/**
+ * @brief Field of a register block.
+ */
+struct i2cd_gather_field {
+	size_t offset;	/**< Offset of field in register block. */
+	size_t size;	/**< Size of field: 1, 2, 4, or 8 bytes. */
+	int flags;	/**< Field flags, i.e. #I2CD_GATHER_BE. */
+	void *array;	/**< Array of @p size byte integers, one per target. */
+};
+
+/**
+ * @brief Read a register block from many slave devices.
+ *
+ * @param targets  Array of targets.
+ * @param ntargets Number of targets.
+ * @param reg      Address of first register.
+ * @param len      Length of register block in bytes.
+ * @param fields   Array of fields to store.
+ * @param nfields  Number of fields.
+ * @param flags    Gather flags, i.e. #I2CD_GATHER_REG16.
+ * @param valid    Bitmap of #I2CD_FANOUT_WORDS(@p ntargets) words to receive
+ *                 targets which were read successfully.
+ *
+ * @return Number of targets read successfully, or -1 on error with @c errno
+ * set appropriately. If fewer than @p ntargets targets were read
+ * successfully, @c errno is set to the error of the last failed target.
+ *
+ * Element @e n of each field array and bit @e n of @p valid correspond to
+ * element @e n of @p targets; the bit may be tested using
+ * i2cd_fanout_succeeded(). Fields of targets which were not read are set to
+ * 0. The register block must not be longer than #I2CD_GATHER_MAX_LEN bytes.
+ * Register addresses are transmitted in host byte order, as with the
+ * [Register Access](@ref register) functions.
+ */
+int i2cd_gather_read(const struct i2cd_fanout_target targets[],
+		size_t ntargets, uint16_t reg, size_t len,
+		const struct i2cd_gather_field fields[], size_t nfields,
+		int flags, uint64_t valid[]);
+
+/** @} */
+
+/**
+ * @defgroup agg Windowed Aggregation
+ *
+ * @brief Functions for aggregating polled values over a rolling window.
+ *
+ * An aggregator keeps the minimum, maximum, mean, and count of values sampled
+ * on each of a number of channels over a rolling window, along with the last
+ * value sampled. The window is divided into a fixed number of slots, each
+ * holding partial aggregates for every channel in contiguous arrays; as time
+ * advances, the oldest slot is reused, so memory does not depend on the
+ * sample rate. Aggregates cover between @e window - @e window / @e nslots and
+ * @e window milliseconds of samples.
+ *
+ * Values are usually sampled from a register using i2cd_agg_read(), though
+ * values from other sources may be added using i2cd_agg_add(). A channel may
+ * be decimated so that only every @e n th sample is taken; i2cd_agg_read()
+ * does not read the register for samples which are not taken. Aggregators are
+ * thread-safe.
+ *
+ * @{
+ */
+
+/** @brief Registers are addressed using 16 bits. */
+#define I2CD_AGG_REG16		0x0001
+
+/** @brief Register value is stored big-endian rather than little-endian. */
+#define I2CD_AGG_BE		0x0002
+
+/** @brief Register value is a two's complement signed integer. */
+#define I2CD_AGG_SIGNED		0x0004
+
+/**
+ * @struct i2cd_agg
+ *
+ * @brief Handle to an aggregator.
+ */
+struct i2cd_agg;
+
+/**
+ * @brief Aggregates of a channel.
+ */
+struct i2cd_agg_stats {
+	uint64_t count;	/**< Number of values in window. */
+	double min;	/**< Minimum value, or NaN if @p count is 0. */
+	double max;	/**< Maximum value, or NaN if @p count is 0. */
+	double mean;	/**< Mean value, or NaN if @p count is 0. */
+	double last;	/**< Last value, or NaN if none were sampled. */
+};
+
+/**
+ * @brief Create an aggregator.
+ *
+ * @param nchannels Number of channels.
+ * @param window_ms Length of window in milliseconds.
+ * @param nslots    Number of slots into which the window is divided.
+ *
+ * @return Pointer to an aggregator, or @c NULL on error with @c errno set
+ * appropriately.
+ */
+struct i2cd_agg *i2cd_agg_new(size_t nchannels, unsigned long window_ms,
+		unsigned int nslots);
+
+/**
+ * @brief Free an aggregator.
+ *
+ * @param agg Pointer to an aggregator.
+ *
+ * Once freed, @p agg is no longer valid for use.
+ */
+void i2cd_agg_free(struct i2cd_agg *agg);
+
+/**
+ * @brief Set the decimation of a channel.
+ *
+ * @param agg     Pointer to an aggregator.
+ * @param channel Channel index.
+ * @param n       Take every @p n th sample; 1 takes every sample.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ */
+int i2cd_agg_set_decimation(struct i2cd_agg *agg, size_t channel,
+		unsigned int n);
+
+/**
+ * @brief Add a value to a channel.
+ *
+ * @param agg     Pointer to an aggregator.
+ * @param channel Channel index.
+ * @param value   Value sampled.
+ *
+ * @return 1 if the value was taken, 0 if it was discarded by decimation, or -1
+ * on error with @c errno set appropriately.
+ */
+int i2cd_agg_add(struct i2cd_agg *agg, size_t channel, double value);
+
+/**
+ * @brief Read a register and add its value to a channel.
+ *
+ * @param agg     Pointer to an aggregator.
+ * @param channel Channel index.
+ * @param dev     Pointer to an I2C character device handle.
+ * @param addr    I2C slave address.
+ * @param reg     I2C slave register.
+ * @param size    Size of register value: 1, 2, or 4 bytes.
+ * @param flags   Bitwise OR of zero or more @c I2CD_AGG_* flags.
+ *
+ * @return 1 if the value was taken, 0 if it was discarded by decimation, or -1
+ * on error with @c errno set appropriately.
+ *
+ * The register is not read if the sample would be discarded. Register
+ * addresses are transmitted in host byte order, as with the
+ * [Register Access](@ref register) functions.
+ */
+int i2cd_agg_read(struct i2cd_agg *agg, size_t channel, struct i2cd *dev,
+		uint16_t addr, uint16_t reg, size_t size, int flags);
+
+/**
+ * @brief Get the aggregates of a channel.
+ *
+ * @param agg     Pointer to an aggregator.
+ * @param channel Channel index.
+ * @param stats   Pointer to aggregates to receive the result.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ */
+int i2cd_agg_get(struct i2cd_agg *agg, size_t channel,
+		struct i2cd_agg_stats *stats);
+
+/**
+ * @brief Get the aggregates of all channels.
+ *
+ * @param agg   Pointer to an aggregator.
+ * @param stats Array of aggregates, one per channel, to receive the result.
+ *
+ * All channels are aggregated over the same window.
+ */
+void i2cd_agg_snapshot(struct i2cd_agg *agg, struct i2cd_agg_stats stats[]);
+
+/** @} */
+
+/**
+ * @defgroup crc Integrity Checks
+ *
+ * @brief Functions for computing and verifying CRC-8 checksums.
+ *
+ * Two checksums are supported: the SMBus Packet Error Code (PEC), which is a
+ * CRC-8 with polynomial 0x07 covering every byte on the bus including
+ * addresses, and the per-word CRC-8 with polynomial 0x31 and initial value
+ * 0xff used by Sensirion and similar sensors, which follows each 16-bit word
+ * of data. Checksums are computed using slicing-by-8 lookup tables.
+ *
+ * @{
+ */
+
+/** @brief Verify a trailing SMBus PEC byte. */
+#define I2CD_VERIFY_PEC		0x0001
+
+/** @brief Verify a CRC-8 byte following each 16-bit word. */
+#define I2CD_VERIFY_WORDS	0x0002
+
+/**
+ * @brief Update an SMBus PEC.
+ *
+ * @param pec PEC of preceding bytes, or 0 for the first bytes.
+ * @param buf Pointer to a buffer containing bytes.
+ * @param len Number of bytes.
+ *
+ * @return PEC of the preceding and given bytes.
+ */
+uint8_t i2cd_pec_update(uint8_t pec, const void *buf, size_t len);
+
+/**
+ * @brief Compute a Sensirion-style CRC-8.
+ *
+ * @param buf Pointer to a buffer containing bytes.
+ * @param len Number of bytes.
+ *
+ * @return CRC-8 of the given bytes.
+ */
+uint8_t i2cd_crc8_word(const void *buf, size_t len);
+
+/**
+ * @brief Verify a buffer of 16-bit words each followed by a CRC-8.
+ *
+ * @param buf Pointer to a buffer containing words.
+ * @param len Length of @p buf in bytes; must be a multiple of 3.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately. If a
+ * word does not match its CRC-8, @c errno is set to @c EBADMSG.
+ *
+ * Verification stops at the first word which does not match.
+ */
+int i2cd_verify_words(const void *buf, size_t len);
+
+/**
+ * @brief Write bytes to and read verified bytes from a slave device.
+ *
+ * @param dev       Pointer to an I2C character device handle.
+ * @param addr      I2C slave address.
+ * @param write_buf Pointer to a buffer containing bytes to write.
+ * @param write_len Number of bytes to write.
+ * @param read_buf  Pointer to a buffer to receive bytes.
+ * @param read_len  Number of bytes to read, including check bytes.
+ * @param verify    One of the I2CD_VERIFY_* checks.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately. If the bytes read fail verification, @c errno is
+ * set to @c EBADMSG.
+ *
+ * This function is equivalent to calling i2cd_write_read(), or i2cd_read() if
+ * @p write_len is 0, followed by verification of the bytes read. For
+ * #I2CD_VERIFY_PEC, the last byte read is the PEC covering the write address,
+ * the bytes written, the read address, and the bytes read. For
+ * #I2CD_VERIFY_WORDS, see i2cd_verify_words().
+ */
+int i2cd_write_read_verify(struct i2cd *dev, uint16_t addr,
+		const void *write_buf, size_t write_len,
+		void *read_buf, size_t read_len, int verify);
+
+/** @} */
+
+/**
+ * @defgroup rt Real-Time Execution
+ *
+ * @brief Functions for transferring messages from a real-time worker thread.
+ *
+ * A real-time context owns a worker thread which issues transfers on behalf
+ * of its callers. The worker may be run using the @c SCHED_FIFO scheduling
+ * policy and pinned to a CPU. All memory used on the transfer path, including
+ * a pool of message slots and buffers, is allocated and pre-faulted when the
+ * context is created; transfers neither allocate memory nor fault pages, and
+ * may optionally be protected from paging using @c mlockall(2).
+ *
+ * Callers block until their transfer completes. Transfers are issued in the
+ * order they are submitted, and the context may be shared between threads.
+ *
+ * @{
+ */
+
+/** @brief Lock all current and future pages of the process into memory. */
+#define I2CD_RT_MLOCK		0x0001
+
+/**
+ * @brief Attributes of a real-time context.
+ */
+struct i2cd_rt_attr {
+	int priority;		/**< @c SCHED_FIFO priority, or 0 to inherit. */
+	int cpu;		/**< CPU to run the worker on, or -1 for any. */
+	int flags;		/**< Bitwise OR of @c I2CD_RT_* flags. */
+	size_t nslots;		/**< Number of transfers which may be queued. */
+	size_t buf_size;	/**< Maximum total message length per transfer. */
+};
+
+/**
+ * @struct i2cd_rt
+ *
+ * @brief Handle to a real-time context.
+ */
+struct i2cd_rt;
+
+/**
+ * @brief Initialize real-time context attributes to default values.
+ *
+ * @param attr Pointer to real-time context attributes.
+ *
+ * By default, the worker inherits the scheduling policy and CPU affinity of
+ * the calling thread, memory is not locked, four transfers may be queued, and
+ * each transfer may contain up to 4096 bytes.
+ */
+void i2cd_rt_attr_init(struct i2cd_rt_attr *attr);
+
+/**
+ * @brief Create a real-time context.
+ *
+ * @param dev  Pointer to an I2C character device handle.
+ * @param attr Pointer to real-time context attributes, or @c NULL for
+ *             defaults.
+ *
+ * @return Pointer to a real-time context, or @c NULL on error with @c errno
+ * set appropriately. If the calling process is not permitted to use the
+ * requested scheduling policy or to lock memory, @c errno is set to @c EPERM.
+ * If the priority or CPU is out of range, @c errno is set to @c EINVAL.
+ *
+ * The lock shared by callers and the worker uses priority inheritance, so a
+ * caller holding it runs at the priority of the worker while it waits.
+ */
+struct i2cd_rt *i2cd_rt_new(struct i2cd *dev, const struct i2cd_rt_attr *attr);
+
+/**
+ * @brief Stop the worker thread and free a real-time context.
+ *
+ * @param rt Pointer to a real-time context.
+ *
+ * Queued transfers are completed before the worker thread exits. Memory
+ * locked using #I2CD_RT_MLOCK remains locked. Once freed, @p rt is no longer
+ * valid for use.
+ */
+void i2cd_rt_free(struct i2cd_rt *rt);
+
+/**
+ * @brief Transfer one or more low-level messages using the worker thread.
+ *
+ * @param rt    Pointer to a real-time context.
+ * @param msgs  Array of messages to transfer.
+ * @param nmsgs Number of messages to transfer.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately. If the total length of all messages exceeds the
+ * @p buf_size attribute, @c errno is set to @c EMSGSIZE.
+ *
+ * Messages are copied into a preallocated slot before the worker transfers
+ * them, and bytes read are copied back before this function returns.
+ */
+int i2cd_rt_transfer(struct i2cd_rt *rt, struct i2c_msg msgs[], size_t nmsgs);
+
+/** @} */
+
+/**
+ * @defgroup prof Latency Profiling
+ *
+ * @brief Functions for profiling the latency of each slave device.
+ *
+ * Once enabled using i2cd_prof_enable(), the latency of each transfer is
+ * measured and attributed to every address it contains. For each address, an
+ * exponentially weighted moving average (EWMA) and a histogram of latencies
+ * are kept, along with the EWMA of the ratio between measured latency and the
+ * on-wire time estimated by i2cd_estimate_transfer_time(). A transfer whose
+ * ratio exceeds the outlier threshold is counted as an outlier; a slave
+ * device which holds the bus by stretching the clock shows a high ratio.
+ *
+ * When the average ratio of an address exceeds the degradation threshold, the
+ * address is marked degraded and the callback is invoked. Depending on the
+ * policy, transfers to a degraded address may then be throttled or rejected,
+ * leaving the bus available to other slave devices. Up to #I2CD_PROF_TARGETS
+ * 7-bit and 10-bit addresses are tracked per handle.
+ *
+ * @{
+ */
+
+/** @brief Maximum number of addresses tracked per handle. */
+#define I2CD_PROF_TARGETS	128
+
+/**
+ * @brief Number of latency histogram buckets.
+ *
+ * Bucket 0 counts latencies under 1 us, bucket @e n counts latencies from
+ * 2^(@e n - 1) up to 2^@e n us, and the last bucket counts all longer
+ * latencies.
+ */
+#define I2CD_PROF_BUCKETS	16
+
+/** @brief Only invoke the callback when an address degrades. */
+#define I2CD_PROF_NOTIFY	0
+
+/** @brief Limit transfers to a degraded address; excess fail with @c EAGAIN. */
+#define I2CD_PROF_THROTTLE	1
+
+/** @brief Reject transfers to a degraded address with @c EHOSTDOWN. */
+#define I2CD_PROF_ISOLATE	2
+
+/** @brief Address is performing normally. */
+#define I2CD_PROF_OK		0
+
+/** @brief Address has degraded. */
+#define I2CD_PROF_DEGRADED	1
+
+/**
+ * @brief Latency statistics of an address.
+ */
+struct i2cd_prof_stats {
+	uint16_t addr;		/**< I2C slave address. */
+	uint16_t flags;		/**< @c I2C_M_TEN if a 10-bit address. */
+	int state;		/**< One of the I2CD_PROF_* states. */
+	uint64_t count;		/**< Number of transfers measured. */
+	uint64_t outliers;	/**< Number of outlying transfers. */
+	uint64_t ewma_ns;	/**< Average latency in nanoseconds. */
+	uint64_t max_ns;	/**< Maximum latency in nanoseconds. */
+	double ewma_ratio;	/**< Average ratio of latency to on-wire time. */
+	uint64_t hist[I2CD_PROF_BUCKETS];	/**< Latency histogram. */
+};
+
+/**
+ * @brief Function invoked when the state of an address changes.
+ *
+ * @param dev   Pointer to an I2C character device handle.
+ * @param stats Statistics of the address, including its new state.
+ * @param arg   Argument given in the profiling attributes.
+ *
+ * The callback is invoked from the thread which made the transfer, after the
+ * transfer has completed.
+ */
+typedef void (*i2cd_prof_callback)(struct i2cd *dev,
+		const struct i2cd_prof_stats *stats, void *arg);
+
+/**
+ * @brief Attributes of latency profiling.
+ */
+struct i2cd_prof_attr {
+	double alpha;		/**< EWMA smoothing factor in (0, 1]. */
+	double outlier_ratio;	/**< Ratio above which a transfer is outlying. */
+	double degraded_ratio;	/**< Average ratio above which an address
+				     is degraded. */
+	unsigned long min_count;	/**< Transfers measured before an
+					     address may degrade. */
+	int policy;		/**< One of the I2CD_PROF_* policies. */
+	unsigned long throttle_ms;	/**< Minimum interval between transfers
+					     to a throttled address. */
+	i2cd_prof_callback callback;	/**< Callback, or @c NULL. */
+	void *arg;		/**< Argument passed to @p callback. */
+};
+
+/**
+ * @brief Initialize latency profiling attributes to default values.
+ *
+ * @param attr Pointer to latency profiling attributes.
+ *
+ * By default, the EWMA smoothing factor is 0.125, transfers taking more than
+ * four times their on-wire time are outliers, and an address degrades once
+ * its average exceeds twice its on-wire time over at least 8 transfers. The
+ * policy is #I2CD_PROF_NOTIFY with a throttle interval of 100 ms and no
+ * callback.
+ */
+void i2cd_prof_attr_init(struct i2cd_prof_attr *attr);
+
+/**
+ * @brief Enable latency profiling.
+ *
+ * @param dev  Pointer to an I2C character device handle.
+ * @param attr Pointer to latency profiling attributes, or @c NULL for
+ *             defaults.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * Calling this function again resets all statistics.
+ */
+int i2cd_prof_enable(struct i2cd *dev, const struct i2cd_prof_attr *attr);
+
+/**
+ * @brief Get the latency statistics of an address.
+ *
+ * @param dev   Pointer to an I2C character device handle.
+ * @param addr  I2C slave address.
+ * @param flags @c I2C_M_TEN if @p addr is a 10-bit address, otherwise 0.
+ * @param stats Pointer to statistics to receive the result.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately. If no
+ * transfers to @p addr were measured, @c errno is set to @c ENOENT.
+ */
+int i2cd_prof_get(struct i2cd *dev, uint16_t addr, int flags,
+		struct i2cd_prof_stats *stats);
+
+/**
+ * @brief Reset the latency statistics and state of an address.
+ *
+ * @param dev   Pointer to an I2C character device handle.
+ * @param addr  I2C slave address.
+ * @param flags @c I2C_M_TEN if @p addr is a 10-bit address, otherwise 0.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * This function should be called to restore an address which was isolated
+ * once the slave device has been recovered.
+ */
+int i2cd_prof_reset(struct i2cd *dev, uint16_t addr, int flags);
+
+/** @} */
+
+/**
+ * @defgroup flight Single-Flight Reads
+ *
+ * @brief Functions for sharing identical register reads between threads.
+ *
+ * Once enabled using i2cd_flight_enable(), a read of a register on a handle
+ * made using i2cd_flight_read() while an identical read is in flight waits
+ * for that read to complete and shares its result, including any error,
+ * rather than issuing another transfer. Reads are identical if they are of
+ * the same length from the same register of the same slave device.
+ *
+ * Optionally, a successful result may also be returned without a transfer
+ * for a short time after it completes. Results are only shared between reads
+ * made using i2cd_flight_read(); i2cd_flight_invalidate() should be called
+ * after writing to a slave device whose registers may be affected. Up to
+ * #I2CD_FLIGHT_ENTRIES distinct reads are tracked per handle; further reads
+ * are issued normally.
+ *
+ * Reads are only shared between threads using the same handle. Handles
+ * created using i2cd_dup() have single-flight reads disabled, and enabling
+ * them tracks reads separately from the original handle.
+ *
+ * @{
+ */
+
+/** @brief Registers are addressed using 16 bits. */
+#define I2CD_FLIGHT_REG16	0x0001
+
+/** @brief Maximum number of distinct reads tracked per handle. */
+#define I2CD_FLIGHT_ENTRIES	32
+
+/** @brief Maximum length of a shared read. */
+#define I2CD_FLIGHT_MAX_LEN	32
+
+/**
+ * @brief Enable single-flight reads.
+ *
+ * @param dev      Pointer to an I2C character device handle.
+ * @param fresh_us Time in microseconds for which a result is returned without
+ *                 a transfer, or 0 to only share reads in flight.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * Calling this function again changes the freshness window and discards
+ * completed results.
+ */
+int i2cd_flight_enable(struct i2cd *dev, unsigned long fresh_us);
+
+/**
+ * @brief Read bytes from a slave register, sharing identical reads.
+ *
+ * @param dev   Pointer to an I2C character device handle.
+ * @param addr  I2C slave address.
+ * @param reg   I2C slave register.
+ * @param buf   Pointer to a buffer to receive bytes.
+ * @param len   Number of bytes to read.
+ * @param flags Bitwise OR of zero or more @c I2CD_FLIGHT_* flags.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately.
+ *
+ * If single-flight reads are not enabled or @p len exceeds
+ * #I2CD_FLIGHT_MAX_LEN, this function is equivalent to
+ * i2cd_register_read() or i2cd_register_read16().
+ */
+int i2cd_flight_read(struct i2cd *dev, uint16_t addr, uint16_t reg,
+		void *buf, size_t len, int flags);
+
+/**
+ * @brief Discard results of a slave device.
+ *
+ * @param dev  Pointer to an I2C character device handle.
+ * @param addr I2C slave address.
+ *
+ * The result of a read in flight is given to threads already waiting for it,
+ * but not shared with later reads or kept once the read completes.
+ */
+void i2cd_flight_invalidate(struct i2cd *dev, uint16_t addr);
+
+/** @} */
+
+/**
+ * @defgroup hotplug Hot-Plug Monitoring
+ *
+ * @brief Functions for reopening handles when adapters are removed and added.
+ *
+ * A hot-plug monitor listens for kernel uevents of the @c i2c-dev subsystem.
+ * When the adapter of a watched handle is removed, the handle is marked stale
+ * and functions which access the adapter fail immediately with @c ENODEV.
+ * When a matching adapter is added, the handle is reopened in place: its
+ * file descriptor number is preserved, and retries, timeout, and cached
+ * functionality are restored, as is the address to which it is bound.
+ * Handles may be matched by path, or by adapter name for adapters such as USB
+ * bridges which may return with a different number; in that case the path of
+ * the handle is updated. The selected channel of each multiplexer and the
+ * results of single-flight reads on a reopened handle are discarded.
+ *
+ * Events are handled by i2cd_hotplug_process(), which should be called when
+ * the file descriptor returned by i2cd_hotplug_get_fd() is readable. A
+ * monitor is not thread-safe, though watched handles may be used by other
+ * threads while events are processed.
+ *
+ * @{
+ */
+
+/**
+ * @struct i2cd_hotplug
+ *
+ * @brief Handle to a hot-plug monitor.
+ */
+struct i2cd_hotplug;
+
+/**
+ * @brief Create a hot-plug monitor.
+ *
+ * @return Pointer to a hot-plug monitor, or @c NULL on error with @c errno
+ * set appropriately.
+ *
+ * Kernel uevents are received using a @c NETLINK_KOBJECT_UEVENT socket.
+ */
+struct i2cd_hotplug *i2cd_hotplug_new(void);
+
+/**
+ * @brief Create a hot-plug monitor from an existing file descriptor.
+ *
+ * @param fd         Datagram socket which receives kernel uevents.
+ * @param sysfs_path Mount point of sysfs, or @c NULL for @c /sys.
+ *
+ * @return Pointer to a hot-plug monitor, or @c NULL on error with @c errno
+ * set appropriately.
+ *
+ * On success, the monitor takes ownership of @p fd. This is useful for
+ * applications which receive uevents by other means.
+ */
+struct i2cd_hotplug *i2cd_hotplug_new_fd(int fd, const char *sysfs_path);
+
+/**
+ * @brief Free a hot-plug monitor.
+ *
+ * @param hotplug Pointer to a hot-plug monitor.
+ *
+ * Watched handles are not closed. Once freed, @p hotplug is no longer valid
+ * for use.
+ */
+void i2cd_hotplug_free(struct i2cd_hotplug *hotplug);
+
+/**
+ * @brief Get the file descriptor of a hot-plug monitor.
+ *
+ * @param hotplug Pointer to a hot-plug monitor.
+ *
+ * @return File descriptor which is readable when events are pending.
+ */
+int i2cd_hotplug_get_fd(struct i2cd_hotplug *hotplug);
+
+/**
+ * @brief Watch an I2C character device handle.
+ *
+ * @param hotplug Pointer to a hot-plug monitor.
+ * @param dev     Pointer to an I2C character device handle.
+ * @param name    Name of the adapter, or @c NULL to match by path.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately. If
+ * @p dev is already watched, @c errno is set to @c EEXIST.
+ *
+ * The adapter name is compared to the @c name attribute of the adapter in
+ * sysfs. A handle must not be closed while it is watched.
+ */
+int i2cd_hotplug_watch(struct i2cd_hotplug *hotplug, struct i2cd *dev,
+		const char *name);
+
+/**
+ * @brief Stop watching an I2C character device handle.
+ *
+ * @param hotplug Pointer to a hot-plug monitor.
+ * @param dev     Pointer to an I2C character device handle.
+ *
+ * A stale handle remains stale.
+ */
+void i2cd_hotplug_unwatch(struct i2cd_hotplug *hotplug, struct i2cd *dev);
+
+/**
+ * @brief Process pending hot-plug events.
+ *
+ * @param hotplug Pointer to a hot-plug monitor.
+ *
+ * @return Number of handles marked stale or reopened on success, or -1 on
+ * error with @c errno set appropriately.
+ *
+ * This function does not block. If a handle cannot be reopened, for example
+ * because udev has yet to set the permissions of a new device node, it remains
+ * stale and reopening it is attempted again by each later call. While a
+ * watched handle is stale, this function should therefore also be called
+ * periodically rather than only when events are pending.
+ */
+int i2cd_hotplug_process(struct i2cd_hotplug *hotplug);
+
+/**
+ * @brief Test whether the adapter of a handle has been removed.
+ *
+ * @param dev Pointer to an I2C character device handle.
+ *
+ * @return Non-zero if the handle is stale, otherwise 0.
+ */
+int i2cd_hotplug_is_stale(struct i2cd *dev);
+
+/** @} */
+
+/**
+ * @defgroup client Client API
+ *
+ * @brief Access I2C character devices owned by i2cd-server.
+ *
+ * These functions mirror the main API, but forward requests over a UNIX
+ * domain socket to an @c i2cd-server process which owns the underlying I2C
+ * character device handles. This allows many short-lived processes to share
+ * an adapter without contending for the bus; the server serializes requests
+ * and may combine requests from concurrent clients into a single @c I2C_RDWR
+ * @c ioctl() request. Transfers whose total length exceeds an internal limit
+ * are passed to the server in shared memory rather than copied through the
+ * socket.
+ *
+ * A client handle is not thread-safe; each thread should open its own handle.
+ *
+ * @{
+ */
+
+/**
+ * @brief Default path of the i2cd-server socket.
+ */
+#define I2CD_SOCKET_PATH "/run/i2cd.sock"
+
+/**
+ * @struct i2cd_client
+ *
+ * @brief Handle to an I2C character device owned by i2cd-server.
+ */
+struct i2cd_client;
+
+/**
+ * @brief Connect to i2cd-server and attach to the I2C character device
+ * specified by @p path.
+ *
+ * @param socket_path Path to the server socket, or @c NULL to use
+ *                    #I2CD_SOCKET_PATH.
+ * @param path        Path to the I2C character device to attach.
+ *
+ * @return Pointer to a client handle, or @c NULL on error with @c errno set
+ * appropriately.
+ */
+struct i2cd_client *i2cd_client_open(const char *socket_path,
+		const char *path);
+
+/**
+ * @brief Disconnect from i2cd-server and free associated memory.
+ *
+ * @param client Pointer to a client handle.
+ *
+ * Once closed, @p client is no longer valid for use.
+ */
+void i2cd_client_close(struct i2cd_client *client);
+
+/**
+ * @brief Get the adapter functionality mask.
+ *
+ * @param client Pointer to a client handle.
+ * @param funcs  Pointer to a buffer to receive a mask.
+ *
+ * @return 0 on success, or -1 on error with @c errno set appropriately.
+ *
+ * See i2cd_get_functionality() for more details.
+ */
+int i2cd_client_get_functionality(struct i2cd_client *client,
+		unsigned long *funcs);
+
+/**
+ * @brief Transfer one or more low-level messages terminated with a single
+ * STOP condition.
+ *
+ * @param client Pointer to a client handle.
+ * @param msgs   Array of messages to transfer.
+ * @param nmsgs  Number of messages to transfer.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately.
+ *
+ * See i2cd_transfer() for more details.
+ */
+int i2cd_client_transfer(struct i2cd_client *client, struct i2c_msg msgs[],
+		size_t nmsgs);
+
+/**
+ * @brief Read bytes from a slave device.
+ *
+ * @param client Pointer to a client handle.
+ * @param addr   I2C slave address.
+ * @param buf    Pointer to a buffer to receive bytes.
+ * @param len    Number of bytes to read.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately.
+ */
+int i2cd_client_read(struct i2cd_client *client, uint16_t addr, void *buf,
+		size_t len);
+
+/**
+ * @brief Write bytes to a slave device.
+ *
+ * @param client Pointer to a client handle.
+ * @param addr   I2C slave address.
+ * @param buf    Pointer to a buffer to send bytes.
+ * @param len    Number of bytes to send.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately.
+ */
+int i2cd_client_write(struct i2cd_client *client, uint16_t addr,
+		const void *buf, size_t len);
+
+/**
+ * @brief Write and read bytes from a slave device using a repeated START
+ * condition.
+ *
+ * @param client    Pointer to a client handle.
+ * @param addr      I2C slave address.
+ * @param write_buf Pointer to a buffer to send bytes.
+ * @param write_len Number of bytes to send.
+ * @param read_buf  Pointer to a buffer to receive bytes.
+ * @param read_len  Number of bytes to receive.
+ *
+ * @return Number of messages transferred on success, or -1 on error with @c
+ * errno set appropriately.
+ */
+int i2cd_client_write_read(struct i2cd_client *client, uint16_t addr,
+		const void *write_buf, size_t write_len,
+		void *read_buf, size_t read_len);
+
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
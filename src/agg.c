@@ -0,0 +1,364 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NSEC_PER_MSEC	1000000ULL
+
+/*
+ * Partial aggregates are stored slot-major, so the aggregates of all
+ * channels in a slot are contiguous. Each slot records the epoch it holds,
+ * counted in slots since the clock started plus one; a slot holding an
+ * epoch outside the window is stale and reset before reuse.
+ */
+struct i2cd_agg {
+	pthread_mutex_t lock;
+	size_t nchannels;	/**< Number of channels. */
+	unsigned int nslots;	/**< Number of slots. */
+	uint64_t slot;		/**< Length of slot (ns). */
+	uint64_t *epochs;	/**< Epoch of each slot, or 0. */
+	uint64_t *count;	/**< Number of values in each slot. */
+	double *min;		/**< Minimum value in each slot. */
+	double *max;		/**< Maximum value in each slot. */
+	double *sum;		/**< Sum of values in each slot. */
+	double *last;		/**< Last value of each channel. */
+	unsigned int *decimation;	/**< Decimation of each channel. */
+	unsigned int *phase;	/**< Samples since last taken. */
+};
+
+static uint64_t agg_epoch(const struct i2cd_agg *agg)
+{
+	return i2cd_clock_ns() / agg->slot + 1;
+}
+
+static bool agg_current(const struct i2cd_agg *agg, uint64_t epoch,
+		unsigned int slot)
+{
+	return agg->epochs[slot] != 0 &&
+		agg->epochs[slot] + agg->nslots > epoch;
+}
+
+static void agg_record(struct i2cd_agg *agg, size_t channel, double value)
+{
+	uint64_t epoch = agg_epoch(agg);
+	unsigned int slot = epoch % agg->nslots;
+	size_t i, base = slot * agg->nchannels;
+
+	if (agg->epochs[slot] != epoch) {
+		for (i = base; i < base + agg->nchannels; i++) {
+			agg->count[i] = 0;
+			agg->min[i] = INFINITY;
+			agg->max[i] = -INFINITY;
+			agg->sum[i] = 0;
+		}
+		agg->epochs[slot] = epoch;
+	}
+
+	i = base + channel;
+	agg->count[i]++;
+	agg->sum[i] += value;
+	if (value < agg->min[i])
+		agg->min[i] = value;
+	if (value > agg->max[i])
+		agg->max[i] = value;
+
+	agg->last[channel] = value;
+}
+
+/* Returns true if the next sample of a channel is to be taken */
+static bool agg_take(struct i2cd_agg *agg, size_t channel)
+{
+	bool take = agg->phase[channel] == 0;
+
+	if (++agg->phase[channel] >= agg->decimation[channel])
+		agg->phase[channel] = 0;
+
+	return take;
+}
+
+struct i2cd_agg *i2cd_agg_new(size_t nchannels, unsigned long window_ms,
+		unsigned int nslots)
+{
+	struct i2cd_agg *agg;
+	size_t n, i;
+	uint8_t *p;
+
+	if (nchannels == 0 || nslots == 0 ||
+	    window_ms * NSEC_PER_MSEC < nslots) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Arrays of 64-bit values are placed first to keep them aligned */
+	n = (size_t)nslots * nchannels;
+	agg = calloc(1, sizeof(*agg) + nslots * sizeof(*agg->epochs) +
+		     n * (sizeof(*agg->count) + sizeof(*agg->min) +
+			  sizeof(*agg->max) + sizeof(*agg->sum)) +
+		     nchannels * (sizeof(*agg->last) +
+				  sizeof(*agg->decimation) +
+				  sizeof(*agg->phase)));
+	if (agg == NULL)
+		return NULL;
+
+	agg->nchannels = nchannels;
+	agg->nslots = nslots;
+	agg->slot = window_ms * NSEC_PER_MSEC / nslots;
+
+	p = (uint8_t *)(agg + 1);
+	agg->epochs = (uint64_t *)p;
+	p += nslots * sizeof(*agg->epochs);
+	agg->count = (uint64_t *)p;
+	p += n * sizeof(*agg->count);
+	agg->min = (double *)p;
+	p += n * sizeof(*agg->min);
+	agg->max = (double *)p;
+	p += n * sizeof(*agg->max);
+	agg->sum = (double *)p;
+	p += n * sizeof(*agg->sum);
+	agg->last = (double *)p;
+	p += nchannels * sizeof(*agg->last);
+	agg->decimation = (unsigned int *)p;
+	p += nchannels * sizeof(*agg->decimation);
+	agg->phase = (unsigned int *)p;
+
+	for (i = 0; i < nchannels; i++) {
+		agg->last[i] = NAN;
+		agg->decimation[i] = 1;
+	}
+	pthread_mutex_init(&agg->lock, NULL);
+
+	return agg;
+}
+
+void i2cd_agg_free(struct i2cd_agg *agg)
+{
+	assert(agg != NULL);
+
+	pthread_mutex_destroy(&agg->lock);
+	free(agg);
+}
+
+int i2cd_agg_set_decimation(struct i2cd_agg *agg, size_t channel,
+		unsigned int n)
+{
+	assert(agg != NULL);
+
+	if (channel >= agg->nchannels || n == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&agg->lock);
+	agg->decimation[channel] = n;
+	agg->phase[channel] = 0;
+	pthread_mutex_unlock(&agg->lock);
+
+	return 0;
+}
+
+int i2cd_agg_add(struct i2cd_agg *agg, size_t channel, double value)
+{
+	int rc = 0;
+
+	assert(agg != NULL);
+
+	if (channel >= agg->nchannels) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&agg->lock);
+	if (agg_take(agg, channel)) {
+		agg_record(agg, channel, value);
+		rc = 1;
+	}
+	pthread_mutex_unlock(&agg->lock);
+
+	return rc;
+}
+
+int i2cd_agg_read(struct i2cd_agg *agg, size_t channel, struct i2cd *dev,
+		uint16_t addr, uint16_t reg, size_t size, int flags)
+{
+	union {
+		uint8_t reg8;
+		uint16_t reg16;
+	} reg_buf;
+	uint8_t buf[4];
+	uint32_t raw = 0;
+	double value;
+	size_t i;
+	bool take;
+	int rc;
+
+	assert(agg != NULL);
+	assert(dev != NULL);
+
+	if (channel >= agg->nchannels ||
+	    (size != 1 && size != 2 && size != 4) ||
+	    (!(flags & I2CD_AGG_REG16) && reg > UINT8_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&agg->lock);
+	take = agg_take(agg, channel);
+	pthread_mutex_unlock(&agg->lock);
+
+	if (!take)
+		return 0;
+
+	if (flags & I2CD_AGG_REG16) {
+		reg_buf.reg16 = reg;
+		rc = i2cd_write_read(dev, addr, &reg_buf.reg16,
+				     sizeof(reg_buf.reg16), buf, size);
+	} else {
+		reg_buf.reg8 = reg;
+		rc = i2cd_write_read(dev, addr, &reg_buf.reg8,
+				     sizeof(reg_buf.reg8), buf, size);
+	}
+	if (rc < 0)
+		return -1;
+
+	for (i = 0; i < size; i++)
+		raw = raw << 8 | buf[(flags & I2CD_AGG_BE) ? i : size - 1 - i];
+
+	/* Sign-extend from the most significant bit of the register */
+	if ((flags & I2CD_AGG_SIGNED) && (raw >> (size * 8 - 1)) & 1)
+		value = (double)raw - (double)(UINT64_C(1) << (size * 8));
+	else
+		value = raw;
+
+	pthread_mutex_lock(&agg->lock);
+	agg_record(agg, channel, value);
+	pthread_mutex_unlock(&agg->lock);
+
+	return 1;
+}
+
+static void agg_finish(struct i2cd_agg_stats *stats)
+{
+	if (stats->count == 0) {
+		stats->min = NAN;
+		stats->max = NAN;
+		stats->mean = NAN;
+	} else {
+		stats->mean /= stats->count;
+	}
+}
+
+int i2cd_agg_get(struct i2cd_agg *agg, size_t channel,
+		struct i2cd_agg_stats *stats)
+{
+	uint64_t epoch;
+	unsigned int slot;
+	size_t i;
+
+	assert(agg != NULL);
+	assert(stats != NULL);
+
+	if (channel >= agg->nchannels) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	stats->count = 0;
+	stats->min = INFINITY;
+	stats->max = -INFINITY;
+	stats->mean = 0;
+
+	pthread_mutex_lock(&agg->lock);
+
+	epoch = agg_epoch(agg);
+	for (slot = 0; slot < agg->nslots; slot++) {
+		if (!agg_current(agg, epoch, slot))
+			continue;
+
+		i = slot * agg->nchannels + channel;
+		if (agg->count[i] == 0)
+			continue;
+
+		stats->count += agg->count[i];
+		stats->mean += agg->sum[i];
+		if (agg->min[i] < stats->min)
+			stats->min = agg->min[i];
+		if (agg->max[i] > stats->max)
+			stats->max = agg->max[i];
+	}
+	stats->last = agg->last[channel];
+
+	pthread_mutex_unlock(&agg->lock);
+
+	agg_finish(stats);
+	return 0;
+}
+
+void i2cd_agg_snapshot(struct i2cd_agg *agg, struct i2cd_agg_stats stats[])
+{
+	uint64_t epoch;
+	unsigned int slot;
+	size_t channel, i;
+
+	assert(agg != NULL);
+	assert(stats != NULL);
+
+	for (channel = 0; channel < agg->nchannels; channel++) {
+		stats[channel].count = 0;
+		stats[channel].min = INFINITY;
+		stats[channel].max = -INFINITY;
+		stats[channel].mean = 0;
+	}
+
+	pthread_mutex_lock(&agg->lock);
+
+	/* Slots are visited in turn so that each is read sequentially */
+	epoch = agg_epoch(agg);
+	for (slot = 0; slot < agg->nslots; slot++) {
+		if (!agg_current(agg, epoch, slot))
+			continue;
+
+		for (channel = 0; channel < agg->nchannels; channel++) {
+			i = slot * agg->nchannels + channel;
+			if (agg->count[i] == 0)
+				continue;
+
+			stats[channel].count += agg->count[i];
+			stats[channel].mean += agg->sum[i];
+			if (agg->min[i] < stats[channel].min)
+				stats[channel].min = agg->min[i];
+			if (agg->max[i] > stats[channel].max)
+				stats[channel].max = agg->max[i];
+		}
+	}
+
+	for (channel = 0; channel < agg->nchannels; channel++)
+		stats[channel].last = agg->last[channel];
+
+	pthread_mutex_unlock(&agg->lock);
+
+	for (channel = 0; channel < agg->nchannels; channel++)
+		agg_finish(&stats[channel]);
+}
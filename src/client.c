@@ -0,0 +1,392 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+#include "i2cd-protocol.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+struct i2cd_client {
+	int fd;		/**< Socket connected to the server. */
+	int shm_fd;	/**< Shared memory file descriptor, or -1. */
+	void *shm;	/**< Shared memory mapping, or NULL. */
+	size_t shm_len;	/**< Length of shared memory mapping. */
+	void *packet;	/**< Buffer used to send and receive packets. */
+};
+
+/*
+ * The server maps the shared memory of its clients, and would be killed by
+ * SIGBUS if a client truncated it. Its size is therefore sealed, so a larger
+ * mapping needs a new memory file.
+ */
+static int client_map(struct i2cd_client *client, size_t len)
+{
+#ifdef HAVE_MEMFD_CREATE
+	void *shm;
+	int fd, errsv;
+
+	if (len <= client->shm_len)
+		return 0;
+
+	fd = memfd_create("i2cd-client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, len) < 0 ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+		goto err;
+
+	shm = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED)
+		goto err;
+
+	if (client->shm != NULL)
+		munmap(client->shm, client->shm_len);
+
+	if (client->shm_fd >= 0)
+		close(client->shm_fd);
+
+	client->shm_fd = fd;
+	client->shm = shm;
+	client->shm_len = len;
+	return 0;
+err:
+	errsv = errno;
+	close(fd);
+	errno = errsv;
+	return -1;
+#else
+	errno = EMSGSIZE;
+	return -1;
+#endif
+}
+
+static int client_call(struct i2cd_client *client, size_t len, int fd,
+		struct i2cd_proto_response *resp, void *data, size_t data_len)
+{
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct iovec iov[2];
+	struct msghdr msg = {
+		.msg_iov	= iov,
+		.msg_iovlen	= 1
+	};
+	ssize_t n;
+
+	iov[0].iov_base = client->packet;
+	iov[0].iov_len = len;
+
+	if (fd >= 0) {
+		struct cmsghdr *cmsg;
+
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	if (sendmsg(client->fd, &msg, MSG_NOSIGNAL) < 0)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov[0].iov_base = resp;
+	iov[0].iov_len = sizeof(*resp);
+	iov[1].iov_base = data;
+	iov[1].iov_len = data_len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = ARRAY_SIZE(iov);
+
+	do {
+		n = recvmsg(client->fd, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return -1;
+
+	if (n < (ssize_t)sizeof(*resp) || (msg.msg_flags & MSG_TRUNC) ||
+	    resp->len != (size_t)n - sizeof(*resp)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	if (resp->rc < 0) {
+		errno = resp->error;
+		return -1;
+	}
+
+	return resp->rc;
+}
+
+struct i2cd_client *i2cd_client_open(const char *socket_path, const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX
+	};
+	struct i2cd_client *client;
+	struct i2cd_proto_request *req;
+	struct i2cd_proto_response resp;
+	size_t len;
+	int errsv;
+
+	assert(path != NULL);
+
+	if (socket_path == NULL)
+		socket_path = I2CD_SOCKET_PATH;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path) ||
+	    strlen(path) >= I2CD_PROTO_INLINE_MAX) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	client = calloc(1, sizeof(*client));
+	if (client == NULL)
+		return NULL;
+
+	client->fd = -1;
+	client->shm_fd = -1;
+
+	client->packet = malloc(I2CD_PROTO_PACKET_MAX);
+	if (client->packet == NULL)
+		goto err;
+
+	client->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (client->fd < 0)
+		goto err;
+
+	if (connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		goto err;
+
+	len = strlen(path) + 1;
+
+	req = client->packet;
+	memset(req, 0, sizeof(*req));
+	req->op = I2CD_PROTO_OPEN;
+	req->len = len;
+	memcpy(req + 1, path, len);
+
+	if (client_call(client, sizeof(*req) + len, -1, &resp, NULL, 0) < 0)
+		goto err;
+
+	return client;
+err:
+	errsv = errno;
+
+	if (client->fd >= 0)
+		close(client->fd);
+
+	free(client->packet);
+	free(client);
+
+	errno = errsv;
+	return NULL;
+}
+
+void i2cd_client_close(struct i2cd_client *client)
+{
+	assert(client != NULL);
+
+	close(client->fd);
+
+	if (client->shm != NULL)
+		munmap(client->shm, client->shm_len);
+
+	if (client->shm_fd >= 0)
+		close(client->shm_fd);
+
+	free(client->packet);
+	free(client);
+}
+
+int i2cd_client_get_functionality(struct i2cd_client *client,
+		unsigned long *funcs)
+{
+	struct i2cd_proto_request *req;
+	struct i2cd_proto_response resp;
+
+	assert(client != NULL);
+	assert(funcs != NULL);
+
+	req = client->packet;
+	memset(req, 0, sizeof(*req));
+	req->op = I2CD_PROTO_FUNCS;
+
+	if (client_call(client, sizeof(*req), -1, &resp, NULL, 0) < 0)
+		return -1;
+
+	*funcs = resp.funcs;
+	return 0;
+}
+
+int i2cd_client_transfer(struct i2cd_client *client, struct i2c_msg msgs[],
+		size_t nmsgs)
+{
+	struct i2cd_proto_request *req;
+	struct i2cd_proto_msg *pmsgs;
+	struct i2cd_proto_response resp;
+	uint8_t *data, *read_data;
+	size_t i, total = 0, len = 0;
+	bool shm;
+	int rc;
+
+	assert(client != NULL);
+	assert(msgs != NULL);
+	assert(nmsgs <= I2C_RDWR_IOCTL_MAX_MSGS);
+
+	for (i = 0; i < nmsgs; i++)
+		total += msgs[i].len;
+
+	shm = total > I2CD_PROTO_INLINE_MAX;
+	if (shm && client_map(client, total) < 0)
+		return -1;
+
+	req = client->packet;
+	memset(req, 0, sizeof(*req));
+	req->op = I2CD_PROTO_TRANSFER;
+	req->flags = shm ? I2CD_PROTO_F_SHM : 0;
+	req->nmsgs = nmsgs;
+
+	pmsgs = (struct i2cd_proto_msg *)(req + 1);
+	data = shm ? client->shm : (uint8_t *)&pmsgs[nmsgs];
+
+	for (i = 0; i < nmsgs; i++) {
+		pmsgs[i].addr = msgs[i].addr;
+		pmsgs[i].flags = msgs[i].flags;
+		pmsgs[i].len = msgs[i].len;
+		pmsgs[i].reserved = 0;
+
+		if (!(msgs[i].flags & I2C_M_RD)) {
+			memcpy(data + len, msgs[i].buf, msgs[i].len);
+			len += msgs[i].len;
+		} else if (shm) {
+			len += msgs[i].len;
+		}
+	}
+
+	if (shm) {
+		req->len = total;
+		rc = client_call(client, sizeof(*req) + nmsgs * sizeof(*pmsgs),
+				 client->shm_fd, &resp, NULL, 0);
+	} else {
+		/* Read data is received after the request in the packet */
+		req->len = len;
+		read_data = data + len;
+		rc = client_call(client, sizeof(*req) +
+				 nmsgs * sizeof(*pmsgs) + len, -1, &resp,
+				 read_data, I2CD_PROTO_INLINE_MAX - len);
+		data = read_data;
+	}
+	if (rc < 0)
+		return -1;
+
+	len = 0;
+	for (i = 0; i < nmsgs; i++) {
+		if (msgs[i].flags & I2C_M_RD) {
+			memcpy(msgs[i].buf, data + len, msgs[i].len);
+			len += msgs[i].len;
+		} else if (shm) {
+			len += msgs[i].len;
+		}
+	}
+
+	return rc;
+}
+
+int i2cd_client_read(struct i2cd_client *client, uint16_t addr, void *buf,
+		size_t len)
+{
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= addr,
+			.flags	= I2C_M_RD,
+			.len	= len,
+			.buf	= buf
+		}
+	};
+
+	assert(buf != NULL);
+	assert(len <= UINT16_MAX);
+
+	return i2cd_client_transfer(client, msgs, ARRAY_SIZE(msgs));
+}
+
+int i2cd_client_write(struct i2cd_client *client, uint16_t addr,
+		const void *buf, size_t len)
+{
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= addr,
+			.flags	= 0,
+			.len	= len,
+			.buf	= (void *)buf
+		}
+	};
+
+	assert(buf != NULL);
+	assert(len <= UINT16_MAX);
+
+	return i2cd_client_transfer(client, msgs, ARRAY_SIZE(msgs));
+}
+
+int i2cd_client_write_read(struct i2cd_client *client, uint16_t addr,
+		const void *write_buf, size_t write_len,
+		void *read_buf, size_t read_len)
+{
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= addr,
+			.flags	= 0,
+			.len	= write_len,
+			.buf	= (void *)write_buf
+		},
+		{
+			.addr	= addr,
+			.flags	= I2C_M_RD,
+			.len	= read_len,
+			.buf	= read_buf
+		}
+	};
+
+	assert(write_buf != NULL);
+	assert(write_len <= UINT16_MAX);
+	assert(read_buf != NULL);
+	assert(read_len <= UINT16_MAX);
+
+	return i2cd_client_transfer(client, msgs, ARRAY_SIZE(msgs));
+}
@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <linux/i2c.h>
+
+#define CRC_SLICES	8
+
+#define PEC_POLY	0x07
+#define WORD_POLY	0x31
+#define WORD_INIT	0xff
+
+/*
+ * Slicing-by-8 tables: table[k][x] is the CRC register after clocking in
+ * byte x followed by k zero bytes. Since the register is a single byte, eight
+ * bytes are folded by XORing one lookup per byte.
+ */
+static uint8_t pec_table[CRC_SLICES][256];
+static uint8_t word_table[256];
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint8_t crc_byte(uint8_t crc, uint8_t poly)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		crc = (crc & 0x80) ? (crc << 1) ^ poly : crc << 1;
+	return crc;
+}
+
+static void crc_init(void)
+{
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		pec_table[0][i] = crc_byte(i, PEC_POLY);
+		word_table[i] = crc_byte(i, WORD_POLY);
+	}
+
+	for (k = 1; k < CRC_SLICES; k++) {
+		for (i = 0; i < 256; i++)
+			pec_table[k][i] = pec_table[0][pec_table[k - 1][i]];
+	}
+}
+
+uint8_t i2cd_pec_update(uint8_t pec, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	assert(buf != NULL || len == 0);
+
+	pthread_once(&crc_once, crc_init);
+
+	for (; len >= CRC_SLICES; len -= CRC_SLICES, p += CRC_SLICES) {
+		pec = pec_table[7][pec ^ p[0]] ^ pec_table[6][p[1]] ^
+		      pec_table[5][p[2]] ^ pec_table[4][p[3]] ^
+		      pec_table[3][p[4]] ^ pec_table[2][p[5]] ^
+		      pec_table[1][p[6]] ^ pec_table[0][p[7]];
+	}
+
+	while (len--)
+		pec = pec_table[0][pec ^ *p++];
+
+	return pec;
+}
+
+uint8_t i2cd_crc8_word(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint8_t crc = WORD_INIT;
+
+	assert(buf != NULL || len == 0);
+
+	pthread_once(&crc_once, crc_init);
+
+	while (len--)
+		crc = word_table[crc ^ *p++];
+
+	return crc;
+}
+
+int i2cd_verify_words(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	assert(buf != NULL || len == 0);
+
+	if (len % 3 != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_once(&crc_once, crc_init);
+
+	for (; len > 0; len -= 3, p += 3) {
+		if (word_table[word_table[WORD_INIT ^ p[0]] ^ p[1]] != p[2]) {
+			errno = EBADMSG;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int i2cd_write_read_verify(struct i2cd *dev, uint16_t addr,
+		const void *write_buf, size_t write_len,
+		void *read_buf, size_t read_len, int verify)
+{
+	uint8_t pec, addr_byte;
+	int rc;
+
+	assert(read_buf != NULL);
+
+	switch (verify) {
+	case I2CD_VERIFY_PEC:
+		if (read_len < 1 || addr > 0x7f)
+			goto invalid;
+		break;
+
+	case I2CD_VERIFY_WORDS:
+		if (read_len % 3 != 0)
+			goto invalid;
+		break;
+
+	default:
+		goto invalid;
+	}
+
+	if (write_len > 0)
+		rc = i2cd_write_read(dev, addr, write_buf, write_len,
+				     read_buf, read_len);
+	else
+		rc = i2cd_read(dev, addr, read_buf, read_len);
+	if (rc < 0)
+		return -1;
+
+	if (verify == I2CD_VERIFY_WORDS)
+		return i2cd_verify_words(read_buf, read_len) < 0 ? -1 : rc;
+
+	/* PEC covers each address byte as it appears on the bus */
+	pec = 0;
+	if (write_len > 0) {
+		addr_byte = addr << 1;
+		pec = i2cd_pec_update(pec, &addr_byte, 1);
+		pec = i2cd_pec_update(pec, write_buf, write_len);
+	}
+	addr_byte = addr << 1 | 1;
+	pec = i2cd_pec_update(pec, &addr_byte, 1);
+	pec = i2cd_pec_update(pec, read_buf, read_len - 1);
+
+	if (pec != ((uint8_t *)read_buf)[read_len - 1]) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	return rc;
+invalid:
+	errno = EINVAL;
+	return -1;
+}
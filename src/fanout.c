@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+struct fanout_chunk {
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	size_t index[I2C_RDWR_IOCTL_MAX_MSGS];	/**< Index of each target. */
+	size_t ntargets;
+};
+
+static void fanout_set(uint64_t status[], size_t index)
+{
+	status[index / 64] |= UINT64_C(1) << (index % 64);
+}
+
+static int fanout_flush(struct i2cd *dev, struct fanout_chunk *chunk,
+		size_t nmsgs, int flags, uint64_t status[], int *error)
+{
+	int count = 0;
+	size_t i;
+
+	if (chunk->ntargets == 0)
+		return 0;
+
+	if (i2cd_transfer(dev, chunk->msgs, chunk->ntargets * nmsgs) >= 0) {
+		for (i = 0; i < chunk->ntargets; i++)
+			fanout_set(status, chunk->index[i]);
+		count = chunk->ntargets;
+	} else if (!(flags & I2CD_FANOUT_REPLAY)) {
+		/* Earlier targets were likely written; never write them twice */
+		*error = errno;
+	} else {
+		/* Write each target separately to determine which failed */
+		for (i = 0; i < chunk->ntargets; i++) {
+			if (i2cd_transfer(dev, &chunk->msgs[i * nmsgs],
+					  nmsgs) < 0) {
+				*error = errno;
+				continue;
+			}
+			fanout_set(status, chunk->index[i]);
+			count++;
+		}
+	}
+
+	chunk->ntargets = 0;
+	return count;
+}
+
+int i2cd_fanout_write(const struct i2cd_fanout_target targets[],
+		size_t ntargets, const struct i2c_msg msgs[], size_t nmsgs,
+		int flags, uint64_t status[])
+{
+	struct fanout_chunk chunk;
+	struct i2cd *dev;
+	size_t i, j, k, per_chunk;
+	int count = 0, error = 0;
+
+	assert(targets != NULL);
+	assert(msgs != NULL);
+	assert(status != NULL);
+
+	if (nmsgs == 0 || nmsgs > I2C_RDWR_IOCTL_MAX_MSGS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < nmsgs; i++) {
+		if (msgs[i].flags & I2C_M_RD) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	memset(status, 0, I2CD_FANOUT_WORDS(ntargets) * sizeof(*status));
+	per_chunk = I2C_RDWR_IOCTL_MAX_MSGS / nmsgs;
+	chunk.ntargets = 0;
+
+	for (i = 0; i < ntargets; i++) {
+		dev = targets[i].dev;
+
+		/* Each adapter is handled once, at its first target */
+		for (j = 0; j < i && targets[j].dev != dev; j++)
+			;
+		if (j < i)
+			continue;
+
+		for (j = i; j < ntargets; j++) {
+			if (targets[j].dev != dev)
+				continue;
+
+			/* Messages share the caller's buffers */
+			for (k = 0; k < nmsgs; k++) {
+				struct i2c_msg *msg =
+					&chunk.msgs[chunk.ntargets * nmsgs + k];
+
+				*msg = msgs[k];
+				msg->addr = targets[j].addr;
+			}
+			chunk.index[chunk.ntargets++] = j;
+
+			if (chunk.ntargets == per_chunk)
+				count += fanout_flush(dev, &chunk, nmsgs,
+						      flags, status, &error);
+		}
+		count += fanout_flush(dev, &chunk, nmsgs, flags, status,
+				      &error);
+	}
+
+	if (error != 0)
+		errno = error;
+
+	return count;
+}
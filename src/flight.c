@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/i2c.h>
+
+#define NSEC_PER_USEC	1000ULL
+
+enum {
+	FLIGHT_FREE,
+	FLIGHT_PENDING,		/* Read is in flight */
+	FLIGHT_DONE,		/* Read has completed */
+};
+
+struct flight_entry {
+	int state;
+	uint16_t addr;		/**< I2C slave address. */
+	uint16_t reg;		/**< I2C slave register. */
+	size_t len;		/**< Length of read. */
+	int flags;		/**< I2CD_FLIGHT_* flags. */
+	bool stale;		/**< Invalidated while in flight. */
+	unsigned long gen;	/**< Incremented as each read completes. */
+	unsigned int waiters;	/**< Threads waiting for the result. */
+	uint64_t done;		/**< Time the read completed (ns). */
+	int rc;			/**< Result of read. */
+	int error;		/**< Error of read, if rc < 0. */
+	uint8_t data[I2CD_FLIGHT_MAX_LEN];
+};
+
+/*
+ * Reads are issued without holding the lock. An entry is only reused once
+ * its read has completed and every waiter has copied its result.
+ */
+struct i2cd_flight {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint64_t fresh;		/**< Freshness window (ns). */
+	unsigned int gen;	/**< Reopen generation of results. */
+	struct flight_entry entries[I2CD_FLIGHT_ENTRIES];
+};
+
+static int flight_register_read(struct i2cd *dev, uint16_t addr, uint16_t reg,
+		void *buf, size_t len, int flags)
+{
+	if (flags & I2CD_FLIGHT_REG16)
+		return i2cd_register_read16(dev, addr, reg, buf, len);
+
+	return i2cd_register_read(dev, addr, reg, buf, len);
+}
+
+static struct flight_entry *flight_lookup(struct i2cd_flight *flight,
+		uint16_t addr, uint16_t reg, size_t len, int flags)
+{
+	struct flight_entry *entry, *victim = NULL;
+	size_t i;
+
+	for (i = 0; i < I2CD_FLIGHT_ENTRIES; i++) {
+		entry = &flight->entries[i];
+		if (entry->state != FLIGHT_FREE && entry->addr == addr &&
+		    entry->reg == reg && entry->len == len &&
+		    entry->flags == flags)
+			return entry;
+
+		/* Prefer a free entry, then the oldest completed entry */
+		if (entry->state == FLIGHT_PENDING || entry->waiters > 0)
+			continue;
+		if (victim == NULL || entry->state == FLIGHT_FREE ||
+		    (victim->state == FLIGHT_DONE &&
+		     entry->done < victim->done))
+			victim = entry;
+	}
+
+	if (victim != NULL) {
+		victim->state = FLIGHT_FREE;
+		victim->addr = addr;
+		victim->reg = reg;
+		victim->len = len;
+		victim->flags = flags;
+	}
+	return victim;
+}
+
+static int flight_result(const struct flight_entry *entry, void *buf)
+{
+	if (entry->rc < 0) {
+		errno = entry->error;
+		return -1;
+	}
+
+	memcpy(buf, entry->data, entry->len);
+	return entry->rc;
+}
+
+/*
+ * Requires lock; discards results of addr, or all if negative. The result of
+ * a read in flight is only given to threads already waiting for it.
+ */
+static void flight_discard(struct i2cd_flight *flight, int addr)
+{
+	struct flight_entry *entry;
+	size_t i;
+
+	for (i = 0; i < I2CD_FLIGHT_ENTRIES; i++) {
+		entry = &flight->entries[i];
+		if (entry->state == FLIGHT_FREE ||
+		    (addr >= 0 && entry->addr != addr))
+			continue;
+
+		/* Waiters still hold a reference to the result */
+		if (entry->state == FLIGHT_PENDING)
+			entry->stale = true;
+		else if (entry->waiters > 0)
+			entry->done = 0;
+		else
+			entry->state = FLIGHT_FREE;
+	}
+}
+
+int i2cd_flight_enable(struct i2cd *dev, unsigned long fresh_us)
+{
+	struct i2cd_flight *flight;
+
+	assert(dev != NULL);
+
+	pthread_mutex_lock(&dev->lock);
+
+	flight = dev->flight;
+	if (flight == NULL) {
+		flight = calloc(1, sizeof(*flight));
+		if (flight == NULL) {
+			pthread_mutex_unlock(&dev->lock);
+			return -1;
+		}
+		pthread_mutex_init(&flight->lock, NULL);
+		pthread_cond_init(&flight->cond, NULL);
+	}
+
+	pthread_mutex_lock(&flight->lock);
+	flight->fresh = fresh_us * NSEC_PER_USEC;
+	flight->gen = __atomic_load_n(&dev->gen, __ATOMIC_ACQUIRE);
+	flight_discard(flight, -1);
+	pthread_mutex_unlock(&flight->lock);
+
+	/* Reads check for single-flight without taking the lock */
+	__atomic_store_n(&dev->flight, flight, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+}
+
+void i2cd_flight_free(struct i2cd_flight *flight)
+{
+	pthread_cond_destroy(&flight->cond);
+	pthread_mutex_destroy(&flight->lock);
+	free(flight);
+}
+
+int i2cd_flight_read(struct i2cd *dev, uint16_t addr, uint16_t reg,
+		void *buf, size_t len, int flags)
+{
+	struct i2cd_flight *flight;
+	struct flight_entry *entry;
+	unsigned long gen;
+	unsigned int dev_gen;
+	int rc, errsv;
+
+	assert(dev != NULL);
+	assert(buf != NULL);
+
+	flight = __atomic_load_n(&dev->flight, __ATOMIC_ACQUIRE);
+	if (flight == NULL || len > I2CD_FLIGHT_MAX_LEN)
+		return flight_register_read(dev, addr, reg, buf, len, flags);
+
+	pthread_mutex_lock(&flight->lock);
+
+	/* Results from before the handle was reopened are discarded */
+	dev_gen = __atomic_load_n(&dev->gen, __ATOMIC_ACQUIRE);
+	if (dev_gen != flight->gen) {
+		flight_discard(flight, -1);
+		flight->gen = dev_gen;
+	}
+
+	entry = flight_lookup(flight, addr, reg, len, flags);
+	if (entry == NULL) {
+		/* Every entry is in use; read without sharing */
+		pthread_mutex_unlock(&flight->lock);
+		return flight_register_read(dev, addr, reg, buf, len, flags);
+	}
+
+	/* A read which began before an invalidation is not shared */
+	if (entry->state == FLIGHT_PENDING && entry->stale) {
+		pthread_mutex_unlock(&flight->lock);
+		return flight_register_read(dev, addr, reg, buf, len, flags);
+	}
+
+	if (entry->state == FLIGHT_PENDING) {
+		gen = entry->gen;
+		entry->waiters++;
+		while (entry->gen == gen)
+			pthread_cond_wait(&flight->cond, &flight->lock);
+		entry->waiters--;
+
+		rc = flight_result(entry, buf);
+		pthread_mutex_unlock(&flight->lock);
+		return rc;
+	}
+
+	if (entry->state == FLIGHT_DONE && entry->rc >= 0 &&
+	    entry->done != 0 && i2cd_clock_ns() - entry->done < flight->fresh) {
+		rc = flight_result(entry, buf);
+		pthread_mutex_unlock(&flight->lock);
+		return rc;
+	}
+
+	entry->state = FLIGHT_PENDING;
+	entry->stale = false;
+	pthread_mutex_unlock(&flight->lock);
+
+	rc = flight_register_read(dev, addr, reg, buf, len, flags);
+	errsv = errno;
+
+	pthread_mutex_lock(&flight->lock);
+
+	entry->rc = rc;
+	entry->error = errsv;
+	if (rc >= 0)
+		memcpy(entry->data, buf, len);
+	entry->done = entry->stale ? 0 : i2cd_clock_ns();
+	entry->state = FLIGHT_DONE;
+	entry->gen++;
+	pthread_cond_broadcast(&flight->cond);
+
+	pthread_mutex_unlock(&flight->lock);
+
+	errno = errsv;
+	return rc;
+}
+
+void i2cd_flight_invalidate(struct i2cd *dev, uint16_t addr)
+{
+	struct i2cd_flight *flight;
+
+	assert(dev != NULL);
+
+	flight = __atomic_load_n(&dev->flight, __ATOMIC_ACQUIRE);
+	if (flight == NULL)
+		return;
+
+	pthread_mutex_lock(&flight->lock);
+	flight_discard(flight, addr);
+	pthread_mutex_unlock(&flight->lock);
+}
@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+/* Each target is read using a register write followed by a block read */
+#define GATHER_PER_CHUNK	(I2C_RDWR_IOCTL_MAX_MSGS / 2)
+
+struct gather_chunk {
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	size_t index[GATHER_PER_CHUNK];	/**< Index of each target. */
+	size_t ntargets;
+	uint8_t data[I2CD_GATHER_MAX_LEN];
+};
+
+static void gather_set(uint64_t valid[], size_t index)
+{
+	valid[index / 64] |= UINT64_C(1) << (index % 64);
+}
+
+static void gather_store(const struct i2cd_gather_field fields[],
+		size_t nfields, size_t index, const uint8_t *data)
+{
+	uint64_t value;
+	size_t i, j;
+
+	for (i = 0; i < nfields; i++) {
+		const struct i2cd_gather_field *field = &fields[i];
+
+		value = 0;
+		if (data != NULL) {
+			for (j = 0; j < field->size; j++) {
+				size_t k = (field->flags & I2CD_GATHER_BE) ?
+					j : field->size - 1 - j;
+
+				value = value << 8 | data[field->offset + k];
+			}
+		}
+
+		switch (field->size) {
+		case 1:
+			((uint8_t *)field->array)[index] = value;
+			break;
+		case 2:
+			((uint16_t *)field->array)[index] = value;
+			break;
+		case 4:
+			((uint32_t *)field->array)[index] = value;
+			break;
+		case 8:
+			((uint64_t *)field->array)[index] = value;
+			break;
+		}
+	}
+}
+
+static int gather_flush(struct i2cd *dev, struct gather_chunk *chunk,
+		size_t len, const struct i2cd_gather_field fields[],
+		size_t nfields, uint64_t valid[], int *error)
+{
+	int count = 0;
+	size_t i;
+
+	if (chunk->ntargets == 0)
+		return 0;
+
+	if (i2cd_transfer(dev, chunk->msgs, chunk->ntargets * 2) >= 0) {
+		for (i = 0; i < chunk->ntargets; i++) {
+			gather_set(valid, chunk->index[i]);
+			gather_store(fields, nfields, chunk->index[i],
+				     chunk->data + i * len);
+		}
+		count = chunk->ntargets;
+	} else {
+		/* Read each target separately to determine which failed */
+		for (i = 0; i < chunk->ntargets; i++) {
+			if (i2cd_transfer(dev, &chunk->msgs[i * 2], 2) < 0) {
+				*error = errno;
+				continue;
+			}
+			gather_set(valid, chunk->index[i]);
+			gather_store(fields, nfields, chunk->index[i],
+				     chunk->data + i * len);
+			count++;
+		}
+	}
+
+	chunk->ntargets = 0;
+	return count;
+}
+
+int i2cd_gather_read(const struct i2cd_fanout_target targets[],
+		size_t ntargets, uint16_t reg, size_t len,
+		const struct i2cd_gather_field fields[], size_t nfields,
+		int flags, uint64_t valid[])
+{
+	struct gather_chunk chunk;
+	struct i2cd *dev;
+	union {
+		uint8_t reg8;
+		uint16_t reg16;
+	} reg_buf;
+	size_t i, j, reg_len, per_chunk;
+	int count = 0, error = 0;
+
+	assert(targets != NULL);
+	assert(fields != NULL || nfields == 0);
+	assert(valid != NULL);
+
+	if (len == 0 || len > I2CD_GATHER_MAX_LEN ||
+	    (!(flags & I2CD_GATHER_REG16) && reg > UINT8_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < nfields; i++) {
+		if ((fields[i].size != 1 && fields[i].size != 2 &&
+		     fields[i].size != 4 && fields[i].size != 8) ||
+		    fields[i].offset + fields[i].size > len ||
+		    fields[i].array == NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if (flags & I2CD_GATHER_REG16) {
+		reg_buf.reg16 = reg;
+		reg_len = sizeof(reg_buf.reg16);
+	} else {
+		reg_buf.reg8 = reg;
+		reg_len = sizeof(reg_buf.reg8);
+	}
+
+	memset(valid, 0, I2CD_FANOUT_WORDS(ntargets) * sizeof(*valid));
+	per_chunk = I2CD_GATHER_MAX_LEN / len;
+	if (per_chunk > GATHER_PER_CHUNK)
+		per_chunk = GATHER_PER_CHUNK;
+	chunk.ntargets = 0;
+
+	for (i = 0; i < ntargets; i++) {
+		dev = targets[i].dev;
+
+		/* Each adapter is handled once, at its first target */
+		for (j = 0; j < i && targets[j].dev != dev; j++)
+			;
+		if (j < i)
+			continue;
+
+		for (j = i; j < ntargets; j++) {
+			struct i2c_msg *msgs = &chunk.msgs[chunk.ntargets * 2];
+
+			if (targets[j].dev != dev)
+				continue;
+
+			/* Register writes share a single buffer */
+			msgs[0].addr = targets[j].addr;
+			msgs[0].flags = 0;
+			msgs[0].len = reg_len;
+			msgs[0].buf = (uint8_t *)&reg_buf;
+
+			msgs[1].addr = targets[j].addr;
+			msgs[1].flags = I2C_M_RD;
+			msgs[1].len = len;
+			msgs[1].buf = chunk.data + chunk.ntargets * len;
+
+			chunk.index[chunk.ntargets++] = j;
+
+			if (chunk.ntargets == per_chunk)
+				count += gather_flush(dev, &chunk, len, fields,
+						      nfields, valid, &error);
+		}
+		count += gather_flush(dev, &chunk, len, fields, nfields,
+				      valid, &error);
+	}
+
+	/* Fields of targets which were not read are cleared */
+	for (i = 0; i < ntargets; i++)
+		if (!i2cd_fanout_succeeded(valid, i))
+			gather_store(fields, nfields, i, NULL);
+
+	if (error != 0)
+		errno = error;
+
+	return count;
+}
@@ -0,0 +1,481 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <linux/i2c-dev.h>
+#include <linux/netlink.h>
+
+#define HOTPLUG_BUF_LEN		8192
+#define HOTPLUG_NAME_LEN	128
+
+struct hotplug_watch {
+	struct hotplug_watch *next;
+	struct i2cd *dev;
+	char *name;		/**< Name of the adapter, or NULL. */
+	char retry_path[PATH_MAX];	/**< Path to reopen again, or empty. */
+};
+
+struct i2cd_hotplug {
+	int fd;			/**< Socket which receives uevents. */
+	char *sysfs_path;	/**< Mount point of sysfs. */
+	struct hotplug_watch *watches;
+	char buf[HOTPLUG_BUF_LEN];
+};
+
+struct hotplug_event {
+	const char *action;
+	const char *subsystem;
+	const char *devname;
+};
+
+/*
+ * Kernel uevents consist of a header of the form "action@devpath" followed
+ * by NUL-terminated "KEY=value" pairs. Messages sent by udev begin with
+ * "libudev" and are ignored.
+ */
+static int hotplug_parse(const char *buf, size_t len,
+		struct hotplug_event *event)
+{
+	const char *p, *end = buf + len;
+
+	memset(event, 0, sizeof(*event));
+
+	if (strchr(buf, '@') == NULL)
+		return -1;
+
+	for (p = buf + strlen(buf) + 1; p < end; p += strlen(p) + 1) {
+		if (strncmp(p, "ACTION=", 7) == 0)
+			event->action = p + 7;
+		else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+			event->subsystem = p + 10;
+		else if (strncmp(p, "DEVNAME=", 8) == 0)
+			event->devname = p + 8;
+	}
+
+	if (event->action == NULL || event->subsystem == NULL ||
+	    event->devname == NULL || strcmp(event->subsystem, "i2c-dev") != 0)
+		return -1;
+
+	return 0;
+}
+
+/* Read the name of an adapter from sysfs, without trailing newline */
+static int hotplug_read_name(struct i2cd_hotplug *hotplug, const char *devname,
+		char *name, size_t len)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/class/i2c-dev/%s/name",
+		 hotplug->sysfs_path, devname);
+
+	fp = fopen(path, "re");
+	if (fp == NULL)
+		return -1;
+
+	if (fgets(name, len, fp) == NULL) {
+		fclose(fp);
+		errno = EIO;
+		return -1;
+	}
+	fclose(fp);
+
+	name[strcspn(name, "\n")] = '\0';
+	return 0;
+}
+
+static void hotplug_mark_stale(struct i2cd *dev)
+{
+	pthread_mutex_lock(&dev->lock);
+	i2cd_set_flags(dev, I2CD_F_STALE);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/*
+ * Opens path and duplicates it onto fd. If request is non-zero, the slave
+ * address is set before the file descriptor is replaced.
+ */
+static int hotplug_replace(int fd, const char *path, unsigned long request,
+		uint16_t addr)
+{
+	int new_fd, errsv;
+
+	new_fd = open(path, O_RDWR);
+	if (new_fd < 0)
+		return -1;
+
+	if ((request != 0 && ioctl(new_fd, request, (unsigned long)addr) < 0) ||
+	    dup2(new_fd, fd) < 0) {
+		errsv = errno;
+		close(new_fd);
+		errno = errsv;
+		return -1;
+	}
+	close(new_fd);
+	return 0;
+}
+
+/*
+ * The new file descriptors are duplicated onto the old ones, so that threads
+ * which loaded a file descriptor before the handle became stale never issue
+ * requests to an unrelated file.
+ */
+static int hotplug_reopen(struct i2cd *dev, const char *path)
+{
+	struct i2cd_old_path *old = NULL;
+	unsigned long request = 0;
+	char *new_path = NULL;
+	int errsv;
+
+	pthread_mutex_lock(&dev->lock);
+
+	/* The old path is kept, as i2cd_get_path() may have returned it */
+	if (strcmp(dev->path, path) != 0) {
+		old = calloc(1, sizeof(*old));
+		if (old == NULL)
+			goto err;
+
+		new_path = strdup(path);
+		if (new_path == NULL)
+			goto err;
+	}
+
+	if (dev->flags & I2CD_F_BOUND)
+		request = (dev->flags & I2CD_F_FORCE) ? I2C_SLAVE_FORCE :
+			  I2C_SLAVE;
+
+	if (hotplug_replace(dev->fd, path, 0, 0) < 0 ||
+	    (dev->bind_fd >= 0 &&
+	     hotplug_replace(dev->bind_fd, path, request, dev->bound) < 0))
+		goto err;
+
+	if (new_path != NULL) {
+		old->path = dev->path;
+		old->next = dev->old_paths;
+		dev->old_paths = old;
+		__atomic_store_n(&dev->path, new_path, __ATOMIC_RELEASE);
+		old = NULL;
+		new_path = NULL;
+	}
+
+	/* Restore state set using the handle; the adapter may differ */
+	i2cd_clear_flags(dev, I2CD_F_FREQ);
+	if (((dev->flags & I2CD_F_RETRIES) &&
+	     ioctl(dev->fd, I2C_RETRIES, dev->retries) < 0) ||
+	    ((dev->flags & I2CD_F_TIMEOUT) &&
+	     ioctl(dev->fd, I2C_TIMEOUT, dev->timeout) < 0) ||
+	    ((dev->flags & I2CD_F_FUNCS) &&
+	     ioctl(dev->fd, I2C_FUNCS, &dev->funcs) < 0))
+		goto err;
+
+	/* State cached outside of the handle is discarded on next use */
+	__atomic_add_fetch(&dev->gen, 1, __ATOMIC_RELEASE);
+	i2cd_clear_flags(dev, I2CD_F_STALE);
+
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+err:
+	errsv = errno;
+
+	if (new_path != NULL)
+		free(new_path);
+
+	if (old != NULL)
+		free(old);
+
+	pthread_mutex_unlock(&dev->lock);
+	errno = errsv;
+	return -1;
+}
+
+/*
+ * The kernel announces an adapter before udev has applied its rules, so the
+ * first attempt to reopen it may fail with EACCES. No later event names the
+ * adapter, so failed attempts are retried each time events are processed.
+ */
+static void hotplug_set_retry(struct hotplug_watch *watch, const char *path)
+{
+	snprintf(watch->retry_path, sizeof(watch->retry_path), "%s",
+		 path != NULL ? path : "");
+}
+
+static int hotplug_retry(struct i2cd_hotplug *hotplug)
+{
+	struct hotplug_watch *watch;
+	int count = 0;
+
+	for (watch = hotplug->watches; watch != NULL; watch = watch->next) {
+		if (watch->retry_path[0] == '\0')
+			continue;
+
+		if (i2cd_hotplug_is_stale(watch->dev) &&
+		    hotplug_reopen(watch->dev, watch->retry_path) < 0)
+			continue;
+
+		if (!i2cd_hotplug_is_stale(watch->dev))
+			count++;
+		hotplug_set_retry(watch, NULL);
+	}
+	return count;
+}
+
+static int hotplug_handle(struct i2cd_hotplug *hotplug,
+		const struct hotplug_event *event)
+{
+	struct hotplug_watch *watch;
+	char path[PATH_MAX], name[HOTPLUG_NAME_LEN];
+	bool have_name = false;
+	int count = 0;
+
+	snprintf(path, sizeof(path), "/dev/%s", event->devname);
+
+	for (watch = hotplug->watches; watch != NULL; watch = watch->next) {
+		struct i2cd *dev = watch->dev;
+		bool stale = i2cd_hotplug_is_stale(dev);
+
+		if (strcmp(event->action, "remove") == 0) {
+			if (strcmp(watch->retry_path, path) == 0)
+				hotplug_set_retry(watch, NULL);
+
+			if (!stale && strcmp(dev->path, path) == 0) {
+				hotplug_mark_stale(dev);
+				count++;
+			}
+			continue;
+		}
+
+		if (strcmp(event->action, "add") != 0 || !stale)
+			continue;
+
+		if (watch->name != NULL) {
+			/* Adapters without a readable name never match */
+			if (!have_name &&
+			    hotplug_read_name(hotplug, event->devname, name,
+					      sizeof(name)) < 0)
+				name[0] = '\0';
+
+			have_name = true;
+			if (name[0] == '\0' || strcmp(watch->name, name) != 0)
+				continue;
+		} else if (strcmp(dev->path, path) != 0) {
+			continue;
+		}
+
+		if (hotplug_reopen(dev, path) == 0) {
+			hotplug_set_retry(watch, NULL);
+			count++;
+		} else {
+			hotplug_set_retry(watch, path);
+		}
+	}
+	return count;
+}
+
+struct i2cd_hotplug *i2cd_hotplug_new(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family	= AF_NETLINK,
+		.nl_groups	= 1	/* Kernel uevents */
+	};
+	struct i2cd_hotplug *hotplug;
+	int fd, errsv;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return NULL;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		goto err;
+
+	hotplug = i2cd_hotplug_new_fd(fd, NULL);
+	if (hotplug == NULL)
+		goto err;
+
+	return hotplug;
+err:
+	errsv = errno;
+	close(fd);
+	errno = errsv;
+	return NULL;
+}
+
+struct i2cd_hotplug *i2cd_hotplug_new_fd(int fd, const char *sysfs_path)
+{
+	struct i2cd_hotplug *hotplug;
+
+	if (sysfs_path == NULL)
+		sysfs_path = "/sys";
+
+	hotplug = calloc(1, sizeof(*hotplug));
+	if (hotplug == NULL)
+		return NULL;
+
+	hotplug->sysfs_path = strdup(sysfs_path);
+	if (hotplug->sysfs_path == NULL) {
+		free(hotplug);
+		return NULL;
+	}
+
+	hotplug->fd = fd;
+	return hotplug;
+}
+
+void i2cd_hotplug_free(struct i2cd_hotplug *hotplug)
+{
+	struct hotplug_watch *watch, *next;
+
+	assert(hotplug != NULL);
+
+	for (watch = hotplug->watches; watch != NULL; watch = next) {
+		next = watch->next;
+		free(watch->name);
+		free(watch);
+	}
+
+	close(hotplug->fd);
+	free(hotplug->sysfs_path);
+	free(hotplug);
+}
+
+int i2cd_hotplug_get_fd(struct i2cd_hotplug *hotplug)
+{
+	assert(hotplug != NULL);
+
+	return hotplug->fd;
+}
+
+int i2cd_hotplug_watch(struct i2cd_hotplug *hotplug, struct i2cd *dev,
+		const char *name)
+{
+	struct hotplug_watch *watch;
+
+	assert(hotplug != NULL);
+	assert(dev != NULL);
+
+	for (watch = hotplug->watches; watch != NULL; watch = watch->next) {
+		if (watch->dev == dev) {
+			errno = EEXIST;
+			return -1;
+		}
+	}
+
+	watch = calloc(1, sizeof(*watch));
+	if (watch == NULL)
+		return -1;
+
+	if (name != NULL) {
+		watch->name = strdup(name);
+		if (watch->name == NULL) {
+			free(watch);
+			return -1;
+		}
+	}
+
+	watch->dev = dev;
+	watch->next = hotplug->watches;
+	hotplug->watches = watch;
+	return 0;
+}
+
+void i2cd_hotplug_unwatch(struct i2cd_hotplug *hotplug, struct i2cd *dev)
+{
+	struct hotplug_watch **p, *watch;
+
+	assert(hotplug != NULL);
+	assert(dev != NULL);
+
+	for (p = &hotplug->watches; *p != NULL; p = &(*p)->next) {
+		watch = *p;
+		if (watch->dev == dev) {
+			*p = watch->next;
+			free(watch->name);
+			free(watch);
+			return;
+		}
+	}
+}
+
+int i2cd_hotplug_process(struct i2cd_hotplug *hotplug)
+{
+	struct sockaddr_nl addr;
+	struct iovec iov;
+	struct msghdr msg;
+	struct hotplug_event event;
+	ssize_t n;
+	int count;
+
+	assert(hotplug != NULL);
+
+	/* Reopens which failed during an earlier call are attempted first */
+	count = hotplug_retry(hotplug);
+
+	for (;;) {
+		iov.iov_base = hotplug->buf;
+		iov.iov_len = sizeof(hotplug->buf) - 1;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &addr;
+		msg.msg_namelen = sizeof(addr);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		n = recvmsg(hotplug->fd, &msg, MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+
+		/* Only accept netlink messages sent by the kernel */
+		if (msg.msg_namelen == sizeof(addr) &&
+		    addr.nl_family == AF_NETLINK && addr.nl_pid != 0)
+			continue;
+
+		hotplug->buf[n] = '\0';
+		if (hotplug_parse(hotplug->buf, n, &event) < 0)
+			continue;
+
+		count += hotplug_handle(hotplug, &event);
+	}
+
+	return count;
+}
+
+int i2cd_hotplug_is_stale(struct i2cd *dev)
+{
+	assert(dev != NULL);
+
+	return !!(__atomic_load_n(&dev->flags, __ATOMIC_ACQUIRE) &
+		  I2CD_F_STALE);
+}
@@ -24,14 +24,98 @@
 #endif
 
 #include <i2cd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <linux/i2c-dev.h>
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(x)	(sizeof(x) / sizeof((x)[0]))
 #endif
 
+/* Longest message accepted by the I2C_RDWR ioctl() request */
+#define I2CD_RDWR_MAX_LEN	8192
+
+#define I2CD_F_RETRIES	0x0001	/**< Retries set using the handle. */
+#define I2CD_F_TIMEOUT	0x0002	/**< Timeout set using the handle. */
+#define I2CD_F_FUNCS	0x0004	/**< Functionality mask is cached. */
+#define I2CD_F_FREQ	0x0008	/**< Bus frequency is cached. */
+#define I2CD_F_BOUND	0x0010	/**< Handle is bound to a slave address. */
+#define I2CD_F_FORCE	0x0020	/**< Binding uses I2C_SLAVE_FORCE. */
+#define I2CD_F_STALE	0x0040	/**< Adapter was removed. */
+
+struct i2cd_flight;
+struct i2cd_prof;
+struct i2cd_util;
+
+/* Paths replaced by reopening a handle, which remain valid until it closes */
+struct i2cd_old_path {
+	struct i2cd_old_path *next;
+	char *path;
+};
+
 struct i2cd {
 	char *path;	/**< Path to an I2C character device. */
 	int fd;		/**< File descriptor of an open I2C character device. */
+	int bind_fd;	/**< File descriptor used by bound transfers, or -1. */
+	pthread_rwlock_t bind_lock;	/**< Held by bound transfers. */
+	pthread_mutex_t lock;	/**< Protects the members below. */
+	unsigned int flags;	/**< Handle state flags. */
+	unsigned int gen;	/**< Incremented each time the handle reopens. */
+	unsigned long retries;	/**< Retries, if I2CD_F_RETRIES is set. */
+	unsigned long timeout;	/**< Timeout, if I2CD_F_TIMEOUT is set. */
+	unsigned long funcs;	/**< Functionality, if I2CD_F_FUNCS is set. */
+	unsigned long freq;	/**< Bus frequency, if I2CD_F_FREQ is set. */
+	uint16_t bound;		/**< Bound address, if I2CD_F_BOUND is set. */
+	struct i2cd_old_path *old_paths;	/**< Paths replaced by path. */
+	struct i2cd_util *util;	/**< Utilization accounting, or NULL. */
+	struct i2cd_prof *prof;	/**< Latency profiling, or NULL. */
+	struct i2cd_flight *flight;	/**< Single-flight reads, or NULL. */
 };
 
+/*
+ * Flags are changed while holding the lock, but I2CD_F_BOUND and I2CD_F_STALE
+ * are tested without it, so every change is made atomically.
+ */
+static inline void i2cd_set_flags(struct i2cd *dev, unsigned int flags)
+{
+	__atomic_or_fetch(&dev->flags, flags, __ATOMIC_RELEASE);
+}
+
+static inline void i2cd_clear_flags(struct i2cd *dev, unsigned int flags)
+{
+	__atomic_and_fetch(&dev->flags, ~flags, __ATOMIC_RELEASE);
+}
+
+/* Handles of removed adapters fail with ENODEV until they are reopened */
+static inline int i2cd_check_stale(struct i2cd *dev)
+{
+	if (__atomic_load_n(&dev->flags, __ATOMIC_ACQUIRE) & I2CD_F_STALE) {
+		errno = ENODEV;
+		return -1;
+	}
+	return 0;
+}
+
+int i2cd_transfer_msgset(struct i2cd *dev,
+		struct i2c_rdwr_ioctl_data *msgset);
+
+uint64_t i2cd_clock_ns(void);
+
+void i2cd_flight_free(struct i2cd_flight *flight);
+
+struct i2cd_util *i2cd_util_ref(struct i2cd_util *util);
+void i2cd_util_unref(struct i2cd_util *util);
+
+int i2cd_prof_admit(struct i2cd *dev,
+		const struct i2c_rdwr_ioctl_data *msgset);
+void i2cd_prof_account(struct i2cd *dev,
+		const struct i2c_rdwr_ioctl_data *msgset, uint64_t ns);
+
+uint64_t i2cd_util_estimate(struct i2cd *dev, const struct i2c_msg msgs[],
+		size_t nmsgs);
+int i2cd_util_admit(struct i2cd *dev,
+		const struct i2c_rdwr_ioctl_data *msgset);
+void i2cd_util_account(struct i2cd *dev,
+		const struct i2c_rdwr_ioctl_data *msgset);
+
 #endif /* I2CD_PRIVATE_H */
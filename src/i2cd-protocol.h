@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef I2CD_PROTOCOL_H
+#define I2CD_PROTOCOL_H
+
+#include <stdint.h>
+#include <linux/i2c-dev.h>
+
+/*
+ * The client and server exchange one request and one response per packet
+ * over a SOCK_SEQPACKET UNIX domain socket. Fields are encoded in host byte
+ * order as both ends are always on the same machine.
+ *
+ * A TRANSFER request is followed by nmsgs message descriptors and the
+ * buffers of all write messages, concatenated in message order. A successful
+ * response is followed by the buffers of all read messages in the same
+ * fashion. If the total length of all buffers exceeds I2CD_PROTO_INLINE_MAX,
+ * buffers are instead passed out-of-band: I2CD_PROTO_F_SHM is set, a shared
+ * memory file descriptor is attached using SCM_RIGHTS, and the buffers of all
+ * messages are laid out consecutively in message order within the shared
+ * mapping. The server then transfers directly into and out of the mapping.
+ * The shared memory must be sealed with F_SEAL_SHRINK, as a mapping which
+ * shrank under the server would raise SIGBUS; requests are otherwise refused.
+ */
+
+#define I2CD_PROTO_INLINE_MAX	4096
+
+#define I2CD_PROTO_PACKET_MAX	(sizeof(struct i2cd_proto_request) + \
+				 sizeof(struct i2cd_proto_msg) * \
+				 I2C_RDWR_IOCTL_MAX_MSGS + \
+				 I2CD_PROTO_INLINE_MAX)
+
+enum {
+	I2CD_PROTO_OPEN = 1,	/**< Attach to adapter; data is a path. */
+	I2CD_PROTO_FUNCS,	/**< Get adapter functionality mask. */
+	I2CD_PROTO_TRANSFER,	/**< Transfer one or more messages. */
+};
+
+#define I2CD_PROTO_F_SHM	0x0001
+
+struct i2cd_proto_request {
+	uint16_t op;		/**< Request operation. */
+	uint16_t flags;		/**< Request flags. */
+	uint16_t nmsgs;		/**< Number of message descriptors. */
+	uint16_t reserved;
+	uint32_t len;		/**< Length of the data area. */
+};
+
+struct i2cd_proto_msg {
+	uint16_t addr;		/**< I2C slave address. */
+	uint16_t flags;		/**< I2C_M_* message flags. */
+	uint16_t len;		/**< Length of message buffer. */
+	uint16_t reserved;
+};
+
+struct i2cd_proto_response {
+	int32_t rc;		/**< Return code of the request. */
+	int32_t error;		/**< Value of errno if rc is negative. */
+	uint32_t len;		/**< Length of the data area. */
+	uint32_t reserved;
+	uint64_t funcs;		/**< Functionality mask for I2CD_PROTO_FUNCS. */
+};
+
+#endif /* I2CD_PROTOCOL_H */
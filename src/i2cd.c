@@ -52,6 +52,9 @@ struct i2cd *i2cd_open(const char *path)
 	if (dev->fd < 0)
 		goto err;
 
+	dev->bind_fd = -1;
+	pthread_rwlock_init(&dev->bind_lock, NULL);
+	pthread_mutex_init(&dev->lock, NULL);
 	return dev;
 err:
 	errsv = errno;
@@ -83,11 +86,78 @@ struct i2cd *i2cd_open_by_number(unsigned int num)
 	return i2cd_open(path);
 }
 
+struct i2cd *i2cd_dup(struct i2cd *dev)
+{
+	struct i2cd *dup;
+	unsigned int bound;
+	uint16_t addr;
+
+	assert(dev != NULL);
+
+	/*
+	 * Retries and timeout are adapter properties; they need not be set.
+	 * The binding is repeated below, which opens another file descriptor.
+	 */
+	pthread_mutex_lock(&dev->lock);
+
+	dup = i2cd_open(dev->path);
+	if (dup == NULL) {
+		pthread_mutex_unlock(&dev->lock);
+		return NULL;
+	}
+
+	bound = dev->flags & (I2CD_F_BOUND | I2CD_F_FORCE);
+	addr = dev->bound;
+	i2cd_set_flags(dup, dev->flags &
+		       ~(I2CD_F_BOUND | I2CD_F_FORCE | I2CD_F_STALE));
+	dup->retries = dev->retries;
+	dup->timeout = dev->timeout;
+	dup->funcs = dev->funcs;
+	dup->freq = dev->freq;
+	if (dev->util != NULL)
+		dup->util = i2cd_util_ref(dev->util);
+	pthread_mutex_unlock(&dev->lock);
+
+	if ((bound & I2CD_F_BOUND) &&
+	    i2cd_bind(dup, addr, (bound & I2CD_F_FORCE) ?
+		      I2CD_BIND_FORCE : 0) < 0) {
+		int errsv = errno;
+
+		i2cd_close(dup);
+		errno = errsv;
+		return NULL;
+	}
+
+	return dup;
+}
+
 void i2cd_close(struct i2cd *dev)
 {
+	struct i2cd_old_path *old;
+
 	assert(dev != NULL);
 
 	close(dev->fd);
+	if (dev->bind_fd >= 0)
+		close(dev->bind_fd);
+	pthread_rwlock_destroy(&dev->bind_lock);
+	pthread_mutex_destroy(&dev->lock);
+
+	if (dev->util != NULL)
+		i2cd_util_unref(dev->util);
+
+	if (dev->prof != NULL)
+		free(dev->prof);
+
+	if (dev->flight != NULL)
+		i2cd_flight_free(dev->flight);
+
+	while (dev->old_paths != NULL) {
+		old = dev->old_paths;
+		dev->old_paths = old->next;
+		free(old->path);
+		free(old);
+	}
 
 	free(dev->path);
 	free(dev);
@@ -97,29 +167,222 @@ const char *i2cd_get_path(struct i2cd *dev)
 {
 	assert(dev != NULL);
 
-	return dev->path;
+	/* The path may be replaced by a reopen; see hotplug_reopen() */
+	return __atomic_load_n(&dev->path, __ATOMIC_ACQUIRE);
+}
+
+int i2cd_fileno(struct i2cd *dev)
+{
+	assert(dev != NULL);
+
+	return dev->fd;
 }
 
 int i2cd_set_retries(struct i2cd *dev, unsigned long retries)
 {
+	int rc;
+
 	assert(dev != NULL);
 
-	return ioctl(dev->fd, I2C_RETRIES, retries);
+	pthread_mutex_lock(&dev->lock);
+	rc = i2cd_check_stale(dev);
+	if (rc == 0)
+		rc = ioctl(dev->fd, I2C_RETRIES, retries);
+	if (rc == 0) {
+		i2cd_set_flags(dev, I2CD_F_RETRIES);
+		dev->retries = retries;
+	}
+	pthread_mutex_unlock(&dev->lock);
+
+	return rc < 0 ? -1 : 0;
 }
 
 int i2cd_set_timeout(struct i2cd *dev, unsigned long timeout)
 {
+	int rc;
+
 	assert(dev != NULL);
 
-	return ioctl(dev->fd, I2C_TIMEOUT, timeout);
+	pthread_mutex_lock(&dev->lock);
+	rc = i2cd_check_stale(dev);
+	if (rc == 0)
+		rc = ioctl(dev->fd, I2C_TIMEOUT, timeout);
+	if (rc == 0) {
+		i2cd_set_flags(dev, I2CD_F_TIMEOUT);
+		dev->timeout = timeout;
+	}
+	pthread_mutex_unlock(&dev->lock);
+
+	return rc < 0 ? -1 : 0;
 }
 
 int i2cd_get_functionality(struct i2cd *dev, unsigned long *funcs)
 {
+	int rc = 0;
+
 	assert(dev != NULL);
 	assert(funcs != NULL);
 
-	return ioctl(dev->fd, I2C_FUNCS, funcs);
+	pthread_mutex_lock(&dev->lock);
+
+	/* Adapter functionality is fixed; only query it once */
+	if (!(dev->flags & I2CD_F_FUNCS)) {
+		rc = ioctl(dev->fd, I2C_FUNCS, &dev->funcs);
+		if (rc == 0)
+			i2cd_set_flags(dev, I2CD_F_FUNCS);
+	}
+	*funcs = dev->funcs;
+
+	pthread_mutex_unlock(&dev->lock);
+
+	return rc < 0 ? -1 : 0;
+}
+
+int i2cd_bind(struct i2cd *dev, uint16_t addr, int flags)
+{
+	unsigned int bound = I2CD_F_BOUND;
+	int rc = -1;
+
+	assert(dev != NULL);
+
+	if (addr > 0x7f) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (flags & I2CD_BIND_FORCE)
+		bound |= I2CD_F_FORCE;
+
+	pthread_mutex_lock(&dev->lock);
+
+	if ((dev->flags & (I2CD_F_BOUND | I2CD_F_FORCE)) == bound &&
+	    dev->bound == addr) {
+		rc = 0;
+		goto out;
+	}
+
+	/*
+	 * Bound transfers use a file descriptor of their own, so that the
+	 * slave address is set once here rather than on each transfer.
+	 */
+	if (dev->bind_fd < 0) {
+		dev->bind_fd = open(dev->path, O_RDWR);
+		if (dev->bind_fd < 0)
+			goto out;
+	}
+
+	/* Bound transfers to the previous address complete first */
+	pthread_rwlock_wrlock(&dev->bind_lock);
+	i2cd_clear_flags(dev, I2CD_F_BOUND | I2CD_F_FORCE);
+
+	rc = ioctl(dev->bind_fd, (bound & I2CD_F_FORCE) ? I2C_SLAVE_FORCE :
+		   I2C_SLAVE, (unsigned long)addr);
+	if (rc == 0) {
+		__atomic_store_n(&dev->bound, addr, __ATOMIC_RELAXED);
+		i2cd_set_flags(dev, bound);
+	}
+	pthread_rwlock_unlock(&dev->bind_lock);
+out:
+	pthread_mutex_unlock(&dev->lock);
+	return rc < 0 ? -1 : 0;
+}
+
+void i2cd_unbind(struct i2cd *dev)
+{
+	assert(dev != NULL);
+
+	/* The file descriptor is kept open until the handle is closed */
+	pthread_mutex_lock(&dev->lock);
+	pthread_rwlock_wrlock(&dev->bind_lock);
+	i2cd_clear_flags(dev, I2CD_F_BOUND | I2CD_F_FORCE);
+	pthread_rwlock_unlock(&dev->bind_lock);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/*
+ * Transfers a single message to the bound address using read(2) or
+ * write(2), falling back to I2C_RDWR if the handle is not bound to the
+ * address of the message. Only the read side of the bind lock is taken, so
+ * bound transfers run concurrently; i2cd_bind() takes the write side before
+ * changing the slave address of the bound file descriptor.
+ */
+static int dev_transfer_bound(struct i2cd *dev, struct i2c_msg *msg)
+{
+	unsigned int flags;
+	ssize_t n;
+
+	if (__atomic_load_n(&dev->util, __ATOMIC_RELAXED) != NULL ||
+	    __atomic_load_n(&dev->prof, __ATOMIC_RELAXED) != NULL)
+		return i2cd_transfer(dev, msg, 1);
+
+	pthread_rwlock_rdlock(&dev->bind_lock);
+
+	flags = __atomic_load_n(&dev->flags, __ATOMIC_ACQUIRE);
+	if (!(flags & I2CD_F_BOUND) || dev->bound != msg->addr) {
+		pthread_rwlock_unlock(&dev->bind_lock);
+		return i2cd_transfer(dev, msg, 1);
+	}
+
+	if (flags & I2CD_F_STALE) {
+		pthread_rwlock_unlock(&dev->bind_lock);
+		errno = ENODEV;
+		return -1;
+	}
+
+	if (msg->flags & I2C_M_RD)
+		n = read(dev->bind_fd, msg->buf, msg->len);
+	else
+		n = write(dev->bind_fd, msg->buf, msg->len);
+
+	pthread_rwlock_unlock(&dev->bind_lock);
+
+	if (n < 0)
+		return -1;
+
+	if ((size_t)n != msg->len) {
+		errno = EIO;
+		return -1;
+	}
+	return 1;
+}
+
+int i2cd_transfer_msgset(struct i2cd *dev,
+		struct i2c_rdwr_ioctl_data *msgset)
+{
+	struct i2cd_util *util;
+	struct i2cd_prof *prof;
+	uint64_t start = 0;
+	int rc, errsv;
+
+	if (i2cd_check_stale(dev) < 0)
+		return -1;
+
+	/* Transfers only take the lock if accounting or profiling is enabled */
+	util = __atomic_load_n(&dev->util, __ATOMIC_ACQUIRE);
+	prof = __atomic_load_n(&dev->prof, __ATOMIC_ACQUIRE);
+	if (util == NULL && prof == NULL)
+		return ioctl(dev->fd, I2C_RDWR, msgset);
+
+	if (prof != NULL && i2cd_prof_admit(dev, msgset) < 0)
+		return -1;
+
+	if (util != NULL && i2cd_util_admit(dev, msgset) < 0)
+		return -1;
+
+	if (prof != NULL)
+		start = i2cd_clock_ns();
+
+	rc = ioctl(dev->fd, I2C_RDWR, msgset);
+	errsv = errno;
+
+	if (prof != NULL)
+		i2cd_prof_account(dev, msgset, i2cd_clock_ns() - start);
+
+	if (util != NULL && rc >= 0)
+		i2cd_util_account(dev, msgset);
+
+	errno = errsv;
+	return rc;
 }
 
 int i2cd_transfer(struct i2cd *dev, struct i2c_msg msgs[], size_t nmsgs)
@@ -130,7 +393,7 @@ int i2cd_transfer(struct i2cd *dev, struct i2c_msg msgs[], size_t nmsgs)
 	assert(msgs != NULL);
 	assert(nmsgs <= I2C_RDWR_IOCTL_MAX_MSGS);
 
-	return ioctl(dev->fd, I2C_RDWR, &msgset);
+	return i2cd_transfer_msgset(dev, &msgset);
 }
 
 int i2cd_read(struct i2cd *dev, uint16_t addr, void *buf, size_t len)
@@ -144,10 +407,11 @@ int i2cd_read(struct i2cd *dev, uint16_t addr, void *buf, size_t len)
 		}
 	};
 
+	assert(dev != NULL);
 	assert(buf != NULL);
 	assert(len <= UINT16_MAX);
 
-	return i2cd_transfer(dev, msgs, ARRAY_SIZE(msgs));
+	return dev_transfer_bound(dev, msgs);
 }
 
 int i2cd_write(struct i2cd *dev, uint16_t addr, const void *buf, size_t len)
@@ -161,10 +425,11 @@ int i2cd_write(struct i2cd *dev, uint16_t addr, const void *buf, size_t len)
 		}
 	};
 
+	assert(dev != NULL);
 	assert(buf != NULL);
 	assert(len <= UINT16_MAX);
 
-	return i2cd_transfer(dev, msgs, ARRAY_SIZE(msgs));
+	return dev_transfer_bound(dev, msgs);
 }
 
 int i2cd_write_read(struct i2cd *dev, uint16_t addr,
@@ -0,0 +1,419 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/i2c.h>
+
+#define NSEC_PER_USEC	1000ULL
+#define NSEC_PER_SEC	1000000000ULL
+
+enum {
+	INIT_PENDING,
+	INIT_DONE,
+	INIT_FAILED,
+};
+
+struct init_seq {
+	struct i2cd_init_seq seq;
+	size_t worker;		/**< Index of the worker running the sequence. */
+	size_t next;		/**< Index of the next step. */
+	uint64_t ready;		/**< Time the next step may start (ns). */
+	int state;
+	int error;		/**< Error of sequence, if failed. */
+};
+
+struct init_worker {
+	struct i2cd_init *init;
+	size_t index;
+	pthread_t thread;
+	bool started;
+};
+
+/*
+ * Sequences are only modified by the worker running them; the lock protects
+ * their state, which is read by workers running dependent sequences. The
+ * condition is signaled each time a sequence completes or fails.
+ */
+struct i2cd_init {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	size_t size;		/**< Maximum number of sequences. */
+	size_t nseqs;		/**< Number of sequences. */
+	size_t words;		/**< Words in each dependency bitmap. */
+	struct init_seq *seqs;
+	uint64_t *deps;		/**< Dependency bitmap of each sequence. */
+};
+
+static bool init_test(const uint64_t bitmap[], size_t index)
+{
+	return (bitmap[index / 64] >> (index % 64)) & 1;
+}
+
+static void init_set(uint64_t bitmap[], size_t index)
+{
+	bitmap[index / 64] |= UINT64_C(1) << (index % 64);
+}
+
+/* Return true if sequence index depends on target, directly or not */
+static bool init_reaches(struct i2cd_init *init, size_t index, size_t target,
+		uint64_t visited[])
+{
+	const uint64_t *deps = &init->deps[index * init->words];
+	size_t i;
+
+	for (i = 0; i < init->nseqs; i++) {
+		if (!init_test(deps, i) || init_test(visited, i))
+			continue;
+
+		if (i == target)
+			return true;
+
+		init_set(visited, i);
+		if (init_reaches(init, i, target, visited))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Return the state of the dependencies of a sequence: INIT_DONE if all have
+ * completed, INIT_FAILED if any failed, otherwise INIT_PENDING.
+ */
+static int init_deps_state(struct i2cd_init *init, size_t index)
+{
+	const uint64_t *deps = &init->deps[index * init->words];
+	int state = INIT_DONE;
+	size_t i;
+
+	for (i = 0; i < init->nseqs; i++) {
+		if (!init_test(deps, i))
+			continue;
+
+		if (init->seqs[i].state == INIT_FAILED)
+			return INIT_FAILED;
+		if (init->seqs[i].state == INIT_PENDING)
+			state = INIT_PENDING;
+	}
+	return state;
+}
+
+static void init_finish(struct i2cd_init *init, struct init_seq *s,
+		int state, int error)
+{
+	s->state = state;
+	s->error = error;
+	pthread_cond_broadcast(&init->cond);
+}
+
+/* Return true if a sequence needs no multiplexer channel to be selected */
+static bool init_selected(const struct init_seq *s, struct i2cd_mux *mux,
+		int channel)
+{
+	return s->seq.mux == NULL ||
+		(s->seq.mux == mux && s->seq.channel == channel);
+}
+
+static int init_step(struct init_seq *s)
+{
+	const struct i2cd_init_step *step = &s->seq.steps[s->next];
+
+	if (step->nmsgs == 0)
+		return 0;
+
+	if (s->seq.mux != NULL)
+		return i2cd_mux_transfer(s->seq.mux, s->seq.channel,
+					 step->msgs, step->nmsgs);
+
+	return i2cd_transfer(s->seq.dev, step->msgs, step->nmsgs);
+}
+
+static void *init_worker_run(void *arg)
+{
+	struct init_worker *worker = arg;
+	struct i2cd_init *init = worker->init;
+	struct i2cd_mux *mux = NULL;
+	struct init_seq *s, *pick;
+	struct timespec ts;
+	uint64_t now, wake;
+	size_t i;
+	bool pending;
+	int channel = I2CD_MUX_NONE, rc, state;
+
+	pthread_mutex_lock(&init->lock);
+
+	for (;;) {
+		now = i2cd_clock_ns();
+		pick = NULL;
+		wake = UINT64_MAX;
+		pending = false;
+
+		for (i = 0; i < init->nseqs; i++) {
+			s = &init->seqs[i];
+			if (s->worker != worker->index ||
+			    s->state != INIT_PENDING)
+				continue;
+
+			state = init_deps_state(init, i);
+			if (state == INIT_FAILED) {
+				init_finish(init, s, INIT_FAILED, ECANCELED);
+				continue;
+			}
+
+			/* The delay of the final step has elapsed */
+			if (state == INIT_DONE && s->next == s->seq.nsteps &&
+			    s->ready <= now) {
+				init_finish(init, s, INIT_DONE, 0);
+				continue;
+			}
+
+			pending = true;
+			if (state == INIT_PENDING)
+				continue;
+
+			if (s->ready > now) {
+				if (s->ready < wake)
+					wake = s->ready;
+				continue;
+			}
+
+			/* Prefer the selected multiplexer channel */
+			if (pick == NULL ||
+			    (!init_selected(pick, mux, channel) &&
+			     init_selected(s, mux, channel)))
+				pick = s;
+		}
+
+		if (!pending)
+			break;
+
+		if (pick != NULL) {
+			pthread_mutex_unlock(&init->lock);
+			rc = init_step(pick);
+			pthread_mutex_lock(&init->lock);
+
+			if (rc < 0) {
+				init_finish(init, pick, INIT_FAILED, errno);
+				continue;
+			}
+
+			if (pick->seq.mux != NULL) {
+				mux = pick->seq.mux;
+				channel = pick->seq.channel;
+			}
+
+			pick->ready = i2cd_clock_ns() +
+				pick->seq.steps[pick->next].delay_us *
+				NSEC_PER_USEC;
+			pick->next++;
+			continue;
+		}
+
+		if (wake == UINT64_MAX) {
+			pthread_cond_wait(&init->cond, &init->lock);
+		} else {
+			ts.tv_sec = wake / NSEC_PER_SEC;
+			ts.tv_nsec = wake % NSEC_PER_SEC;
+			pthread_cond_timedwait(&init->cond, &init->lock, &ts);
+		}
+	}
+
+	pthread_mutex_unlock(&init->lock);
+	return NULL;
+}
+
+struct i2cd_init *i2cd_init_new(size_t size)
+{
+	struct i2cd_init *init;
+	pthread_condattr_t attr;
+	size_t words;
+	uint8_t *p;
+
+	if (size == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Sequences and dependency bitmaps share a single allocation */
+	words = (size + 63) / 64;
+	init = calloc(1, sizeof(*init) + size * sizeof(*init->seqs) +
+		      size * words * sizeof(*init->deps));
+	if (init == NULL)
+		return NULL;
+
+	init->size = size;
+	init->words = words;
+
+	p = (uint8_t *)(init + 1);
+	init->seqs = (struct init_seq *)p;
+	p += size * sizeof(*init->seqs);
+	init->deps = (uint64_t *)p;
+
+	/* Delays are measured using the monotonic clock */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&init->lock, NULL);
+	pthread_cond_init(&init->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	return init;
+}
+
+void i2cd_init_free(struct i2cd_init *init)
+{
+	assert(init != NULL);
+
+	pthread_cond_destroy(&init->cond);
+	pthread_mutex_destroy(&init->lock);
+	free(init);
+}
+
+int i2cd_init_add(struct i2cd_init *init, const struct i2cd_init_seq *seq)
+{
+	assert(init != NULL);
+	assert(seq != NULL);
+	assert(seq->dev != NULL);
+	assert(seq->steps != NULL || seq->nsteps == 0);
+
+	if (init->nseqs == init->size) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	init->seqs[init->nseqs].seq = *seq;
+	return init->nseqs++;
+}
+
+int i2cd_init_depend(struct i2cd_init *init, size_t index, size_t after)
+{
+	uint64_t *visited;
+	bool cycle;
+
+	assert(init != NULL);
+
+	if (index >= init->nseqs || after >= init->nseqs) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	visited = calloc(init->words, sizeof(*visited));
+	if (visited == NULL)
+		return -1;
+
+	cycle = index == after || init_reaches(init, after, index, visited);
+	free(visited);
+
+	if (cycle) {
+		errno = EDEADLK;
+		return -1;
+	}
+
+	init_set(&init->deps[index * init->words], after);
+	return 0;
+}
+
+int i2cd_init_run(struct i2cd_init *init, uint64_t status[])
+{
+	struct init_worker *workers;
+	size_t i, j, nworkers = 0;
+	int count = 0, error = 0;
+
+	assert(init != NULL);
+
+	workers = calloc(init->nseqs + 1, sizeof(*workers));
+	if (workers == NULL)
+		return -1;
+
+	/* Each distinct handle is run by its own worker */
+	for (i = 0; i < init->nseqs; i++) {
+		struct init_seq *s = &init->seqs[i];
+
+		for (j = 0; j < i; j++) {
+			if (init->seqs[j].seq.dev == s->seq.dev)
+				break;
+		}
+		s->worker = j < i ? init->seqs[j].worker : nworkers++;
+		s->next = 0;
+		s->ready = 0;
+		s->state = INIT_PENDING;
+		s->error = 0;
+	}
+
+	for (i = 0; i < nworkers || i == 0; i++) {
+		workers[i].init = init;
+		workers[i].index = i;
+	}
+
+	/*
+	 * The first worker is run by the calling thread. Sequences of workers
+	 * which cannot be started are reassigned to it, which remains correct
+	 * but loses concurrency.
+	 */
+	pthread_mutex_lock(&init->lock);
+	for (i = 1; i < nworkers; i++) {
+		workers[i].started = pthread_create(&workers[i].thread, NULL,
+						    init_worker_run,
+						    &workers[i]) == 0;
+		if (workers[i].started)
+			continue;
+
+		for (j = 0; j < init->nseqs; j++) {
+			if (init->seqs[j].worker == i)
+				init->seqs[j].worker = 0;
+		}
+	}
+	pthread_mutex_unlock(&init->lock);
+
+	init_worker_run(&workers[0]);
+
+	for (i = 1; i < nworkers; i++) {
+		if (workers[i].started)
+			pthread_join(workers[i].thread, NULL);
+	}
+
+	free(workers);
+
+	if (status != NULL)
+		memset(status, 0, I2CD_FANOUT_WORDS(init->nseqs) *
+		       sizeof(*status));
+
+	for (i = 0; i < init->nseqs; i++) {
+		if (init->seqs[i].state == INIT_DONE) {
+			if (status != NULL)
+				init_set(status, i);
+			count++;
+		} else if (error == 0 ||
+			   (error == ECANCELED &&
+			    init->seqs[i].error != ECANCELED)) {
+			error = init->seqs[i].error;
+		}
+	}
+
+	if (count < (int)init->nseqs)
+		errno = error;
+
+	return count;
+}
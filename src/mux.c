@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <linux/i2c.h>
+
+#define MUX_UNKNOWN	(-2)
+
+/* Multiplexers select a channel by setting an enable bit and index */
+#define MUX_ENABLE	0x04
+
+struct mux_desc {
+	unsigned int nchannels;
+	bool is_switch;		/* Channels are selected by bitmask */
+};
+
+static const struct mux_desc mux_descs[] = {
+	[I2CD_MUX_PCA9540] = {2, false},
+	[I2CD_MUX_PCA9542] = {2, false},
+	[I2CD_MUX_PCA9543] = {2, true},
+	[I2CD_MUX_PCA9544] = {4, false},
+	[I2CD_MUX_PCA9545] = {4, true},
+	[I2CD_MUX_PCA9546] = {4, true},
+	[I2CD_MUX_PCA9548] = {8, true},
+};
+
+struct i2cd_mux {
+	struct i2cd *dev;
+	uint16_t addr;			/**< I2C slave address. */
+	const struct mux_desc *desc;
+	pthread_mutex_t lock;		/**< Protects the selected channel. */
+	int channel;			/**< Selected channel, if known. */
+	unsigned int gen;		/**< Reopen generation of channel. */
+};
+
+struct i2cd_mux *i2cd_mux_new(struct i2cd *dev, uint16_t addr,
+		enum i2cd_mux_type type)
+{
+	struct i2cd_mux *mux;
+
+	assert(dev != NULL);
+
+	if ((size_t)type >= ARRAY_SIZE(mux_descs)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	mux = calloc(1, sizeof(*mux));
+	if (mux == NULL)
+		return NULL;
+
+	mux->dev = dev;
+	mux->addr = addr;
+	mux->desc = &mux_descs[type];
+	mux->channel = MUX_UNKNOWN;
+	mux->gen = __atomic_load_n(&dev->gen, __ATOMIC_ACQUIRE);
+	pthread_mutex_init(&mux->lock, NULL);
+
+	return mux;
+}
+
+void i2cd_mux_free(struct i2cd_mux *mux)
+{
+	assert(mux != NULL);
+
+	pthread_mutex_destroy(&mux->lock);
+	free(mux);
+}
+
+unsigned int i2cd_mux_get_num_channels(struct i2cd_mux *mux)
+{
+	assert(mux != NULL);
+
+	return mux->desc->nchannels;
+}
+
+/* Requires lock; the multiplexer may have been reset if the handle reopened */
+static int mux_channel(struct i2cd_mux *mux)
+{
+	unsigned int gen = __atomic_load_n(&mux->dev->gen, __ATOMIC_ACQUIRE);
+
+	if (gen != mux->gen) {
+		mux->channel = MUX_UNKNOWN;
+		mux->gen = gen;
+	}
+	return mux->channel;
+}
+
+static int mux_select(struct i2cd_mux *mux, int channel)
+{
+	uint8_t ctrl = 0;
+
+	if ((unsigned int)channel >= mux->desc->nchannels &&
+	    channel != I2CD_MUX_NONE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (channel == mux_channel(mux))
+		return 0;
+
+	if (channel != I2CD_MUX_NONE)
+		ctrl = mux->desc->is_switch ? 1 << channel :
+					      MUX_ENABLE | channel;
+
+	/*
+	 * Channel selection takes effect on a STOP condition, so the control
+	 * register is written in a transfer of its own.
+	 */
+	if (i2cd_write(mux->dev, mux->addr, &ctrl, sizeof(ctrl)) < 0) {
+		mux->channel = MUX_UNKNOWN;
+		return -1;
+	}
+
+	mux->channel = channel;
+	return 0;
+}
+
+int i2cd_mux_select(struct i2cd_mux *mux, int channel)
+{
+	int rc;
+
+	assert(mux != NULL);
+	assert(channel >= I2CD_MUX_NONE);
+
+	pthread_mutex_lock(&mux->lock);
+	rc = mux_select(mux, channel);
+	pthread_mutex_unlock(&mux->lock);
+
+	return rc;
+}
+
+void i2cd_mux_invalidate(struct i2cd_mux *mux)
+{
+	assert(mux != NULL);
+
+	pthread_mutex_lock(&mux->lock);
+	mux->channel = MUX_UNKNOWN;
+	pthread_mutex_unlock(&mux->lock);
+}
+
+static int mux_transfer(struct i2cd_mux *mux, int channel,
+		struct i2c_msg msgs[], size_t nmsgs)
+{
+	if (mux_select(mux, channel) < 0)
+		return -1;
+
+	return i2cd_transfer(mux->dev, msgs, nmsgs);
+}
+
+int i2cd_mux_transfer(struct i2cd_mux *mux, int channel,
+		struct i2c_msg msgs[], size_t nmsgs)
+{
+	int rc;
+
+	assert(mux != NULL);
+	assert(channel >= I2CD_MUX_NONE);
+
+	/* The channel must remain selected for the duration of the transfer */
+	pthread_mutex_lock(&mux->lock);
+	rc = mux_transfer(mux, channel, msgs, nmsgs);
+	pthread_mutex_unlock(&mux->lock);
+
+	return rc;
+}
+
+static void mux_run(struct i2cd_mux *mux, struct i2cd_mux_op ops[],
+		size_t nops, int channel)
+{
+	size_t i;
+
+	for (i = 0; i < nops; i++) {
+		if (ops[i].channel != channel)
+			continue;
+
+		ops[i].rc = mux_transfer(mux, channel, ops[i].msgs,
+					 ops[i].nmsgs);
+		ops[i].error = ops[i].rc < 0 ? errno : 0;
+	}
+}
+
+int i2cd_mux_transfer_batch(struct i2cd_mux *mux, struct i2cd_mux_op ops[],
+		size_t nops)
+{
+	int channel, first;
+	size_t i;
+
+	assert(mux != NULL);
+	assert(ops != NULL);
+
+	pthread_mutex_lock(&mux->lock);
+
+	first = mux_channel(mux);
+
+	/* Transfer operations on the selected channel before switching */
+	if (first >= 0)
+		mux_run(mux, ops, nops, first);
+
+	for (channel = 0; channel < (int)mux->desc->nchannels; channel++) {
+		if (channel != first)
+			mux_run(mux, ops, nops, channel);
+	}
+
+	pthread_mutex_unlock(&mux->lock);
+
+	for (i = 0; i < nops; i++) {
+		if (ops[i].channel < 0 ||
+		    ops[i].channel >= (int)mux->desc->nchannels) {
+			ops[i].rc = -1;
+			ops[i].error = EINVAL;
+		}
+	}
+
+	for (i = 0; i < nops; i++) {
+		if (ops[i].rc < 0) {
+			errno = ops[i].error;
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,339 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define NSEC_PER_USEC	1000ULL
+#define NSEC_PER_MSEC	1000000ULL
+
+/* 10-bit addresses are distinguished from 7-bit addresses in the key */
+#define PROF_KEY(addr, flags) \
+	((uint16_t)((addr) | (((flags) & I2C_M_TEN) ? 0x8000 : 0)))
+
+struct prof_target {
+	bool used;		/**< Entry is in use. */
+	uint16_t key;		/**< Address and 10-bit flag. */
+	uint64_t next;		/**< Earliest throttled transfer (ns). */
+	struct i2cd_prof_stats stats;
+};
+
+/*
+ * Targets are kept in an open-addressed table; entries are never removed,
+ * so a lookup stops at the first unused entry.
+ */
+struct i2cd_prof {
+	struct i2cd_prof_attr attr;
+	struct prof_target targets[I2CD_PROF_TARGETS];
+};
+
+static struct prof_target *prof_lookup(struct i2cd_prof *prof, uint16_t addr,
+		int flags, bool insert)
+{
+	uint16_t key = PROF_KEY(addr, flags);
+	struct prof_target *target;
+	size_t i, n;
+
+	i = (key ^ key >> 7) % I2CD_PROF_TARGETS;
+	for (n = 0; n < I2CD_PROF_TARGETS; n++) {
+		target = &prof->targets[(i + n) % I2CD_PROF_TARGETS];
+		if (target->used && target->key == key)
+			return target;
+
+		if (!target->used) {
+			if (!insert)
+				return NULL;
+
+			target->used = true;
+			target->key = key;
+			target->stats.addr = addr;
+			target->stats.flags = flags & I2C_M_TEN;
+			return target;
+		}
+	}
+	return NULL;
+}
+
+static bool prof_seen(const struct i2c_msg msgs[], size_t i)
+{
+	size_t j;
+
+	for (j = 0; j < i; j++)
+		if (PROF_KEY(msgs[j].addr, msgs[j].flags) ==
+		    PROF_KEY(msgs[i].addr, msgs[i].flags))
+			return true;
+	return false;
+}
+
+static size_t prof_bucket(uint64_t ns)
+{
+	uint64_t us = ns / NSEC_PER_USEC;
+	size_t bucket = 0;
+
+	while (us != 0 && bucket < I2CD_PROF_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+/* Returns true if the state of the target changed */
+static bool prof_update(const struct i2cd_prof_attr *attr,
+		struct i2cd_prof_stats *stats, uint64_t ns, double ratio)
+{
+	if (stats->count++ == 0) {
+		stats->ewma_ns = ns;
+		stats->ewma_ratio = ratio;
+	} else {
+		stats->ewma_ns += attr->alpha * ((double)ns - stats->ewma_ns);
+		stats->ewma_ratio += attr->alpha * (ratio - stats->ewma_ratio);
+	}
+
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+
+	if (ratio > attr->outlier_ratio)
+		stats->outliers++;
+
+	stats->hist[prof_bucket(ns)]++;
+
+	/* Hysteresis keeps a marginal target from flapping */
+	if (stats->state == I2CD_PROF_OK && stats->count >= attr->min_count &&
+	    stats->ewma_ratio > attr->degraded_ratio) {
+		stats->state = I2CD_PROF_DEGRADED;
+		return true;
+	}
+	if (stats->state == I2CD_PROF_DEGRADED &&
+	    stats->ewma_ratio < attr->degraded_ratio / 2) {
+		stats->state = I2CD_PROF_OK;
+		return true;
+	}
+	return false;
+}
+
+void i2cd_prof_attr_init(struct i2cd_prof_attr *attr)
+{
+	assert(attr != NULL);
+
+	memset(attr, 0, sizeof(*attr));
+	attr->alpha = 0.125;
+	attr->outlier_ratio = 4;
+	attr->degraded_ratio = 2;
+	attr->min_count = 8;
+	attr->policy = I2CD_PROF_NOTIFY;
+	attr->throttle_ms = 100;
+}
+
+int i2cd_prof_enable(struct i2cd *dev, const struct i2cd_prof_attr *attr)
+{
+	struct i2cd_prof_attr defaults;
+	struct i2cd_prof *prof;
+
+	assert(dev != NULL);
+
+	if (attr == NULL) {
+		i2cd_prof_attr_init(&defaults);
+		attr = &defaults;
+	}
+
+	if (!(attr->alpha > 0 && attr->alpha <= 1) ||
+	    !(attr->outlier_ratio > 0) || !(attr->degraded_ratio > 0) ||
+	    (attr->policy != I2CD_PROF_NOTIFY &&
+	     attr->policy != I2CD_PROF_THROTTLE &&
+	     attr->policy != I2CD_PROF_ISOLATE)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->lock);
+
+	prof = dev->prof;
+	if (prof == NULL) {
+		prof = calloc(1, sizeof(*prof));
+		if (prof == NULL) {
+			pthread_mutex_unlock(&dev->lock);
+			return -1;
+		}
+	}
+
+	memset(prof, 0, sizeof(*prof));
+	prof->attr = *attr;
+
+	/* Transfers check for profiling without taking the lock */
+	__atomic_store_n(&dev->prof, prof, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+}
+
+int i2cd_prof_get(struct i2cd *dev, uint16_t addr, int flags,
+		struct i2cd_prof_stats *stats)
+{
+	struct prof_target *target;
+	int rc = 0;
+
+	assert(dev != NULL);
+	assert(stats != NULL);
+
+	pthread_mutex_lock(&dev->lock);
+
+	if (dev->prof == NULL) {
+		errno = EINVAL;
+		rc = -1;
+	} else {
+		target = prof_lookup(dev->prof, addr, flags, false);
+		if (target == NULL || target->stats.count == 0) {
+			errno = ENOENT;
+			rc = -1;
+		} else {
+			*stats = target->stats;
+		}
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+	return rc;
+}
+
+int i2cd_prof_reset(struct i2cd *dev, uint16_t addr, int flags)
+{
+	struct prof_target *target;
+	int rc = 0;
+
+	assert(dev != NULL);
+
+	pthread_mutex_lock(&dev->lock);
+
+	if (dev->prof == NULL) {
+		errno = EINVAL;
+		rc = -1;
+	} else {
+		target = prof_lookup(dev->prof, addr, flags, false);
+		if (target != NULL) {
+			memset(&target->stats, 0, sizeof(target->stats));
+			target->stats.addr = addr;
+			target->stats.flags = flags & I2C_M_TEN;
+			target->next = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+	return rc;
+}
+
+int i2cd_prof_admit(struct i2cd *dev,
+		const struct i2c_rdwr_ioctl_data *msgset)
+{
+	struct i2cd_prof *prof = dev->prof;
+	struct prof_target *target;
+	uint64_t now = 0;
+	size_t i;
+
+	pthread_mutex_lock(&dev->lock);
+
+	for (i = 0; i < msgset->nmsgs; i++) {
+		const struct i2c_msg *msg = &msgset->msgs[i];
+
+		target = prof_lookup(prof, msg->addr, msg->flags, false);
+		if (target == NULL || target->stats.state == I2CD_PROF_OK)
+			continue;
+
+		if (prof->attr.policy == I2CD_PROF_ISOLATE) {
+			pthread_mutex_unlock(&dev->lock);
+			errno = EHOSTDOWN;
+			return -1;
+		}
+
+		if (prof->attr.policy == I2CD_PROF_THROTTLE) {
+			if (now == 0)
+				now = i2cd_clock_ns();
+
+			if (now < target->next) {
+				pthread_mutex_unlock(&dev->lock);
+				errno = EAGAIN;
+				return -1;
+			}
+		}
+	}
+
+	/* Throttled targets are only charged once the transfer is admitted */
+	if (now != 0) {
+		for (i = 0; i < msgset->nmsgs; i++) {
+			const struct i2c_msg *msg = &msgset->msgs[i];
+
+			target = prof_lookup(prof, msg->addr, msg->flags, false);
+			if (target != NULL &&
+			    target->stats.state == I2CD_PROF_DEGRADED)
+				target->next = now +
+					prof->attr.throttle_ms * NSEC_PER_MSEC;
+		}
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+}
+
+void i2cd_prof_account(struct i2cd *dev,
+		const struct i2c_rdwr_ioctl_data *msgset, uint64_t ns)
+{
+	struct i2cd_prof *prof = dev->prof;
+	struct i2cd_prof_stats changed[I2C_RDWR_IOCTL_MAX_MSGS];
+	struct prof_target *target;
+	i2cd_prof_callback callback;
+	void *arg;
+	size_t i, nchanged = 0;
+	uint64_t expected;
+	double ratio;
+
+	pthread_mutex_lock(&dev->lock);
+
+	expected = i2cd_util_estimate(dev, msgset->msgs, msgset->nmsgs);
+	ratio = expected != 0 ? (double)ns / expected : 0;
+
+	/* Latency is attributed to each address taking part in the transfer */
+	for (i = 0; i < msgset->nmsgs && i < I2C_RDWR_IOCTL_MAX_MSGS; i++) {
+		const struct i2c_msg *msg = &msgset->msgs[i];
+
+		if (prof_seen(msgset->msgs, i))
+			continue;
+
+		target = prof_lookup(prof, msg->addr, msg->flags, true);
+		if (target == NULL)
+			continue;
+
+		if (prof_update(&prof->attr, &target->stats, ns, ratio))
+			changed[nchanged++] = target->stats;
+	}
+
+	callback = prof->attr.callback;
+	arg = prof->attr.arg;
+
+	pthread_mutex_unlock(&dev->lock);
+
+	/* Callbacks are invoked without the lock so they may use the handle */
+	if (callback != NULL)
+		for (i = 0; i < nchanged; i++)
+			callback(dev, &changed[i], arg);
+}
@@ -0,0 +1,313 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define RT_NSLOTS	4
+#define RT_BUF_SIZE	4096
+
+#define RT_STACK_SIZE	(128 * 1024)
+#define RT_STACK_TOUCH	(32 * 1024)	/* Stack pre-faulted by worker */
+
+enum {
+	SLOT_FREE,
+	SLOT_FILLING,	/* Reserved by a caller */
+	SLOT_PENDING,	/* Waiting for the worker */
+	SLOT_DONE,	/* Waiting for the caller */
+};
+
+struct rt_slot {
+	int state;
+	size_t nmsgs;
+	int rc;
+	int error;
+	uint8_t *data;
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+};
+
+struct i2cd_rt {
+	struct i2cd *dev;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t submit_cond;	/**< Signaled when a slot is pending. */
+	pthread_cond_t done_cond;	/**< Signaled when a slot changes. */
+	size_t nslots;
+	size_t buf_size;
+	size_t head;			/**< Next slot for the worker. */
+	size_t tail;			/**< Next slot for a caller. */
+	bool stop;
+	struct rt_slot slots[];
+};
+
+/* Touch each page so that no faults occur once transfers start */
+static void rt_prefault(void *p, size_t len)
+{
+	volatile uint8_t *q = p;
+	size_t page = sysconf(_SC_PAGESIZE), i;
+
+	for (i = 0; i < len; i += page)
+		q[i] = 0;
+	if (len > 0)
+		q[len - 1] = 0;
+}
+
+static void *rt_worker(void *arg)
+{
+	struct i2cd_rt *rt = arg;
+	struct rt_slot *slot;
+	uint8_t stack[RT_STACK_TOUCH];
+
+	rt_prefault(stack, sizeof(stack));
+
+	pthread_mutex_lock(&rt->lock);
+	for (;;) {
+		slot = &rt->slots[rt->head];
+
+		while (slot->state != SLOT_PENDING && !rt->stop)
+			pthread_cond_wait(&rt->submit_cond, &rt->lock);
+
+		if (slot->state != SLOT_PENDING)
+			break;
+
+		pthread_mutex_unlock(&rt->lock);
+
+		slot->rc = i2cd_transfer(rt->dev, slot->msgs, slot->nmsgs);
+		slot->error = slot->rc < 0 ? errno : 0;
+
+		pthread_mutex_lock(&rt->lock);
+		slot->state = SLOT_DONE;
+		rt->head = (rt->head + 1) % rt->nslots;
+		pthread_cond_broadcast(&rt->done_cond);
+	}
+	pthread_mutex_unlock(&rt->lock);
+
+	return NULL;
+}
+
+void i2cd_rt_attr_init(struct i2cd_rt_attr *attr)
+{
+	assert(attr != NULL);
+
+	attr->priority = 0;
+	attr->cpu = -1;
+	attr->flags = 0;
+	attr->nslots = RT_NSLOTS;
+	attr->buf_size = RT_BUF_SIZE;
+}
+
+struct i2cd_rt *i2cd_rt_new(struct i2cd *dev, const struct i2cd_rt_attr *attr)
+{
+	struct i2cd_rt_attr defaults;
+	struct i2cd_rt *rt;
+	pthread_mutexattr_t lock_attr;
+	pthread_attr_t thread_attr;
+	size_t i, size;
+	uint8_t *data;
+	int rc;
+
+	assert(dev != NULL);
+
+	if (attr == NULL) {
+		i2cd_rt_attr_init(&defaults);
+		attr = &defaults;
+	}
+
+	if (attr->nslots == 0 || attr->priority < 0 ||
+	    attr->cpu >= CPU_SETSIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((attr->flags & I2CD_RT_MLOCK) &&
+	    mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		return NULL;
+
+	/* Slots and their buffers share a single allocation */
+	size = sizeof(*rt) + attr->nslots * (sizeof(*rt->slots) +
+					     attr->buf_size);
+	rt = calloc(1, size);
+	if (rt == NULL)
+		return NULL;
+
+	rt_prefault(rt, size);
+
+	rt->dev = dev;
+	rt->nslots = attr->nslots;
+	rt->buf_size = attr->buf_size;
+
+	data = (uint8_t *)&rt->slots[rt->nslots];
+	for (i = 0; i < rt->nslots; i++)
+		rt->slots[i].data = data + i * rt->buf_size;
+
+	/* Callers contend with the worker; boost it rather than invert */
+	pthread_mutexattr_init(&lock_attr);
+	rc = pthread_mutexattr_setprotocol(&lock_attr, PTHREAD_PRIO_INHERIT);
+	if (rc == 0)
+		rc = pthread_mutex_init(&rt->lock, &lock_attr);
+	pthread_mutexattr_destroy(&lock_attr);
+
+	if (rc != 0) {
+		free(rt);
+
+		errno = rc;
+		return NULL;
+	}
+
+	pthread_cond_init(&rt->submit_cond, NULL);
+	pthread_cond_init(&rt->done_cond, NULL);
+
+	pthread_attr_init(&thread_attr);
+	rc = pthread_attr_setstacksize(&thread_attr, RT_STACK_SIZE);
+
+	if (rc == 0 && attr->priority > 0) {
+		struct sched_param param = {
+			.sched_priority = attr->priority
+		};
+
+		rc = pthread_attr_setinheritsched(&thread_attr,
+						  PTHREAD_EXPLICIT_SCHED);
+		if (rc == 0)
+			rc = pthread_attr_setschedpolicy(&thread_attr,
+							 SCHED_FIFO);
+		if (rc == 0)
+			rc = pthread_attr_setschedparam(&thread_attr, &param);
+	}
+
+	if (rc == 0 && attr->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(attr->cpu, &cpus);
+		rc = pthread_attr_setaffinity_np(&thread_attr, sizeof(cpus),
+						 &cpus);
+	}
+
+	if (rc == 0)
+		rc = pthread_create(&rt->thread, &thread_attr, rt_worker, rt);
+	pthread_attr_destroy(&thread_attr);
+
+	if (rc != 0) {
+		pthread_cond_destroy(&rt->done_cond);
+		pthread_cond_destroy(&rt->submit_cond);
+		pthread_mutex_destroy(&rt->lock);
+		free(rt);
+
+		errno = rc;
+		return NULL;
+	}
+
+	return rt;
+}
+
+void i2cd_rt_free(struct i2cd_rt *rt)
+{
+	assert(rt != NULL);
+
+	pthread_mutex_lock(&rt->lock);
+	rt->stop = true;
+	pthread_cond_signal(&rt->submit_cond);
+	pthread_mutex_unlock(&rt->lock);
+
+	pthread_join(rt->thread, NULL);
+
+	pthread_cond_destroy(&rt->done_cond);
+	pthread_cond_destroy(&rt->submit_cond);
+	pthread_mutex_destroy(&rt->lock);
+	free(rt);
+}
+
+int i2cd_rt_transfer(struct i2cd_rt *rt, struct i2c_msg msgs[], size_t nmsgs)
+{
+	struct rt_slot *slot;
+	size_t i, len = 0;
+	int rc, error;
+
+	assert(rt != NULL);
+	assert(msgs != NULL);
+	assert(nmsgs <= I2C_RDWR_IOCTL_MAX_MSGS);
+
+	for (i = 0; i < nmsgs; i++)
+		len += msgs[i].len;
+
+	if (len > rt->buf_size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	/* Slots are reserved in order, which is the order they are issued */
+	pthread_mutex_lock(&rt->lock);
+	slot = &rt->slots[rt->tail];
+	while (slot->state != SLOT_FREE) {
+		pthread_cond_wait(&rt->done_cond, &rt->lock);
+		slot = &rt->slots[rt->tail];
+	}
+	slot->state = SLOT_FILLING;
+	rt->tail = (rt->tail + 1) % rt->nslots;
+	pthread_mutex_unlock(&rt->lock);
+
+	len = 0;
+	for (i = 0; i < nmsgs; i++) {
+		slot->msgs[i] = msgs[i];
+		slot->msgs[i].buf = slot->data + len;
+
+		if (!(msgs[i].flags & I2C_M_RD))
+			memcpy(slot->msgs[i].buf, msgs[i].buf, msgs[i].len);
+		len += msgs[i].len;
+	}
+	slot->nmsgs = nmsgs;
+
+	pthread_mutex_lock(&rt->lock);
+	slot->state = SLOT_PENDING;
+	pthread_cond_signal(&rt->submit_cond);
+
+	while (slot->state != SLOT_DONE)
+		pthread_cond_wait(&rt->done_cond, &rt->lock);
+	pthread_mutex_unlock(&rt->lock);
+
+	rc = slot->rc;
+	error = slot->error;
+	if (rc >= 0) {
+		for (i = 0; i < nmsgs; i++) {
+			if (msgs[i].flags & I2C_M_RD)
+				memcpy(msgs[i].buf, slot->msgs[i].buf,
+				       msgs[i].len);
+		}
+	}
+
+	pthread_mutex_lock(&rt->lock);
+	slot->state = SLOT_FREE;
+	pthread_cond_broadcast(&rt->done_cond);
+	pthread_mutex_unlock(&rt->lock);
+
+	if (rc < 0)
+		errno = error;
+	return rc;
+}
@@ -0,0 +1,313 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define SCAN_MODE_MASK	0xff
+
+#define SCAN_TIMEOUT	1	/* 10ms */
+
+#define SCAN_RESTORE	(I2CD_F_RETRIES | I2CD_F_TIMEOUT)
+
+enum {
+	PROBE_NONE,
+	PROBE_WRITE,		/* Zero-length I2C write */
+	PROBE_READ,		/* One-byte I2C read */
+	PROBE_QUICK,		/* SMBus quick write */
+	PROBE_READ_BYTE,	/* SMBus receive byte */
+};
+
+struct scan_job {
+	struct i2cd *dev;
+	uint16_t first;
+	uint16_t last;
+	int flags;
+	uint64_t *bitmap;
+	pthread_t thread;
+	bool started;
+	int rc;
+	int error;
+};
+
+static bool scan_unsafe(uint16_t addr)
+{
+	/* Writes may corrupt EEPROMs and similar devices; see i2cdetect(8) */
+	return (addr >= 0x30 && addr <= 0x37) || (addr >= 0x50 && addr <= 0x5f);
+}
+
+static int scan_select(unsigned long funcs, int mode, uint16_t addr)
+{
+	switch (mode) {
+	case I2CD_SCAN_AUTO:
+		if (scan_unsafe(addr))
+			return scan_select(funcs, I2CD_SCAN_READ, addr);
+
+		if (funcs & I2C_FUNC_I2C)
+			return PROBE_WRITE;
+		if (funcs & I2C_FUNC_SMBUS_QUICK)
+			return PROBE_QUICK;
+		return scan_select(funcs, I2CD_SCAN_READ, addr);
+
+	case I2CD_SCAN_QUICK:
+		if (funcs & I2C_FUNC_SMBUS_QUICK)
+			return PROBE_QUICK;
+		break;
+
+	case I2CD_SCAN_WRITE:
+		if (funcs & I2C_FUNC_I2C)
+			return PROBE_WRITE;
+		break;
+
+	case I2CD_SCAN_READ:
+		if (funcs & I2C_FUNC_I2C)
+			return PROBE_READ;
+		if (funcs & I2C_FUNC_SMBUS_READ_BYTE)
+			return PROBE_READ_BYTE;
+		break;
+	}
+	return PROBE_NONE;
+}
+
+/*
+ * Probes are made while holding the lock, so they are issued directly rather
+ * than using i2cd_transfer(). Bound transfers use their own file descriptor,
+ * so setting the slave address below does not affect them; see i2cd_bind().
+ */
+static int scan_rdwr(struct i2cd *dev, uint16_t addr, uint16_t flags,
+		uint8_t *buf, uint16_t len)
+{
+	struct i2c_msg msg = {
+		.addr	= addr,
+		.flags	= flags,
+		.len	= len,
+		.buf	= buf
+	};
+	struct i2c_rdwr_ioctl_data msgset = {&msg, 1};
+
+	return ioctl(dev->fd, I2C_RDWR, &msgset);
+}
+
+static int scan_smbus(struct i2cd *dev, uint16_t addr, char read_write,
+		int size)
+{
+	union i2c_smbus_data data;
+	struct i2c_smbus_ioctl_data args = {
+		.read_write	= read_write,
+		.command	= 0,
+		.size		= size,
+		.data		= &data
+	};
+
+	if (ioctl(dev->fd, I2C_SLAVE, (unsigned long)addr) < 0) {
+		/* Address is in use by a kernel driver */
+		return errno == EBUSY ? 0 : -1;
+	}
+	return ioctl(dev->fd, I2C_SMBUS, &args);
+}
+
+static int scan_probe(struct i2cd *dev, uint16_t addr, int probe)
+{
+	uint8_t buf;
+	int rc = -1;
+
+	switch (probe) {
+	case PROBE_WRITE:
+		rc = scan_rdwr(dev, addr, 0, &buf, 0);
+		break;
+
+	case PROBE_READ:
+		rc = scan_rdwr(dev, addr, I2C_M_RD, &buf, sizeof(buf));
+		break;
+
+	case PROBE_QUICK:
+		rc = scan_smbus(dev, addr, I2C_SMBUS_WRITE, I2C_SMBUS_QUICK);
+		break;
+
+	case PROBE_READ_BYTE:
+		rc = scan_smbus(dev, addr, I2C_SMBUS_READ, I2C_SMBUS_BYTE);
+		break;
+	}
+	if (rc >= 0)
+		return 1;
+
+	/* Errors which indicate a missing acknowledgement */
+	switch (errno) {
+	case EAGAIN:
+	case EIO:
+	case ENXIO:
+	case EREMOTEIO:
+	case ETIMEDOUT:
+		return 0;
+	}
+	return -1;
+}
+
+int i2cd_scan(struct i2cd *dev, uint16_t first, uint16_t last, int flags,
+		uint64_t bitmap[])
+{
+	int mode = flags & SCAN_MODE_MASK;
+	unsigned long funcs;
+	uint16_t addr;
+	int probe, rc, count = 0, errsv;
+	bool lowered = false;
+
+	assert(dev != NULL);
+	assert(first <= last);
+	assert(last <= 0x7f);
+	assert(mode <= I2CD_SCAN_READ);
+	assert(bitmap != NULL);
+
+	memset(bitmap, 0, I2CD_SCAN_WORDS * sizeof(*bitmap));
+
+	if (i2cd_get_functionality(dev, &funcs) < 0)
+		return -1;
+
+	if (mode != I2CD_SCAN_AUTO &&
+	    scan_select(funcs, mode, first) == PROBE_NONE) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->lock);
+
+	rc = i2cd_check_stale(dev);
+
+	/*
+	 * Retries and timeout are adapter-wide; they are only lowered if this
+	 * handle set both, as the values they replace are otherwise unknown.
+	 */
+	if (rc == 0 && (flags & I2CD_SCAN_FAST)) {
+		if ((dev->flags & SCAN_RESTORE) != SCAN_RESTORE) {
+			errno = EINVAL;
+			rc = -1;
+		} else {
+			lowered = true;
+			if (ioctl(dev->fd, I2C_RETRIES, 0UL) < 0 ||
+			    ioctl(dev->fd, I2C_TIMEOUT,
+				  (unsigned long)SCAN_TIMEOUT) < 0)
+				rc = -1;
+		}
+	}
+
+	for (addr = first; rc == 0 && addr <= last; addr++) {
+		probe = scan_select(funcs, mode, addr);
+		if (probe == PROBE_NONE)
+			continue;
+
+		rc = scan_probe(dev, addr, probe);
+
+		/*
+		 * Adapters may reject zero-length messages; fall back to
+		 * another probe for the remaining addresses.
+		 */
+		if (rc < 0 && errno == EOPNOTSUPP && probe == PROBE_WRITE &&
+		    mode == I2CD_SCAN_AUTO) {
+			funcs &= ~I2C_FUNC_I2C;
+			addr--;
+			rc = 0;
+			continue;
+		}
+
+		if (rc > 0) {
+			bitmap[addr / 64] |= UINT64_C(1) << (addr % 64);
+			count++;
+			rc = 0;
+		}
+	}
+
+	if (lowered) {
+		errsv = errno;
+		ioctl(dev->fd, I2C_RETRIES, dev->retries);
+		ioctl(dev->fd, I2C_TIMEOUT, dev->timeout);
+		errno = errsv;
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+
+	return rc < 0 ? -1 : count;
+}
+
+static void *scan_thread(void *arg)
+{
+	struct scan_job *job = arg;
+
+	job->rc = i2cd_scan(job->dev, job->first, job->last, job->flags,
+			    job->bitmap);
+	job->error = errno;
+	return NULL;
+}
+
+int i2cd_scan_multi(struct i2cd *devs[], size_t ndevs, uint16_t first,
+		uint16_t last, int flags, uint64_t bitmaps[][I2CD_SCAN_WORDS])
+{
+	struct scan_job *jobs;
+	size_t i;
+	int count = 0, error = 0;
+
+	assert(devs != NULL);
+	assert(bitmaps != NULL);
+
+	jobs = calloc(ndevs, sizeof(*jobs));
+	if (jobs == NULL)
+		return -1;
+
+	for (i = 0; i < ndevs; i++) {
+		jobs[i].dev = devs[i];
+		jobs[i].first = first;
+		jobs[i].last = last;
+		jobs[i].flags = flags;
+		jobs[i].bitmap = bitmaps[i];
+
+		/* The first adapter is scanned by the calling thread */
+		if (i > 0)
+			jobs[i].started = pthread_create(&jobs[i].thread, NULL,
+							 scan_thread,
+							 &jobs[i]) == 0;
+	}
+
+	for (i = 0; i < ndevs; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		else
+			scan_thread(&jobs[i]);
+
+		if (jobs[i].rc < 0 && error == 0)
+			error = jobs[i].error;
+		else if (jobs[i].rc > 0)
+			count += jobs[i].rc;
+	}
+
+	free(jobs);
+
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return count;
+}
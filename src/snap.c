@@ -0,0 +1,429 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+/* Each unit is read using a register write followed by a block read */
+#define SNAP_PER_CHUNK		(I2C_RDWR_IOCTL_MAX_MSGS / 2)
+
+#define SNAP_MAGIC		"I2CDSNAP"
+#define SNAP_VERSION		1
+
+/* Header: magic, version, flags, addr, reserved, nranges */
+#define SNAP_HEADER_LEN		(8 + 2 + 2 + 2 + 2 + 4)
+
+struct i2cd_snap {
+	uint16_t addr;		/**< I2C slave address. */
+	int flags;		/**< I2CD_SNAP_* flags. */
+	bool captured;		/**< Snapshot holds valid data. */
+	size_t nranges;		/**< Number of register ranges. */
+	size_t total;		/**< Total number of registers. */
+	struct i2cd_snap_range *ranges;
+	uint8_t *data;		/**< Captured values, in range order. */
+	uint8_t *cur;		/**< Current values read when restoring. */
+};
+
+static size_t snap_reg_len(const struct i2cd_snap *snap)
+{
+	return (snap->flags & I2CD_SNAP_REG16) ? sizeof(uint16_t) :
+						 sizeof(uint8_t);
+}
+
+/* Read all ranges into buf, combining as many as possible per transfer */
+static int snap_read(struct i2cd_snap *snap, struct i2cd *dev, uint8_t *buf)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	uint8_t regs[SNAP_PER_CHUNK][sizeof(uint16_t)];
+	size_t i, j, n, nunits = 0, reg_len;
+	uint16_t reg;
+
+	reg_len = snap_reg_len(snap);
+
+	for (i = 0; i < snap->nranges; i++) {
+		const struct i2cd_snap_range *range = &snap->ranges[i];
+
+		for (j = 0; j < range->len; j += n) {
+			n = range->len - j;
+			if (snap->flags & I2CD_SNAP_NO_BURST)
+				n = 1;
+			else if (n > I2CD_RDWR_MAX_LEN)
+				n = I2CD_RDWR_MAX_LEN;
+			reg = range->reg + j;
+
+			if (reg_len == sizeof(uint8_t))
+				regs[nunits][0] = reg;
+			else
+				memcpy(regs[nunits], &reg, reg_len);
+
+			msgs[2 * nunits].addr = snap->addr;
+			msgs[2 * nunits].flags = 0;
+			msgs[2 * nunits].len = reg_len;
+			msgs[2 * nunits].buf = regs[nunits];
+
+			msgs[2 * nunits + 1].addr = snap->addr;
+			msgs[2 * nunits + 1].flags = I2C_M_RD;
+			msgs[2 * nunits + 1].len = n;
+			msgs[2 * nunits + 1].buf = buf;
+
+			buf += n;
+
+			if (++nunits == SNAP_PER_CHUNK) {
+				if (i2cd_transfer(dev, msgs, 2 * nunits) < 0)
+					return -1;
+				nunits = 0;
+			}
+		}
+	}
+
+	if (nunits > 0 && i2cd_transfer(dev, msgs, 2 * nunits) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Return the number of registers to write starting at index i, which
+ * differs. A gap of equal registers is included when writing it costs no
+ * more than the slave and register addresses of a separate message would.
+ */
+static size_t snap_run(const struct i2cd_snap *snap, const uint8_t *data,
+		const uint8_t *cur, size_t i, size_t len)
+{
+	size_t end = i + 1, gap = 0, max_gap;
+
+	if (snap->flags & I2CD_SNAP_NO_BURST)
+		return 1;
+
+	max_gap = snap_reg_len(snap) + 1;
+
+	while (end + gap < len) {
+		if (data[end + gap] != cur[end + gap]) {
+			end += gap + 1;
+			gap = 0;
+		} else if (++gap > max_gap) {
+			break;
+		}
+	}
+	return end - i;
+}
+
+struct i2cd_snap *i2cd_snap_new(uint16_t addr,
+		const struct i2cd_snap_range ranges[], size_t nranges,
+		int flags)
+{
+	struct i2cd_snap *snap;
+	size_t i, max, total = 0;
+	uint8_t *p;
+
+	assert(ranges != NULL || nranges == 0);
+
+	if (nranges == 0 || nranges > UINT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	max = (flags & I2CD_SNAP_REG16) ? UINT16_MAX : UINT8_MAX;
+	for (i = 0; i < nranges; i++) {
+		if (ranges[i].len == 0 || ranges[i].reg > max ||
+		    ranges[i].len > max - ranges[i].reg + 1) {
+			errno = EINVAL;
+			return NULL;
+		}
+		total += ranges[i].len;
+	}
+
+	/* Ranges, captured values, and current values share an allocation */
+	snap = calloc(1, sizeof(*snap) + nranges * sizeof(*snap->ranges) +
+		      2 * total);
+	if (snap == NULL)
+		return NULL;
+
+	snap->addr = addr;
+	snap->flags = flags;
+	snap->nranges = nranges;
+	snap->total = total;
+
+	p = (uint8_t *)(snap + 1);
+	snap->ranges = (struct i2cd_snap_range *)p;
+	p += nranges * sizeof(*snap->ranges);
+	snap->data = p;
+	p += total;
+	snap->cur = p;
+
+	memcpy(snap->ranges, ranges, nranges * sizeof(*snap->ranges));
+
+	return snap;
+}
+
+void i2cd_snap_free(struct i2cd_snap *snap)
+{
+	assert(snap != NULL);
+
+	free(snap);
+}
+
+int i2cd_snap_capture(struct i2cd_snap *snap, struct i2cd *dev)
+{
+	assert(snap != NULL);
+	assert(dev != NULL);
+
+	/* A failed capture leaves the snapshot partially overwritten */
+	snap->captured = false;
+
+	if (snap_read(snap, dev, snap->data) < 0)
+		return -1;
+
+	snap->captured = true;
+	return 0;
+}
+
+int i2cd_snap_restore(struct i2cd_snap *snap, struct i2cd *dev)
+{
+	struct i2cd_wbuf *wbuf;
+	const uint8_t *data, *cur;
+	size_t i, j, n, count = 0;
+	int errsv, wbuf_flags = 0;
+
+	assert(snap != NULL);
+	assert(dev != NULL);
+
+	if (!snap->captured) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (snap_read(snap, dev, snap->cur) < 0)
+		return -1;
+
+	if (memcmp(snap->data, snap->cur, snap->total) == 0)
+		return 0;
+
+	if (snap->flags & I2CD_SNAP_REG16)
+		wbuf_flags |= I2CD_WBUF_REG16;
+	if (snap->flags & I2CD_SNAP_NO_BURST)
+		wbuf_flags |= I2CD_WBUF_NO_BURST;
+
+	wbuf = i2cd_wbuf_new(dev, snap->addr,
+			     snap->total < UINT16_MAX - sizeof(uint16_t) ?
+			     snap->total : UINT16_MAX - sizeof(uint16_t),
+			     wbuf_flags);
+	if (wbuf == NULL)
+		return -1;
+
+	data = snap->data;
+	cur = snap->cur;
+
+	for (i = 0; i < snap->nranges; i++) {
+		const struct i2cd_snap_range *range = &snap->ranges[i];
+
+		for (j = 0; j < range->len; j += n) {
+			n = 1;
+			if (data[j] == cur[j])
+				continue;
+
+			n = snap_run(snap, data, cur, j, range->len);
+			if (i2cd_wbuf_write(wbuf, range->reg + j, &data[j],
+					    n) < 0)
+				goto err;
+			count += n;
+		}
+
+		data += range->len;
+		cur += range->len;
+	}
+
+	if (i2cd_wbuf_flush(wbuf) < 0)
+		goto err;
+
+	i2cd_wbuf_free(wbuf);
+	return count;
+err:
+	errsv = errno;
+	i2cd_wbuf_free(wbuf);
+	errno = errsv;
+	return -1;
+}
+
+int i2cd_snap_get(struct i2cd_snap *snap, uint16_t reg, void *buf,
+		size_t len)
+{
+	const uint8_t *data;
+	size_t i;
+
+	assert(snap != NULL);
+	assert(buf != NULL);
+
+	if (!snap->captured) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	data = snap->data;
+	for (i = 0; i < snap->nranges; i++) {
+		const struct i2cd_snap_range *range = &snap->ranges[i];
+
+		if (reg >= range->reg &&
+		    (size_t)reg + len <= (size_t)range->reg + range->len) {
+			memcpy(buf, data + (reg - range->reg), len);
+			return 0;
+		}
+		data += range->len;
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+static void snap_put16(uint8_t *p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static uint16_t snap_get16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+int i2cd_snap_save(struct i2cd_snap *snap, const char *path)
+{
+	uint8_t header[SNAP_HEADER_LEN] = {0}, buf[4];
+	size_t i;
+	FILE *fp;
+	int errsv;
+
+	assert(snap != NULL);
+	assert(path != NULL);
+
+	if (!snap->captured) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Fields are stored in little-endian byte order */
+	memcpy(header, SNAP_MAGIC, 8);
+	snap_put16(&header[8], SNAP_VERSION);
+	snap_put16(&header[10], snap->flags);
+	snap_put16(&header[12], snap->addr);
+	snap_put16(&header[16], snap->nranges);
+	snap_put16(&header[18], snap->nranges >> 16);
+
+	fp = fopen(path, "wbe");
+	if (fp == NULL)
+		return -1;
+
+	if (fwrite(header, sizeof(header), 1, fp) != 1)
+		goto err;
+
+	for (i = 0; i < snap->nranges; i++) {
+		snap_put16(&buf[0], snap->ranges[i].reg);
+		snap_put16(&buf[2], snap->ranges[i].len);
+		if (fwrite(buf, sizeof(buf), 1, fp) != 1)
+			goto err;
+	}
+
+	if (fwrite(snap->data, 1, snap->total, fp) != snap->total)
+		goto err;
+
+	if (fclose(fp) != 0)
+		return -1;
+
+	return 0;
+err:
+	errsv = errno;
+	fclose(fp);
+	errno = errsv;
+	return -1;
+}
+
+struct i2cd_snap *i2cd_snap_load(const char *path)
+{
+	uint8_t header[SNAP_HEADER_LEN], buf[4];
+	struct i2cd_snap_range *ranges = NULL;
+	struct i2cd_snap *snap = NULL;
+	size_t i, nranges;
+	FILE *fp;
+	int errsv;
+
+	assert(path != NULL);
+
+	fp = fopen(path, "rbe");
+	if (fp == NULL)
+		return NULL;
+
+	errno = EINVAL;
+	if (fread(header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header, SNAP_MAGIC, 8) != 0 ||
+	    snap_get16(&header[8]) != SNAP_VERSION)
+		goto err;
+
+	nranges = snap_get16(&header[16]) |
+		  (size_t)snap_get16(&header[18]) << 16;
+	if (nranges == 0)
+		goto err;
+
+	ranges = calloc(nranges, sizeof(*ranges));
+	if (ranges == NULL)
+		goto err;
+
+	for (i = 0; i < nranges; i++) {
+		errno = EINVAL;
+		if (fread(buf, sizeof(buf), 1, fp) != 1)
+			goto err;
+		ranges[i].reg = snap_get16(&buf[0]);
+		ranges[i].len = snap_get16(&buf[2]);
+	}
+
+	snap = i2cd_snap_new(snap_get16(&header[12]), ranges, nranges,
+			     snap_get16(&header[10]));
+	if (snap == NULL)
+		goto err;
+
+	/* Trailing data indicates a corrupt file */
+	errno = EINVAL;
+	if (fread(snap->data, 1, snap->total, fp) != snap->total ||
+	    fgetc(fp) != EOF)
+		goto err;
+
+	snap->captured = true;
+
+	free(ranges);
+	fclose(fp);
+	return snap;
+err:
+	errsv = errno;
+
+	if (snap != NULL)
+		i2cd_snap_free(snap);
+
+	free(ranges);
+	fclose(fp);
+
+	errno = errsv;
+	return NULL;
+}
@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define MANGLING_FLAGS	(I2C_M_NO_RD_ACK | I2C_M_IGNORE_NAK | \
+			 I2C_M_REV_DIR_ADDR | I2C_M_STOP)
+
+struct i2cd_txn {
+	struct i2cd *dev;
+	struct i2c_rdwr_ioctl_data msgset;
+	struct i2c_msg msgs[];
+};
+
+static int txn_validate(unsigned long funcs, const struct i2c_msg *msg,
+		size_t index)
+{
+	if (!(funcs & I2C_FUNC_I2C))
+		goto unsupported;
+
+	if (msg->flags & I2C_M_TEN) {
+		if (!(funcs & I2C_FUNC_10BIT_ADDR))
+			goto unsupported;
+		if (msg->addr > 0x3ff)
+			goto invalid;
+	} else if (msg->addr > 0x7f) {
+		goto invalid;
+	}
+
+	if (msg->flags & I2C_M_NOSTART) {
+		if (!(funcs & I2C_FUNC_NOSTART))
+			goto unsupported;
+		if (index == 0)
+			goto invalid;
+	}
+
+	if ((msg->flags & MANGLING_FLAGS) &&
+	    !(funcs & I2C_FUNC_PROTOCOL_MANGLING))
+		goto unsupported;
+
+	if (msg->flags & I2C_M_RECV_LEN) {
+		if (!(funcs & I2C_FUNC_SMBUS_READ_BLOCK_DATA))
+			goto unsupported;
+		if (!(msg->flags & I2C_M_RD) || msg->len < 1)
+			goto invalid;
+	}
+
+	return 0;
+unsupported:
+	errno = EOPNOTSUPP;
+	return -1;
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+struct i2cd_txn *i2cd_txn_new(struct i2cd *dev, const struct i2c_msg msgs[],
+		size_t nmsgs)
+{
+	struct i2cd_txn *txn;
+	unsigned long funcs;
+	size_t i, size;
+	uint8_t *data;
+
+	assert(dev != NULL);
+	assert(msgs != NULL);
+
+	if (nmsgs == 0 || nmsgs > I2C_RDWR_IOCTL_MAX_MSGS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (i2cd_get_functionality(dev, &funcs) < 0)
+		return NULL;
+
+	size = sizeof(*txn) + nmsgs * sizeof(*msgs);
+	for (i = 0; i < nmsgs; i++) {
+		if (txn_validate(funcs, &msgs[i], i) < 0)
+			return NULL;
+
+		if (msgs[i].buf == NULL)
+			size += msgs[i].len;
+	}
+
+	/* Messages and owned buffers share a single allocation */
+	txn = calloc(1, size);
+	if (txn == NULL)
+		return NULL;
+
+	txn->dev = dev;
+	txn->msgset.msgs = txn->msgs;
+	txn->msgset.nmsgs = nmsgs;
+
+	data = (uint8_t *)&txn->msgs[nmsgs];
+	for (i = 0; i < nmsgs; i++) {
+		txn->msgs[i] = msgs[i];
+
+		if (msgs[i].buf == NULL) {
+			txn->msgs[i].buf = data;
+			data += msgs[i].len;
+		}
+	}
+
+	return txn;
+}
+
+void i2cd_txn_free(struct i2cd_txn *txn)
+{
+	assert(txn != NULL);
+
+	free(txn);
+}
+
+void *i2cd_txn_get_buf(struct i2cd_txn *txn, size_t index)
+{
+	assert(txn != NULL);
+	assert(index < txn->msgset.nmsgs);
+
+	return txn->msgs[index].buf;
+}
+
+void i2cd_txn_set_buf(struct i2cd_txn *txn, size_t index, void *buf,
+		size_t len)
+{
+	assert(txn != NULL);
+	assert(index < txn->msgset.nmsgs);
+	assert(buf != NULL);
+	assert(len <= UINT16_MAX);
+
+	txn->msgs[index].buf = buf;
+	txn->msgs[index].len = len;
+}
+
+int i2cd_txn_execute(struct i2cd_txn *txn)
+{
+	assert(txn != NULL);
+
+	return i2cd_transfer_msgset(txn->dev, &txn->msgset);
+}
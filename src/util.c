@@ -0,0 +1,399 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/i2c.h>
+
+#define NSEC_PER_SEC	1000000000ULL
+#define NSEC_PER_MSEC	1000000ULL
+
+#define UTIL_TARGETS	128
+
+/*
+ * Utilization is tracked using a sliding window approximated by two fixed
+ * windows: busy time in the previous window is weighted by the fraction of
+ * it still covered by the sliding window and added to the current window.
+ *
+ * Accounting is shared by handles duplicated from the one it was enabled on,
+ * so it has a lock of its own; the bus frequency remains per handle.
+ */
+struct i2cd_util {
+	pthread_mutex_t lock;	/**< Protects the members below. */
+	unsigned int refs;	/**< Number of handles sharing accounting. */
+	uint64_t window;	/**< Length of window (ns). */
+	uint64_t start;		/**< Start of current window (ns). */
+	uint64_t bus[2];	/**< Previous and current busy time (ns). */
+	uint64_t target[UTIL_TARGETS][2];
+	double ceiling;		/**< Utilization ceiling, or 0. */
+	int policy;		/**< Admission policy. */
+};
+
+uint64_t i2cd_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void util_advance(struct i2cd_util *util, uint64_t now)
+{
+	uint64_t n;
+	size_t i;
+
+	n = (now - util->start) / util->window;
+	if (n == 0)
+		return;
+
+	util->start += n * util->window;
+
+	util->bus[0] = n == 1 ? util->bus[1] : 0;
+	util->bus[1] = 0;
+	for (i = 0; i < UTIL_TARGETS; i++) {
+		util->target[i][0] = n == 1 ? util->target[i][1] : 0;
+		util->target[i][1] = 0;
+	}
+}
+
+static double util_busy(const struct i2cd_util *util, const uint64_t busy[2],
+		uint64_t now)
+{
+	uint64_t elapsed = now - util->start;
+
+	return (double)busy[0] * (util->window - elapsed) / util->window +
+		busy[1];
+}
+
+static unsigned long util_msg_bits(const struct i2c_msg *msg, int first)
+{
+	unsigned long bits = 0;
+
+	/* START or repeated START followed by address and ACK */
+	if (first || !(msg->flags & I2C_M_NOSTART))
+		bits += 1 + ((msg->flags & I2C_M_TEN) ? 18 : 9);
+
+	/* Each data byte is followed by ACK or NACK */
+	return bits + msg->len * 9UL;
+}
+
+static unsigned long util_freq(struct i2cd *dev)
+{
+	char path[PATH_MAX];
+	const char *name;
+	uint8_t prop[4];
+	FILE *fp;
+
+	if (dev->flags & I2CD_F_FREQ)
+		return dev->freq;
+
+	dev->freq = I2CD_BUS_FREQ_DEFAULT;
+
+	/* Device tree properties are stored as big-endian cells */
+	name = strrchr(dev->path, '/');
+	name = name != NULL ? name + 1 : dev->path;
+	snprintf(path, sizeof(path),
+		 "/sys/class/i2c-dev/%s/device/of_node/clock-frequency", name);
+
+	fp = fopen(path, "rb");
+	if (fp != NULL) {
+		if (fread(prop, sizeof(prop), 1, fp) == 1) {
+			unsigned long hz = (unsigned long)prop[0] << 24 |
+				prop[1] << 16 | prop[2] << 8 | prop[3];
+
+			if (hz != 0)
+				dev->freq = hz;
+		}
+		fclose(fp);
+	}
+
+	i2cd_set_flags(dev, I2CD_F_FREQ);
+	return dev->freq;
+}
+
+static uint64_t util_bits_to_ns(unsigned long hz, uint64_t bits)
+{
+	return (bits * NSEC_PER_SEC + hz - 1) / hz;
+}
+
+uint64_t i2cd_util_estimate(struct i2cd *dev, const struct i2c_msg msgs[],
+		size_t nmsgs)
+{
+	uint64_t bits = 0;
+	size_t i;
+
+	if (nmsgs == 0)
+		return 0;
+
+	for (i = 0; i < nmsgs; i++)
+		bits += util_msg_bits(&msgs[i], i == 0);
+
+	/* STOP */
+	return util_bits_to_ns(util_freq(dev), bits + 1);
+}
+
+int i2cd_set_bus_frequency(struct i2cd *dev, unsigned long hz)
+{
+	assert(dev != NULL);
+
+	if (hz == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->lock);
+	i2cd_set_flags(dev, I2CD_F_FREQ);
+	dev->freq = hz;
+	pthread_mutex_unlock(&dev->lock);
+
+	return 0;
+}
+
+unsigned long i2cd_get_bus_frequency(struct i2cd *dev)
+{
+	unsigned long hz;
+
+	assert(dev != NULL);
+
+	pthread_mutex_lock(&dev->lock);
+	hz = util_freq(dev);
+	pthread_mutex_unlock(&dev->lock);
+
+	return hz;
+}
+
+uint64_t i2cd_estimate_transfer_time(struct i2cd *dev,
+		const struct i2c_msg msgs[], size_t nmsgs)
+{
+	uint64_t ns;
+
+	assert(dev != NULL);
+	assert(msgs != NULL);
+
+	pthread_mutex_lock(&dev->lock);
+	ns = i2cd_util_estimate(dev, msgs, nmsgs);
+	pthread_mutex_unlock(&dev->lock);
+
+	return ns;
+}
+
+int i2cd_util_enable(struct i2cd *dev, unsigned long window_ms)
+{
+	struct i2cd_util *util;
+
+	assert(dev != NULL);
+
+	if (window_ms == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&dev->lock);
+
+	util = dev->util;
+	if (util == NULL) {
+		util = calloc(1, sizeof(*util));
+		if (util == NULL) {
+			pthread_mutex_unlock(&dev->lock);
+			return -1;
+		}
+		pthread_mutex_init(&util->lock, NULL);
+		util->refs = 1;
+	}
+
+	pthread_mutex_lock(&util->lock);
+	util->window = window_ms * NSEC_PER_MSEC;
+	util->start = i2cd_clock_ns();
+	memset(util->bus, 0, sizeof(util->bus));
+	memset(util->target, 0, sizeof(util->target));
+	util->ceiling = 0;
+	util->policy = I2CD_UTIL_REJECT;
+	pthread_mutex_unlock(&util->lock);
+
+	/* Transfers check for accounting without taking the lock */
+	__atomic_store_n(&dev->util, util, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&dev->lock);
+	return 0;
+}
+
+void i2cd_util_unref(struct i2cd_util *util)
+{
+	unsigned int refs;
+
+	pthread_mutex_lock(&util->lock);
+	refs = --util->refs;
+	pthread_mutex_unlock(&util->lock);
+
+	if (refs == 0) {
+		pthread_mutex_destroy(&util->lock);
+		free(util);
+	}
+}
+
+struct i2cd_util *i2cd_util_ref(struct i2cd_util *util)
+{
+	pthread_mutex_lock(&util->lock);
+	util->refs++;
+	pthread_mutex_unlock(&util->lock);
+
+	return util;
+}
+
+int i2cd_util_set_ceiling(struct i2cd *dev, double ceiling, int policy)
+{
+	struct i2cd_util *util;
+
+	assert(dev != NULL);
+
+	/* Once enabled, accounting is not replaced until the handle closes */
+	util = __atomic_load_n(&dev->util, __ATOMIC_ACQUIRE);
+	if (util == NULL || ceiling < 0 ||
+	    (policy != I2CD_UTIL_REJECT && policy != I2CD_UTIL_DEFER)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&util->lock);
+	util->ceiling = ceiling;
+	util->policy = policy;
+	pthread_mutex_unlock(&util->lock);
+
+	return 0;
+}
+
+static double util_get(struct i2cd *dev, int addr)
+{
+	struct i2cd_util *util;
+	uint64_t now = i2cd_clock_ns();
+	double busy;
+
+	util = __atomic_load_n(&dev->util, __ATOMIC_ACQUIRE);
+	if (util == NULL)
+		return 0;
+
+	pthread_mutex_lock(&util->lock);
+	util_advance(util, now);
+	busy = util_busy(util, addr < 0 ? util->bus : util->target[addr],
+			 now) / util->window;
+	pthread_mutex_unlock(&util->lock);
+
+	return busy;
+}
+
+double i2cd_util_get(struct i2cd *dev)
+{
+	assert(dev != NULL);
+
+	return util_get(dev, -1);
+}
+
+double i2cd_util_get_target(struct i2cd *dev, uint16_t addr)
+{
+	assert(dev != NULL);
+
+	if (addr >= UTIL_TARGETS)
+		return 0;
+
+	return util_get(dev, addr);
+}
+
+int i2cd_util_admit(struct i2cd *dev,
+		const struct i2c_rdwr_ioctl_data *msgset)
+{
+	struct i2cd_util *util = __atomic_load_n(&dev->util, __ATOMIC_ACQUIRE);
+	struct timespec ts;
+	uint64_t now, ns;
+	double busy;
+
+	pthread_mutex_lock(&dev->lock);
+	ns = i2cd_util_estimate(dev, msgset->msgs, msgset->nmsgs);
+	pthread_mutex_unlock(&dev->lock);
+
+	pthread_mutex_lock(&util->lock);
+
+	for (;;) {
+		now = i2cd_clock_ns();
+		util_advance(util, now);
+
+		busy = util_busy(util, util->bus, now);
+		if (util->ceiling == 0 || busy == 0 ||
+		    busy + ns <= util->ceiling * util->window)
+			break;
+
+		if (util->policy == I2CD_UTIL_REJECT) {
+			pthread_mutex_unlock(&util->lock);
+			errno = EAGAIN;
+			return -1;
+		}
+
+		/*
+		 * Busy time only decays as the window slides; wait a fraction
+		 * of the window before checking again. The bus is idle after
+		 * two windows have elapsed, so this always terminates.
+		 */
+		ts.tv_sec = util->window / 16 / NSEC_PER_SEC;
+		ts.tv_nsec = util->window / 16 % NSEC_PER_SEC;
+
+		pthread_mutex_unlock(&util->lock);
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&util->lock);
+	}
+
+	pthread_mutex_unlock(&util->lock);
+	return 0;
+}
+
+void i2cd_util_account(struct i2cd *dev,
+		const struct i2c_rdwr_ioctl_data *msgset)
+{
+	struct i2cd_util *util = __atomic_load_n(&dev->util, __ATOMIC_ACQUIRE);
+	unsigned long hz;
+	uint64_t ns;
+	size_t i;
+
+	pthread_mutex_lock(&dev->lock);
+	hz = util_freq(dev);
+	pthread_mutex_unlock(&dev->lock);
+
+	pthread_mutex_lock(&util->lock);
+
+	util_advance(util, i2cd_clock_ns());
+
+	for (i = 0; i < msgset->nmsgs; i++) {
+		const struct i2c_msg *msg = &msgset->msgs[i];
+
+		/* STOP is accounted to the last message */
+		ns = util_bits_to_ns(hz, util_msg_bits(msg, i == 0) +
+				     (i == msgset->nmsgs - 1));
+
+		util->bus[1] += ns;
+		if (!(msg->flags & I2C_M_TEN) && msg->addr < UTIL_TARGETS)
+			util->target[msg->addr][1] += ns;
+	}
+
+	pthread_mutex_unlock(&util->lock);
+}
@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+struct i2cd_wbuf {
+	struct i2cd *dev;
+	uint16_t addr;		/**< I2C slave address. */
+	int flags;		/**< I2CD_WBUF_* flags. */
+	size_t size;		/**< Number of registers which may be buffered. */
+	size_t count;		/**< Number of registers buffered. */
+	uint16_t *regs;		/**< Buffered registers in ascending order. */
+	uint8_t *vals;		/**< Buffered register values. */
+	uint8_t *data;		/**< Message buffers used when flushing. */
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+};
+
+static size_t wbuf_reg_len(const struct i2cd_wbuf *wbuf)
+{
+	return (wbuf->flags & I2CD_WBUF_REG16) ? sizeof(uint16_t) :
+						  sizeof(uint8_t);
+}
+
+/* Return the index of the first buffered register not less than reg */
+static size_t wbuf_find(const struct i2cd_wbuf *wbuf, uint16_t reg)
+{
+	size_t lo = 0, hi = wbuf->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (wbuf->regs[mid] < reg)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void wbuf_drop(struct i2cd_wbuf *wbuf, size_t n)
+{
+	wbuf->count -= n;
+	memmove(wbuf->regs, wbuf->regs + n, wbuf->count * sizeof(*wbuf->regs));
+	memmove(wbuf->vals, wbuf->vals + n, wbuf->count);
+}
+
+struct i2cd_wbuf *i2cd_wbuf_new(struct i2cd *dev, uint16_t addr, size_t size,
+		int flags)
+{
+	struct i2cd_wbuf *wbuf;
+	uint8_t *p;
+
+	assert(dev != NULL);
+
+	if (size == 0 || size > UINT16_MAX - sizeof(uint16_t)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/*
+	 * Registers, values, and message buffers share a single allocation.
+	 * In the worst case, each register is flushed in its own message.
+	 */
+	wbuf = calloc(1, sizeof(*wbuf) + size * sizeof(*wbuf->regs) + size +
+		      size * (sizeof(uint16_t) + 1));
+	if (wbuf == NULL)
+		return NULL;
+
+	wbuf->dev = dev;
+	wbuf->addr = addr;
+	wbuf->flags = flags;
+	wbuf->size = size;
+
+	p = (uint8_t *)(wbuf + 1);
+	wbuf->regs = (uint16_t *)p;
+	p += size * sizeof(*wbuf->regs);
+	wbuf->vals = p;
+	p += size;
+	wbuf->data = p;
+
+	return wbuf;
+}
+
+void i2cd_wbuf_free(struct i2cd_wbuf *wbuf)
+{
+	assert(wbuf != NULL);
+
+	free(wbuf);
+}
+
+int i2cd_wbuf_write(struct i2cd_wbuf *wbuf, uint16_t reg, const void *buf,
+		size_t len)
+{
+	const uint8_t *vals = buf;
+	size_t i, index, max;
+
+	assert(wbuf != NULL);
+	assert(buf != NULL);
+
+	max = (wbuf->flags & I2CD_WBUF_REG16) ? UINT16_MAX : UINT8_MAX;
+	if (reg > max || len > max - reg + 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < len; i++) {
+		uint16_t r = reg + i;
+
+		index = wbuf_find(wbuf, r);
+		if (index < wbuf->count && wbuf->regs[index] == r) {
+			/* Last value wins */
+			wbuf->vals[index] = vals[i];
+			continue;
+		}
+
+		if (wbuf->count == wbuf->size) {
+			if (i2cd_wbuf_flush(wbuf) < 0)
+				return -1;
+			index = 0;
+		}
+
+		memmove(&wbuf->regs[index + 1], &wbuf->regs[index],
+			(wbuf->count - index) * sizeof(*wbuf->regs));
+		memmove(&wbuf->vals[index + 1], &wbuf->vals[index],
+			wbuf->count - index);
+
+		wbuf->regs[index] = r;
+		wbuf->vals[index] = vals[i];
+		wbuf->count++;
+	}
+
+	return 0;
+}
+
+int i2cd_wbuf_read(struct i2cd_wbuf *wbuf, uint16_t reg, void *buf,
+		size_t len)
+{
+	size_t index;
+
+	assert(wbuf != NULL);
+
+	/* Flush if a write to any register being read is buffered */
+	index = wbuf_find(wbuf, reg);
+	if (index < wbuf->count && wbuf->regs[index] < (size_t)reg + len &&
+	    i2cd_wbuf_flush(wbuf) < 0)
+		return -1;
+
+	if (wbuf->flags & I2CD_WBUF_REG16)
+		return i2cd_register_read16(wbuf->dev, wbuf->addr, reg, buf,
+					    len);
+
+	return i2cd_register_read(wbuf->dev, wbuf->addr, reg, buf, len);
+}
+
+int i2cd_wbuf_flush(struct i2cd_wbuf *wbuf)
+{
+	size_t i, n, nmsgs, reg_len;
+	struct i2c_msg *msg;
+	uint8_t *data;
+
+	assert(wbuf != NULL);
+
+	reg_len = wbuf_reg_len(wbuf);
+
+	while (wbuf->count > 0) {
+		data = wbuf->data;
+		nmsgs = 0;
+
+		for (i = 0; i < wbuf->count &&
+		     nmsgs < I2C_RDWR_IOCTL_MAX_MSGS; i += n) {
+			/* Merge contiguous registers into a single burst */
+			n = 1;
+			if (!(wbuf->flags & I2CD_WBUF_NO_BURST)) {
+				while (i + n < wbuf->count &&
+				       reg_len + n < I2CD_RDWR_MAX_LEN &&
+				       wbuf->regs[i + n] == wbuf->regs[i] + n)
+					n++;
+			}
+
+			if (reg_len == sizeof(uint8_t))
+				data[0] = wbuf->regs[i];
+			else
+				memcpy(data, &wbuf->regs[i], reg_len);
+			memcpy(data + reg_len, &wbuf->vals[i], n);
+
+			msg = &wbuf->msgs[nmsgs++];
+			msg->addr = wbuf->addr;
+			msg->flags = 0;
+			msg->len = reg_len + n;
+			msg->buf = data;
+
+			data += msg->len;
+		}
+
+		if (i2cd_transfer(wbuf->dev, wbuf->msgs, nmsgs) < 0)
+			return -1;
+
+		wbuf_drop(wbuf, i);
+	}
+
+	return 0;
+}
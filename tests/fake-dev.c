@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fake-dev.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define FAKE_NADDRS	128
+
+struct fake_fd fake_fds[FAKE_FD_MAX];
+struct fake_entry fake_log[FAKE_LOG_MAX];
+atomic_int fake_nlog;
+atomic_ulong fake_transfers;
+atomic_ulong fake_misdirected;
+atomic_bool fake_hold;
+atomic_bool fake_entered;
+_Atomic pthread_t fake_thread;
+
+static atomic_int fake_next_fd;
+static atomic_ulong fake_delay_us[FAKE_NADDRS];
+static atomic_int fake_error[FAKE_NADDRS];
+static _Atomic fake_hook_t fake_hook;
+
+uint64_t fake_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void fake_reset(void)
+{
+	int i;
+
+	atomic_store(&fake_nlog, 0);
+	atomic_store(&fake_transfers, 0);
+	atomic_store(&fake_misdirected, 0);
+	atomic_store(&fake_hold, false);
+	atomic_store(&fake_entered, false);
+	atomic_store(&fake_hook, NULL);
+
+	for (i = 0; i < FAKE_NADDRS; i++) {
+		atomic_store(&fake_delay_us[i], 0);
+		atomic_store(&fake_error[i], 0);
+	}
+}
+
+void fake_set_delay(int addr, unsigned long us)
+{
+	int i;
+
+	for (i = 0; i < FAKE_NADDRS; i++) {
+		if (addr < 0 || addr == i)
+			atomic_store(&fake_delay_us[i], us);
+	}
+}
+
+void fake_set_error(int addr, int error)
+{
+	int i;
+
+	for (i = 0; i < FAKE_NADDRS; i++) {
+		if (addr < 0 || addr == i)
+			atomic_store(&fake_error[i], error);
+	}
+}
+
+void fake_set_hook(fake_hook_t hook)
+{
+	atomic_store(&fake_hook, hook);
+}
+
+int fake_find(uint8_t byte)
+{
+	int i, nlog;
+
+	nlog = atomic_load(&fake_nlog);
+	for (i = 0; i < nlog && i < FAKE_LOG_MAX; i++) {
+		if (fake_log[i].byte == byte)
+			return i;
+	}
+	return -1;
+}
+
+static void fake_sleep_us(unsigned long us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = us % 1000000 * 1000
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+static int fake_transfer(int fd, struct i2c_rdwr_ioctl_data *msgset)
+{
+	struct fake_fd *ffd = &fake_fds[fd - FAKE_FD_BASE];
+	struct i2c_msg *msgs = msgset->msgs;
+	unsigned int addr = msgs[0].addr % FAKE_NADDRS;
+	unsigned long n, delay_us;
+	fake_hook_t hook;
+	int i, inflight, max, error, rc;
+
+	n = atomic_fetch_add(&fake_transfers, 1) + 1;
+	atomic_store(&fake_thread, pthread_self());
+
+	i = atomic_fetch_add(&fake_nlog, 1);
+	if (i < FAKE_LOG_MAX) {
+		fake_log[i].fd = fd;
+		fake_log[i].byte = msgs[0].len > 0 ? msgs[0].buf[0] : 0;
+		fake_log[i].start = fake_now_ns();
+	}
+
+	inflight = atomic_fetch_add(&ffd->inflight, 1) + 1;
+	max = atomic_load(&ffd->inflight_max);
+	while (inflight > max &&
+	       !atomic_compare_exchange_weak(&ffd->inflight_max, &max,
+					     inflight))
+		;
+
+	atomic_store(&fake_entered, true);
+	while (atomic_load(&fake_hold))
+		fake_sleep_us(1000);
+
+	delay_us = atomic_load(&fake_delay_us[addr]);
+	if (delay_us != 0)
+		fake_sleep_us(delay_us);
+
+	error = atomic_load(&fake_error[addr]);
+	hook = atomic_load(&fake_hook);
+	if (error != 0) {
+		errno = error;
+		rc = -1;
+	} else if (hook != NULL) {
+		rc = hook(msgset, n);
+	} else {
+		if (msgset->nmsgs == 2)
+			memcpy(msgs[1].buf, msgs[0].buf,
+			       msgs[0].len < msgs[1].len ?
+			       msgs[0].len : msgs[1].len);
+		rc = msgset->nmsgs;
+	}
+
+	atomic_fetch_sub(&ffd->inflight, 1);
+	return rc;
+}
+
+int __wrap_open(const char *pathname, int flags, mode_t mode)
+{
+	int n = atomic_fetch_add(&fake_next_fd, 1);
+
+	if (n >= FAKE_FD_MAX) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	atomic_store(&fake_fds[n].inflight, 0);
+	atomic_store(&fake_fds[n].inflight_max, 0);
+	atomic_store(&fake_fds[n].addr, -1);
+	return FAKE_FD_BASE + n;
+}
+
+int __wrap_close(int fd)
+{
+	return 0;
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	extern ssize_t __real_read(int fd, void *buf, size_t count);
+
+	if (fd < FAKE_FD_BASE || fd >= FAKE_FD_BASE + FAKE_FD_MAX)
+		return __real_read(fd, buf, count);
+
+	atomic_fetch_add(&fake_transfers, 1);
+	memset(buf, 0, count);
+	return count;
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+	extern ssize_t __real_write(int fd, const void *buf, size_t count);
+	const uint8_t *p = buf;
+
+	if (fd < FAKE_FD_BASE || fd >= FAKE_FD_BASE + FAKE_FD_MAX)
+		return __real_write(fd, buf, count);
+
+	/* Widen the window in which the slave address may change */
+	sched_yield();
+
+	atomic_fetch_add(&fake_transfers, 1);
+	if (count > 0 && p[0] != atomic_load(&fake_fds[fd - FAKE_FD_BASE].addr))
+		atomic_fetch_add(&fake_misdirected, 1);
+	return count;
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fd < FAKE_FD_BASE || fd >= FAKE_FD_BASE + FAKE_FD_MAX) {
+		errno = EBADF;
+		return -1;
+	}
+
+	switch (request) {
+	case I2C_FUNCS:
+		*(unsigned long *)arg = I2C_FUNC_I2C;
+		return 0;
+
+	case I2C_RETRIES:
+	case I2C_TIMEOUT:
+		return 0;
+
+	case I2C_SLAVE:
+	case I2C_SLAVE_FORCE:
+		atomic_store(&fake_fds[fd - FAKE_FD_BASE].addr,
+			     (int)(uintptr_t)arg);
+		return 0;
+
+	case I2C_RDWR:
+		return fake_transfer(fd, arg);
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
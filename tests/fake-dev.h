@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FAKE_DEV_H
+#define FAKE_DEV_H
+
+/*
+ * The cmocka mocks are not thread-safe, so tests which transfer from more
+ * than one thread link with $(FAKE_LDFLAGS) and use this stand-in for the
+ * I2C character device instead.
+ *
+ * Each open returns a new file descriptor. I2C_RDWR echoes the first message
+ * into the second unless a hook is set; transfers may also be delayed or not
+ * acknowledged per address, and are held while fake_hold is set. Writes to
+ * a file descriptor bound by I2C_SLAVE are counted in fake_misdirected if
+ * the first byte is not the slave address.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define FAKE_FD_BASE	100
+#define FAKE_FD_MAX	64
+#define FAKE_LOG_MAX	64
+
+struct fake_fd {
+	atomic_int inflight;		/**< Transfers in flight. */
+	atomic_int inflight_max;	/**< Most transfers in flight at once. */
+	atomic_int addr;		/**< Slave address set by I2C_SLAVE. */
+};
+
+struct fake_entry {
+	int fd;
+	uint8_t byte;		/**< First byte of the first message. */
+	uint64_t start;		/**< Time transfer started (ns). */
+};
+
+/*
+ * Complete transfer n (counting from 1 since fake_reset) in place of the
+ * echo. Returns the number of messages transferred, or -1 with errno set.
+ */
+typedef int (*fake_hook_t)(struct i2c_rdwr_ioctl_data *msgset,
+		unsigned long n);
+
+extern struct fake_fd fake_fds[FAKE_FD_MAX];
+extern struct fake_entry fake_log[FAKE_LOG_MAX];
+extern atomic_int fake_nlog;
+extern atomic_ulong fake_transfers;
+extern atomic_ulong fake_misdirected;
+extern atomic_bool fake_hold;
+extern atomic_bool fake_entered;
+extern _Atomic pthread_t fake_thread;
+
+uint64_t fake_now_ns(void);
+
+/* Clear the log and counters, and restore the default behavior */
+void fake_reset(void);
+
+/* Delay transfers to addr (or all addresses if negative) by us */
+void fake_set_delay(int addr, unsigned long us);
+
+/* Fail transfers to addr (or all addresses if negative) with error */
+void fake_set_error(int addr, int error);
+
+void fake_set_hook(fake_hook_t hook);
+
+/* Return the index of the log entry of byte, or -1 if it was not written */
+int fake_find(uint8_t byte);
+
+#endif /* FAKE_DEV_H */
@@ -18,10 +18,13 @@
 
 #include "mocks.h"
 
+#include <errno.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 #include <cmocka.h>
 #include <linux/i2c.h>
@@ -29,6 +32,40 @@
 
 bool mocks_enabled;
 
+int check_i2c_msg(const LargestIntegralType value,
+		const LargestIntegralType check_value)
+{
+	struct i2c_msg *msg_value = (struct i2c_msg *)(uintptr_t)value;
+	struct i2c_msg *msg_check = (struct i2c_msg *)(uintptr_t)check_value;
+
+	return (msg_value->addr == msg_check->addr) &&
+		(msg_value->flags == msg_check->flags) &&
+		(msg_value->len == msg_check->len) &&
+		(memcmp(msg_value->buf, msg_check->buf, msg_check->len) == 0);
+}
+
+/*
+ * Messages are checked as by check_i2c_msg(), except that the data of read
+ * messages is supplied rather than compared.
+ */
+int check_and_fill_i2c_msg(const LargestIntegralType value,
+		const LargestIntegralType check_value)
+{
+	struct i2c_msg *msg_value = (struct i2c_msg *)(uintptr_t)value;
+	struct i2c_msg *msg_check = (struct i2c_msg *)(uintptr_t)check_value;
+
+	if (!(msg_check->flags & I2C_M_RD))
+		return check_i2c_msg(value, check_value);
+
+	if (msg_value->addr != msg_check->addr ||
+	    msg_value->flags != msg_check->flags ||
+	    msg_value->len != msg_check->len)
+		return 0;
+
+	memcpy(msg_value->buf, msg_check->buf, msg_check->len);
+	return 1;
+}
+
 void *mock_calloc(size_t nmemb, size_t size)
 {
 	check_expected(nmemb);
@@ -114,9 +151,80 @@ int __wrap_close(int fd)
 	return __real_close(fd);
 }
 
+int mock_dup2(int oldfd, int newfd)
+{
+	check_expected(oldfd);
+	check_expected(newfd);
+
+	return mock_type(int);
+}
+
+int __wrap_dup2(int oldfd, int newfd)
+{
+	extern int __real_dup2(int oldfd, int newfd);
+
+	if (mocks_enabled)
+		return mock_dup2(oldfd, newfd);
+
+	return __real_dup2(oldfd, newfd);
+}
+
+ssize_t mock_read(int fd, void *buf, size_t count)
+{
+	ssize_t rc;
+
+	check_expected(fd);
+	check_expected(count);
+
+	/* Failed requests are followed by a value for errno */
+	rc = mock_type(int);
+	if (rc < 0)
+		errno = mock_type(int);
+	else
+		memset(buf, 0, rc);
+
+	return rc;
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	extern ssize_t __real_read(int fd, void *buf, size_t count);
+
+	if (mocks_enabled)
+		return mock_read(fd, buf, count);
+
+	return __real_read(fd, buf, count);
+}
+
+ssize_t mock_write(int fd, const void *buf, size_t count)
+{
+	ssize_t rc;
+
+	check_expected(fd);
+	check_expected(count);
+
+	/* Failed requests are followed by a value for errno */
+	rc = mock_type(int);
+	if (rc < 0)
+		errno = mock_type(int);
+
+	return rc;
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+	extern ssize_t __real_write(int fd, const void *buf, size_t count);
+
+	if (mocks_enabled)
+		return mock_write(fd, buf, count);
+
+	return __real_write(fd, buf, count);
+}
+
 int mock_ioctl(int fd, unsigned long request, ...)
 {
 	va_list ap;
+	int rc;
 
 	check_expected(fd);
 	check_expected(request);
@@ -144,6 +252,26 @@ int mock_ioctl(int fd, unsigned long request, ...)
 
 		funcs = va_arg(ap, unsigned long *);
 		check_expected_ptr(funcs);
+		*funcs = mock_type(unsigned long);
+		break;
+	}
+
+	case I2C_SLAVE:
+	case I2C_SLAVE_FORCE: {
+		unsigned long addr;
+
+		addr = va_arg(ap, unsigned long);
+		check_expected(addr);
+		break;
+	}
+
+	case I2C_SMBUS: {
+		struct i2c_smbus_ioctl_data *args;
+		int size;
+
+		args = va_arg(ap, struct i2c_smbus_ioctl_data *);
+		size = args->size;
+		check_expected(size);
 		break;
 	}
 
@@ -162,7 +290,12 @@ int mock_ioctl(int fd, unsigned long request, ...)
 	}
 	va_end(ap);
 
-	return mock_type(int);
+	/* Failed requests are followed by a value for errno */
+	rc = mock_type(int);
+	if (rc < 0)
+		errno = mock_type(int);
+
+	return rc;
 }
 
 int __wrap_ioctl(int fd, unsigned long request, ...)
@@ -19,16 +19,28 @@
 #ifndef MOCKS_H
 #define MOCKS_H
 
+#include <setjmp.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <cmocka.h>
+#include <sys/types.h>
 
 extern bool mocks_enabled;
 
+int check_i2c_msg(const LargestIntegralType value,
+		const LargestIntegralType check_value);
+int check_and_fill_i2c_msg(const LargestIntegralType value,
+		const LargestIntegralType check_value);
+
 void *mock_calloc(size_t nmemb, size_t size);
 char *mock_strdup(const char *s);
 void mock_free(void *ptr);
 int mock_open(const char *pathname, int flags);
 int mock_close(int fd);
+int mock_dup2(int oldfd, int newfd);
+ssize_t mock_read(int fd, void *buf, size_t count);
+ssize_t mock_write(int fd, const void *buf, size_t count);
 int mock_ioctl(int fd, unsigned long request, ...);
 
 #endif /* MOCKS_H */
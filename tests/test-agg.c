@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+/*
+ * Aggregators are allocated normally; mocks are only enabled while
+ * registers are read.
+ */
+static uint8_t mock_reg_buf[] = {0x10};
+static uint8_t mock_read_buf[] = {0xff, 0xfe};
+
+void test_i2cd_agg_add(void **state)
+{
+	struct i2cd_agg *agg;
+	struct i2cd_agg_stats stats, snapshot[2];
+	const double values[] = {2, 1, 6, 3};
+	size_t i;
+
+	agg = i2cd_agg_new(2, 60000, 4);
+	assert_non_null(agg);
+
+	for (i = 0; i < ARRAY_SIZE(values); i++)
+		assert_int_equal(i2cd_agg_add(agg, 0, values[i]), 1);
+
+	/* Check behavior when values were added */
+	assert_return_code(i2cd_agg_get(agg, 0, &stats), 0);
+
+	assert_int_equal(stats.count, 4);
+	assert_true(stats.min == 1);
+	assert_true(stats.max == 6);
+	assert_true(stats.mean == 3);
+	assert_true(stats.last == 3);
+
+	/* Check behavior when no values were added */
+	assert_return_code(i2cd_agg_get(agg, 1, &stats), 0);
+
+	assert_int_equal(stats.count, 0);
+	assert_true(isnan(stats.min));
+	assert_true(isnan(stats.mean));
+	assert_true(isnan(stats.last));
+
+	i2cd_agg_snapshot(agg, snapshot);
+
+	assert_int_equal(snapshot[0].count, 4);
+	assert_true(snapshot[0].mean == 3);
+	assert_int_equal(snapshot[1].count, 0);
+
+	i2cd_agg_free(agg);
+}
+
+void test_i2cd_agg_expire(void **state)
+{
+	struct i2cd_agg *agg;
+	struct i2cd_agg_stats stats;
+	struct timespec ts = {.tv_nsec = 50000000};
+
+	agg = i2cd_agg_new(1, 40, 4);
+	assert_non_null(agg);
+
+	assert_int_equal(i2cd_agg_add(agg, 0, 5), 1);
+	nanosleep(&ts, NULL);
+
+	/* Check behavior when values are older than the window */
+	assert_return_code(i2cd_agg_get(agg, 0, &stats), 0);
+
+	assert_int_equal(stats.count, 0);
+	assert_true(stats.last == 5);
+
+	assert_int_equal(i2cd_agg_add(agg, 0, 7), 1);
+	assert_return_code(i2cd_agg_get(agg, 0, &stats), 0);
+
+	assert_int_equal(stats.count, 1);
+	assert_true(stats.mean == 7);
+
+	i2cd_agg_free(agg);
+}
+
+void test_i2cd_agg_decimation(void **state)
+{
+	struct i2cd_agg *agg;
+	struct i2cd_agg_stats stats;
+	int i;
+
+	agg = i2cd_agg_new(1, 60000, 4);
+	assert_non_null(agg);
+
+	assert_return_code(i2cd_agg_set_decimation(agg, 0, 3), 0);
+
+	/* Check behavior when every third value is taken */
+	for (i = 0; i < 9; i++)
+		assert_int_equal(i2cd_agg_add(agg, 0, i), i % 3 == 0);
+
+	assert_return_code(i2cd_agg_get(agg, 0, &stats), 0);
+
+	assert_int_equal(stats.count, 3);
+	assert_true(stats.min == 0);
+	assert_true(stats.max == 6);
+	assert_true(stats.mean == 3);
+
+	i2cd_agg_free(agg);
+}
+
+void test_i2cd_agg_read(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2c_msg expect_msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(mock_reg_buf),
+			.buf	= mock_reg_buf
+		},
+		{
+			.addr	= 0x20,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(mock_read_buf),
+			.buf	= mock_read_buf
+		}
+	};
+	struct i2cd_agg *agg;
+	struct i2cd_agg_stats stats;
+	int rc;
+
+	agg = i2cd_agg_new(1, 60000, 4);
+	assert_non_null(agg);
+
+	assert_return_code(i2cd_agg_set_decimation(agg, 0, 2), 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[0]);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[1]);
+	will_return(mock_ioctl, 2);
+
+	/* Check behavior when function succeeds */
+	mocks_enabled = true;
+	rc = i2cd_agg_read(agg, 0, &mock_dev, 0x20, 0x10, 2,
+			   I2CD_AGG_BE | I2CD_AGG_SIGNED);
+	mocks_enabled = false;
+
+	assert_int_equal(rc, 1);
+
+	/* Check behavior when sample is discarded without a transfer */
+	mocks_enabled = true;
+	rc = i2cd_agg_read(agg, 0, &mock_dev, 0x20, 0x10, 2,
+			   I2CD_AGG_BE | I2CD_AGG_SIGNED);
+	mocks_enabled = false;
+
+	assert_int_equal(rc, 0);
+
+	assert_return_code(i2cd_agg_get(agg, 0, &stats), 0);
+	assert_int_equal(stats.count, 1);
+	assert_true(stats.last == -2);
+
+	i2cd_agg_free(agg);
+}
+
+void test_i2cd_agg_fail_invalid(void **state)
+{
+	struct i2cd_agg *agg;
+	struct i2cd_agg_stats stats;
+
+	/* Check behavior when there are no channels */
+	agg = i2cd_agg_new(0, 60000, 4);
+
+	assert_null(agg);
+	assert_int_equal(errno, EINVAL);
+
+	agg = i2cd_agg_new(1, 60000, 4);
+	assert_non_null(agg);
+
+	/* Check behavior when channel is out of range */
+	assert_int_equal(i2cd_agg_add(agg, 1, 0), -1);
+	assert_int_equal(errno, EINVAL);
+	assert_int_equal(i2cd_agg_get(agg, 1, &stats), -1);
+	assert_int_equal(errno, EINVAL);
+	assert_int_equal(i2cd_agg_set_decimation(agg, 0, 0), -1);
+	assert_int_equal(errno, EINVAL);
+
+	i2cd_agg_free(agg);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_agg_add),
+		cmocka_unit_test(test_i2cd_agg_expire),
+		cmocka_unit_test(test_i2cd_agg_decimation),
+		cmocka_unit_test(test_i2cd_agg_read),
+		cmocka_unit_test(test_i2cd_agg_fail_invalid),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
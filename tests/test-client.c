@@ -0,0 +1,348 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+#include "i2cd-protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+/*
+ * A fake server is run in a separate thread, which records the most recent
+ * request and replies with a canned response. Buffers passed through shared
+ * memory are filled with shm_fill.
+ */
+struct fake_server {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd;
+	pthread_t thread;
+	uint8_t request[I2CD_PROTO_PACKET_MAX];
+	size_t request_len;
+	int request_fd;
+	int request_seals;
+	struct i2cd_proto_response resp;
+	uint8_t resp_data[I2CD_PROTO_INLINE_MAX];
+	uint8_t shm_fill;
+};
+
+static void *fake_server_run(void *arg)
+{
+	struct fake_server *server = arg;
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct iovec iov, resp_iov[2];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t n;
+	int fd;
+
+	fd = accept(server->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return NULL;
+
+	for (;;) {
+		iov.iov_base = server->request;
+		iov.iov_len = sizeof(server->request);
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		n = recvmsg(fd, &msg, 0);
+		if (n <= 0)
+			break;
+
+		server->request_len = n;
+		server->request_fd = -1;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg))
+			memcpy(&server->request_fd, CMSG_DATA(cmsg), sizeof(int));
+
+		if (server->request_fd >= 0) {
+			const struct i2cd_proto_request *req =
+				(const void *)server->request;
+			void *shm;
+
+			server->request_seals = fcntl(server->request_fd,
+						      F_GET_SEALS);
+			shm = mmap(NULL, req->len, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, server->request_fd, 0);
+			if (shm != MAP_FAILED) {
+				memset(shm, server->shm_fill, req->len);
+				munmap(shm, req->len);
+			}
+			close(server->request_fd);
+		}
+
+		resp_iov[0].iov_base = &server->resp;
+		resp_iov[0].iov_len = sizeof(server->resp);
+		resp_iov[1].iov_base = server->resp_data;
+		resp_iov[1].iov_len = server->resp.len;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = resp_iov;
+		msg.msg_iovlen = 2;
+
+		sendmsg(fd, &msg, 0);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void fake_server_respond(struct fake_server *server, int rc, int error,
+		const void *data, size_t len)
+{
+	memset(&server->resp, 0, sizeof(server->resp));
+	server->resp.rc = rc;
+	server->resp.error = error;
+	server->resp.len = len;
+
+	if (data != NULL)
+		memcpy(server->resp_data, data, len);
+}
+
+int setup(void **state)
+{
+	static struct fake_server server;
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX
+	};
+
+	snprintf(server.path, sizeof(server.path), "/tmp/test-client-%d.sock",
+		 (int)getpid());
+	strcpy(addr.sun_path, server.path);
+
+	server.listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (server.listen_fd < 0)
+		return -1;
+
+	unlink(server.path);
+	if (bind(server.listen_fd, (struct sockaddr *)&addr,
+		 sizeof(addr)) < 0 ||
+	    listen(server.listen_fd, 1) < 0)
+		return -1;
+
+	*state = &server;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	struct fake_server *server = *state;
+
+	close(server->listen_fd);
+	unlink(server->path);
+	return 0;
+}
+
+static struct i2cd_client *open_client(struct fake_server *server)
+{
+	struct i2cd_client *client;
+
+	fake_server_respond(server, 0, 0, NULL, 0);
+	pthread_create(&server->thread, NULL, fake_server_run, server);
+
+	client = i2cd_client_open(server->path, "/dev/i2c-0");
+	assert_non_null(client);
+
+	return client;
+}
+
+static void close_client(struct fake_server *server,
+		struct i2cd_client *client)
+{
+	i2cd_client_close(client);
+	pthread_join(server->thread, NULL);
+}
+
+void test_i2cd_client_open(void **state)
+{
+	struct fake_server *server = *state;
+	struct i2cd_proto_request *req = (void *)server->request;
+	struct i2cd_client *client;
+
+	/* Check behavior when function succeeds */
+	client = open_client(server);
+
+	assert_int_equal(req->op, I2CD_PROTO_OPEN);
+	assert_int_equal(req->len, sizeof("/dev/i2c-0"));
+	assert_string_equal((char *)(req + 1), "/dev/i2c-0");
+
+	close_client(server, client);
+}
+
+void test_i2cd_client_open_fail(void **state)
+{
+	struct fake_server *server = *state;
+	struct i2cd_client *client;
+
+	fake_server_respond(server, -1, ENOENT, NULL, 0);
+	pthread_create(&server->thread, NULL, fake_server_run, server);
+
+	/* Check behavior when server fails to open adapter */
+	client = i2cd_client_open(server->path, "/dev/i2c-0");
+
+	assert_null(client);
+	assert_int_equal(errno, ENOENT);
+
+	pthread_join(server->thread, NULL);
+}
+
+void test_i2cd_client_get_functionality(void **state)
+{
+	struct fake_server *server = *state;
+	struct i2cd_proto_request *req = (void *)server->request;
+	struct i2cd_client *client;
+	unsigned long funcs = 0;
+	int rc;
+
+	client = open_client(server);
+
+	fake_server_respond(server, 0, 0, NULL, 0);
+	server->resp.funcs = I2C_FUNC_I2C;
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_client_get_functionality(client, &funcs);
+
+	assert_return_code(rc, 0);
+	assert_int_equal(req->op, I2CD_PROTO_FUNCS);
+	assert_int_equal(funcs, I2C_FUNC_I2C);
+
+	close_client(server, client);
+}
+
+void test_i2cd_client_write_read(void **state)
+{
+	struct fake_server *server = *state;
+	struct i2cd_proto_request *req = (void *)server->request;
+	struct i2cd_proto_msg *pmsgs = (void *)(req + 1);
+	struct i2cd_client *client;
+	uint8_t mock_write_buf[2] = {0x01, 0x02};
+	uint8_t mock_read_buf[4], expect_read_buf[4] = {0xde, 0xad, 0xbe, 0xef};
+	int rc;
+
+	client = open_client(server);
+
+	fake_server_respond(server, 2, 0, expect_read_buf,
+			    sizeof(expect_read_buf));
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_client_write_read(client, 0x20,
+		mock_write_buf, sizeof(mock_write_buf),
+		mock_read_buf, sizeof(mock_read_buf));
+
+	assert_int_equal(rc, 2);
+	assert_int_equal(req->op, I2CD_PROTO_TRANSFER);
+	assert_int_equal(req->flags, 0);
+	assert_int_equal(req->nmsgs, 2);
+	assert_int_equal(req->len, sizeof(mock_write_buf));
+	assert_int_equal(pmsgs[0].addr, 0x20);
+	assert_int_equal(pmsgs[0].flags, 0);
+	assert_int_equal(pmsgs[0].len, sizeof(mock_write_buf));
+	assert_int_equal(pmsgs[1].addr, 0x20);
+	assert_int_equal(pmsgs[1].flags, I2C_M_RD);
+	assert_int_equal(pmsgs[1].len, sizeof(mock_read_buf));
+	assert_memory_equal(&pmsgs[2], mock_write_buf, sizeof(mock_write_buf));
+	assert_memory_equal(mock_read_buf, expect_read_buf,
+			    sizeof(expect_read_buf));
+
+	close_client(server, client);
+}
+
+void test_i2cd_client_read_shm(void **state)
+{
+	struct fake_server *server = *state;
+	struct i2cd_proto_request *req = (void *)server->request;
+	struct i2cd_client *client;
+	static uint8_t mock_buf[2 * I2CD_PROTO_INLINE_MAX];
+	int rc;
+
+	client = open_client(server);
+
+	fake_server_respond(server, 1, 0, NULL, 0);
+	server->shm_fill = 0x5a;
+
+	/* Check behavior when data is passed in shared memory */
+	rc = i2cd_client_read(client, 0x20, mock_buf, sizeof(mock_buf));
+
+	assert_int_equal(rc, 1);
+	assert_int_equal(req->op, I2CD_PROTO_TRANSFER);
+	assert_int_equal(req->flags, I2CD_PROTO_F_SHM);
+	assert_int_equal(req->len, sizeof(mock_buf));
+	assert_true(server->request_fd >= 0);
+	assert_true(server->request_seals >= 0 &&
+		    (server->request_seals & F_SEAL_SHRINK));
+	assert_int_equal(mock_buf[0], server->shm_fill);
+	assert_int_equal(mock_buf[sizeof(mock_buf) - 1], server->shm_fill);
+
+	close_client(server, client);
+}
+
+void test_i2cd_client_transfer_fail(void **state)
+{
+	struct fake_server *server = *state;
+	struct i2cd_client *client;
+	uint8_t mock_buf[8];
+	int rc;
+
+	client = open_client(server);
+
+	fake_server_respond(server, -1, ENXIO, NULL, 0);
+
+	/* Check behavior when transfer fails */
+	rc = i2cd_client_write(client, 0x20, mock_buf, sizeof(mock_buf));
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, ENXIO);
+
+	close_client(server, client);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_client_open),
+		cmocka_unit_test(test_i2cd_client_open_fail),
+		cmocka_unit_test(test_i2cd_client_get_functionality),
+		cmocka_unit_test(test_i2cd_client_write_read),
+		cmocka_unit_test(test_i2cd_client_read_shm),
+		cmocka_unit_test(test_i2cd_client_transfer_fail),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+int setup(void **state)
+{
+	mocks_enabled = true;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	mocks_enabled = false;
+	return 0;
+}
+
+static uint8_t crc8_bitwise(uint8_t crc, uint8_t poly, const uint8_t *buf,
+		size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ poly : crc << 1;
+	}
+	return crc;
+}
+
+static void expect_write_read(struct i2cd *dev, struct i2c_msg msgs[2])
+{
+	expect_value(mock_ioctl, fd, dev->fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &msgs[0]);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &msgs[1]);
+	will_return(mock_ioctl, 2);
+}
+
+void test_i2cd_pec_update(void **state)
+{
+	uint8_t buf[64];
+	size_t i, len;
+
+	/* Check behavior with the CRC-8/SMBUS check value */
+	assert_int_equal(i2cd_pec_update(0, "123456789", 9), 0xf4);
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 37 + 11;
+
+	/* Check behavior when slicing and trailing bytes are combined */
+	for (len = 0; len <= sizeof(buf); len++)
+		assert_int_equal(i2cd_pec_update(0, buf, len),
+				 crc8_bitwise(0, 0x07, buf, len));
+
+	/* Check behavior when a PEC is updated incrementally */
+	assert_int_equal(i2cd_pec_update(i2cd_pec_update(0, buf, 13),
+					 buf + 13, 29),
+			 crc8_bitwise(0, 0x07, buf, 42));
+}
+
+void test_i2cd_verify_words(void **state)
+{
+	uint8_t buf[] = {0xbe, 0xef, 0x92, 0x12, 0x34, 0x37};
+	int rc;
+
+	assert_int_equal(i2cd_crc8_word(buf, 2), 0x92);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_verify_words(buf, sizeof(buf));
+
+	assert_return_code(rc, 0);
+
+	/* Check behavior when a word is corrupted */
+	buf[4] ^= 0x01;
+	rc = i2cd_verify_words(buf, sizeof(buf));
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EBADMSG);
+
+	/* Check behavior when length is not a multiple of 3 */
+	rc = i2cd_verify_words(buf, 4);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+}
+
+void test_i2cd_write_read_verify_pec(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_reg = 0x10, mock_read_buf[] = {0x12, 0x34, 0xb3};
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(mock_reg),
+			.buf	= &mock_reg
+		},
+		{
+			.addr	= 0x20,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(mock_read_buf),
+			.buf	= mock_read_buf
+		}
+	};
+	int rc;
+
+	expect_write_read(&mock_dev, msgs);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_write_read_verify(&mock_dev, 0x20, &mock_reg,
+				    sizeof(mock_reg), mock_read_buf,
+				    sizeof(mock_read_buf), I2CD_VERIFY_PEC);
+
+	assert_int_equal(rc, 2);
+
+	mock_read_buf[2] ^= 0x01;
+	expect_write_read(&mock_dev, msgs);
+
+	/* Check behavior when PEC does not match */
+	rc = i2cd_write_read_verify(&mock_dev, 0x20, &mock_reg,
+				    sizeof(mock_reg), mock_read_buf,
+				    sizeof(mock_read_buf), I2CD_VERIFY_PEC);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EBADMSG);
+}
+
+void test_i2cd_write_read_verify_words(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_cmd[] = {0x24, 0x00};
+	uint8_t mock_read_buf[] = {0xbe, 0xef, 0x92, 0x12, 0x34, 0x36};
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x44,
+			.flags	= 0,
+			.len	= sizeof(mock_cmd),
+			.buf	= mock_cmd
+		},
+		{
+			.addr	= 0x44,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(mock_read_buf),
+			.buf	= mock_read_buf
+		}
+	};
+	int rc;
+
+	expect_write_read(&mock_dev, msgs);
+
+	/* Check behavior when a word fails verification */
+	rc = i2cd_write_read_verify(&mock_dev, 0x44, mock_cmd,
+				    sizeof(mock_cmd), mock_read_buf,
+				    sizeof(mock_read_buf), I2CD_VERIFY_WORDS);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EBADMSG);
+
+	/* Check behavior when length is invalid; no transfer is made */
+	rc = i2cd_write_read_verify(&mock_dev, 0x44, mock_cmd,
+				    sizeof(mock_cmd), mock_read_buf, 4,
+				    I2CD_VERIFY_WORDS);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_pec_update),
+		cmocka_unit_test(test_i2cd_verify_words),
+		cmocka_unit_test(test_i2cd_write_read_verify_pec),
+		cmocka_unit_test(test_i2cd_write_read_verify_words),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static uint8_t mock_reg_buf[] = {0x10, 0x01};
+static uint8_t mock_cfg_buf[] = {0x20, 0x02, 0x03};
+
+static const struct i2c_msg mock_msgs[] = {
+	{
+		.addr	= 0,
+		.flags	= 0,
+		.len	= sizeof(mock_reg_buf),
+		.buf	= mock_reg_buf
+	},
+	{
+		.addr	= 0,
+		.flags	= 0,
+		.len	= sizeof(mock_cfg_buf),
+		.buf	= mock_cfg_buf
+	}
+};
+
+static struct i2c_msg expect_msgs[64][2];
+
+int setup(void **state)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(expect_msgs); i++) {
+		expect_msgs[i][0] = mock_msgs[0];
+		expect_msgs[i][0].addr = 0x40 + i;
+		expect_msgs[i][1] = mock_msgs[1];
+		expect_msgs[i][1].addr = 0x40 + i;
+	}
+
+	mocks_enabled = true;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	mocks_enabled = false;
+	return 0;
+}
+
+static void expect_transfer(struct i2cd *dev, size_t first, size_t ntargets,
+		int rc)
+{
+	size_t i;
+
+	expect_value(mock_ioctl, fd, dev->fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	for (i = first; i < first + ntargets; i++) {
+		expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msgs[i][0]);
+		expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msgs[i][1]);
+	}
+	will_return(mock_ioctl, rc);
+	if (rc < 0)
+		will_return(mock_ioctl, ENXIO);
+}
+
+void test_i2cd_fanout_write(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2cd_fanout_target targets[25];
+	uint64_t status[I2CD_FANOUT_WORDS(ARRAY_SIZE(targets))];
+	size_t i;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		targets[i].dev = &mock_dev;
+		targets[i].addr = 0x40 + i;
+	}
+
+	/* At most 21 targets fit in a single request of two messages each */
+	expect_transfer(&mock_dev, 0, 21, 42);
+	expect_transfer(&mock_dev, 21, 4, 8);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_fanout_write(targets, ARRAY_SIZE(targets), mock_msgs,
+			       ARRAY_SIZE(mock_msgs), 0, status);
+
+	assert_int_equal(rc, ARRAY_SIZE(targets));
+	for (i = 0; i < ARRAY_SIZE(targets); i++)
+		assert_true(i2cd_fanout_succeeded(status, i));
+}
+
+void test_i2cd_fanout_write_multi(void **state)
+{
+	struct i2cd mock_devs[] = {
+		{.path = "/dev/i2c-0", .fd = 42},
+		{.path = "/dev/i2c-1", .fd = 43}
+	};
+	struct i2cd_fanout_target targets[4];
+	uint64_t status[I2CD_FANOUT_WORDS(ARRAY_SIZE(targets))];
+	size_t i;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		targets[i].dev = &mock_devs[i / 2];
+		targets[i].addr = 0x40 + i;
+	}
+
+	expect_transfer(&mock_devs[0], 0, 2, 4);
+	expect_transfer(&mock_devs[1], 2, 2, 4);
+
+	/* Check behavior when targets are on several adapters */
+	rc = i2cd_fanout_write(targets, ARRAY_SIZE(targets), mock_msgs,
+			       ARRAY_SIZE(mock_msgs), 0, status);
+
+	assert_int_equal(rc, ARRAY_SIZE(targets));
+	assert_int_equal(status[0], 0xf);
+}
+
+void test_i2cd_fanout_write_fail(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2cd_fanout_target targets[3];
+	uint64_t status[I2CD_FANOUT_WORDS(ARRAY_SIZE(targets))];
+	size_t i;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		targets[i].dev = &mock_dev;
+		targets[i].addr = 0x40 + i;
+	}
+
+	/* Targets before the one which failed are not written again */
+	expect_transfer(&mock_dev, 0, 3, -1);
+
+	/* Check behavior when a target does not acknowledge */
+	rc = i2cd_fanout_write(targets, ARRAY_SIZE(targets), mock_msgs,
+			       ARRAY_SIZE(mock_msgs), 0, status);
+
+	assert_int_equal(rc, 0);
+	assert_int_equal(errno, ENXIO);
+	assert_int_equal(status[0], 0);
+}
+
+void test_i2cd_fanout_write_replay(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2cd_fanout_target targets[3];
+	uint64_t status[I2CD_FANOUT_WORDS(ARRAY_SIZE(targets))];
+	size_t i;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		targets[i].dev = &mock_dev;
+		targets[i].addr = 0x40 + i;
+	}
+
+	expect_transfer(&mock_dev, 0, 3, -1);
+	expect_transfer(&mock_dev, 0, 1, 2);
+	expect_transfer(&mock_dev, 1, 1, -1);
+	expect_transfer(&mock_dev, 2, 1, 2);
+
+	/* Check behavior when failed requests are replayed */
+	rc = i2cd_fanout_write(targets, ARRAY_SIZE(targets), mock_msgs,
+			       ARRAY_SIZE(mock_msgs), I2CD_FANOUT_REPLAY,
+			       status);
+
+	assert_int_equal(rc, 2);
+	assert_int_equal(errno, ENXIO);
+	assert_true(i2cd_fanout_succeeded(status, 0));
+	assert_false(i2cd_fanout_succeeded(status, 1));
+	assert_true(i2cd_fanout_succeeded(status, 2));
+}
+
+void test_i2cd_fanout_write_fail_invalid(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2cd_fanout_target targets[] = {
+		{.dev = &mock_dev, .addr = 0x40}
+	};
+	uint8_t mock_buf[1];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(mock_buf),
+			.buf	= mock_buf
+		}
+	};
+	uint64_t status[1];
+	int rc;
+
+	/* Check behavior when a message is not a write */
+	rc = i2cd_fanout_write(targets, ARRAY_SIZE(targets), msgs,
+			       ARRAY_SIZE(msgs), 0, status);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_fanout_write),
+		cmocka_unit_test(test_i2cd_fanout_write_multi),
+		cmocka_unit_test(test_i2cd_fanout_write_fail),
+		cmocka_unit_test(test_i2cd_fanout_write_replay),
+		cmocka_unit_test(test_i2cd_fanout_write_fail_invalid),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
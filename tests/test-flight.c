@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "fake-dev.h"
+
+#define NTHREADS	8
+
+/* Reads return the register address followed by the number of transfers */
+static int fill_reg(struct i2c_rdwr_ioctl_data *msgset, unsigned long n)
+{
+	if (msgset->nmsgs != 2) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	memset(msgset->msgs[1].buf, 0, msgset->msgs[1].len);
+	msgset->msgs[1].buf[0] = msgset->msgs[0].buf[0];
+	msgset->msgs[1].buf[1] = n;
+	return 2;
+}
+
+struct reader {
+	pthread_t thread;
+	struct i2cd *dev;
+	uint8_t reg;
+	uint8_t buf[2];
+	int rc;
+	int error;
+};
+
+static void *reader_run(void *arg)
+{
+	struct reader *reader = arg;
+
+	reader->rc = i2cd_flight_read(reader->dev, 0x20, reader->reg,
+				      reader->buf, sizeof(reader->buf), 0);
+	reader->error = errno;
+	return NULL;
+}
+
+/* Start readers while the first transfer is held, then release it */
+static void run_readers(struct reader readers[], size_t nreaders)
+{
+	struct timespec poll = {.tv_nsec = 1000000};
+	struct timespec ts = {.tv_nsec = 100000000};
+	size_t i;
+
+	atomic_store(&fake_hold, true);
+	atomic_store(&fake_entered, false);
+
+	assert_int_equal(pthread_create(&readers[0].thread, NULL, reader_run,
+					&readers[0]), 0);
+	while (!atomic_load(&fake_entered))
+		nanosleep(&poll, NULL);
+
+	for (i = 1; i < nreaders; i++)
+		assert_int_equal(pthread_create(&readers[i].thread, NULL,
+						reader_run, &readers[i]), 0);
+
+	nanosleep(&ts, NULL);
+	atomic_store(&fake_hold, false);
+
+	for (i = 0; i < nreaders; i++)
+		pthread_join(readers[i].thread, NULL);
+}
+
+static struct i2cd *open_dev(unsigned long fresh_us)
+{
+	struct i2cd *dev;
+
+	fake_reset();
+	fake_set_hook(fill_reg);
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+	assert_return_code(i2cd_flight_enable(dev, fresh_us), 0);
+
+	return dev;
+}
+
+void test_i2cd_flight_read(void **state)
+{
+	struct reader readers[NTHREADS];
+	struct i2cd *dev;
+	size_t i;
+
+	dev = open_dev(0);
+
+	for (i = 0; i < NTHREADS; i++) {
+		readers[i].dev = dev;
+		readers[i].reg = 0x10;
+	}
+
+	/* Check behavior when identical reads are in flight */
+	run_readers(readers, NTHREADS);
+
+	assert_int_equal(atomic_load(&fake_transfers), 1);
+	for (i = 0; i < NTHREADS; i++) {
+		assert_int_equal(readers[i].rc, 2);
+		assert_int_equal(readers[i].buf[0], 0x10);
+		assert_int_equal(readers[i].buf[1], 1);
+	}
+
+	i2cd_close(dev);
+}
+
+void test_i2cd_flight_read_distinct(void **state)
+{
+	struct reader readers[2];
+	struct i2cd *dev;
+
+	dev = open_dev(0);
+
+	readers[0].dev = dev;
+	readers[0].reg = 0x10;
+	readers[1].dev = dev;
+	readers[1].reg = 0x11;
+
+	/* Check behavior when reads are of different registers */
+	run_readers(readers, 2);
+
+	assert_int_equal(atomic_load(&fake_transfers), 2);
+	assert_int_equal(readers[0].buf[0], 0x10);
+	assert_int_equal(readers[1].buf[0], 0x11);
+
+	i2cd_close(dev);
+}
+
+void test_i2cd_flight_read_fresh(void **state)
+{
+	struct i2cd *dev;
+	uint8_t buf[2];
+
+	dev = open_dev(60000000);
+
+	assert_int_equal(i2cd_flight_read(dev, 0x20, 0x10, buf, sizeof(buf), 0),
+			 2);
+
+	/* Check behavior when result is fresh */
+	assert_int_equal(i2cd_flight_read(dev, 0x20, 0x10, buf, sizeof(buf), 0),
+			 2);
+
+	assert_int_equal(atomic_load(&fake_transfers), 1);
+	assert_int_equal(buf[1], 1);
+
+	/* Check behavior when result is invalidated */
+	i2cd_flight_invalidate(dev, 0x20);
+	assert_int_equal(i2cd_flight_read(dev, 0x20, 0x10, buf, sizeof(buf), 0),
+			 2);
+
+	assert_int_equal(atomic_load(&fake_transfers), 2);
+	assert_int_equal(buf[1], 2);
+
+	/* Check behavior when the handle has been reopened */
+	dev->gen++;
+	assert_int_equal(i2cd_flight_read(dev, 0x20, 0x10, buf, sizeof(buf), 0),
+			 2);
+
+	assert_int_equal(atomic_load(&fake_transfers), 3);
+	assert_int_equal(buf[1], 3);
+
+	i2cd_close(dev);
+}
+
+void test_i2cd_flight_read_invalidate(void **state)
+{
+	struct timespec poll = {.tv_nsec = 1000000};
+	struct reader reader = {.reg = 0x10};
+	struct i2cd *dev;
+	uint8_t buf[2];
+
+	dev = open_dev(60000000);
+	reader.dev = dev;
+
+	atomic_store(&fake_hold, true);
+	atomic_store(&fake_entered, false);
+
+	assert_int_equal(pthread_create(&reader.thread, NULL, reader_run,
+					&reader), 0);
+	while (!atomic_load(&fake_entered))
+		nanosleep(&poll, NULL);
+
+	/* Check behavior when result is invalidated while in flight */
+	i2cd_flight_invalidate(dev, 0x20);
+	atomic_store(&fake_hold, false);
+	pthread_join(reader.thread, NULL);
+
+	assert_int_equal(reader.rc, 2);
+	assert_int_equal(reader.buf[1], 1);
+
+	assert_int_equal(i2cd_flight_read(dev, 0x20, 0x10, buf, sizeof(buf), 0),
+			 2);
+	assert_int_equal(atomic_load(&fake_transfers), 2);
+	assert_int_equal(buf[1], 2);
+
+	i2cd_close(dev);
+}
+
+void test_i2cd_flight_read_fail(void **state)
+{
+	struct reader readers[NTHREADS];
+	struct i2cd *dev;
+	uint8_t buf[2];
+	size_t i;
+
+	dev = open_dev(60000000);
+
+	for (i = 0; i < NTHREADS; i++) {
+		readers[i].dev = dev;
+		readers[i].reg = 0x10;
+	}
+
+	/* Check behavior when the shared read fails */
+	fake_set_error(-1, ENXIO);
+	run_readers(readers, NTHREADS);
+
+	assert_int_equal(atomic_load(&fake_transfers), 1);
+	for (i = 0; i < NTHREADS; i++) {
+		assert_int_equal(readers[i].rc, -1);
+		assert_int_equal(readers[i].error, ENXIO);
+	}
+
+	/* Failed results are not fresh */
+	fake_set_error(-1, 0);
+	assert_int_equal(i2cd_flight_read(dev, 0x20, 0x10, buf, sizeof(buf), 0),
+			 2);
+	assert_int_equal(atomic_load(&fake_transfers), 2);
+
+	i2cd_close(dev);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_flight_read),
+		cmocka_unit_test(test_i2cd_flight_read_distinct),
+		cmocka_unit_test(test_i2cd_flight_read_fresh),
+		cmocka_unit_test(test_i2cd_flight_read_invalidate),
+		cmocka_unit_test(test_i2cd_flight_read_fail),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
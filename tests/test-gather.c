@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static uint8_t mock_reg_buf[] = {0x10};
+
+/* Each target returns a block of its address and index */
+static uint8_t mock_data[64][4];
+static struct i2c_msg expect_msgs[64][2];
+
+int setup(void **state)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(expect_msgs); i++) {
+		mock_data[i][0] = 0x80 | i;
+		mock_data[i][1] = 0x40 + i;
+		mock_data[i][2] = i;
+		mock_data[i][3] = 0x01;
+
+		expect_msgs[i][0].addr = 0x40 + i;
+		expect_msgs[i][0].flags = 0;
+		expect_msgs[i][0].len = sizeof(mock_reg_buf);
+		expect_msgs[i][0].buf = mock_reg_buf;
+
+		expect_msgs[i][1].addr = 0x40 + i;
+		expect_msgs[i][1].flags = I2C_M_RD;
+		expect_msgs[i][1].len = sizeof(mock_data[i]);
+		expect_msgs[i][1].buf = mock_data[i];
+	}
+
+	mocks_enabled = true;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	mocks_enabled = false;
+	return 0;
+}
+
+static void expect_transfer(struct i2cd *dev, size_t first, size_t ntargets,
+		int rc)
+{
+	size_t i;
+
+	expect_value(mock_ioctl, fd, dev->fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	for (i = first; i < first + ntargets; i++) {
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i][0]);
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i][1]);
+	}
+	will_return(mock_ioctl, rc);
+	if (rc < 0)
+		will_return(mock_ioctl, ENXIO);
+}
+
+static void init_targets(struct i2cd_fanout_target targets[], size_t ntargets,
+		struct i2cd *dev)
+{
+	size_t i;
+
+	for (i = 0; i < ntargets; i++) {
+		targets[i].dev = dev;
+		targets[i].addr = 0x40 + i;
+	}
+}
+
+void test_i2cd_gather_read(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2cd_fanout_target targets[25];
+	uint16_t temp[ARRAY_SIZE(targets)], status[ARRAY_SIZE(targets)];
+	const struct i2cd_gather_field fields[] = {
+		{.offset = 0, .size = 2, .flags = I2CD_GATHER_BE, .array = temp},
+		{.offset = 2, .size = 2, .flags = 0, .array = status}
+	};
+	uint64_t valid[I2CD_FANOUT_WORDS(ARRAY_SIZE(targets))];
+	size_t i;
+	int rc;
+
+	init_targets(targets, ARRAY_SIZE(targets), &mock_dev);
+
+	/* At most 21 targets fit in a single request of two messages each */
+	expect_transfer(&mock_dev, 0, 21, 42);
+	expect_transfer(&mock_dev, 21, 4, 8);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_gather_read(targets, ARRAY_SIZE(targets), 0x10, 4,
+			      fields, ARRAY_SIZE(fields), 0, valid);
+
+	assert_int_equal(rc, ARRAY_SIZE(targets));
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		assert_true(i2cd_fanout_succeeded(valid, i));
+		assert_int_equal(temp[i], (0x80 | i) << 8 | (0x40 + i));
+		assert_int_equal(status[i], 0x0100 | i);
+	}
+}
+
+void test_i2cd_gather_read_multi(void **state)
+{
+	struct i2cd mock_devs[] = {
+		{.path = "/dev/i2c-0", .fd = 42},
+		{.path = "/dev/i2c-1", .fd = 43}
+	};
+	struct i2cd_fanout_target targets[4];
+	uint8_t id[ARRAY_SIZE(targets)];
+	uint32_t raw[ARRAY_SIZE(targets)];
+	const struct i2cd_gather_field fields[] = {
+		{.offset = 2, .size = 1, .flags = 0, .array = id},
+		{.offset = 0, .size = 4, .flags = I2CD_GATHER_BE, .array = raw}
+	};
+	uint64_t valid[I2CD_FANOUT_WORDS(ARRAY_SIZE(targets))];
+	size_t i;
+	int rc;
+
+	/* Targets on each adapter are interleaved */
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		targets[i].dev = &mock_devs[i % 2];
+		targets[i].addr = 0x40 + i;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mock_devs); i++) {
+		expect_value(mock_ioctl, fd, mock_devs[i].fd);
+		expect_value(mock_ioctl, request, I2C_RDWR);
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i][0]);
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i][1]);
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i + 2][0]);
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i + 2][1]);
+		will_return(mock_ioctl, 4);
+	}
+
+	/* Check behavior when targets are on several adapters */
+	rc = i2cd_gather_read(targets, ARRAY_SIZE(targets), 0x10, 4,
+			      fields, ARRAY_SIZE(fields), 0, valid);
+
+	assert_int_equal(rc, ARRAY_SIZE(targets));
+	assert_int_equal(valid[0], 0xf);
+	for (i = 0; i < ARRAY_SIZE(targets); i++) {
+		assert_int_equal(id[i], i);
+		assert_int_equal(raw[i], (uint32_t)(0x80 | i) << 24 |
+				 (0x40 + i) << 16 | i << 8 | 0x01);
+	}
+}
+
+void test_i2cd_gather_read_fail(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2cd_fanout_target targets[3];
+	uint8_t id[ARRAY_SIZE(targets)];
+	const struct i2cd_gather_field fields[] = {
+		{.offset = 2, .size = 1, .flags = 0, .array = id}
+	};
+	uint64_t valid[I2CD_FANOUT_WORDS(ARRAY_SIZE(targets))];
+	int rc;
+
+	init_targets(targets, ARRAY_SIZE(targets), &mock_dev);
+	memset(id, 0xff, sizeof(id));
+
+	expect_transfer(&mock_dev, 0, 3, -1);
+	expect_transfer(&mock_dev, 0, 1, 2);
+	expect_transfer(&mock_dev, 1, 1, -1);
+	expect_transfer(&mock_dev, 2, 1, 2);
+
+	/* Check behavior when a target does not acknowledge */
+	rc = i2cd_gather_read(targets, ARRAY_SIZE(targets), 0x10, 4,
+			      fields, ARRAY_SIZE(fields), 0, valid);
+
+	assert_int_equal(rc, 2);
+	assert_int_equal(errno, ENXIO);
+	assert_int_equal(valid[0], 0x5);
+	assert_int_equal(id[0], 0);
+	assert_int_equal(id[1], 0);
+	assert_int_equal(id[2], 2);
+}
+
+void test_i2cd_gather_read_fail_invalid(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2cd_fanout_target targets[1];
+	uint32_t raw[ARRAY_SIZE(targets)];
+	struct i2cd_gather_field fields[] = {
+		{.offset = 2, .size = 4, .flags = 0, .array = raw}
+	};
+	uint64_t valid[1];
+	int rc;
+
+	init_targets(targets, ARRAY_SIZE(targets), &mock_dev);
+
+	/* Check behavior when a field is outside the register block */
+	rc = i2cd_gather_read(targets, ARRAY_SIZE(targets), 0x10, 4,
+			      fields, ARRAY_SIZE(fields), 0, valid);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+
+	/* Check behavior when a field has an unsupported size */
+	fields[0].offset = 0;
+	fields[0].size = 3;
+	rc = i2cd_gather_read(targets, ARRAY_SIZE(targets), 0x10, 4,
+			      fields, ARRAY_SIZE(fields), 0, valid);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_gather_read),
+		cmocka_unit_test(test_i2cd_gather_read_multi),
+		cmocka_unit_test(test_i2cd_gather_read_fail),
+		cmocka_unit_test(test_i2cd_gather_read_fail_invalid),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
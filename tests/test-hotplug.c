@@ -0,0 +1,395 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42, .bind_fd = -1};
+
+/*
+ * Uevents are sent by the test through one end of a socket pair; sysfs is
+ * stood in for by a temporary directory containing the name of adapter
+ * i2c-7. Mocks are only enabled while events are processed.
+ */
+struct fake_kernel {
+	int fds[2];
+	char sysfs_path[64];
+	struct i2cd_hotplug *hotplug;
+};
+
+static void fake_send(struct fake_kernel *kernel, const char *action,
+		const char *subsystem, const char *devname)
+{
+	char buf[512];
+	int len;
+
+	len = snprintf(buf, sizeof(buf),
+		       "%s@/devices/virtual/i2c-dev/%s%c"
+		       "ACTION=%s%cDEVPATH=/devices/virtual/i2c-dev/%s%c"
+		       "SUBSYSTEM=%s%cDEVNAME=%s%cSEQNUM=1",
+		       action, devname, '\0', action, '\0', devname, '\0',
+		       subsystem, '\0', devname, '\0');
+	assert_int_equal(send(kernel->fds[1], buf, len + 1, 0), len + 1);
+}
+
+static int fake_process(struct fake_kernel *kernel)
+{
+	int rc;
+
+	mocks_enabled = true;
+	rc = i2cd_hotplug_process(kernel->hotplug);
+	mocks_enabled = false;
+
+	return rc;
+}
+
+int setup(void **state)
+{
+	static struct fake_kernel kernel;
+	char path[PATH_MAX];
+	const char *dirs[] = {
+		"", "/class", "/class/i2c-dev", "/class/i2c-dev/i2c-7"
+	};
+	size_t i;
+	FILE *fp;
+
+	snprintf(kernel.sysfs_path, sizeof(kernel.sysfs_path),
+		 "/tmp/test-hotplug-%d", (int)getpid());
+
+	for (i = 0; i < ARRAY_SIZE(dirs); i++) {
+		snprintf(path, sizeof(path), "%s%s", kernel.sysfs_path,
+			 dirs[i]);
+		if (mkdir(path, 0700) < 0)
+			return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/class/i2c-dev/i2c-7/name",
+		 kernel.sysfs_path);
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	fputs("usb-bridge\n", fp);
+	fclose(fp);
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, kernel.fds) < 0)
+		return -1;
+
+	kernel.hotplug = i2cd_hotplug_new_fd(kernel.fds[0], kernel.sysfs_path);
+	if (kernel.hotplug == NULL)
+		return -1;
+
+	*state = &kernel;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	struct fake_kernel *kernel = *state;
+	char path[PATH_MAX];
+	const char *dirs[] = {
+		"/class/i2c-dev/i2c-7/name", "/class/i2c-dev/i2c-7",
+		"/class/i2c-dev", "/class", ""
+	};
+	size_t i;
+
+	i2cd_hotplug_free(kernel->hotplug);
+	close(kernel->fds[1]);
+
+	for (i = 0; i < ARRAY_SIZE(dirs); i++) {
+		snprintf(path, sizeof(path), "%s%s", kernel->sysfs_path,
+			 dirs[i]);
+		remove(path);
+	}
+	return 0;
+}
+
+int setup_dev(void **state)
+{
+	struct fake_kernel *kernel = *state;
+
+	mock_dev.flags = 0;
+	mock_dev.bind_fd = -1;
+	return i2cd_hotplug_watch(kernel->hotplug, &mock_dev, NULL);
+}
+
+int teardown_dev(void **state)
+{
+	struct fake_kernel *kernel = *state;
+
+	i2cd_hotplug_unwatch(kernel->hotplug, &mock_dev);
+	return 0;
+}
+
+void test_i2cd_hotplug_remove(void **state)
+{
+	struct fake_kernel *kernel = *state;
+	uint8_t buf[1];
+	int rc;
+
+	/* Check behavior when another adapter or subsystem is removed */
+	fake_send(kernel, "remove", "i2c-dev", "i2c-1");
+	fake_send(kernel, "remove", "tty", "i2c-0");
+	rc = fake_process(kernel);
+
+	assert_int_equal(rc, 0);
+	assert_false(i2cd_hotplug_is_stale(&mock_dev));
+
+	/* Check behavior when function succeeds */
+	fake_send(kernel, "remove", "i2c-dev", "i2c-0");
+	rc = fake_process(kernel);
+
+	assert_int_equal(rc, 1);
+	assert_true(i2cd_hotplug_is_stale(&mock_dev));
+
+	/* Check behavior when handle is stale; no ioctl is issued */
+	mocks_enabled = true;
+	rc = i2cd_write(&mock_dev, 0x20, buf, sizeof(buf));
+	mocks_enabled = false;
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, ENODEV);
+
+	mocks_enabled = true;
+	rc = i2cd_set_retries(&mock_dev, 1);
+	mocks_enabled = false;
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, ENODEV);
+}
+
+void test_i2cd_hotplug_reopen(void **state)
+{
+	struct fake_kernel *kernel = *state;
+	unsigned int gen = mock_dev.gen;
+	int rc;
+
+	mock_dev.flags = I2CD_F_RETRIES | I2CD_F_TIMEOUT | I2CD_F_FUNCS |
+			 I2CD_F_FREQ | I2CD_F_BOUND | I2CD_F_STALE;
+	mock_dev.bind_fd = 44;
+	mock_dev.bound = 0x20;
+	mock_dev.retries = 3;
+	mock_dev.timeout = 100;
+
+	fake_send(kernel, "add", "i2c-dev", "i2c-0");
+
+	expect_string(mock_open, pathname, "/dev/i2c-0");
+	expect_value(mock_open, flags, O_RDWR);
+	will_return(mock_open, 43);
+
+	expect_value(mock_dup2, oldfd, 43);
+	expect_value(mock_dup2, newfd, mock_dev.fd);
+	will_return(mock_dup2, mock_dev.fd);
+
+	expect_value(mock_close, fd, 43);
+	will_return(mock_close, 0);
+
+	/* The address of a bound handle is set before it is replaced */
+	expect_string(mock_open, pathname, "/dev/i2c-0");
+	expect_value(mock_open, flags, O_RDWR);
+	will_return(mock_open, 45);
+
+	expect_value(mock_ioctl, fd, 45);
+	expect_value(mock_ioctl, request, I2C_SLAVE);
+	expect_value(mock_ioctl, addr, 0x20);
+	will_return(mock_ioctl, 0);
+
+	expect_value(mock_dup2, oldfd, 45);
+	expect_value(mock_dup2, newfd, mock_dev.bind_fd);
+	will_return(mock_dup2, mock_dev.bind_fd);
+
+	expect_value(mock_close, fd, 45);
+	will_return(mock_close, 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RETRIES);
+	expect_value(mock_ioctl, retries, 3);
+	will_return(mock_ioctl, 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_TIMEOUT);
+	expect_value(mock_ioctl, timeout, 100);
+	will_return(mock_ioctl, 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_FUNCS);
+	expect_value(mock_ioctl, funcs, &mock_dev.funcs);
+	will_return(mock_ioctl, I2C_FUNC_I2C);
+	will_return(mock_ioctl, 0);
+
+	/* Check behavior when function succeeds */
+	rc = fake_process(kernel);
+
+	assert_int_equal(rc, 1);
+	assert_false(i2cd_hotplug_is_stale(&mock_dev));
+	assert_string_equal(i2cd_get_path(&mock_dev), "/dev/i2c-0");
+	assert_int_equal(mock_dev.funcs, I2C_FUNC_I2C);
+	assert_int_equal(mock_dev.gen, gen + 1);
+
+	/* Cached state which depends on the open file is discarded */
+	assert_int_equal(mock_dev.flags, I2CD_F_RETRIES | I2CD_F_TIMEOUT |
+			 I2CD_F_FUNCS | I2CD_F_BOUND);
+}
+
+void test_i2cd_hotplug_reopen_by_name(void **state)
+{
+	struct fake_kernel *kernel = *state;
+	struct i2cd_old_path old;
+	char *path;
+	int rc;
+
+	i2cd_hotplug_unwatch(kernel->hotplug, &mock_dev);
+	assert_return_code(i2cd_hotplug_watch(kernel->hotplug, &mock_dev,
+					      "usb-bridge"), 0);
+
+	mock_dev.flags = I2CD_F_STALE;
+	path = strdup("/dev/i2c-7");
+	assert_non_null(path);
+
+	/* Check behavior when the adapter name does not match */
+	fake_send(kernel, "add", "i2c-dev", "i2c-3");
+	rc = fake_process(kernel);
+
+	assert_int_equal(rc, 0);
+	assert_true(i2cd_hotplug_is_stale(&mock_dev));
+
+	fake_send(kernel, "add", "i2c-dev", "i2c-7");
+
+	expect_value(mock_calloc, nmemb, 1);
+	expect_value(mock_calloc, size, sizeof(old));
+	will_return(mock_calloc, &old);
+
+	expect_string(mock_strdup, s, "/dev/i2c-7");
+	will_return(mock_strdup, path);
+
+	expect_string(mock_open, pathname, "/dev/i2c-7");
+	expect_value(mock_open, flags, O_RDWR);
+	will_return(mock_open, 43);
+
+	expect_value(mock_dup2, oldfd, 43);
+	expect_value(mock_dup2, newfd, mock_dev.fd);
+	will_return(mock_dup2, mock_dev.fd);
+
+	expect_value(mock_close, fd, 43);
+	will_return(mock_close, 0);
+
+	/* Check behavior when adapter returns with a different number */
+	rc = fake_process(kernel);
+
+	assert_int_equal(rc, 1);
+	assert_false(i2cd_hotplug_is_stale(&mock_dev));
+	assert_string_equal(i2cd_get_path(&mock_dev), "/dev/i2c-7");
+	assert_int_equal(i2cd_fileno(&mock_dev), mock_dev.fd);
+
+	/* The old path remains valid until the handle is closed */
+	assert_ptr_equal(mock_dev.old_paths, &old);
+	assert_string_equal(old.path, "/dev/i2c-0");
+
+	free(mock_dev.path);
+	mock_dev.path = "/dev/i2c-0";
+	mock_dev.old_paths = NULL;
+}
+
+void test_i2cd_hotplug_reopen_fail(void **state)
+{
+	struct fake_kernel *kernel = *state;
+	int rc;
+
+	mock_dev.flags = I2CD_F_STALE;
+
+	fake_send(kernel, "add", "i2c-dev", "i2c-0");
+
+	expect_string(mock_open, pathname, "/dev/i2c-0");
+	expect_value(mock_open, flags, O_RDWR);
+	will_return(mock_open, -1);
+
+	/* Check behavior when the adapter cannot be opened */
+	rc = fake_process(kernel);
+
+	assert_int_equal(rc, 0);
+	assert_true(i2cd_hotplug_is_stale(&mock_dev));
+
+	expect_string(mock_open, pathname, "/dev/i2c-0");
+	expect_value(mock_open, flags, O_RDWR);
+	will_return(mock_open, 43);
+
+	expect_value(mock_dup2, oldfd, 43);
+	expect_value(mock_dup2, newfd, mock_dev.fd);
+	will_return(mock_dup2, mock_dev.fd);
+
+	expect_value(mock_close, fd, 43);
+	will_return(mock_close, 0);
+
+	/* Check behavior when a later attempt succeeds without an event */
+	rc = fake_process(kernel);
+
+	assert_int_equal(rc, 1);
+	assert_false(i2cd_hotplug_is_stale(&mock_dev));
+
+	/* Nothing is attempted once the handle has been reopened */
+	rc = fake_process(kernel);
+
+	assert_int_equal(rc, 0);
+}
+
+void test_i2cd_hotplug_watch_fail(void **state)
+{
+	struct fake_kernel *kernel = *state;
+
+	/* Check behavior when handle is already watched */
+	assert_int_equal(i2cd_hotplug_watch(kernel->hotplug, &mock_dev, NULL),
+			 -1);
+	assert_int_equal(errno, EEXIST);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_i2cd_hotplug_remove,
+						setup_dev, teardown_dev),
+		cmocka_unit_test_setup_teardown(test_i2cd_hotplug_reopen,
+						setup_dev, teardown_dev),
+		cmocka_unit_test_setup_teardown(
+			test_i2cd_hotplug_reopen_by_name, setup_dev,
+			teardown_dev),
+		cmocka_unit_test_setup_teardown(test_i2cd_hotplug_reopen_fail,
+						setup_dev, teardown_dev),
+		cmocka_unit_test_setup_teardown(test_i2cd_hotplug_watch_fail,
+						setup_dev, teardown_dev),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
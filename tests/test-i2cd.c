@@ -18,6 +18,7 @@
 
 #include "i2cd-private.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <setjmp.h>
 #include <stdarg.h>
@@ -31,18 +32,6 @@
 
 #include "mocks.h"
 
-int check_i2c_msg(const LargestIntegralType value,
-		const LargestIntegralType check_value)
-{
-	struct i2c_msg *msg_value = (struct i2c_msg *)(uintptr_t)value;
-	struct i2c_msg *msg_check = (struct i2c_msg *)(uintptr_t)check_value;
-
-	return (msg_value->addr == msg_check->addr) &&
-		(msg_value->flags == msg_check->flags) &&
-		(msg_value->len == msg_check->len) &&
-		(memcmp(msg_value->buf, msg_check->buf, msg_check->len) == 0);
-}
-
 int setup(void **state)
 {
 	mocks_enabled = true;
@@ -192,11 +181,14 @@ void test_i2cd_open_fail_open(void **state)
 
 void test_i2cd_close(void **state)
 {
-	struct i2cd mock_dev = {"/dev/i2c-0", 42};
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42, .bind_fd = 43};
 
 	expect_value(mock_close, fd, mock_dev.fd);
 	will_return(mock_close, 0);
 
+	expect_value(mock_close, fd, mock_dev.bind_fd);
+	will_return(mock_close, 0);
+
 	expect_value(mock_free, ptr, mock_dev.path);
 	expect_value(mock_free, ptr, &mock_dev);
 
@@ -206,7 +198,7 @@ void test_i2cd_close(void **state)
 
 void test_i2cd_set_retries(void **state)
 {
-	struct i2cd mock_dev = {"/dev/i2c-0", 42};
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
 	unsigned long mock_retries = 3;
 	int rc;
 
@@ -219,11 +211,13 @@ void test_i2cd_set_retries(void **state)
 	rc = i2cd_set_retries(&mock_dev, mock_retries);
 
 	assert_return_code(rc, 0);
+	assert_true(mock_dev.flags & I2CD_F_RETRIES);
+	assert_int_equal(mock_dev.retries, mock_retries);
 }
 
 void test_i2cd_set_timeout(void **state)
 {
-	struct i2cd mock_dev = {"/dev/i2c-0", 42};
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
 	unsigned long mock_timeout = 10;
 	int rc;
 
@@ -236,28 +230,178 @@ void test_i2cd_set_timeout(void **state)
 	rc = i2cd_set_timeout(&mock_dev, mock_timeout);
 
 	assert_return_code(rc, 0);
+	assert_true(mock_dev.flags & I2CD_F_TIMEOUT);
+	assert_int_equal(mock_dev.timeout, mock_timeout);
 }
 
 void test_i2cd_get_functionality(void **state)
 {
-	struct i2cd mock_dev = {"/dev/i2c-0", 42};
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
 	unsigned long mock_funcs;
 	int rc;
 
 	expect_value(mock_ioctl, fd, mock_dev.fd);
 	expect_value(mock_ioctl, request, I2C_FUNCS);
-	expect_value(mock_ioctl, funcs, &mock_funcs);
+	expect_value(mock_ioctl, funcs, &mock_dev.funcs);
+	will_return(mock_ioctl, I2C_FUNC_I2C);
 	will_return(mock_ioctl, 0);
 
 	/* Check behavior when function succeeds */
 	rc = i2cd_get_functionality(&mock_dev, &mock_funcs);
 
 	assert_return_code(rc, 0);
+	assert_int_equal(mock_funcs, I2C_FUNC_I2C);
+}
+
+void test_i2cd_get_functionality_cached(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	unsigned long mock_funcs;
+	int rc;
+
+	mock_dev.flags = I2CD_F_FUNCS;
+	mock_dev.funcs = I2C_FUNC_I2C;
+
+	/* Check behavior when functionality is cached */
+	rc = i2cd_get_functionality(&mock_dev, &mock_funcs);
+
+	assert_return_code(rc, 0);
+	assert_int_equal(mock_funcs, I2C_FUNC_I2C);
+}
+
+static void expect_slave(int fd, unsigned long request, uint16_t addr,
+		int rc, int error)
+{
+	expect_value(mock_ioctl, fd, fd);
+	expect_value(mock_ioctl, request, request);
+	expect_value(mock_ioctl, addr, addr);
+	will_return(mock_ioctl, rc);
+	if (rc < 0)
+		will_return(mock_ioctl, error);
+}
+
+void test_i2cd_bind(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42, .bind_fd = -1};
+	int rc;
+
+	expect_string(mock_open, pathname, "/dev/i2c-0");
+	expect_value(mock_open, flags, O_RDWR);
+	will_return(mock_open, 43);
+
+	expect_slave(43, I2C_SLAVE_FORCE, 0x20, 0, 0);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_bind(&mock_dev, 0x20, I2CD_BIND_FORCE);
+
+	assert_return_code(rc, 0);
+	assert_true(mock_dev.flags & I2CD_F_BOUND);
+	assert_true(mock_dev.flags & I2CD_F_FORCE);
+	assert_int_equal(mock_dev.bound, 0x20);
+	assert_int_equal(mock_dev.bind_fd, 43);
+
+	/* Check behavior when address is already set */
+	rc = i2cd_bind(&mock_dev, 0x20, I2CD_BIND_FORCE);
+
+	assert_return_code(rc, 0);
+
+	/* Check behavior when address changes; the file is not reopened */
+	expect_slave(43, I2C_SLAVE, 0x21, 0, 0);
+
+	rc = i2cd_bind(&mock_dev, 0x21, 0);
+
+	assert_return_code(rc, 0);
+	assert_false(mock_dev.flags & I2CD_F_FORCE);
+	assert_int_equal(mock_dev.bound, 0x21);
+
+	i2cd_unbind(&mock_dev);
+
+	assert_false(mock_dev.flags & I2CD_F_BOUND);
+	assert_int_equal(mock_dev.bind_fd, 43);
+}
+
+void test_i2cd_bind_fail_busy(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42, .bind_fd = 43};
+	int rc;
+
+	expect_slave(43, I2C_SLAVE, 0x20, -1, EBUSY);
+
+	/* Check behavior when address is in use by a kernel driver */
+	rc = i2cd_bind(&mock_dev, 0x20, 0);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EBUSY);
+	assert_false(mock_dev.flags & I2CD_F_BOUND);
+}
+
+void test_i2cd_read_bound(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42, .bind_fd = 43};
+	uint8_t mock_buf[8];
+	int rc;
+
+	mock_dev.flags = I2CD_F_BOUND;
+	mock_dev.bound = 0x20;
+
+	expect_value(mock_read, fd, mock_dev.bind_fd);
+	expect_value(mock_read, count, sizeof(mock_buf));
+	will_return(mock_read, sizeof(mock_buf));
+
+	expect_value(mock_read, fd, mock_dev.bind_fd);
+	expect_value(mock_read, count, sizeof(mock_buf));
+	will_return(mock_read, 4);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_read(&mock_dev, 0x20, mock_buf, sizeof(mock_buf));
+
+	assert_int_equal(rc, 1);
+
+	/* Check behavior when fewer bytes are read */
+	rc = i2cd_read(&mock_dev, 0x20, mock_buf, sizeof(mock_buf));
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EIO);
+}
+
+void test_i2cd_write_bound(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42, .bind_fd = 43};
+	uint8_t mock_buf[8];
+	struct i2c_msg expect_msg = {
+		.addr	= 0x21,
+		.flags	= 0,
+		.len	= sizeof(mock_buf),
+		.buf	= mock_buf
+	};
+	int rc;
+
+	mock_dev.flags = I2CD_F_BOUND;
+	mock_dev.bound = 0x20;
+
+	expect_value(mock_write, fd, mock_dev.bind_fd);
+	expect_value(mock_write, count, sizeof(mock_buf));
+	will_return(mock_write, sizeof(mock_buf));
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_write(&mock_dev, 0x20, mock_buf, sizeof(mock_buf));
+
+	assert_int_equal(rc, 1);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msg);
+	will_return(mock_ioctl, 1);
+
+	/* Check behavior when address is not bound */
+	rc = i2cd_write(&mock_dev, 0x21, mock_buf, sizeof(mock_buf));
+
+	assert_int_equal(rc, 1);
 }
 
 void test_i2cd_read(void **state)
 {
-	struct i2cd mock_dev = {"/dev/i2c-0", 42};
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
 	uint16_t mock_addr = 0x20;
 	uint8_t mock_buf[8];
 	struct i2c_msg expect_msg = {
@@ -281,7 +425,7 @@ void test_i2cd_read(void **state)
 
 void test_i2cd_write(void **state)
 {
-	struct i2cd mock_dev = {"/dev/i2c-0", 42};
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
 	uint16_t mock_addr = 0x20;
 	uint8_t mock_buf[8];
 	struct i2c_msg expect_msg = {
@@ -305,7 +449,7 @@ void test_i2cd_write(void **state)
 
 void test_i2cd_write_read(void **state)
 {
-	struct i2cd mock_dev = {"/dev/i2c-0", 42};
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
 	uint16_t mock_addr = 0x20;
 	uint8_t mock_write_buf[2], mock_read_buf[8];
 	struct i2c_msg expect_msgs[] = {
@@ -351,6 +495,11 @@ int main(void)
 		cmocka_unit_test(test_i2cd_set_retries),
 		cmocka_unit_test(test_i2cd_set_timeout),
 		cmocka_unit_test(test_i2cd_get_functionality),
+		cmocka_unit_test(test_i2cd_get_functionality_cached),
+		cmocka_unit_test(test_i2cd_bind),
+		cmocka_unit_test(test_i2cd_bind_fail_busy),
+		cmocka_unit_test(test_i2cd_read_bound),
+		cmocka_unit_test(test_i2cd_write_bound),
 		cmocka_unit_test(test_i2cd_read),
 		cmocka_unit_test(test_i2cd_write),
 		cmocka_unit_test(test_i2cd_write_read),
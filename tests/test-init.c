@@ -0,0 +1,269 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "fake-dev.h"
+
+#define NSEC_PER_MSEC	1000000ULL
+
+/* Each step writes a single byte, which identifies it in the log */
+static uint8_t step_bytes[] = {
+	0xa0, 0xa1, 0xa2, 0xa3, 0xb0, 0xb1, 0xb2, 0xb3, 0xc0, 0xc1
+};
+
+static struct i2c_msg step_msgs[ARRAY_SIZE(step_bytes)];
+
+int setup(void **state)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(step_bytes); i++) {
+		step_msgs[i].addr = 0x20 + i;
+		step_msgs[i].flags = 0;
+		step_msgs[i].len = 1;
+		step_msgs[i].buf = &step_bytes[i];
+	}
+	return 0;
+}
+
+static void init_steps(struct i2cd_init_step steps[], size_t first,
+		size_t nsteps, unsigned int delay_us)
+{
+	size_t i;
+
+	for (i = 0; i < nsteps; i++) {
+		steps[i].msgs = &step_msgs[first + i];
+		steps[i].nmsgs = 1;
+		steps[i].delay_us = delay_us;
+	}
+}
+
+void test_i2cd_init_interleave(void **state)
+{
+	struct i2cd_init_step a_steps[2], b_steps[3], c_steps[1];
+	struct i2cd_init *init;
+	struct i2cd *dev;
+	uint64_t status[1];
+	int a, c, rc;
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+
+	/* Sequence a waits 20 ms between steps; c depends on a */
+	init_steps(a_steps, 0, 2, 20000);
+	a_steps[1].delay_us = 0;
+	init_steps(b_steps, 4, 3, 0);
+	init_steps(c_steps, 8, 1, 0);
+
+	init = i2cd_init_new(3);
+	assert_non_null(init);
+
+	a = i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = dev, .steps = a_steps, .nsteps = 2});
+	i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = dev, .steps = b_steps, .nsteps = 3});
+	c = i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = dev, .steps = c_steps, .nsteps = 1});
+	assert_int_equal(c, 2);
+	assert_return_code(i2cd_init_depend(init, c, a), 0);
+
+	fake_reset();
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_init_run(init, status);
+
+	assert_int_equal(rc, 3);
+	assert_int_equal(status[0], 0x7);
+
+	/* Sequence b runs while sequence a waits */
+	assert_int_equal(atomic_load(&fake_nlog), 6);
+	assert_int_equal(fake_find(0xa0), 0);
+	assert_int_equal(fake_find(0xb0), 1);
+	assert_int_equal(fake_find(0xb2), 3);
+	assert_int_equal(fake_find(0xa1), 4);
+	assert_int_equal(fake_find(0xc0), 5);
+	assert_true(fake_log[4].start - fake_log[0].start >=
+		    20 * NSEC_PER_MSEC);
+
+	i2cd_init_free(init);
+	i2cd_close(dev);
+}
+
+void test_i2cd_init_parallel(void **state)
+{
+	struct i2cd_init_step a_steps[4], b_steps[4], c_steps[1];
+	struct i2cd_init *init;
+	struct i2cd *devs[2];
+	uint64_t start, elapsed;
+	int a, c, rc;
+
+	devs[0] = i2cd_open("/dev/i2c-0");
+	devs[1] = i2cd_open("/dev/i2c-1");
+	assert_non_null(devs[0]);
+	assert_non_null(devs[1]);
+
+	init_steps(a_steps, 0, 4, 0);
+	init_steps(b_steps, 4, 4, 0);
+	init_steps(c_steps, 8, 1, 0);
+
+	init = i2cd_init_new(3);
+	assert_non_null(init);
+
+	a = i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = devs[0], .steps = a_steps, .nsteps = 4});
+	i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = devs[1], .steps = b_steps, .nsteps = 4});
+	c = i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = devs[1], .steps = c_steps, .nsteps = 1});
+	assert_return_code(i2cd_init_depend(init, c, a), 0);
+
+	fake_reset();
+	fake_set_delay(-1, 10000);
+
+	/* Check behavior when sequences are on different adapters */
+	start = fake_now_ns();
+	rc = i2cd_init_run(init, NULL);
+	elapsed = fake_now_ns() - start;
+
+	assert_int_equal(rc, 3);
+	assert_int_equal(atomic_load(&fake_nlog), 9);
+	assert_int_equal(fake_log[fake_find(0xa0)].fd, devs[0]->fd);
+	assert_int_equal(fake_log[fake_find(0xb0)].fd, devs[1]->fd);
+
+	/* Dependencies are honored across adapters */
+	assert_true(fake_log[fake_find(0xc0)].start >=
+		    fake_log[fake_find(0xa3)].start + 10 * NSEC_PER_MSEC);
+
+	/* Transferred one after the other, this would take 90 ms */
+	assert_true(elapsed < 80 * NSEC_PER_MSEC);
+
+	i2cd_init_free(init);
+	i2cd_close(devs[1]);
+	i2cd_close(devs[0]);
+}
+
+void test_i2cd_init_fail(void **state)
+{
+	struct i2cd_init_step a_steps[2], b_steps[1], c_steps[1];
+	struct i2cd_init *init;
+	struct i2cd *dev;
+	uint64_t status[1];
+	int rc;
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+
+	init_steps(a_steps, 0, 2, 0);
+	init_steps(b_steps, 4, 1, 0);
+	init_steps(c_steps, 8, 1, 0);
+
+	init = i2cd_init_new(3);
+	assert_non_null(init);
+
+	i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = dev, .steps = a_steps, .nsteps = 2});
+	i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = dev, .steps = b_steps, .nsteps = 1});
+	i2cd_init_add(init, &(struct i2cd_init_seq){
+		.dev = dev, .steps = c_steps, .nsteps = 1});
+	assert_return_code(i2cd_init_depend(init, 1, 0), 0);
+
+	fake_reset();
+	fake_set_error(step_msgs[0].addr, EIO);
+
+	/* Check behavior when a sequence fails */
+	rc = i2cd_init_run(init, status);
+
+	assert_int_equal(rc, 1);
+	assert_int_equal(errno, EIO);
+	assert_int_equal(status[0], 0x4);
+	assert_int_equal(fake_find(0xa1), -1);
+	assert_int_equal(fake_find(0xb0), -1);
+	assert_int_not_equal(fake_find(0xc0), -1);
+
+	i2cd_init_free(init);
+	i2cd_close(dev);
+}
+
+void test_i2cd_init_fail_invalid(void **state)
+{
+	struct i2cd_init_step steps[1];
+	struct i2cd_init_seq seq = {.steps = steps, .nsteps = 1};
+	struct i2cd_init *init;
+	struct i2cd *dev;
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+
+	init_steps(steps, 0, 1, 0);
+	seq.dev = dev;
+
+	init = i2cd_init_new(3);
+	assert_non_null(init);
+
+	assert_int_equal(i2cd_init_add(init, &seq), 0);
+	assert_int_equal(i2cd_init_add(init, &seq), 1);
+	assert_int_equal(i2cd_init_add(init, &seq), 2);
+
+	/* Check behavior when engine is full */
+	assert_int_equal(i2cd_init_add(init, &seq), -1);
+	assert_int_equal(errno, ENOSPC);
+
+	/* Check behavior when sequence is out of range */
+	assert_int_equal(i2cd_init_depend(init, 0, 3), -1);
+	assert_int_equal(errno, EINVAL);
+
+	/* Check behavior when dependency creates a cycle */
+	assert_return_code(i2cd_init_depend(init, 1, 0), 0);
+	assert_return_code(i2cd_init_depend(init, 2, 1), 0);
+	assert_int_equal(i2cd_init_depend(init, 0, 2), -1);
+	assert_int_equal(errno, EDEADLK);
+	assert_int_equal(i2cd_init_depend(init, 0, 0), -1);
+	assert_int_equal(errno, EDEADLK);
+
+	i2cd_init_free(init);
+	i2cd_close(dev);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_init_interleave),
+		cmocka_unit_test(test_i2cd_init_parallel),
+		cmocka_unit_test(test_i2cd_init_fail),
+		cmocka_unit_test(test_i2cd_init_fail_invalid),
+	};
+
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
@@ -0,0 +1,265 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static uint64_t mock_mux[16];
+
+int setup(void **state)
+{
+	mocks_enabled = true;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	mocks_enabled = false;
+	return 0;
+}
+
+static struct i2cd_mux *new_mux(struct i2cd *dev, enum i2cd_mux_type type)
+{
+	struct i2cd_mux *mux;
+
+	expect_value(mock_calloc, nmemb, 1);
+	expect_any(mock_calloc, size);
+	will_return(mock_calloc, mock_mux);
+
+	mux = i2cd_mux_new(dev, 0x70, type);
+	assert_non_null(mux);
+
+	return mux;
+}
+
+static void expect_write(struct i2cd *dev, struct i2c_msg *msg)
+{
+	expect_value(mock_ioctl, fd, dev->fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, msg);
+	will_return(mock_ioctl, 1);
+}
+
+void test_i2cd_mux_new_fail_invalid(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	struct i2cd_mux *mux;
+
+	/* Check behavior when type is invalid */
+	mux = i2cd_mux_new(&mock_dev, 0x70, (enum i2cd_mux_type)99);
+
+	assert_null(mux);
+	assert_int_equal(errno, EINVAL);
+}
+
+void test_i2cd_mux_select(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t expect_ctrl = 0x08;
+	struct i2c_msg expect_msg = {
+		.addr	= 0x70,
+		.flags	= 0,
+		.len	= sizeof(expect_ctrl),
+		.buf	= &expect_ctrl
+	};
+	struct i2cd_mux *mux;
+	int rc;
+
+	mux = new_mux(&mock_dev, I2CD_MUX_PCA9548);
+	assert_int_equal(i2cd_mux_get_num_channels(mux), 8);
+
+	expect_write(&mock_dev, &expect_msg);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_mux_select(mux, 3);
+
+	assert_return_code(rc, 0);
+
+	/* Check behavior when channel is already selected */
+	rc = i2cd_mux_select(mux, 3);
+
+	assert_return_code(rc, 0);
+
+	expect_write(&mock_dev, &expect_msg);
+
+	/* Check behavior when selected channel is forgotten */
+	i2cd_mux_invalidate(mux);
+	rc = i2cd_mux_select(mux, 3);
+
+	assert_return_code(rc, 0);
+
+	expect_write(&mock_dev, &expect_msg);
+
+	/* Check behavior when the handle has been reopened */
+	mock_dev.gen++;
+	rc = i2cd_mux_select(mux, 3);
+
+	assert_return_code(rc, 0);
+
+	/* Check behavior when channel is out of range */
+	rc = i2cd_mux_select(mux, 8);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+}
+
+void test_i2cd_mux_select_mux(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t expect_ctrl = 0x06;
+	struct i2c_msg expect_msg = {
+		.addr	= 0x70,
+		.flags	= 0,
+		.len	= sizeof(expect_ctrl),
+		.buf	= &expect_ctrl
+	};
+	struct i2cd_mux *mux;
+	int rc;
+
+	mux = new_mux(&mock_dev, I2CD_MUX_PCA9544);
+
+	expect_write(&mock_dev, &expect_msg);
+
+	/* Check behavior when multiplexer encodes channel index */
+	rc = i2cd_mux_select(mux, 2);
+
+	assert_return_code(rc, 0);
+}
+
+void test_i2cd_mux_select_fail(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t expect_ctrl = 0x01;
+	struct i2c_msg expect_msg = {
+		.addr	= 0x70,
+		.flags	= 0,
+		.len	= sizeof(expect_ctrl),
+		.buf	= &expect_ctrl
+	};
+	struct i2cd_mux *mux;
+	int rc;
+
+	mux = new_mux(&mock_dev, I2CD_MUX_PCA9548);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msg);
+	will_return(mock_ioctl, -1);
+	will_return(mock_ioctl, ENXIO);
+
+	/* Check behavior when select fails */
+	rc = i2cd_mux_select(mux, 0);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, ENXIO);
+
+	expect_write(&mock_dev, &expect_msg);
+
+	/* Check behavior when selected channel is unknown after failure */
+	rc = i2cd_mux_select(mux, 0);
+
+	assert_return_code(rc, 0);
+}
+
+void test_i2cd_mux_transfer_batch(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t ctrl[3] = {0x02, 0x01, 0x04};
+	uint8_t buf[4] = {0x10, 0x11, 0x12, 0x13};
+	struct i2c_msg select_msgs[3], msgs[4];
+	struct i2cd_mux_op ops[] = {
+		{.channel = 0, .msgs = &msgs[0], .nmsgs = 1},
+		{.channel = 1, .msgs = &msgs[1], .nmsgs = 1},
+		{.channel = 2, .msgs = &msgs[2], .nmsgs = 1},
+		{.channel = 0, .msgs = &msgs[3], .nmsgs = 1},
+	};
+	struct i2cd_mux *mux;
+	size_t i;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(select_msgs); i++) {
+		select_msgs[i].addr = 0x70;
+		select_msgs[i].flags = 0;
+		select_msgs[i].len = 1;
+		select_msgs[i].buf = &ctrl[i];
+	}
+	for (i = 0; i < ARRAY_SIZE(msgs); i++) {
+		msgs[i].addr = 0x20;
+		msgs[i].flags = 0;
+		msgs[i].len = 1;
+		msgs[i].buf = &buf[i];
+	}
+
+	mux = new_mux(&mock_dev, I2CD_MUX_PCA9548);
+
+	expect_write(&mock_dev, &select_msgs[0]);
+	assert_return_code(i2cd_mux_select(mux, 1), 0);
+
+	/*
+	 * Operations on the selected channel are transferred first, followed
+	 * by the remaining channels in ascending order.
+	 */
+	expect_write(&mock_dev, &msgs[1]);
+	expect_write(&mock_dev, &select_msgs[1]);
+	expect_write(&mock_dev, &msgs[0]);
+	expect_write(&mock_dev, &msgs[3]);
+	expect_write(&mock_dev, &select_msgs[2]);
+	expect_write(&mock_dev, &msgs[2]);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_mux_transfer_batch(mux, ops, ARRAY_SIZE(ops));
+
+	assert_return_code(rc, 0);
+	for (i = 0; i < ARRAY_SIZE(ops); i++)
+		assert_int_equal(ops[i].rc, 1);
+}
+
+void test_i2cd_mux_free(void **state)
+{
+	struct i2cd_mux *mux = (struct i2cd_mux *)mock_mux;
+
+	expect_value(mock_free, ptr, mock_mux);
+
+	/* Check behavior when function succeeds */
+	i2cd_mux_free(mux);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_mux_new_fail_invalid),
+		cmocka_unit_test(test_i2cd_mux_select),
+		cmocka_unit_test(test_i2cd_mux_select_mux),
+		cmocka_unit_test(test_i2cd_mux_select_fail),
+		cmocka_unit_test(test_i2cd_mux_transfer_batch),
+		cmocka_unit_test(test_i2cd_mux_free),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
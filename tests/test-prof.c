@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "fake-dev.h"
+
+/* At 1 MHz, a one byte write takes 20 us on the wire */
+#define FAST_ADDR	0x20
+#define SLOW_ADDR	0x21
+#define SLOW_US		500
+
+struct callback_state {
+	unsigned int calls;
+	struct i2cd_prof_stats stats;
+};
+
+static void callback(struct i2cd *dev, const struct i2cd_prof_stats *stats,
+		void *arg)
+{
+	struct callback_state *cb = arg;
+
+	cb->calls++;
+	cb->stats = *stats;
+}
+
+static struct i2cd *open_dev(void)
+{
+	struct i2cd *dev;
+
+	fake_reset();
+	fake_set_delay(SLOW_ADDR, SLOW_US);
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+	assert_return_code(i2cd_set_bus_frequency(dev, 1000000), 0);
+
+	return dev;
+}
+
+static int write_byte(struct i2cd *dev, uint16_t addr)
+{
+	uint8_t buf = 0;
+
+	return i2cd_write(dev, addr, &buf, sizeof(buf));
+}
+
+void test_i2cd_prof_enable(void **state)
+{
+	struct i2cd_prof_attr attr;
+	struct i2cd_prof_stats stats;
+	struct i2cd *dev;
+	int rc;
+
+	dev = open_dev();
+
+	/* Check behavior when profiling is not enabled */
+	rc = i2cd_prof_get(dev, FAST_ADDR, 0, &stats);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+
+	/* Check behavior when attributes are invalid */
+	i2cd_prof_attr_init(&attr);
+	attr.alpha = 0;
+	rc = i2cd_prof_enable(dev, &attr);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+
+	i2cd_prof_attr_init(&attr);
+	attr.policy = -1;
+	rc = i2cd_prof_enable(dev, &attr);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_prof_enable(dev, NULL);
+
+	assert_return_code(rc, 0);
+	assert_int_equal(i2cd_prof_get(dev, FAST_ADDR, 0, &stats), -1);
+	assert_int_equal(errno, ENOENT);
+
+	i2cd_close(dev);
+}
+
+void test_i2cd_prof_latency(void **state)
+{
+	struct i2cd_prof_attr attr;
+	struct i2cd_prof_stats stats;
+	struct callback_state cb = {0};
+	struct i2cd *dev;
+	uint64_t total;
+	unsigned int i;
+
+	dev = open_dev();
+
+	i2cd_prof_attr_init(&attr);
+	attr.callback = callback;
+	attr.arg = &cb;
+	assert_return_code(i2cd_prof_enable(dev, &attr), 0);
+
+	for (i = 0; i < attr.min_count; i++) {
+		assert_return_code(write_byte(dev, FAST_ADDR), 0);
+		assert_return_code(write_byte(dev, SLOW_ADDR), 0);
+	}
+
+	/* Check behavior when slave device responds promptly */
+	assert_return_code(i2cd_prof_get(dev, FAST_ADDR, 0, &stats), 0);
+
+	assert_int_equal(stats.addr, FAST_ADDR);
+	assert_int_equal(stats.state, I2CD_PROF_OK);
+	assert_int_equal(stats.count, attr.min_count);
+
+	for (i = 0, total = 0; i < I2CD_PROF_BUCKETS; i++)
+		total += stats.hist[i];
+	assert_int_equal(total, stats.count);
+
+	/* Check behavior when slave device stretches the clock */
+	assert_return_code(i2cd_prof_get(dev, SLOW_ADDR, 0, &stats), 0);
+
+	assert_int_equal(stats.state, I2CD_PROF_DEGRADED);
+	assert_int_equal(stats.count, attr.min_count);
+	assert_int_equal(stats.outliers, attr.min_count);
+	assert_true(stats.max_ns >= SLOW_US * 1000);
+	assert_true(stats.ewma_ratio > attr.outlier_ratio);
+	assert_int_equal(stats.hist[0], 0);
+
+	assert_int_equal(cb.calls, 1);
+	assert_int_equal(cb.stats.addr, SLOW_ADDR);
+	assert_int_equal(cb.stats.state, I2CD_PROF_DEGRADED);
+
+	/* Check behavior when slave device recovers */
+	fake_set_delay(SLOW_ADDR, 0);
+	for (i = 0; i < 64 && cb.calls == 1; i++)
+		assert_return_code(write_byte(dev, SLOW_ADDR), 0);
+
+	assert_int_equal(cb.calls, 2);
+	assert_int_equal(cb.stats.state, I2CD_PROF_OK);
+
+	i2cd_close(dev);
+}
+
+void test_i2cd_prof_throttle(void **state)
+{
+	struct i2cd_prof_attr attr;
+	struct i2cd *dev;
+	unsigned int i;
+	int rc;
+
+	dev = open_dev();
+
+	i2cd_prof_attr_init(&attr);
+	attr.policy = I2CD_PROF_THROTTLE;
+	attr.throttle_ms = 60000;
+	assert_return_code(i2cd_prof_enable(dev, &attr), 0);
+
+	for (i = 0; i < attr.min_count; i++)
+		assert_return_code(write_byte(dev, SLOW_ADDR), 0);
+
+	/* Check behavior when slave device is throttled */
+	assert_return_code(write_byte(dev, SLOW_ADDR), 0);
+	rc = write_byte(dev, SLOW_ADDR);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EAGAIN);
+	assert_return_code(write_byte(dev, FAST_ADDR), 0);
+
+	i2cd_close(dev);
+}
+
+void test_i2cd_prof_isolate(void **state)
+{
+	struct i2cd_prof_attr attr;
+	struct i2cd_prof_stats stats;
+	struct i2cd *dev;
+	unsigned int i;
+	int rc;
+
+	dev = open_dev();
+
+	i2cd_prof_attr_init(&attr);
+	attr.policy = I2CD_PROF_ISOLATE;
+	assert_return_code(i2cd_prof_enable(dev, &attr), 0);
+
+	for (i = 0; i < attr.min_count; i++)
+		assert_return_code(write_byte(dev, SLOW_ADDR), 0);
+
+	/* Check behavior when slave device is isolated */
+	rc = write_byte(dev, SLOW_ADDR);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EHOSTDOWN);
+	assert_return_code(write_byte(dev, FAST_ADDR), 0);
+
+	/* Check behavior when slave device is reset */
+	assert_return_code(i2cd_prof_reset(dev, SLOW_ADDR, 0), 0);
+	assert_int_equal(i2cd_prof_get(dev, SLOW_ADDR, 0, &stats), -1);
+	assert_int_equal(errno, ENOENT);
+	assert_return_code(write_byte(dev, SLOW_ADDR), 0);
+
+	i2cd_close(dev);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_prof_enable),
+		cmocka_unit_test(test_i2cd_prof_latency),
+		cmocka_unit_test(test_i2cd_prof_throttle),
+		cmocka_unit_test(test_i2cd_prof_isolate),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,244 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "fake-dev.h"
+
+#define NTHREADS	4
+#define NTRANSFERS	1000
+#define NAK_ADDR	0x7f
+
+int setup(void **state)
+{
+	struct i2cd *dev;
+
+	fake_reset();
+	fake_set_error(NAK_ADDR, ENXIO);
+
+	dev = i2cd_open("/dev/i2c-0");
+	if (dev == NULL)
+		return -1;
+
+	*state = dev;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	i2cd_close(*state);
+	return 0;
+}
+
+struct caller {
+	pthread_t thread;
+	struct i2cd_rt *rt;
+	unsigned int id;
+	unsigned long errors;
+};
+
+static void *caller_run(void *arg)
+{
+	struct caller *caller = arg;
+	uint32_t write_buf, read_buf;
+	unsigned long i;
+
+	for (i = 0; i < NTRANSFERS; i++) {
+		struct i2c_msg msgs[] = {
+			{
+				.addr	= 0x20,
+				.flags	= 0,
+				.len	= sizeof(write_buf),
+				.buf	= (uint8_t *)&write_buf
+			},
+			{
+				.addr	= 0x20,
+				.flags	= I2C_M_RD,
+				.len	= sizeof(read_buf),
+				.buf	= (uint8_t *)&read_buf
+			}
+		};
+
+		write_buf = caller->id << 24 | i;
+		read_buf = 0;
+
+		if (i2cd_rt_transfer(caller->rt, msgs, ARRAY_SIZE(msgs)) != 2 ||
+		    read_buf != write_buf)
+			caller->errors++;
+	}
+	return NULL;
+}
+
+void test_i2cd_rt_transfer(void **state)
+{
+	struct i2cd *dev = *state;
+	struct i2cd_rt_attr attr;
+	struct i2cd_rt *rt;
+	uint8_t write_buf[] = {0xde, 0xad, 0xbe, 0xef}, read_buf[4] = {0};
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(write_buf),
+			.buf	= write_buf
+		},
+		{
+			.addr	= 0x20,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(read_buf),
+			.buf	= read_buf
+		}
+	};
+	int rc;
+
+	i2cd_rt_attr_init(&attr);
+	attr.cpu = 0;
+
+	rt = i2cd_rt_new(dev, &attr);
+	assert_non_null(rt);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_rt_transfer(rt, msgs, ARRAY_SIZE(msgs));
+
+	assert_int_equal(rc, 2);
+	assert_memory_equal(read_buf, write_buf, sizeof(write_buf));
+	assert_false(pthread_equal(atomic_load(&fake_thread), pthread_self()));
+
+	/* Check behavior when transfer fails */
+	msgs[0].addr = NAK_ADDR;
+	rc = i2cd_rt_transfer(rt, msgs, ARRAY_SIZE(msgs));
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, ENXIO);
+
+	i2cd_rt_free(rt);
+}
+
+void test_i2cd_rt_transfer_fail_size(void **state)
+{
+	struct i2cd *dev = *state;
+	struct i2cd_rt_attr attr;
+	struct i2cd_rt *rt;
+	uint8_t buf[64];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(buf),
+			.buf	= buf
+		}
+	};
+	int rc;
+
+	i2cd_rt_attr_init(&attr);
+	attr.buf_size = sizeof(buf) - 1;
+
+	rt = i2cd_rt_new(dev, &attr);
+	assert_non_null(rt);
+
+	/* Check behavior when messages exceed the slot buffer */
+	rc = i2cd_rt_transfer(rt, msgs, ARRAY_SIZE(msgs));
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EMSGSIZE);
+
+	i2cd_rt_free(rt);
+}
+
+void test_i2cd_rt_new_fail_invalid(void **state)
+{
+	struct i2cd *dev = *state;
+	struct i2cd_rt_attr attr;
+	struct i2cd_rt *rt;
+
+	i2cd_rt_attr_init(&attr);
+	attr.priority = sched_get_priority_max(SCHED_FIFO) + 1;
+
+	/* Check behavior when priority is out of range */
+	rt = i2cd_rt_new(dev, &attr);
+
+	assert_null(rt);
+	assert_int_equal(errno, EINVAL);
+
+	i2cd_rt_attr_init(&attr);
+	attr.cpu = CPU_SETSIZE;
+
+	/* Check behavior when CPU is out of range */
+	rt = i2cd_rt_new(dev, &attr);
+
+	assert_null(rt);
+	assert_int_equal(errno, EINVAL);
+}
+
+void test_i2cd_rt_transfer_concurrent(void **state)
+{
+	struct i2cd *dev = *state;
+	struct caller callers[NTHREADS];
+	struct i2cd_rt_attr attr;
+	struct i2cd_rt *rt;
+	unsigned int i;
+
+	i2cd_rt_attr_init(&attr);
+	attr.nslots = 2;
+
+	rt = i2cd_rt_new(dev, &attr);
+	assert_non_null(rt);
+
+	/* Check behavior when callers outnumber slots */
+	for (i = 0; i < NTHREADS; i++) {
+		callers[i].rt = rt;
+		callers[i].id = i;
+		callers[i].errors = 0;
+		assert_int_equal(pthread_create(&callers[i].thread, NULL,
+						caller_run, &callers[i]), 0);
+	}
+
+	for (i = 0; i < NTHREADS; i++) {
+		pthread_join(callers[i].thread, NULL);
+		assert_int_equal(callers[i].errors, 0);
+	}
+
+	i2cd_rt_free(rt);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_rt_transfer),
+		cmocka_unit_test(test_i2cd_rt_transfer_fail_size),
+		cmocka_unit_test(test_i2cd_rt_new_fail_invalid),
+		cmocka_unit_test(test_i2cd_rt_transfer_concurrent),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,316 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+int setup(void **state)
+{
+	mocks_enabled = true;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	mocks_enabled = false;
+	return 0;
+}
+
+static void expect_funcs(struct i2cd *dev, unsigned long funcs)
+{
+	expect_value(mock_ioctl, fd, dev->fd);
+	expect_value(mock_ioctl, request, I2C_FUNCS);
+	expect_any(mock_ioctl, funcs);
+	will_return(mock_ioctl, funcs);
+	will_return(mock_ioctl, 0);
+}
+
+static void expect_transfer(struct i2cd *dev, struct i2c_msg *msg, int rc,
+		int error)
+{
+	expect_value(mock_ioctl, fd, dev->fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, msg);
+	will_return(mock_ioctl, rc);
+	if (rc < 0)
+		will_return(mock_ioctl, error);
+}
+
+void test_i2cd_scan(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_buf[1];
+	struct i2c_msg expect_msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= 0,
+			.buf	= mock_buf
+		},
+		{
+			.addr	= 0x21,
+			.flags	= 0,
+			.len	= 0,
+			.buf	= mock_buf
+		},
+	};
+	uint64_t bitmap[I2CD_SCAN_WORDS];
+	int rc;
+
+	expect_funcs(&mock_dev, I2C_FUNC_I2C);
+	expect_transfer(&mock_dev, &expect_msgs[0], 1, 0);
+	expect_transfer(&mock_dev, &expect_msgs[1], -1, ENXIO);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_scan(&mock_dev, 0x20, 0x21, I2CD_SCAN_AUTO, bitmap);
+
+	assert_int_equal(rc, 1);
+	assert_true(i2cd_scan_present(bitmap, 0x20));
+	assert_false(i2cd_scan_present(bitmap, 0x21));
+}
+
+void test_i2cd_scan_unsafe(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_buf[1];
+	struct i2c_msg expect_msg = {
+		.addr	= 0x50,
+		.flags	= I2C_M_RD,
+		.len	= sizeof(mock_buf),
+		.buf	= mock_buf
+	};
+	uint64_t bitmap[I2CD_SCAN_WORDS];
+	int rc;
+
+	expect_funcs(&mock_dev, I2C_FUNC_I2C);
+	expect_transfer(&mock_dev, &expect_msg, 1, 0);
+
+	/* Check behavior when probing an address reserved for EEPROMs */
+	mock_buf[0] = 0;
+	rc = i2cd_scan(&mock_dev, 0x50, 0x50, I2CD_SCAN_AUTO, bitmap);
+
+	assert_int_equal(rc, 1);
+	assert_true(i2cd_scan_present(bitmap, 0x50));
+}
+
+void test_i2cd_scan_fallback(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_buf[1];
+	struct i2c_msg expect_msg = {
+		.addr	= 0x20,
+		.flags	= 0,
+		.len	= 0,
+		.buf	= mock_buf
+	};
+	uint64_t bitmap[I2CD_SCAN_WORDS];
+	int rc;
+
+	expect_funcs(&mock_dev, I2C_FUNC_I2C | I2C_FUNC_SMBUS_QUICK);
+	expect_transfer(&mock_dev, &expect_msg, -1, EOPNOTSUPP);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_SLAVE);
+	expect_value(mock_ioctl, addr, 0x20);
+	will_return(mock_ioctl, 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_SMBUS);
+	expect_value(mock_ioctl, size, I2C_SMBUS_QUICK);
+	will_return(mock_ioctl, 0);
+
+	/* Check behavior when zero-length messages are not supported */
+	rc = i2cd_scan(&mock_dev, 0x20, 0x20, I2CD_SCAN_AUTO, bitmap);
+
+	assert_int_equal(rc, 1);
+	assert_true(i2cd_scan_present(bitmap, 0x20));
+}
+
+void test_i2cd_scan_fast(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint64_t bitmap[I2CD_SCAN_WORDS];
+	int rc;
+
+	mock_dev.flags = I2CD_F_RETRIES | I2CD_F_TIMEOUT;
+	mock_dev.retries = 3;
+	mock_dev.timeout = 10;
+
+	expect_funcs(&mock_dev, I2C_FUNC_SMBUS_QUICK);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RETRIES);
+	expect_value(mock_ioctl, retries, 0);
+	will_return(mock_ioctl, 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_TIMEOUT);
+	expect_value(mock_ioctl, timeout, 1);
+	will_return(mock_ioctl, 0);
+
+	/* An address in use by a kernel driver is present */
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_SLAVE);
+	expect_value(mock_ioctl, addr, 0x20);
+	will_return(mock_ioctl, -1);
+	will_return(mock_ioctl, EBUSY);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RETRIES);
+	expect_value(mock_ioctl, retries, mock_dev.retries);
+	will_return(mock_ioctl, 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_TIMEOUT);
+	expect_value(mock_ioctl, timeout, mock_dev.timeout);
+	will_return(mock_ioctl, 0);
+
+	/* Check behavior when retries and timeout are lowered */
+	rc = i2cd_scan(&mock_dev, 0x20, 0x20, I2CD_SCAN_QUICK | I2CD_SCAN_FAST,
+		       bitmap);
+
+	assert_int_equal(rc, 1);
+	assert_true(i2cd_scan_present(bitmap, 0x20));
+}
+
+void test_i2cd_scan_fast_fail_invalid(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint64_t bitmap[I2CD_SCAN_WORDS];
+	int rc;
+
+	mock_dev.flags = I2CD_F_TIMEOUT;
+	mock_dev.timeout = 10;
+
+	expect_funcs(&mock_dev, I2C_FUNC_SMBUS_QUICK);
+
+	/* Check behavior when retries cannot be restored */
+	rc = i2cd_scan(&mock_dev, 0x20, 0x20, I2CD_SCAN_QUICK | I2CD_SCAN_FAST,
+		       bitmap);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+}
+
+void test_i2cd_scan_bound(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42, .bind_fd = 43};
+	uint64_t bitmap[I2CD_SCAN_WORDS];
+	uint8_t mock_buf[1];
+	int rc;
+
+	mock_dev.flags = I2CD_F_BOUND;
+	mock_dev.bound = 0x20;
+
+	expect_funcs(&mock_dev, I2C_FUNC_SMBUS_QUICK);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_SLAVE);
+	expect_value(mock_ioctl, addr, 0x21);
+	will_return(mock_ioctl, 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_SMBUS);
+	expect_value(mock_ioctl, size, I2C_SMBUS_QUICK);
+	will_return(mock_ioctl, 0);
+
+	rc = i2cd_scan(&mock_dev, 0x21, 0x21, I2CD_SCAN_QUICK, bitmap);
+
+	assert_int_equal(rc, 1);
+
+	/* Check that scanning does not change the address of a bound handle */
+	expect_value(mock_read, fd, mock_dev.bind_fd);
+	expect_value(mock_read, count, sizeof(mock_buf));
+	will_return(mock_read, sizeof(mock_buf));
+
+	rc = i2cd_read(&mock_dev, 0x20, mock_buf, sizeof(mock_buf));
+
+	assert_int_equal(rc, 1);
+}
+
+void test_i2cd_scan_fail_unsupported(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint64_t bitmap[I2CD_SCAN_WORDS];
+	int rc;
+
+	expect_funcs(&mock_dev, I2C_FUNC_SMBUS_QUICK);
+
+	/* Check behavior when probe mode is not supported */
+	rc = i2cd_scan(&mock_dev, 0x08, 0x77, I2CD_SCAN_WRITE, bitmap);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EOPNOTSUPP);
+}
+
+void test_i2cd_scan_multi(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42}, *devs[] = {&mock_dev};
+	uint8_t mock_buf[1];
+	struct i2c_msg expect_msg = {
+		.addr	= 0x20,
+		.flags	= 0,
+		.len	= 0,
+		.buf	= mock_buf
+	};
+	uint64_t bitmaps[1][I2CD_SCAN_WORDS];
+	static uint64_t mock_jobs[16];
+	int rc;
+
+	expect_value(mock_calloc, nmemb, 1);
+	expect_any(mock_calloc, size);
+	will_return(mock_calloc, mock_jobs);
+
+	expect_funcs(&mock_dev, I2C_FUNC_I2C);
+	expect_transfer(&mock_dev, &expect_msg, 1, 0);
+
+	expect_value(mock_free, ptr, mock_jobs);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_scan_multi(devs, 1, 0x20, 0x20, I2CD_SCAN_AUTO, bitmaps);
+
+	assert_int_equal(rc, 1);
+	assert_true(i2cd_scan_present(bitmaps[0], 0x20));
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_scan),
+		cmocka_unit_test(test_i2cd_scan_unsafe),
+		cmocka_unit_test(test_i2cd_scan_fallback),
+		cmocka_unit_test(test_i2cd_scan_fast),
+		cmocka_unit_test(test_i2cd_scan_fast_fail_invalid),
+		cmocka_unit_test(test_i2cd_scan_bound),
+		cmocka_unit_test(test_i2cd_scan_fail_unsupported),
+		cmocka_unit_test(test_i2cd_scan_multi),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,496 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+/* The server is built into the test so that its internals can be exercised */
+#define main server_main
+#include "../tools/i2cd-server.c"
+#undef main
+
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42, .bind_fd = -1};
+static struct adapter mock_adapter = {.dev = &mock_dev};
+
+struct mock_client {
+	struct client *client;
+	int peer_fd;			/**< Receives server responses. */
+};
+
+struct mock_response {
+	struct i2cd_proto_response resp;
+	uint8_t data[I2CD_PROTO_INLINE_MAX];
+};
+
+int setup(void **state)
+{
+	packet = malloc(I2CD_PROTO_PACKET_MAX);
+	if (packet == NULL)
+		return -1;
+
+	return 0;
+}
+
+int teardown(void **state)
+{
+	free(packet);
+	return 0;
+}
+
+static void mock_client_init(struct mock_client *mc)
+{
+	int sv[2];
+
+	assert_return_code(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv), 0);
+
+	mc->client = calloc(1, sizeof(*mc->client));
+	assert_non_null(mc->client);
+	mc->client->fd = sv[0];
+	mc->client->adapter = &mock_adapter;
+	mc->peer_fd = sv[1];
+}
+
+static void mock_client_free(struct mock_client *mc)
+{
+	close(mc->client->fd);
+	close(mc->peer_fd);
+	free(mc->client);
+}
+
+static void mock_client_recv(struct mock_client *mc,
+		struct mock_response *resp)
+{
+	memset(resp, 0, sizeof(*resp));
+	assert_true(recv(mc->peer_fd, resp, sizeof(*resp), MSG_DONTWAIT) >=
+		    (ssize_t)sizeof(resp->resp));
+}
+
+/* Build a TRANSFER request in buf, returning its length */
+static size_t build_request(void *buf, const struct i2cd_proto_msg pmsgs[],
+		size_t nmsgs, const void *data, size_t len)
+{
+	struct i2cd_proto_request *req = buf;
+	uint8_t *p = buf;
+
+	memset(req, 0, sizeof(*req));
+	req->op = I2CD_PROTO_TRANSFER;
+	req->nmsgs = nmsgs;
+	req->len = len;
+
+	memcpy(p + sizeof(*req), pmsgs, nmsgs * sizeof(*pmsgs));
+	memcpy(p + sizeof(*req) + nmsgs * sizeof(*pmsgs), data, len);
+	return sizeof(*req) + nmsgs * sizeof(*pmsgs) + len;
+}
+
+static int queue_read(struct mock_client *mc, uint16_t addr, uint8_t reg,
+		uint16_t len)
+{
+	struct i2cd_proto_msg pmsgs[] = {
+		{.addr = addr, .flags = 0, .len = 1},
+		{.addr = addr, .flags = I2C_M_RD, .len = len}
+	};
+	uint64_t buf[64];
+	size_t n;
+
+	n = build_request(buf, pmsgs, ARRAY_SIZE(pmsgs), &reg, sizeof(reg));
+	return client_queue(mc->client, (void *)buf, -1, n);
+}
+
+static int queue_write(struct mock_client *mc, uint16_t addr, uint8_t byte)
+{
+	struct i2cd_proto_msg pmsgs[] = {
+		{.addr = addr, .flags = 0, .len = 1}
+	};
+	uint64_t buf[64];
+	size_t n;
+
+	n = build_request(buf, pmsgs, ARRAY_SIZE(pmsgs), &byte, sizeof(byte));
+	return client_queue(mc->client, (void *)buf, -1, n);
+}
+
+void test_client_queue(void **state)
+{
+	struct mock_client mc;
+	struct client *client;
+	int rc;
+
+	mock_client_init(&mc);
+	client = mc.client;
+
+	/* Check behavior when function succeeds */
+	rc = queue_read(&mc, 0x20, 0x10, 2);
+
+	assert_return_code(rc, 0);
+	assert_int_equal(client->nmsgs, 2);
+	assert_int_equal(client->msgs[0].addr, 0x20);
+	assert_int_equal(client->msgs[0].flags, 0);
+	assert_int_equal(client->msgs[0].len, 1);
+	assert_ptr_equal(client->msgs[0].buf, client->data);
+	assert_int_equal(client->data[0], 0x10);
+	assert_int_equal(client->msgs[1].flags, I2C_M_RD);
+	assert_int_equal(client->msgs[1].len, 2);
+	assert_ptr_equal(client->msgs[1].buf, client->data + 1);
+	assert_ptr_equal(mock_adapter.pending, client);
+
+	mock_adapter.pending = NULL;
+	mock_client_free(&mc);
+}
+
+void test_client_queue_fail_invalid(void **state)
+{
+	struct i2cd_proto_msg pmsgs[] = {
+		{.addr = 0x20, .flags = 0, .len = 1}
+	};
+	uint8_t byte = 0;
+	uint64_t buf[64];
+	struct i2cd_proto_request *req = (void *)buf;
+	size_t n;
+	struct mock_client mc;
+	int rc;
+
+	mock_client_init(&mc);
+
+	/* Check behavior when packet is truncated */
+	n = build_request(buf, pmsgs, ARRAY_SIZE(pmsgs), &byte, sizeof(byte));
+	rc = client_queue(mc.client, req, -1, n - 1);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+
+	/* Check behavior when data length does not match messages */
+	req->len = 2;
+	rc = client_queue(mc.client, req, -1, n);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+
+	/* Check behavior when too many messages are requested */
+	req->len = 1;
+	req->nmsgs = I2C_RDWR_IOCTL_MAX_MSGS + 1;
+	rc = client_queue(mc.client, req, -1, n);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+
+	/* Check behavior when client is not attached */
+	req->nmsgs = 1;
+	mc.client->adapter = NULL;
+	rc = client_queue(mc.client, req, -1, n);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EBADF);
+
+	assert_null(mock_adapter.pending);
+
+	mock_client_free(&mc);
+}
+
+void test_client_queue_shm(void **state)
+{
+#ifdef HAVE_MEMFD_CREATE
+	struct i2cd_proto_msg pmsgs[] = {
+		{.addr = 0x20, .flags = I2C_M_RD, .len = 16}
+	};
+	uint64_t buf[64];
+	struct i2cd_proto_request *req = (void *)buf;
+	struct mock_client mc;
+	size_t n;
+	int fd, rc;
+
+	mock_client_init(&mc);
+
+	n = build_request(buf, pmsgs, ARRAY_SIZE(pmsgs), "", 0);
+	req->flags = I2CD_PROTO_F_SHM;
+	req->len = pmsgs[0].len;
+
+	fd = memfd_create("test-server", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	assert_return_code(fd, 0);
+	assert_return_code(ftruncate(fd, pmsgs[0].len), 0);
+
+	/* Check behavior when shared memory may be truncated */
+	rc = client_queue(mc.client, req, fd, n);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+	assert_null(mc.client->shm);
+	assert_null(mock_adapter.pending);
+
+	/* Check behavior when function succeeds */
+	assert_return_code(fcntl(fd, F_ADD_SEALS,
+				 F_SEAL_SHRINK | F_SEAL_GROW), 0);
+	rc = client_queue(mc.client, req, fd, n);
+
+	assert_return_code(rc, 0);
+	assert_non_null(mc.client->shm);
+	assert_ptr_equal(mc.client->msgs[0].buf, mc.client->shm);
+	assert_ptr_equal(mock_adapter.pending, mc.client);
+
+	mock_adapter.pending = NULL;
+	client_release(mc.client);
+	close(fd);
+	mock_client_free(&mc);
+#else
+	skip();
+#endif
+}
+
+void test_client_replayable(void **state)
+{
+	struct client client = {0};
+
+	/* Check behavior when transfer consists of reads */
+	client.msgs[0].flags = I2C_M_RD;
+	client.msgs[1].flags = I2C_M_RD;
+	client.nmsgs = 2;
+
+	assert_true(client_replayable(&client));
+
+	/* Check behavior when each write precedes a read */
+	client.msgs[0].flags = 0;
+	client.msgs[2].flags = 0;
+	client.msgs[3].flags = I2C_M_RD;
+	client.nmsgs = 4;
+
+	assert_true(client_replayable(&client));
+
+	/* Check behavior when write is last */
+	client.nmsgs = 3;
+
+	assert_false(client_replayable(&client));
+
+	/* Check behavior when writes are consecutive */
+	client.msgs[1].flags = 0;
+	client.nmsgs = 4;
+
+	assert_false(client_replayable(&client));
+}
+
+void test_adapter_run(void **state)
+{
+	struct mock_client mcs[2];
+	struct mock_response resp;
+	uint8_t regs[] = {0x10, 0x11};
+	uint8_t data[][2] = {{0xaa, 0xbb}, {0xcc, 0xdd}};
+	struct i2c_msg expect_msgs[] = {
+		{.addr = 0x21, .flags = 0, .len = 1, .buf = &regs[1]},
+		{.addr = 0x21, .flags = I2C_M_RD, .len = 2, .buf = data[1]},
+		{.addr = 0x20, .flags = 0, .len = 1, .buf = &regs[0]},
+		{.addr = 0x20, .flags = I2C_M_RD, .len = 2, .buf = data[0]}
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(mcs); i++) {
+		mock_client_init(&mcs[i]);
+		assert_return_code(queue_read(&mcs[i], 0x20 + i, regs[i], 2),
+				   0);
+	}
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	for (i = 0; i < ARRAY_SIZE(expect_msgs); i++)
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i]);
+	will_return(mock_ioctl, 4);
+
+	/* Check behavior when replayable transfers are combined */
+	mocks_enabled = true;
+	adapter_run(&mock_adapter);
+	mocks_enabled = false;
+
+	assert_null(mock_adapter.pending);
+	for (i = 0; i < ARRAY_SIZE(mcs); i++) {
+		mock_client_recv(&mcs[i], &resp);
+		assert_int_equal(resp.resp.rc, 2);
+		assert_int_equal(resp.resp.len, 2);
+		assert_memory_equal(resp.data, data[i], 2);
+		mock_client_free(&mcs[i]);
+	}
+}
+
+void test_adapter_run_replay(void **state)
+{
+	struct mock_client mcs[2];
+	struct mock_response resp;
+	uint8_t regs[] = {0x10, 0x11};
+	uint8_t data[] = {0xaa, 0xbb};
+	struct i2c_msg expect_msgs[] = {
+		{.addr = 0x21, .flags = 0, .len = 1, .buf = &regs[1]},
+		{.addr = 0x21, .flags = I2C_M_RD, .len = 2, .buf = data},
+		{.addr = 0x20, .flags = 0, .len = 1, .buf = &regs[0]},
+		{.addr = 0x20, .flags = I2C_M_RD, .len = 2, .buf = data}
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(mcs); i++) {
+		mock_client_init(&mcs[i]);
+		assert_return_code(queue_read(&mcs[i], 0x20 + i, regs[i], 2),
+				   0);
+	}
+
+	/* Combined transfer fails as 0x21 does not acknowledge */
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	for (i = 0; i < ARRAY_SIZE(expect_msgs); i++)
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i]);
+	will_return(mock_ioctl, -1);
+	will_return(mock_ioctl, ENXIO);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[0]);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[1]);
+	will_return(mock_ioctl, -1);
+	will_return(mock_ioctl, ENXIO);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[2]);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[3]);
+	will_return(mock_ioctl, 2);
+
+	/* Check behavior when combined transfer fails */
+	mocks_enabled = true;
+	adapter_run(&mock_adapter);
+	mocks_enabled = false;
+
+	assert_null(mock_adapter.pending);
+
+	mock_client_recv(&mcs[0], &resp);
+	assert_int_equal(resp.resp.rc, 2);
+	assert_memory_equal(resp.data, data, 2);
+
+	mock_client_recv(&mcs[1], &resp);
+	assert_int_equal(resp.resp.rc, -1);
+	assert_int_equal(resp.resp.error, ENXIO);
+	assert_int_equal(resp.resp.len, 0);
+
+	for (i = 0; i < ARRAY_SIZE(mcs); i++)
+		mock_client_free(&mcs[i]);
+}
+
+void test_adapter_run_unbatched(void **state)
+{
+	struct mock_client mcs[3];
+	struct mock_response resp;
+	uint8_t reg = 0x10, byte = 0x55;
+	uint8_t data[] = {0xaa};
+	struct i2c_msg expect_msgs[] = {
+		{.addr = 0x22, .flags = 0, .len = 1, .buf = &byte},
+		{.addr = 0x20, .flags = 0, .len = 1, .buf = &reg},
+		{.addr = 0x20, .flags = I2C_M_RD, .len = 1, .buf = data}
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(mcs); i++)
+		mock_client_init(&mcs[i]);
+
+	/* Pending transfers run most recently queued first */
+	assert_return_code(queue_read(&mcs[0], 0x20, reg, 1), 0);
+	assert_return_code(queue_read(&mcs[1], 0x20, reg, 1), 0);
+	assert_return_code(queue_write(&mcs[2], 0x22, byte), 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msgs[0]);
+	will_return(mock_ioctl, 1);
+
+	for (i = 0; i < 2; i++) {
+		expect_value(mock_ioctl, fd, mock_dev.fd);
+		expect_value(mock_ioctl, request, I2C_RDWR);
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[1]);
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[2]);
+		will_return(mock_ioctl, 2);
+	}
+
+	/* Check behavior when transfer is not replayable and batching is off */
+	batching = false;
+
+	mocks_enabled = true;
+	adapter_run(&mock_adapter);
+	mocks_enabled = false;
+
+	batching = true;
+
+	assert_null(mock_adapter.pending);
+
+	mock_client_recv(&mcs[2], &resp);
+	assert_int_equal(resp.resp.rc, 1);
+	assert_int_equal(resp.resp.len, 0);
+
+	for (i = 0; i < 2; i++) {
+		mock_client_recv(&mcs[i], &resp);
+		assert_int_equal(resp.resp.rc, 2);
+		assert_memory_equal(resp.data, data, 1);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mcs); i++)
+		mock_client_free(&mcs[i]);
+}
+
+void test_adapter_get_fail_invalid(void **state)
+{
+	struct adapter *adapter;
+
+	/* Check behavior when path is not an i2c-dev device */
+	adapter = adapter_get("/dev/null");
+
+	assert_null(adapter);
+	assert_int_equal(errno, ENOTTY);
+
+	/* Check behavior when path does not exist */
+	adapter = adapter_get("/dev/i2c-nonexistent");
+
+	assert_null(adapter);
+	assert_int_equal(errno, ENOENT);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_client_queue),
+		cmocka_unit_test(test_client_queue_fail_invalid),
+		cmocka_unit_test(test_client_queue_shm),
+		cmocka_unit_test(test_client_replayable),
+		cmocka_unit_test(test_adapter_run),
+		cmocka_unit_test(test_adapter_run_replay),
+		cmocka_unit_test(test_adapter_run_unbatched),
+		cmocka_unit_test(test_adapter_get_fail_invalid),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
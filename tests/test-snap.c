@@ -0,0 +1,309 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+
+/*
+ * Snapshots are allocated normally; mocks are only enabled while registers
+ * are read or written.
+ */
+static const struct i2cd_snap_range mock_ranges[] = {
+	{.reg = 0x10, .len = 8},
+	{.reg = 0x40, .len = 2}
+};
+
+static uint8_t mock_reg_buf[][1] = {{0x10}, {0x40}};
+static uint8_t mock_data[] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x80, 0x81
+};
+
+/* Write-combining buffer allocated while restoring */
+static uint64_t mock_wbuf[512];
+
+static void expect_read(const uint8_t *data)
+{
+	static struct i2c_msg expect_msgs[4];
+
+	expect_msgs[0] = (struct i2c_msg){
+		.addr = 0x20, .flags = 0, .len = 1, .buf = mock_reg_buf[0]
+	};
+	expect_msgs[1] = (struct i2c_msg){
+		.addr = 0x20, .flags = I2C_M_RD, .len = 8,
+		.buf = (uint8_t *)data
+	};
+	expect_msgs[2] = (struct i2c_msg){
+		.addr = 0x20, .flags = 0, .len = 1, .buf = mock_reg_buf[1]
+	};
+	expect_msgs[3] = (struct i2c_msg){
+		.addr = 0x20, .flags = I2C_M_RD, .len = 2,
+		.buf = (uint8_t *)data + 8
+	};
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[0]);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[1]);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[2]);
+	expect_check(mock_ioctl, msg, check_and_fill_i2c_msg, &expect_msgs[3]);
+	will_return(mock_ioctl, 4);
+}
+
+static struct i2cd_snap *capture(void)
+{
+	struct i2cd_snap *snap;
+
+	snap = i2cd_snap_new(0x20, mock_ranges, ARRAY_SIZE(mock_ranges), 0);
+	assert_non_null(snap);
+
+	expect_read(mock_data);
+
+	mocks_enabled = true;
+	assert_return_code(i2cd_snap_capture(snap, &mock_dev), 0);
+	mocks_enabled = false;
+
+	return snap;
+}
+
+void test_i2cd_snap_capture(void **state)
+{
+	struct i2cd_snap *snap;
+	uint8_t buf[4];
+
+	/* Check behavior when function succeeds */
+	snap = capture();
+
+	assert_return_code(i2cd_snap_get(snap, 0x14, buf, 4), 0);
+	assert_memory_equal(buf, &mock_data[4], 4);
+	assert_return_code(i2cd_snap_get(snap, 0x40, buf, 2), 0);
+	assert_memory_equal(buf, &mock_data[8], 2);
+
+	/* Check behavior when registers span ranges */
+	assert_int_equal(i2cd_snap_get(snap, 0x16, buf, 4), -1);
+	assert_int_equal(errno, ENOENT);
+
+	i2cd_snap_free(snap);
+}
+
+void test_i2cd_snap_capture_long(void **state)
+{
+	static const struct i2cd_snap_range ranges[] = {
+		{.reg = 0x0000, .len = I2CD_RDWR_MAX_LEN + 808}
+	};
+	static uint8_t data[I2CD_RDWR_MAX_LEN + 808];
+	uint16_t regs[] = {0x0000, I2CD_RDWR_MAX_LEN};
+	struct i2c_msg expect_msgs[] = {
+		{.addr = 0x20, .flags = 0, .len = 2, .buf = (uint8_t *)&regs[0]},
+		{
+			.addr = 0x20, .flags = I2C_M_RD,
+			.len = I2CD_RDWR_MAX_LEN, .buf = data
+		},
+		{.addr = 0x20, .flags = 0, .len = 2, .buf = (uint8_t *)&regs[1]},
+		{
+			.addr = 0x20, .flags = I2C_M_RD, .len = 808,
+			.buf = data + I2CD_RDWR_MAX_LEN
+		}
+	};
+	struct i2cd_snap *snap;
+	uint8_t buf[4];
+	size_t i;
+	int rc;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i;
+
+	snap = i2cd_snap_new(0x20, ranges, ARRAY_SIZE(ranges),
+			     I2CD_SNAP_REG16);
+	assert_non_null(snap);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	for (i = 0; i < ARRAY_SIZE(expect_msgs); i++)
+		expect_check(mock_ioctl, msg, check_and_fill_i2c_msg,
+			     &expect_msgs[i]);
+	will_return(mock_ioctl, 4);
+
+	/* Check behavior when a range exceeds the longest message */
+	mocks_enabled = true;
+	rc = i2cd_snap_capture(snap, &mock_dev);
+	mocks_enabled = false;
+
+	assert_return_code(rc, 0);
+	assert_return_code(i2cd_snap_get(snap, I2CD_RDWR_MAX_LEN - 2, buf,
+					 sizeof(buf)), 0);
+	assert_memory_equal(buf, &data[I2CD_RDWR_MAX_LEN - 2], sizeof(buf));
+
+	i2cd_snap_free(snap);
+}
+
+void test_i2cd_snap_restore(void **state)
+{
+	uint8_t mock_cur[sizeof(mock_data)];
+	uint8_t expect_bufs[][5] = {
+		{0x11, 0x11, 0x22, 0x33, 0x44},
+		{0x41, 0x81}
+	};
+	struct i2c_msg expect_msgs[] = {
+		{.addr = 0x20, .flags = 0, .len = 5, .buf = expect_bufs[0]},
+		{.addr = 0x20, .flags = 0, .len = 2, .buf = expect_bufs[1]}
+	};
+	struct i2cd_snap *snap;
+	int rc;
+
+	snap = capture();
+
+	/* Registers 0x11, 0x14, and 0x41 differ; 0x12 and 0x13 do not */
+	memcpy(mock_cur, mock_data, sizeof(mock_cur));
+	mock_cur[1] = 0xff;
+	mock_cur[4] = 0xff;
+	mock_cur[9] = 0xff;
+
+	expect_read(mock_cur);
+
+	memset(mock_wbuf, 0, sizeof(mock_wbuf));
+	expect_value(mock_calloc, nmemb, 1);
+	expect_any(mock_calloc, size);
+	will_return(mock_calloc, mock_wbuf);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msgs[0]);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msgs[1]);
+	will_return(mock_ioctl, 2);
+
+	expect_value(mock_free, ptr, mock_wbuf);
+
+	/* Check behavior when function succeeds */
+	mocks_enabled = true;
+	rc = i2cd_snap_restore(snap, &mock_dev);
+	mocks_enabled = false;
+
+	assert_int_equal(rc, 5);
+
+	expect_read(mock_data);
+
+	/* Check behavior when no registers differ */
+	mocks_enabled = true;
+	rc = i2cd_snap_restore(snap, &mock_dev);
+	mocks_enabled = false;
+
+	assert_int_equal(rc, 0);
+
+	i2cd_snap_free(snap);
+}
+
+void test_i2cd_snap_save_load(void **state)
+{
+	struct i2cd_snap *snap, *load;
+	char path[64];
+	uint8_t buf[sizeof(mock_data)];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/tmp/test-snap-%d", (int)getpid());
+
+	snap = capture();
+
+	/* Check behavior when function succeeds */
+	assert_return_code(i2cd_snap_save(snap, path), 0);
+	load = i2cd_snap_load(path);
+
+	assert_non_null(load);
+	assert_return_code(i2cd_snap_get(load, 0x10, buf, 8), 0);
+	assert_memory_equal(buf, mock_data, 8);
+	assert_return_code(i2cd_snap_get(load, 0x40, buf, 2), 0);
+	assert_memory_equal(buf, &mock_data[8], 2);
+
+	i2cd_snap_free(load);
+
+	/* Check behavior when file is truncated */
+	assert_int_equal(truncate(path, 20), 0);
+	load = i2cd_snap_load(path);
+
+	assert_null(load);
+	assert_int_equal(errno, EINVAL);
+
+	/* Check behavior when file is not a snapshot */
+	fp = fopen(path, "w");
+	assert_non_null(fp);
+	fputs("not a snapshot\n", fp);
+	fclose(fp);
+	load = i2cd_snap_load(path);
+
+	assert_null(load);
+	assert_int_equal(errno, EINVAL);
+
+	unlink(path);
+	i2cd_snap_free(snap);
+}
+
+void test_i2cd_snap_fail_invalid(void **state)
+{
+	const struct i2cd_snap_range bad_ranges[] = {
+		{.reg = 0xf0, .len = 0x20}
+	};
+	struct i2cd_snap *snap;
+	uint8_t buf[1];
+
+	/* Check behavior when range exceeds register addresses */
+	snap = i2cd_snap_new(0x20, bad_ranges, ARRAY_SIZE(bad_ranges), 0);
+
+	assert_null(snap);
+	assert_int_equal(errno, EINVAL);
+
+	snap = i2cd_snap_new(0x20, bad_ranges, ARRAY_SIZE(bad_ranges),
+			     I2CD_SNAP_REG16);
+	assert_non_null(snap);
+
+	/* Check behavior when snapshot has not been captured */
+	assert_int_equal(i2cd_snap_restore(snap, &mock_dev), -1);
+	assert_int_equal(errno, EINVAL);
+	assert_int_equal(i2cd_snap_get(snap, 0xf0, buf, 1), -1);
+	assert_int_equal(errno, EINVAL);
+
+	i2cd_snap_free(snap);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_snap_capture),
+		cmocka_unit_test(test_i2cd_snap_capture_long),
+		cmocka_unit_test(test_i2cd_snap_restore),
+		cmocka_unit_test(test_i2cd_snap_save_load),
+		cmocka_unit_test(test_i2cd_snap_fail_invalid),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
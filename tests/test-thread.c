@@ -0,0 +1,318 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "fake-dev.h"
+
+#define NTHREADS	8
+#define NTRANSFERS	20000
+
+struct worker {
+	pthread_t thread;
+	struct i2cd *dev;
+	unsigned int id;
+	unsigned long errors;
+};
+
+static void *worker_run(void *arg)
+{
+	struct worker *worker = arg;
+	uint32_t write_buf, read_buf;
+	unsigned long i;
+
+	for (i = 0; i < NTRANSFERS; i++) {
+		write_buf = worker->id << 24 | i;
+		read_buf = 0;
+
+		if (i2cd_write_read(worker->dev, 0x20 + worker->id,
+				    &write_buf, sizeof(write_buf),
+				    &read_buf, sizeof(read_buf)) != 2 ||
+		    read_buf != write_buf)
+			worker->errors++;
+
+		/* Exercise state cached by the handle */
+		if (i % 1024 == 0) {
+			unsigned long funcs;
+
+			if (i2cd_set_retries(worker->dev, worker->id) < 0 ||
+			    i2cd_get_functionality(worker->dev, &funcs) < 0 ||
+			    funcs != I2C_FUNC_I2C)
+				worker->errors++;
+		}
+	}
+	return NULL;
+}
+
+static double run_workers(struct worker workers[], struct i2cd *devs[])
+{
+	struct timespec start, end;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NTHREADS; i++) {
+		workers[i].dev = devs[i];
+		workers[i].id = i;
+		workers[i].errors = 0;
+		assert_int_equal(pthread_create(&workers[i].thread, NULL,
+						worker_run, &workers[i]), 0);
+	}
+
+	for (i = 0; i < NTHREADS; i++) {
+		pthread_join(workers[i].thread, NULL);
+		assert_int_equal(workers[i].errors, 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void test_i2cd_dup(void **state)
+{
+	struct i2cd *dev, *dup;
+	unsigned long funcs;
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+
+	assert_return_code(i2cd_get_functionality(dev, &funcs), 0);
+	assert_return_code(i2cd_set_retries(dev, 3), 0);
+	assert_return_code(i2cd_set_bus_frequency(dev, 400000), 0);
+
+	/* Check behavior when function succeeds */
+	dup = i2cd_dup(dev);
+
+	assert_non_null(dup);
+	assert_int_not_equal(dup->fd, dev->fd);
+	assert_string_equal(i2cd_get_path(dup), i2cd_get_path(dev));
+	assert_int_equal(dup->flags, dev->flags);
+	assert_int_equal(dup->retries, 3);
+	assert_int_equal(dup->funcs, I2C_FUNC_I2C);
+	assert_int_equal(i2cd_get_bus_frequency(dup), 400000);
+
+	i2cd_close(dup);
+	i2cd_close(dev);
+}
+
+void test_i2cd_shared_stress(void **state)
+{
+	struct worker workers[NTHREADS];
+	struct i2cd *devs[NTHREADS];
+	struct i2cd *dev;
+	uint8_t buf[4];
+	struct i2c_msg msgs[] = {
+		{.addr = 0x20, .flags = 0, .len = sizeof(buf), .buf = buf},
+		{.addr = 0x20, .flags = I2C_M_RD, .len = sizeof(buf), .buf = buf}
+	};
+	uint64_t ns;
+	double secs, busy;
+	unsigned int i;
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+
+	i2cd_set_bus_frequency(dev, 400000);
+	assert_return_code(i2cd_util_enable(dev, 60000), 0);
+	ns = i2cd_estimate_transfer_time(dev, msgs, ARRAY_SIZE(msgs));
+
+	for (i = 0; i < NTHREADS; i++)
+		devs[i] = dev;
+
+	fake_reset();
+
+	/* Check behavior when all threads share a handle */
+	secs = run_workers(workers, devs);
+
+	assert_int_equal(atomic_load(&fake_transfers),
+			 NTHREADS * NTRANSFERS);
+
+	/* Accounting loses no updates; transfers are all the same length */
+	busy = i2cd_util_get(dev) * 60000 * 1e6;
+	assert_true(busy > 0.999 * NTHREADS * NTRANSFERS * ns &&
+		    busy <= 1.0 * NTHREADS * NTRANSFERS * ns);
+
+	printf("# shared handle (accounting): %.0f transfers/s\n",
+	       NTHREADS * NTRANSFERS / secs);
+
+	for (i = 0; i < NTHREADS; i++) {
+		devs[i] = i2cd_dup(dev);
+		assert_non_null(devs[i]);
+	}
+
+	/* Check behavior when duplicated handles share accounting */
+	run_workers(workers, devs);
+
+	busy = i2cd_util_get(devs[0]) * 60000 * 1e6;
+	assert_true(busy > 0.999 * 2 * NTHREADS * NTRANSFERS * ns &&
+		    busy <= 2.0 * NTHREADS * NTRANSFERS * ns);
+
+	for (i = 0; i < NTHREADS; i++)
+		i2cd_close(devs[i]);
+
+	i2cd_close(dev);
+}
+
+void test_i2cd_dup_throughput(void **state)
+{
+	struct worker workers[NTHREADS];
+	struct i2cd *devs[NTHREADS];
+	struct i2cd *dev;
+	double secs;
+	unsigned int i;
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+
+	for (i = 0; i < NTHREADS; i++)
+		devs[i] = dev;
+
+	fake_reset();
+	secs = run_workers(workers, devs);
+
+	assert_int_equal(atomic_load(&fake_transfers),
+			 NTHREADS * NTRANSFERS);
+	printf("# shared handle: %.0f transfers/s\n",
+	       NTHREADS * NTRANSFERS / secs);
+
+	for (i = 0; i < NTHREADS; i++) {
+		devs[i] = i2cd_dup(dev);
+		assert_non_null(devs[i]);
+	}
+
+	fake_reset();
+
+	/* Check behavior when each thread has its own handle */
+	secs = run_workers(workers, devs);
+
+	assert_int_equal(atomic_load(&fake_transfers),
+			 NTHREADS * NTRANSFERS);
+	for (i = 0; i < NTHREADS; i++) {
+		struct fake_fd *ffd = &fake_fds[devs[i]->fd - FAKE_FD_BASE];
+
+		assert_int_equal(atomic_load(&ffd->inflight_max), 1);
+		i2cd_close(devs[i]);
+	}
+	printf("# duplicated handles: %.0f transfers/s\n",
+	       NTHREADS * NTRANSFERS / secs);
+
+	i2cd_close(dev);
+}
+
+struct binder {
+	pthread_t thread;
+	struct i2cd *dev;
+	atomic_bool done;
+	unsigned long errors;
+};
+
+static void *binder_run(void *arg)
+{
+	struct binder *binder = arg;
+	uint16_t addr = 0x21;
+
+	while (!atomic_load(&binder->done)) {
+		if (i2cd_bind(binder->dev, addr, 0) < 0)
+			binder->errors++;
+		addr ^= 0x01;
+	}
+	return NULL;
+}
+
+static void *writer_run(void *arg)
+{
+	struct worker *worker = arg;
+	uint8_t buf = 0x20;
+	unsigned long i;
+
+	/* The first byte identifies the intended slave to the fake device */
+	for (i = 0; i < NTRANSFERS; i++) {
+		if (i2cd_write(worker->dev, 0x20, &buf, sizeof(buf)) < 0)
+			worker->errors++;
+	}
+	return NULL;
+}
+
+void test_i2cd_bind_shared(void **state)
+{
+	struct worker workers[NTHREADS];
+	struct binder binder = {0};
+	struct i2cd *dev;
+	unsigned int i;
+
+	dev = i2cd_open("/dev/i2c-0");
+	assert_non_null(dev);
+	assert_return_code(i2cd_bind(dev, 0x20, 0), 0);
+
+	fake_reset();
+
+	binder.dev = dev;
+	assert_int_equal(pthread_create(&binder.thread, NULL, binder_run,
+					&binder), 0);
+
+	for (i = 0; i < NTHREADS; i++) {
+		workers[i].dev = dev;
+		workers[i].errors = 0;
+		assert_int_equal(pthread_create(&workers[i].thread, NULL,
+						writer_run, &workers[i]), 0);
+	}
+
+	/* Check behavior when the handle is rebound during bound writes */
+	for (i = 0; i < NTHREADS; i++) {
+		pthread_join(workers[i].thread, NULL);
+		assert_int_equal(workers[i].errors, 0);
+	}
+
+	atomic_store(&binder.done, true);
+	pthread_join(binder.thread, NULL);
+
+	assert_int_equal(binder.errors, 0);
+	assert_int_equal(atomic_load(&fake_misdirected), 0);
+
+	i2cd_close(dev);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_dup),
+		cmocka_unit_test(test_i2cd_shared_stress),
+		cmocka_unit_test(test_i2cd_dup_throughput),
+		cmocka_unit_test(test_i2cd_bind_shared),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
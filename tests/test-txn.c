@@ -0,0 +1,216 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static uint64_t mock_txn[64];
+
+int setup(void **state)
+{
+	mocks_enabled = true;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	mocks_enabled = false;
+	return 0;
+}
+
+void test_i2cd_txn_new(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_read_buf[4];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= 1,
+			.buf	= NULL
+		},
+		{
+			.addr	= 0x20,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(mock_read_buf),
+			.buf	= mock_read_buf
+		}
+	};
+	struct i2cd_txn *txn;
+	uint8_t *reg;
+
+	mock_dev.flags = I2CD_F_FUNCS;
+	mock_dev.funcs = I2C_FUNC_I2C;
+
+	expect_value(mock_calloc, nmemb, 1);
+	expect_any(mock_calloc, size);
+	will_return(mock_calloc, mock_txn);
+
+	/* Check behavior when function succeeds */
+	txn = i2cd_txn_new(&mock_dev, msgs, ARRAY_SIZE(msgs));
+
+	assert_non_null(txn);
+
+	reg = i2cd_txn_get_buf(txn, 0);
+	assert_non_null(reg);
+	assert_ptr_equal(i2cd_txn_get_buf(txn, 1), mock_read_buf);
+}
+
+void test_i2cd_txn_new_fail_unsupported(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_buf[1];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x220,
+			.flags	= I2C_M_TEN,
+			.len	= sizeof(mock_buf),
+			.buf	= mock_buf
+		}
+	};
+	struct i2cd_txn *txn;
+
+	mock_dev.flags = I2CD_F_FUNCS;
+	mock_dev.funcs = I2C_FUNC_I2C;
+
+	/* Check behavior when adapter lacks 10-bit addressing */
+	txn = i2cd_txn_new(&mock_dev, msgs, ARRAY_SIZE(msgs));
+
+	assert_null(txn);
+	assert_int_equal(errno, EOPNOTSUPP);
+}
+
+void test_i2cd_txn_new_fail_invalid(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_buf[1];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x80,
+			.flags	= 0,
+			.len	= sizeof(mock_buf),
+			.buf	= mock_buf
+		}
+	};
+	struct i2cd_txn *txn;
+
+	mock_dev.flags = I2CD_F_FUNCS;
+	mock_dev.funcs = I2C_FUNC_I2C | I2C_FUNC_10BIT_ADDR;
+
+	/* Check behavior when address is out of range */
+	txn = i2cd_txn_new(&mock_dev, msgs, ARRAY_SIZE(msgs));
+
+	assert_null(txn);
+	assert_int_equal(errno, EINVAL);
+}
+
+void test_i2cd_txn_execute(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_reg = 0x10, mock_read_buf[4], mock_rebind_buf[2];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(mock_reg),
+			.buf	= NULL
+		},
+		{
+			.addr	= 0x20,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(mock_read_buf),
+			.buf	= mock_read_buf
+		}
+	};
+	struct i2c_msg expect_msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(mock_reg),
+			.buf	= &mock_reg
+		},
+		{
+			.addr	= 0x20,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(mock_rebind_buf),
+			.buf	= mock_rebind_buf
+		}
+	};
+	struct i2cd_txn *txn;
+	uint8_t *reg;
+	int rc;
+
+	mock_dev.flags = I2CD_F_FUNCS;
+	mock_dev.funcs = I2C_FUNC_I2C;
+
+	expect_any(mock_calloc, nmemb);
+	expect_any(mock_calloc, size);
+	will_return(mock_calloc, mock_txn);
+
+	txn = i2cd_txn_new(&mock_dev, msgs, ARRAY_SIZE(msgs));
+	assert_non_null(txn);
+
+	reg = i2cd_txn_get_buf(txn, 0);
+	*reg = mock_reg;
+	i2cd_txn_set_buf(txn, 1, mock_rebind_buf, sizeof(mock_rebind_buf));
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msgs[0]);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &expect_msgs[1]);
+	will_return(mock_ioctl, 2);
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_txn_execute(txn);
+
+	assert_int_equal(rc, 2);
+}
+
+void test_i2cd_txn_free(void **state)
+{
+	struct i2cd_txn *txn = (struct i2cd_txn *)mock_txn;
+
+	expect_value(mock_free, ptr, mock_txn);
+
+	/* Check behavior when function succeeds */
+	i2cd_txn_free(txn);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_txn_new),
+		cmocka_unit_test(test_i2cd_txn_new_fail_unsupported),
+		cmocka_unit_test(test_i2cd_txn_new_fail_invalid),
+		cmocka_unit_test(test_i2cd_txn_execute),
+		cmocka_unit_test(test_i2cd_txn_free),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
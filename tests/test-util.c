@@ -0,0 +1,198 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static uint64_t mock_util[512];
+
+int setup(void **state)
+{
+	mocks_enabled = true;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	mocks_enabled = false;
+	return 0;
+}
+
+static void enable_util(struct i2cd *dev)
+{
+	expect_value(mock_calloc, nmemb, 1);
+	expect_any(mock_calloc, size);
+	will_return(mock_calloc, mock_util);
+
+	assert_return_code(i2cd_util_enable(dev, 1000), 0);
+}
+
+void test_i2cd_get_bus_frequency(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	int rc;
+
+	/* Check behavior when function succeeds */
+	rc = i2cd_set_bus_frequency(&mock_dev, 400000);
+
+	assert_return_code(rc, 0);
+	assert_int_equal(i2cd_get_bus_frequency(&mock_dev), 400000);
+
+	/* Check behavior when frequency is invalid */
+	rc = i2cd_set_bus_frequency(&mock_dev, 0);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+}
+
+void test_i2cd_estimate_transfer_time(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_reg = 0x10, mock_read_buf[4];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(mock_reg),
+			.buf	= &mock_reg
+		},
+		{
+			.addr	= 0x20,
+			.flags	= I2C_M_RD,
+			.len	= sizeof(mock_read_buf),
+			.buf	= mock_read_buf
+		}
+	};
+
+	i2cd_set_bus_frequency(&mock_dev, 100000);
+
+	/*
+	 * Check behavior when function succeeds: (1 + 9 + 9) bits for the
+	 * write, (1 + 9 + 36) bits for the read, and 1 bit for STOP.
+	 */
+	assert_int_equal(i2cd_estimate_transfer_time(&mock_dev, msgs,
+						     ARRAY_SIZE(msgs)), 660000);
+
+	/* Check behavior when bus frequency is increased */
+	i2cd_set_bus_frequency(&mock_dev, 400000);
+	assert_int_equal(i2cd_estimate_transfer_time(&mock_dev, msgs,
+						     ARRAY_SIZE(msgs)), 165000);
+}
+
+void test_i2cd_util_get(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_buf[10];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(mock_buf),
+			.buf	= mock_buf
+		}
+	};
+	double util;
+	int rc;
+
+	i2cd_set_bus_frequency(&mock_dev, 100000);
+	enable_util(&mock_dev);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &msgs[0]);
+	will_return(mock_ioctl, 1);
+
+	/* Check behavior when transfer is accounted: 101 bits at 100 kHz */
+	rc = i2cd_transfer(&mock_dev, msgs, ARRAY_SIZE(msgs));
+
+	assert_int_equal(rc, 1);
+
+	util = i2cd_util_get(&mock_dev);
+	assert_true(util > 0.00100 && util <= 0.00101);
+
+	util = i2cd_util_get_target(&mock_dev, 0x20);
+	assert_true(util > 0.00100 && util <= 0.00101);
+
+	assert_true(i2cd_util_get_target(&mock_dev, 0x21) == 0);
+}
+
+void test_i2cd_util_set_ceiling(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t mock_buf[10];
+	struct i2c_msg msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(mock_buf),
+			.buf	= mock_buf
+		}
+	};
+	int rc;
+
+	/* Check behavior when accounting is not enabled */
+	rc = i2cd_util_set_ceiling(&mock_dev, 0.001, I2CD_UTIL_REJECT);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+
+	i2cd_set_bus_frequency(&mock_dev, 100000);
+	enable_util(&mock_dev);
+
+	rc = i2cd_util_set_ceiling(&mock_dev, 0.0015, I2CD_UTIL_REJECT);
+	assert_return_code(rc, 0);
+
+	expect_value(mock_ioctl, fd, mock_dev.fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	expect_check(mock_ioctl, msg, check_i2c_msg, &msgs[0]);
+	will_return(mock_ioctl, 1);
+
+	/* Check behavior when bus is idle */
+	rc = i2cd_transfer(&mock_dev, msgs, ARRAY_SIZE(msgs));
+
+	assert_int_equal(rc, 1);
+
+	/* Check behavior when transfer would exceed ceiling */
+	rc = i2cd_transfer(&mock_dev, msgs, ARRAY_SIZE(msgs));
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EAGAIN);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_get_bus_frequency),
+		cmocka_unit_test(test_i2cd_estimate_transfer_time),
+		cmocka_unit_test(test_i2cd_util_get),
+		cmocka_unit_test(test_i2cd_util_set_ceiling),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
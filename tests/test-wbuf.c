@@ -0,0 +1,364 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "i2cd-private.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <cmocka.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "mocks.h"
+
+static uint64_t mock_wbuf[256];
+
+int setup(void **state)
+{
+	mocks_enabled = true;
+	return 0;
+}
+
+int teardown(void **state)
+{
+	mocks_enabled = false;
+	return 0;
+}
+
+static struct i2cd_wbuf *new_wbuf(struct i2cd *dev, size_t size, int flags)
+{
+	struct i2cd_wbuf *wbuf;
+
+	memset(mock_wbuf, 0, sizeof(mock_wbuf));
+
+	expect_value(mock_calloc, nmemb, 1);
+	expect_any(mock_calloc, size);
+	will_return(mock_calloc, mock_wbuf);
+
+	wbuf = i2cd_wbuf_new(dev, 0x20, size, flags);
+	assert_non_null(wbuf);
+
+	return wbuf;
+}
+
+static void write_reg(struct i2cd_wbuf *wbuf, uint16_t reg, uint8_t val)
+{
+	assert_return_code(i2cd_wbuf_write(wbuf, reg, &val, sizeof(val)), 0);
+}
+
+static void expect_transfer(struct i2cd *dev, struct i2c_msg msgs[],
+		size_t nmsgs, int rc)
+{
+	size_t i;
+
+	expect_value(mock_ioctl, fd, dev->fd);
+	expect_value(mock_ioctl, request, I2C_RDWR);
+	for (i = 0; i < nmsgs; i++)
+		expect_check(mock_ioctl, msg, check_i2c_msg, &msgs[i]);
+	will_return(mock_ioctl, rc);
+	if (rc < 0)
+		will_return(mock_ioctl, EIO);
+}
+
+void test_i2cd_wbuf_flush(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t expect_burst[] = {0x10, 0x09, 0x02, 0x03};
+	uint8_t expect_single[] = {0x20, 0x05};
+	struct i2c_msg expect_msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(expect_burst),
+			.buf	= expect_burst
+		},
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(expect_single),
+			.buf	= expect_single
+		}
+	};
+	struct i2cd_wbuf *wbuf;
+	int rc;
+
+	wbuf = new_wbuf(&mock_dev, 16, 0);
+
+	write_reg(wbuf, 0x10, 0x01);
+	write_reg(wbuf, 0x12, 0x03);
+	write_reg(wbuf, 0x20, 0x05);
+	write_reg(wbuf, 0x11, 0x02);
+	write_reg(wbuf, 0x10, 0x09);
+
+	expect_transfer(&mock_dev, expect_msgs, ARRAY_SIZE(expect_msgs), 2);
+
+	/*
+	 * Check behavior when function succeeds: repeated writes collapse
+	 * and contiguous registers are merged into one transfer.
+	 */
+	rc = i2cd_wbuf_flush(wbuf);
+
+	assert_return_code(rc, 0);
+
+	/* Check behavior when nothing is buffered */
+	rc = i2cd_wbuf_flush(wbuf);
+
+	assert_return_code(rc, 0);
+}
+
+void test_i2cd_wbuf_flush_no_burst(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint16_t reg0 = 0x1000, reg1 = 0x1001;
+	uint8_t expect_buf[2][3];
+	struct i2c_msg expect_msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(expect_buf[0]),
+			.buf	= expect_buf[0]
+		},
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(expect_buf[1]),
+			.buf	= expect_buf[1]
+		}
+	};
+	uint8_t vals[] = {0xaa, 0xbb};
+	struct i2cd_wbuf *wbuf;
+	int rc;
+
+	memcpy(expect_buf[0], &reg0, sizeof(reg0));
+	expect_buf[0][2] = vals[0];
+	memcpy(expect_buf[1], &reg1, sizeof(reg1));
+	expect_buf[1][2] = vals[1];
+
+	wbuf = new_wbuf(&mock_dev, 16, I2CD_WBUF_REG16 | I2CD_WBUF_NO_BURST);
+
+	rc = i2cd_wbuf_write(wbuf, reg0, vals, sizeof(vals));
+	assert_return_code(rc, 0);
+
+	expect_transfer(&mock_dev, expect_msgs, ARRAY_SIZE(expect_msgs), 2);
+
+	/* Check behavior when slave device lacks auto-increment */
+	rc = i2cd_wbuf_flush(wbuf);
+
+	assert_return_code(rc, 0);
+}
+
+void test_i2cd_wbuf_flush_long(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	static uint8_t vals[I2CD_RDWR_MAX_LEN + 808];
+	static uint8_t expect_bufs[2][I2CD_RDWR_MAX_LEN];
+	uint16_t reg = I2CD_RDWR_MAX_LEN - 2;
+	struct i2c_msg expect_msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= I2CD_RDWR_MAX_LEN,
+			.buf	= expect_bufs[0]
+		},
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= 2 + 810,
+			.buf	= expect_bufs[1]
+		}
+	};
+	struct i2cd_wbuf *wbuf;
+	size_t i;
+	int rc;
+
+	for (i = 0; i < sizeof(vals); i++)
+		vals[i] = i;
+
+	memset(expect_bufs[0], 0, 2);
+	memcpy(expect_bufs[0] + 2, vals, I2CD_RDWR_MAX_LEN - 2);
+	memcpy(expect_bufs[1], &reg, 2);
+	memcpy(expect_bufs[1] + 2, vals + reg, 810);
+
+	/* The buffer is too large for mock_wbuf; allocate it normally */
+	mocks_enabled = false;
+	wbuf = i2cd_wbuf_new(&mock_dev, 0x20, sizeof(vals), I2CD_WBUF_REG16);
+	mocks_enabled = true;
+	assert_non_null(wbuf);
+
+	assert_return_code(i2cd_wbuf_write(wbuf, 0, vals, sizeof(vals)), 0);
+
+	expect_transfer(&mock_dev, expect_msgs, ARRAY_SIZE(expect_msgs), 2);
+
+	/* Check behavior when a burst exceeds the longest message */
+	rc = i2cd_wbuf_flush(wbuf);
+
+	assert_return_code(rc, 0);
+
+	mocks_enabled = false;
+	i2cd_wbuf_free(wbuf);
+	mocks_enabled = true;
+}
+
+void test_i2cd_wbuf_write_full(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t expect_buf[4][2] = {
+		{0x00, 0x01}, {0x02, 0x01}, {0x04, 0x01}, {0x06, 0x01}
+	};
+	struct i2c_msg expect_msgs[4];
+	struct i2cd_wbuf *wbuf;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(expect_msgs); i++) {
+		expect_msgs[i].addr = 0x20;
+		expect_msgs[i].flags = 0;
+		expect_msgs[i].len = sizeof(expect_buf[i]);
+		expect_msgs[i].buf = expect_buf[i];
+	}
+
+	wbuf = new_wbuf(&mock_dev, 4, 0);
+
+	for (i = 0; i < 4; i++)
+		write_reg(wbuf, i * 2, 0x01);
+
+	/* Check behavior when a rewrite does not need space */
+	write_reg(wbuf, 0x06, 0x01);
+
+	expect_transfer(&mock_dev, expect_msgs, ARRAY_SIZE(expect_msgs), 4);
+
+	/* Check behavior when buffer is full */
+	write_reg(wbuf, 0x08, 0x01);
+
+	expect_buf[0][0] = 0x08;
+	expect_transfer(&mock_dev, expect_msgs, 1, 1);
+
+	assert_return_code(i2cd_wbuf_flush(wbuf), 0);
+}
+
+void test_i2cd_wbuf_read(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t expect_write[] = {0x10, 0x01};
+	uint8_t reg_other = 0x20, reg = 0x0f, mock_read_buf[2];
+	struct i2c_msg expect_flush = {
+		.addr	= 0x20,
+		.flags	= 0,
+		.len	= sizeof(expect_write),
+		.buf	= expect_write
+	};
+	struct i2c_msg expect_msgs[] = {
+		{
+			.addr	= 0x20,
+			.flags	= 0,
+			.len	= sizeof(reg_other),
+			.buf	= &reg_other
+		},
+		{
+			.addr	= 0x20,
+			.flags	= I2C_M_RD,
+			.len	= 1,
+			.buf	= mock_read_buf
+		}
+	};
+	struct i2cd_wbuf *wbuf;
+	int rc;
+
+	wbuf = new_wbuf(&mock_dev, 16, 0);
+
+	write_reg(wbuf, 0x10, 0x01);
+
+	expect_transfer(&mock_dev, expect_msgs, ARRAY_SIZE(expect_msgs), 2);
+
+	/* Check behavior when register read is not buffered */
+	rc = i2cd_wbuf_read(wbuf, reg_other, mock_read_buf, 1);
+
+	assert_int_equal(rc, 2);
+
+	expect_transfer(&mock_dev, &expect_flush, 1, 1);
+	expect_msgs[0].buf = &reg;
+	expect_msgs[1].len = sizeof(mock_read_buf);
+	expect_transfer(&mock_dev, expect_msgs, ARRAY_SIZE(expect_msgs), 2);
+
+	/* Check behavior when register read is buffered */
+	rc = i2cd_wbuf_read(wbuf, reg, mock_read_buf, sizeof(mock_read_buf));
+
+	assert_int_equal(rc, 2);
+}
+
+void test_i2cd_wbuf_flush_fail(void **state)
+{
+	struct i2cd mock_dev = {.path = "/dev/i2c-0", .fd = 42};
+	uint8_t expect_write[] = {0x10, 0x01};
+	struct i2c_msg expect_msg = {
+		.addr	= 0x20,
+		.flags	= 0,
+		.len	= sizeof(expect_write),
+		.buf	= expect_write
+	};
+	struct i2cd_wbuf *wbuf;
+	int rc;
+
+	wbuf = new_wbuf(&mock_dev, 16, 0);
+
+	write_reg(wbuf, 0x10, 0x01);
+
+	expect_transfer(&mock_dev, &expect_msg, 1, -1);
+
+	/* Check behavior when transfer fails */
+	rc = i2cd_wbuf_flush(wbuf);
+
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EIO);
+
+	expect_transfer(&mock_dev, &expect_msg, 1, 1);
+
+	/* Check behavior when writes remain buffered after failure */
+	rc = i2cd_wbuf_flush(wbuf);
+
+	assert_return_code(rc, 0);
+}
+
+void test_i2cd_wbuf_free(void **state)
+{
+	struct i2cd_wbuf *wbuf = (struct i2cd_wbuf *)mock_wbuf;
+
+	expect_value(mock_free, ptr, mock_wbuf);
+
+	/* Check behavior when function succeeds */
+	i2cd_wbuf_free(wbuf);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_i2cd_wbuf_flush),
+		cmocka_unit_test(test_i2cd_wbuf_flush_no_burst),
+		cmocka_unit_test(test_i2cd_wbuf_flush_long),
+		cmocka_unit_test(test_i2cd_wbuf_write_full),
+		cmocka_unit_test(test_i2cd_wbuf_read),
+		cmocka_unit_test(test_i2cd_wbuf_flush_fail),
+		cmocka_unit_test(test_i2cd_wbuf_free),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,653 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <i2cd.h>
+
+#include "i2cd-protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x)	(sizeof(x) / sizeof((x)[0]))
+#endif
+
+#define I2C_DEV_MAJOR	89
+
+struct adapter {
+	struct adapter *next;
+	struct i2cd *dev;		/**< Shared I2C character device handle. */
+	unsigned int refcnt;		/**< Number of attached clients. */
+	struct client *pending;		/**< Clients with a queued transfer. */
+};
+
+struct client {
+	struct client *next;
+	struct client *next_pending;
+	int fd;				/**< Connected client socket. */
+	bool dead;			/**< Client should be disconnected. */
+	struct adapter *adapter;	/**< Attached adapter, or NULL. */
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	size_t nmsgs;			/**< Number of queued messages. */
+	void *shm;			/**< Shared memory mapping, or NULL. */
+	size_t shm_len;			/**< Length of shared memory mapping. */
+	int rc;				/**< Result of queued transfer. */
+	int error;			/**< Value of errno if rc is negative. */
+	uint8_t data[I2CD_PROTO_INLINE_MAX];
+};
+
+static struct adapter *adapters;
+static struct client *clients;
+static size_t nclients;
+static void *packet;
+static bool batching = true;
+static volatile sig_atomic_t done;
+
+static void handle_signal(int signum)
+{
+	done = 1;
+}
+
+/* Only i2c-dev character devices may be opened on behalf of clients */
+static bool adapter_valid(const struct stat *st)
+{
+	return S_ISCHR(st->st_mode) && major(st->st_rdev) == I2C_DEV_MAJOR;
+}
+
+static struct adapter *adapter_get(const char *path)
+{
+	struct adapter *adapter;
+	struct stat st;
+
+	for (adapter = adapters; adapter != NULL; adapter = adapter->next) {
+		if (strcmp(i2cd_get_path(adapter->dev), path) == 0) {
+			adapter->refcnt++;
+			return adapter;
+		}
+	}
+
+	if (stat(path, &st) < 0)
+		return NULL;
+
+	if (!adapter_valid(&st)) {
+		errno = ENOTTY;
+		return NULL;
+	}
+
+	adapter = calloc(1, sizeof(*adapter));
+	if (adapter == NULL)
+		return NULL;
+
+	adapter->dev = i2cd_open(path);
+	if (adapter->dev == NULL) {
+		free(adapter);
+		return NULL;
+	}
+
+	/* The path may have been replaced after it was checked */
+	if (fstat(i2cd_fileno(adapter->dev), &st) < 0 || !adapter_valid(&st)) {
+		i2cd_close(adapter->dev);
+		free(adapter);
+		errno = ENOTTY;
+		return NULL;
+	}
+
+	adapter->refcnt = 1;
+	adapter->next = adapters;
+	adapters = adapter;
+	return adapter;
+}
+
+static void adapter_put(struct adapter *adapter)
+{
+	struct adapter **p;
+
+	if (--adapter->refcnt > 0)
+		return;
+
+	for (p = &adapters; *p != adapter; p = &(*p)->next)
+		;
+	*p = adapter->next;
+
+	i2cd_close(adapter->dev);
+	free(adapter);
+}
+
+static void client_release(struct client *client)
+{
+	if (client->shm != NULL) {
+		munmap(client->shm, client->shm_len);
+		client->shm = NULL;
+	}
+}
+
+static void client_free(struct client *client)
+{
+	client_release(client);
+
+	if (client->adapter != NULL)
+		adapter_put(client->adapter);
+
+	close(client->fd);
+	free(client);
+}
+
+static void client_respond(struct client *client,
+		struct i2cd_proto_response *resp)
+{
+	struct iovec iov[] = {
+		{
+			.iov_base	= resp,
+			.iov_len	= sizeof(*resp)
+		},
+		{
+			.iov_base	= packet,
+			.iov_len	= resp->len
+		}
+	};
+	struct msghdr msg = {
+		.msg_iov	= iov,
+		.msg_iovlen	= ARRAY_SIZE(iov)
+	};
+
+	if (sendmsg(client->fd, &msg, MSG_NOSIGNAL) < 0)
+		client->dead = true;
+}
+
+static void client_error(struct client *client, int error)
+{
+	struct i2cd_proto_response resp = {
+		.rc	= -1,
+		.error	= error
+	};
+
+	client_respond(client, &resp);
+}
+
+static void client_complete(struct client *client)
+{
+	struct i2cd_proto_response resp = {
+		.rc	= client->rc,
+		.error	= client->error
+	};
+	uint8_t *p = packet;
+	size_t i;
+
+	/* Inline read data is gathered into the response packet */
+	if (client->rc >= 0 && client->shm == NULL) {
+		for (i = 0; i < client->nmsgs; i++) {
+			if (client->msgs[i].flags & I2C_M_RD) {
+				memcpy(p + resp.len, client->msgs[i].buf,
+				       client->msgs[i].len);
+				resp.len += client->msgs[i].len;
+			}
+		}
+	}
+
+	client_respond(client, &resp);
+	client_release(client);
+}
+
+static int client_open(struct client *client, const char *data, size_t len)
+{
+	struct adapter *adapter;
+
+	if (len == 0 || data[len - 1] != '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	adapter = adapter_get(data);
+	if (adapter == NULL)
+		return -1;
+
+	if (client->adapter != NULL)
+		adapter_put(client->adapter);
+
+	client->adapter = adapter;
+	return 0;
+}
+
+static int client_queue(struct client *client,
+		const struct i2cd_proto_request *req, int fd, size_t len)
+{
+	const struct i2cd_proto_msg *pmsgs = (const void *)(req + 1);
+	const uint8_t *src = (const uint8_t *)&pmsgs[req->nmsgs];
+	uint8_t *data = client->data;
+	size_t i, total = 0, off = 0, write_len = 0;
+	struct stat st;
+	int seals;
+
+	if (client->adapter == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (req->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS ||
+	    len < sizeof(*req) + req->nmsgs * sizeof(*pmsgs)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < req->nmsgs; i++) {
+		total += pmsgs[i].len;
+		if (!(pmsgs[i].flags & I2C_M_RD))
+			write_len += pmsgs[i].len;
+	}
+
+	if (req->flags & I2CD_PROTO_F_SHM) {
+		/* Unless its size is sealed, the mapping may be truncated */
+		seals = fd < 0 ? -1 : fcntl(fd, F_GET_SEALS);
+		if (seals < 0 || !(seals & F_SEAL_SHRINK) ||
+		    req->len != total || fstat(fd, &st) < 0 ||
+		    (size_t)st.st_size < total) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		client->shm = mmap(NULL, total, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, fd, 0);
+		if (client->shm == MAP_FAILED) {
+			client->shm = NULL;
+			return -1;
+		}
+		client->shm_len = total;
+		data = client->shm;
+	} else if (total > I2CD_PROTO_INLINE_MAX || req->len != write_len ||
+		   len != sizeof(*req) + req->nmsgs * sizeof(*pmsgs) +
+			  write_len) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < req->nmsgs; i++) {
+		client->msgs[i].addr = pmsgs[i].addr;
+		client->msgs[i].flags = pmsgs[i].flags;
+		client->msgs[i].len = pmsgs[i].len;
+		client->msgs[i].buf = data + off;
+
+		if (client->shm == NULL && !(pmsgs[i].flags & I2C_M_RD)) {
+			memcpy(data + off, src, pmsgs[i].len);
+			src += pmsgs[i].len;
+		}
+		off += pmsgs[i].len;
+	}
+	client->nmsgs = req->nmsgs;
+
+	client->next_pending = client->adapter->pending;
+	client->adapter->pending = client;
+	return 0;
+}
+
+static void client_handle(struct client *client)
+{
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct iovec iov = {
+		.iov_base	= packet,
+		.iov_len	= I2CD_PROTO_PACKET_MAX
+	};
+	struct msghdr msg = {
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+		.msg_control	= control.buf,
+		.msg_controllen	= sizeof(control.buf)
+	};
+	const struct i2cd_proto_request *req = packet;
+	struct i2cd_proto_response resp = {0};
+	struct cmsghdr *cmsg;
+	unsigned long funcs;
+	ssize_t n;
+	int fd = -1;
+
+	n = recvmsg(client->fd, &msg, MSG_CMSG_CLOEXEC);
+	if (n <= 0) {
+		client->dead = true;
+		return;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	if ((size_t)n < sizeof(*req) || (msg.msg_flags & MSG_TRUNC)) {
+		client_error(client, EINVAL);
+		goto out;
+	}
+
+	switch (req->op) {
+	case I2CD_PROTO_OPEN:
+		if (req->len != n - sizeof(*req) ||
+		    client_open(client, (const char *)(req + 1), req->len) < 0)
+			client_error(client, errno);
+		else
+			client_respond(client, &resp);
+		break;
+
+	case I2CD_PROTO_FUNCS:
+		if (client->adapter == NULL) {
+			client_error(client, EBADF);
+		} else if (i2cd_get_functionality(client->adapter->dev,
+						  &funcs) < 0) {
+			client_error(client, errno);
+		} else {
+			resp.funcs = funcs;
+			client_respond(client, &resp);
+		}
+		break;
+
+	case I2CD_PROTO_TRANSFER:
+		if (client_queue(client, req, fd, n) < 0)
+			client_error(client, errno);
+		break;
+
+	default:
+		client_error(client, EOPNOTSUPP);
+		break;
+	}
+out:
+	if (fd >= 0)
+		close(fd);
+}
+
+/*
+ * A transfer may only be combined with others if it can safely be replayed
+ * when the combined transfer fails. This holds for transfers consisting of
+ * reads, each optionally preceded by a write which sets a register address.
+ */
+static bool client_replayable(const struct client *client)
+{
+	size_t i;
+
+	for (i = 0; i < client->nmsgs; i++) {
+		if (client->msgs[i].flags & I2C_M_RD)
+			continue;
+
+		if (i + 1 == client->nmsgs ||
+		    !(client->msgs[i + 1].flags & I2C_M_RD))
+			return false;
+	}
+	return true;
+}
+
+static void client_transfer(struct client *client)
+{
+	client->rc = i2cd_transfer(client->adapter->dev, client->msgs,
+				   client->nmsgs);
+	client->error = client->rc < 0 ? errno : 0;
+}
+
+static void adapter_run(struct adapter *adapter)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	struct client *batch, *client, *next;
+	size_t nmsgs, nbatch;
+	int rc;
+
+	while ((batch = adapter->pending) != NULL) {
+		nmsgs = 0;
+		nbatch = 0;
+
+		/* Combine as many replayable transfers as possible */
+		for (client = batch; batching && client != NULL;
+		     client = client->next_pending) {
+			if (!client_replayable(client) ||
+			    nmsgs + client->nmsgs > ARRAY_SIZE(msgs))
+				break;
+
+			memcpy(&msgs[nmsgs], client->msgs,
+			       client->nmsgs * sizeof(*msgs));
+			nmsgs += client->nmsgs;
+			nbatch++;
+		}
+
+		if (nbatch > 1) {
+			rc = i2cd_transfer(adapter->dev, msgs, nmsgs);
+			for (client = batch; nbatch-- > 0; client = next) {
+				next = client->next_pending;
+				if (rc < 0) {
+					client_transfer(client);
+				} else {
+					client->rc = client->nmsgs;
+					client->error = 0;
+				}
+				client_complete(client);
+			}
+			adapter->pending = client;
+		} else {
+			adapter->pending = batch->next_pending;
+			client_transfer(batch);
+			client_complete(batch);
+		}
+	}
+}
+
+static int server_listen(const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX
+	};
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	/* Remove a stale socket left behind by a previous server */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, SOMAXCONN) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void server_accept(int listen_fd)
+{
+	struct client *client;
+	int fd;
+
+	fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	client = calloc(1, sizeof(*client));
+	if (client == NULL) {
+		close(fd);
+		return;
+	}
+
+	client->fd = fd;
+	client->next = clients;
+	clients = client;
+	nclients++;
+}
+
+static int server_run(int listen_fd)
+{
+	struct pollfd *pfds = NULL, *tmp;
+	struct client *client, **p;
+	struct adapter *adapter;
+	size_t npfds = 0, i;
+
+	while (!done) {
+		if (npfds < nclients + 1) {
+			tmp = realloc(pfds, (nclients + 1) * sizeof(*pfds));
+			if (tmp == NULL)
+				break;
+			pfds = tmp;
+			npfds = nclients + 1;
+		}
+
+		pfds[0].fd = listen_fd;
+		pfds[0].events = POLLIN;
+		for (client = clients, i = 1; client != NULL;
+		     client = client->next, i++) {
+			pfds[i].fd = client->fd;
+			pfds[i].events = POLLIN;
+		}
+
+		if (poll(pfds, i, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/*
+		 * Receive one request from each ready client before running
+		 * queued transfers so that requests arriving together can be
+		 * combined into a single ioctl() request per adapter.
+		 */
+		for (client = clients, i = 1; client != NULL;
+		     client = client->next, i++) {
+			if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				client_handle(client);
+		}
+
+		for (adapter = adapters; adapter != NULL;
+		     adapter = adapter->next)
+			adapter_run(adapter);
+
+		for (p = &clients; (client = *p) != NULL;) {
+			if (client->dead) {
+				*p = client->next;
+				client_free(client);
+				nclients--;
+			} else {
+				p = &client->next;
+			}
+		}
+
+		if (pfds[0].revents & POLLIN)
+			server_accept(listen_fd);
+	}
+
+	free(pfds);
+	return done ? 0 : -1;
+}
+
+static void usage(FILE *stream, const char *progname)
+{
+	fprintf(stream,
+		"Usage: %s [-n] [-s socket]\n"
+		"\n"
+		"Options:\n"
+		"  -n         do not combine requests from concurrent clients\n"
+		"  -s socket  listen on socket (default: %s)\n"
+		"  -h         display this help and exit\n",
+		progname, I2CD_SOCKET_PATH);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *socket_path = I2CD_SOCKET_PATH;
+	struct sigaction sa = {
+		.sa_handler = handle_signal
+	};
+	struct client *client;
+	int listen_fd, opt, rc;
+
+	while ((opt = getopt(argc, argv, "hns:")) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(stdout, argv[0]);
+			return EXIT_SUCCESS;
+		case 'n':
+			batching = false;
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		default:
+			usage(stderr, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		usage(stderr, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	packet = malloc(I2CD_PROTO_PACKET_MAX);
+	if (packet == NULL) {
+		perror(NULL);
+		return EXIT_FAILURE;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	listen_fd = server_listen(socket_path);
+	if (listen_fd < 0) {
+		perror(socket_path);
+		free(packet);
+		return EXIT_FAILURE;
+	}
+
+	rc = server_run(listen_fd);
+	if (rc < 0)
+		perror(NULL);
+
+	while ((client = clients) != NULL) {
+		clients = client->next;
+		client_free(client);
+	}
+
+	close(listen_fd);
+	unlink(socket_path);
+	free(packet);
+
+	return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,597 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2021 Steven Stallion <sstallion@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <i2cd.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x)	(sizeof(x) / sizeof((x)[0]))
+#endif
+
+#define MAX_LINE	4096
+
+enum op_type {
+	OP_READ,
+	OP_WRITE,
+	OP_WRITE_READ,
+};
+
+static const char *op_names[] = {
+	[OP_READ]	= "read",
+	[OP_WRITE]	= "write",
+	[OP_WRITE_READ]	= "write_read",
+};
+
+struct op {
+	enum op_type type;
+	unsigned int line;	/**< Script line number. */
+	uint16_t addr;		/**< I2C slave address. */
+	uint8_t *write_buf;	/**< Bytes to send, or NULL. */
+	size_t write_len;	/**< Number of bytes to send. */
+	uint8_t *read_buf;	/**< Buffer to receive bytes, or NULL. */
+	size_t read_len;	/**< Number of bytes to receive. */
+};
+
+struct batch {
+	struct op ops[I2C_RDWR_IOCTL_MAX_MSGS];
+	size_t nops;
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	size_t nmsgs;
+};
+
+static const char *progname;
+static bool json;
+static bool json_first = true;
+
+static struct i2cd *open_device(const char *device)
+{
+	char *end;
+	unsigned long num;
+
+	/* Devices may be given as a path, a name, or a number */
+	if (strchr(device, '/') != NULL)
+		return i2cd_open(device);
+
+	num = strtoul(device, &end, 0);
+	if (*device != '\0' && *end == '\0')
+		return i2cd_open_by_number(num);
+
+	return i2cd_open_by_name(device);
+}
+
+static int parse_ulong(const char *s, unsigned long max, unsigned long *val)
+{
+	char *end;
+
+	if (s == NULL || !isdigit((unsigned char)*s))
+		return -1;
+
+	errno = 0;
+	*val = strtoul(s, &end, 0);
+	if (errno != 0 || *end != '\0' || *val > max)
+		return -1;
+
+	return 0;
+}
+
+static void print_bytes(const uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (json)
+			printf("%s%u", i > 0 ? "," : "", buf[i]);
+		else
+			printf(" %02x", buf[i]);
+	}
+}
+
+static void print_op(const struct op *op, int error)
+{
+	if (json) {
+		printf("%s\n  {\"line\":%u,\"op\":\"%s\",\"addr\":%u",
+		       json_first ? "[" : ",", op->line, op_names[op->type],
+		       op->addr);
+		json_first = false;
+
+		if (error != 0) {
+			printf(",\"error\":\"%s\"}", strerror(error));
+			return;
+		}
+
+		if (op->read_buf != NULL) {
+			printf(",\"data\":[");
+			print_bytes(op->read_buf, op->read_len);
+			printf("]");
+		}
+		printf("}");
+	} else if (error != 0) {
+		fprintf(stderr, "%s: line %u: %s 0x%02x: %s\n", progname,
+			op->line, op_names[op->type], op->addr,
+			strerror(error));
+	} else if (op->read_buf != NULL) {
+		printf("0x%02x:", op->addr);
+		print_bytes(op->read_buf, op->read_len);
+		printf("\n");
+	}
+}
+
+static void batch_add_msg(struct batch *batch, uint16_t addr, uint16_t flags,
+		uint8_t *buf, size_t len)
+{
+	struct i2c_msg *msg = &batch->msgs[batch->nmsgs++];
+
+	/* Addresses beyond the 7-bit range require 10-bit addressing */
+	if (addr > 0x7f)
+		flags |= I2C_M_TEN;
+
+	msg->addr = addr;
+	msg->flags = flags;
+	msg->len = len;
+	msg->buf = buf;
+}
+
+static int batch_flush(struct i2cd *dev, struct batch *batch)
+{
+	size_t i;
+	int error = 0;
+
+	if (batch->nops == 0)
+		return 0;
+
+	if (i2cd_transfer(dev, batch->msgs, batch->nmsgs) < 0)
+		error = errno;
+
+	for (i = 0; i < batch->nops; i++) {
+		print_op(&batch->ops[i], error);
+		free(batch->ops[i].write_buf);
+		free(batch->ops[i].read_buf);
+	}
+
+	batch->nops = 0;
+	batch->nmsgs = 0;
+
+	return error != 0 ? -1 : 0;
+}
+
+static int batch_add(struct i2cd *dev, struct batch *batch, struct op *op,
+		bool grouped)
+{
+	size_t nmsgs = op->type == OP_WRITE_READ ? 2 : 1;
+
+	if (!grouped || batch->nmsgs + nmsgs > ARRAY_SIZE(batch->msgs)) {
+		if (batch_flush(dev, batch) < 0)
+			return -1;
+	}
+
+	if (op->write_buf != NULL)
+		batch_add_msg(batch, op->addr, 0, op->write_buf, op->write_len);
+
+	if (op->read_buf != NULL)
+		batch_add_msg(batch, op->addr, I2C_M_RD, op->read_buf,
+			      op->read_len);
+
+	batch->ops[batch->nops++] = *op;
+	return 0;
+}
+
+static int parse_op(char *args[], size_t nargs, struct op *op)
+{
+	unsigned long val;
+	size_t i, first = 1;
+
+	if (nargs < 2 || parse_ulong(args[1], 0x3ff, &val) < 0)
+		return -1;
+	op->addr = val;
+
+	switch (op->type) {
+	case OP_READ:
+		if (nargs != 3)
+			return -1;
+		break;
+
+	case OP_WRITE:
+		if (nargs < 3)
+			return -1;
+		first = 2;
+		break;
+
+	case OP_WRITE_READ:
+		if (nargs < 4)
+			return -1;
+		first = 3;
+		break;
+	}
+
+	if (op->type != OP_WRITE) {
+		if (parse_ulong(args[2], UINT16_MAX, &val) < 0 || val == 0)
+			return -1;
+
+		op->read_len = val;
+		op->read_buf = calloc(1, op->read_len);
+		if (op->read_buf == NULL)
+			return -1;
+	}
+
+	if (op->type != OP_READ) {
+		op->write_len = nargs - first;
+		op->write_buf = calloc(1, op->write_len);
+		if (op->write_buf == NULL)
+			return -1;
+
+		for (i = first; i < nargs; i++) {
+			if (parse_ulong(args[i], UINT8_MAX, &val) < 0)
+				return -1;
+			op->write_buf[i - first] = val;
+		}
+	}
+
+	return 0;
+}
+
+static int run_script(struct i2cd *dev, FILE *stream, const char *name,
+		bool grouped)
+{
+	static struct batch batch;
+	char line[MAX_LINE], *args[MAX_LINE / 2], *p;
+	unsigned int lineno = 0;
+	size_t nargs, i;
+	struct op op;
+	double ms;
+	int rc = 0;
+
+	while (rc == 0 && fgets(line, sizeof(line), stream) != NULL) {
+		lineno++;
+
+		p = strchr(line, '#');
+		if (p != NULL)
+			*p = '\0';
+
+		nargs = 0;
+		for (p = strtok(line, " \t\r\n"); p != NULL;
+		     p = strtok(NULL, " \t\r\n"))
+			args[nargs++] = p;
+
+		if (nargs == 0)
+			continue;
+
+		if (strcmp(args[0], "stop") == 0 && nargs == 1) {
+			rc = batch_flush(dev, &batch);
+			continue;
+		}
+
+		if (strcmp(args[0], "sleep") == 0 && nargs == 2) {
+			ms = strtod(args[1], &p);
+			if (*p == '\0' && ms >= 0) {
+				struct timespec ts = {
+					.tv_sec		= ms / 1000,
+					.tv_nsec	= (long)(ms * 1e6) %
+							  1000000000L
+				};
+
+				rc = batch_flush(dev, &batch);
+				if (rc == 0)
+					nanosleep(&ts, NULL);
+				continue;
+			}
+		}
+
+		memset(&op, 0, sizeof(op));
+		op.line = lineno;
+
+		for (i = 0; i < ARRAY_SIZE(op_names); i++) {
+			if (strcmp(args[0], op_names[i]) == 0)
+				break;
+		}
+
+		op.type = i;
+
+		if (i == ARRAY_SIZE(op_names) ||
+		    parse_op(args, nargs, &op) < 0) {
+			fprintf(stderr, "%s: %s:%u: invalid operation\n",
+				progname, name, lineno);
+			free(op.write_buf);
+			free(op.read_buf);
+			rc = -1;
+			break;
+		}
+
+		rc = batch_add(dev, &batch, &op, grouped);
+	}
+
+	if (rc == 0)
+		rc = batch_flush(dev, &batch);
+
+	/* Release operations left unsent after an error */
+	for (i = 0; i < batch.nops; i++) {
+		free(batch.ops[i].write_buf);
+		free(batch.ops[i].read_buf);
+	}
+
+	if (json)
+		printf("%s]\n", json_first ? "[" : "\n");
+
+	return rc;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage(FILE *stream)
+{
+	fprintf(stream,
+		"Usage: %s [-j] [-s] [-f script] device\n"
+		"       %s bench [-Bj] [-n count] [-b batch] [-l len] [-r reg] "
+		"device addr\n"
+		"\n"
+		"Execute a script of operations read from stdin or a file:\n"
+		"  read addr len\n"
+		"  write addr byte...\n"
+		"  write_read addr len byte...\n"
+		"  sleep ms\n"
+		"  stop\n"
+		"\n"
+		"Consecutive operations are combined into a single transfer\n"
+		"terminated with a STOP condition, up to the message limit,\n"
+		"a sleep, or an explicit stop.\n"
+		"\n"
+		"Options:\n"
+		"  -B         bind to addr and read using read(2) rather than\n"
+		"             I2C_RDWR; incompatible with -b and -r\n"
+		"  -b batch   number of reads per transfer (default: 1)\n"
+		"  -f script  read operations from script\n"
+		"  -j         print results as JSON\n"
+		"  -l len     number of bytes to read (default: 1)\n"
+		"  -n count   number of transfers (default: 1000)\n"
+		"  -r reg     write 8-bit register address before each read\n"
+		"  -s         issue each operation as a separate transfer\n"
+		"  -h         display this help and exit\n",
+		progname, progname);
+}
+
+static int bench_main(int argc, char *argv[])
+{
+	unsigned long count = 1000, nbatch = 1, len = 1, reg = 0, addr;
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	uint64_t *lat, start, first, total = 0, elapsed;
+	bool use_bind = false, use_reg = false;
+	uint8_t reg_buf, *buf;
+	struct i2cd *dev;
+	size_t i, nmsgs = 0;
+	int opt, rc = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "Bb:hjl:n:r:")) != -1) {
+		switch (opt) {
+		case 'B':
+			use_bind = true;
+			break;
+		case 'b':
+			if (parse_ulong(optarg, ARRAY_SIZE(msgs), &nbatch) < 0 ||
+			    nbatch == 0)
+				goto usage;
+			break;
+		case 'h':
+			usage(stdout);
+			return EXIT_SUCCESS;
+		case 'j':
+			json = true;
+			break;
+		case 'l':
+			if (parse_ulong(optarg, UINT16_MAX, &len) < 0 ||
+			    len == 0)
+				goto usage;
+			break;
+		case 'n':
+			if (parse_ulong(optarg, 100000000, &count) < 0 ||
+			    count == 0)
+				goto usage;
+			break;
+		case 'r':
+			if (parse_ulong(optarg, UINT8_MAX, &reg) < 0)
+				goto usage;
+			use_reg = true;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (argc - optind != 2 ||
+	    parse_ulong(argv[optind + 1], 0x3ff, &addr) < 0 ||
+	    (use_reg && nbatch * 2 > ARRAY_SIZE(msgs)) ||
+	    (use_bind && (use_reg || nbatch > 1 || addr > 0x7f)))
+		goto usage;
+
+	dev = open_device(argv[optind]);
+	if (dev == NULL) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	lat = calloc(count, sizeof(*lat));
+	buf = calloc(nbatch, len);
+	if (lat == NULL || buf == NULL) {
+		perror(NULL);
+		goto out;
+	}
+
+	if (use_bind && i2cd_bind(dev, addr, 0) < 0) {
+		fprintf(stderr, "%s: bind 0x%02lx: %s\n", progname, addr,
+			strerror(errno));
+		goto out;
+	}
+
+	reg_buf = reg;
+	for (i = 0; i < nbatch; i++) {
+		struct i2c_msg *msg;
+
+		if (use_reg) {
+			msg = &msgs[nmsgs++];
+			msg->addr = addr;
+			msg->flags = addr > 0x7f ? I2C_M_TEN : 0;
+			msg->len = sizeof(reg_buf);
+			msg->buf = &reg_buf;
+		}
+
+		msg = &msgs[nmsgs++];
+		msg->addr = addr;
+		msg->flags = I2C_M_RD | (addr > 0x7f ? I2C_M_TEN : 0);
+		msg->len = len;
+		msg->buf = buf + i * len;
+	}
+
+	first = now_ns();
+	for (i = 0; i < count; i++) {
+		start = now_ns();
+		if ((use_bind ? i2cd_read(dev, addr, buf, len) :
+				i2cd_transfer(dev, msgs, nmsgs)) < 0) {
+			fprintf(stderr, "%s: transfer %zu: %s\n", progname, i,
+				strerror(errno));
+			goto out;
+		}
+		lat[i] = now_ns() - start;
+		total += lat[i];
+	}
+
+	elapsed = now_ns() - first;
+	qsort(lat, count, sizeof(*lat), compare_u64);
+
+	if (json) {
+		printf("{\"transfers\":%lu,\"reads\":%lu,\"bytes\":%lu,"
+		       "\"transfers_per_sec\":%.1f,\"bytes_per_sec\":%.1f,"
+		       "\"latency_us\":{\"min\":%.1f,\"avg\":%.1f,"
+		       "\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+		       count, count * nbatch, count * nbatch * len,
+		       count * 1e9 / elapsed, count * nbatch * len * 1e9 / elapsed,
+		       lat[0] / 1e3, total / 1e3 / count,
+		       lat[count / 2] / 1e3, lat[count * 99 / 100] / 1e3,
+		       lat[count - 1] / 1e3);
+	} else {
+		printf("transfers:    %lu (%lu reads, %lu bytes)\n",
+		       count, count * nbatch, count * nbatch * len);
+		printf("throughput:   %.1f transfers/s, %.1f bytes/s\n",
+		       count * 1e9 / elapsed,
+		       count * nbatch * len * 1e9 / elapsed);
+		printf("latency (us): min %.1f, avg %.1f, p50 %.1f, p99 %.1f, "
+		       "max %.1f\n",
+		       lat[0] / 1e3, total / 1e3 / count,
+		       lat[count / 2] / 1e3, lat[count * 99 / 100] / 1e3,
+		       lat[count - 1] / 1e3);
+	}
+
+	rc = EXIT_SUCCESS;
+out:
+	free(buf);
+	free(lat);
+	i2cd_close(dev);
+	return rc;
+usage:
+	usage(stderr);
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *script = NULL;
+	bool grouped = true;
+	struct i2cd *dev;
+	FILE *stream = stdin;
+	int opt, rc;
+
+	progname = argv[0];
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		return bench_main(argc - 1, argv + 1);
+
+	while ((opt = getopt(argc, argv, "f:hjs")) != -1) {
+		switch (opt) {
+		case 'f':
+			script = optarg;
+			break;
+		case 'h':
+			usage(stdout);
+			return EXIT_SUCCESS;
+		case 'j':
+			json = true;
+			break;
+		case 's':
+			grouped = false;
+			break;
+		default:
+			usage(stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (script != NULL) {
+		stream = fopen(script, "r");
+		if (stream == NULL) {
+			perror(script);
+			return EXIT_FAILURE;
+		}
+	}
+
+	dev = open_device(argv[optind]);
+	if (dev == NULL) {
+		perror(argv[optind]);
+		if (script != NULL)
+			fclose(stream);
+		return EXIT_FAILURE;
+	}
+
+	rc = run_script(dev, stream, script != NULL ? script : "<stdin>",
+			grouped);
+
+	i2cd_close(dev);
+	if (script != NULL)
+		fclose(stream);
+
+	return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}